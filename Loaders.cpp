@@ -0,0 +1,26 @@
+//
+//  Loaders.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 19/8/14.
+//
+//
+
+#include "Loaders.h"
+
+ShaderProgram *programWithShaders(const char *vertexShaderFilename, const char *fragmentShaderFilename) {
+    static std::map<std::pair<std::string, std::string>, ShaderProgram *> programs;
+    
+    std::pair<std::string, std::string> key(vertexShaderFilename, fragmentShaderFilename);
+    std::map<std::pair<std::string, std::string>, ShaderProgram *>::const_iterator it = programs.find(key);
+    if (it != programs.end())
+        return it->second;
+    
+    std::vector<Shader> shaders;
+    shaders.push_back(Shader::shaderFromFile(ResourcePath(vertexShaderFilename), GL_VERTEX_SHADER));
+    shaders.push_back(Shader::shaderFromFile(ResourcePath(fragmentShaderFilename), GL_FRAGMENT_SHADER));
+    
+    ShaderProgram *program = new ShaderProgram(shaders);
+    programs[key] = program;
+    return program;
+}
@@ -19,6 +19,7 @@
 #include "ShaderProgram.h"
 #include "Texture.h"
 #include "Bitmap.h"
+#include "KtxFile.h"
 #include "Model.h"
 
 #define MAX_PATH_LEN 1024
@@ -39,17 +40,36 @@ static std::string ResourcePath(std::string fileName) {
     return finalPath;
 }
 
-static ShaderProgram *programWithShaders(const char *vertexShaderFilename, const char *fragmentShaderFilename) {
-    std::vector<Shader> shaders;
-    shaders.push_back(Shader::shaderFromFile(ResourcePath(vertexShaderFilename), GL_VERTEX_SHADER));
-    shaders.push_back(Shader::shaderFromFile(ResourcePath(fragmentShaderFilename), GL_FRAGMENT_SHADER));
-    return new ShaderProgram(shaders);
+// Checks whether a resource file exists
+static bool ResourceExists(std::string fileName) {
+    std::ifstream file(ResourcePath(fileName).c_str(), std::ios::in | std::ios::binary);
+    return file.is_open();
 }
 
-static Texture *textureFromFile(const char *textureFilename) {
+// Returns the program linked from the given shaders. Programs are cached, so that models using the same shaders
+// share a program object and can be drawn without switching programs. The cache is in Loaders.cpp, so it's shared by
+// every file that includes this header.
+ShaderProgram *programWithShaders(const char *vertexShaderFilename, const char *fragmentShaderFilename);
+
+// Returns the name of the pre-compressed version of a texture, as made by --compress-texture
+static std::string compressedTextureName(const std::string& textureFilename) {
+    return textureFilename.substr(0, textureFilename.find_last_of('.')) + ".ktx";
+}
+
+// Checks whether a pre-compressed version of the texture exists, and the driver can sample it
+static bool compressedTextureAvailable(const std::string& textureFilename) {
+    return GLEW_EXT_texture_compression_s3tc && GLEW_EXT_texture_sRGB && ResourceExists(compressedTextureName(textureFilename));
+}
+
+static KtxFile compressedTextureFromFile(const std::string& textureFilename) {
+    return KtxFile::ktxFromFile(ResourcePath(compressedTextureName(textureFilename)));
+}
+
+// Decodes a texture image, flipped to the row order OpenGL expects
+static Bitmap bitmapFromTextureFile(const std::string& textureFilename) {
     Bitmap bmp = Bitmap::bitmapFromFile(ResourcePath(textureFilename));
     bmp.flipVertically();
-    return new Texture(bmp);
+    return bmp;
 }
 
 static std::map<std::string, ModelData> loadModelsFromObj(const char *objFilename) {
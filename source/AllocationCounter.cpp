@@ -0,0 +1,64 @@
+//
+//  AllocationCounter.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 11/9/14.
+//
+//
+
+#include "AllocationCounter.h"
+
+#include <cstdlib>
+#include <new>
+
+// A plain __thread integer, since counting must not allocate and thread_local isn't available on every toolchain we use
+static __thread unsigned long ThreadAllocations = 0;
+
+static void *CountedAllocate(std::size_t size) {
+    ++ThreadAllocations;
+    
+    // operator new must return a unique pointer even for zero bytes
+    void *pointer = malloc(size == 0 ? 1 : size);
+    if (!pointer)
+        throw std::bad_alloc();
+    
+    return pointer;
+}
+
+unsigned long AllocationCounter::threadAllocationCount() {
+    return ThreadAllocations;
+}
+
+void *operator new(std::size_t size) {
+    return CountedAllocate(size);
+}
+
+void *operator new[](std::size_t size) {
+    return CountedAllocate(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    ++ThreadAllocations;
+    return malloc(size == 0 ? 1 : size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    ++ThreadAllocations;
+    return malloc(size == 0 ? 1 : size);
+}
+
+void operator delete(void *pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete(void *pointer, const std::nothrow_t&) noexcept {
+    free(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t&) noexcept {
+    free(pointer);
+}
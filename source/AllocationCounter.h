@@ -0,0 +1,24 @@
+//
+//  AllocationCounter.h
+//  Robot
+//
+//  Created by Itamar Ravid on 11/9/14.
+//
+//
+
+#ifndef __Robot__AllocationCounter__
+#define __Robot__AllocationCounter__
+
+/* Counts calls to the global operator new, which AllocationCounter.cpp replaces. Counts are per thread, so a section
+ * of the frame loop can be checked for heap allocations without counting what the worker threads do meanwhile.
+ * Allocations made directly with malloc, like the ones inside system frameworks, aren't counted. */
+class AllocationCounter {
+public:
+    // The number of operator new calls made by the calling thread so far
+    static unsigned long threadAllocationCount();
+    
+private:
+    AllocationCounter();
+};
+
+#endif /* defined(__Robot__AllocationCounter__) */
@@ -6,13 +6,28 @@
 //
 //
 
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
 #include <iostream>
+#include <set>
+#include <stdexcept>
 
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
 
 #include "Application.h"
+#include "AllocationCounter.h"
 #include "MathUtils.h"
 #include "Loaders.h"
+#include "ThreadPool.h"
+
+// Replaces the rotation of a scene node, keeping its translation and scale
+static void SetNodeRotation(Scene& scene, NodeHandle node, const glm::mat4& rotate) {
+    ModelTransform transform = scene.localTransform(node);
+    transform.rotate = rotate;
+    scene.setLocalTransform(node, transform);
+}
 
 Application& Application::getInstance() {
     static Application instance;
@@ -20,177 +35,723 @@ Application& Application::getInstance() {
     return instance;
 }
 
-Application::Application() {
+// Enough for a draw packet per node in scenes far larger than the robot's room
+static const size_t FrameArenaCapacity = 4 * 1024 * 1024;
+
+// Frames run before checkFrameAllocations starts counting, while the first uploads and residency changes settle
+static const unsigned AllocationCheckWarmupFrames = 120;
+
+// The head sensor's resolution, vertical field of view in degrees, and range in world units
+static const unsigned HeadSensorWidth = 256, HeadSensorHeight = 192;
+static const float HeadSensorFieldOfView = 60.0f, HeadSensorRange = 20.0f;
+
+// The software occlusion buffer's resolution. It only needs to tell the large occluders apart.
+static const unsigned OcclusionBufferWidth = 256, OcclusionBufferHeight = 192;
+
+// The size of each face of the static shadow map, and of the dynamic shadow map. The dynamic map only covers the robot.
+static const unsigned StaticShadowMapSize = 1024, DynamicShadowMapSize = 512;
+
+// The most point lights that can be on, and how many are on at start. The -/= keys turn more on.
+static const unsigned MaxPointLights = 1000, InitialPointLightCount = 0;
+
+// Frames benchmarkLights runs before measuring each light count, so the timings of the previous one have drained
+static const unsigned LightBenchmarkWarmupFrames = 10;
+
+// The same for benchmarkOverdraw, between its configurations
+static const unsigned OverdrawBenchmarkWarmupFrames = 10;
+
+// The GPU time dynamic resolution keeps frames under at start, in milliseconds. It leaves the CPU room in a 60 Hz frame.
+static const double InitialFrameTimeBudget = 14.0;
+
+Application::Application() : _headSensor(HeadSensorWidth, HeadSensorHeight, HeadSensorFieldOfView, HeadSensorRange),
+    _headSensorEnabled(false), _frameArena(FrameArenaCapacity), _nodeVisibility(nullptr), _visibleModelCount(0), _culledModelCount(0),
+    _boundsTestCount(0), _occlusionCuller(nullptr),
+    _depthRasterizer(OcclusionBufferWidth, OcclusionBufferHeight), _occluderNodes(), _occlusionMode(OcclusionMode_Queries),
+    _nodeIsOccluder(nullptr), _softwareOccludedCount(0), _renderPath(RenderPath_Forward), _lightClusters(nullptr),
+    _deferredRenderer(nullptr),
+    _pointLights(), _pointLightAnchors(), _pointLightCount(InitialPointLightCount), _shadowMaps(nullptr), _staticNodes(),
+    _nodeIsStatic(nullptr), _drawOrder(DrawOrder_Scene), _depthPrepass(false), _showOverdraw(false), _fragmentCounter(nullptr),
+    _depthPrepassProgram(nullptr), _overdrawProgram(nullptr), _dynamicResolution(nullptr), _cameraInHead(false), _lastFrameTime(0.0),
+    _frameAllocations(0), _printFrameStats(false), _lastStatsTime(0.0), _textureFiltering(Texture::Filtering_Anisotropic) {
     initGlfw(1024, 768);
     initOpenGL();
+    _frameTimer = new GpuTimer();
+    _fragmentCounter = new FragmentCounter();
+    _occlusionCuller = new OcclusionCuller();
+    _depthPrepassProgram = programWithShaders("depth-prepass.vsh", "shadow-depth.fsh");
+    _overdrawProgram = programWithShaders("depth-prepass.vsh", "overdraw.fsh");
+    
+    int framebufferWidth, framebufferHeight;
+    glfwGetFramebufferSize(_window, &framebufferWidth, &framebufferHeight);
+    _lightClusters = new LightClusters(framebufferWidth, framebufferHeight);
+    _deferredRenderer = new DeferredRenderer(framebufferWidth, framebufferHeight);
+    _shadowMaps = new ShadowMaps(StaticShadowMapSize, DynamicShadowMapSize);
+    _dynamicResolution = new DynamicResolution(framebufferWidth, framebufferHeight, InitialFrameTimeBudget);
+    
+    _textureStreamer = new TextureStreamer();
     createScene();
     initCamera(glm::vec3(0, 2, 0), glm::vec3(0, 2, -1), 0.2f, 100.0f, 45.0f);
     initLightSource(glm::vec3(5.0f, 3.0f, -2.0f), glm::vec4(0.5), glm::vec4(1.0f), glm::vec4(1.5), 1.2f);
+    initPointLights();
     
     _robotMovementSpeed = 1.5f;
     _mouseSensitivity = 0.1f;
 }
 
 void Application::startAppLoop() {
-    double lastTime = glfwGetTime();
-    while (!glfwWindowShouldClose(_window)) {
-        double currentTime = glfwGetTime();
-        updatePositions(currentTime - lastTime);
-        lastTime = currentTime;
+    _lastFrameTime = glfwGetTime();
+    while (!glfwWindowShouldClose(_window))
+        runFrame();
+    
+    shutdown();
+}
+
+bool Application::checkFrameAllocations(unsigned frameCount) {
+    _lastFrameTime = glfwGetTime();
+    
+    unsigned long allocations = 0;
+    unsigned frame = 0;
+    for (; frame < AllocationCheckWarmupFrames + frameCount && !glfwWindowShouldClose(_window); ++frame) {
+        runFrame();
+        if (frame >= AllocationCheckWarmupFrames)
+            allocations += _frameAllocations;
+    }
+    
+    unsigned checkedFrames = frame > AllocationCheckWarmupFrames ? frame - AllocationCheckWarmupFrames : 0;
+    std::cout << allocations << " heap allocations in " << checkedFrames << " frames, frame arena high water mark "
+              << _frameArena.highWaterMark() << " bytes" << std::endl;
+    
+    shutdown();
+    return allocations == 0;
+}
+
+void Application::benchmarkHeadSensor(unsigned captureCount) {
+    std::cout << _headSensor.width() << "x" << _headSensor.height() << " head sensor, " << _sceneBvh.itemCount() << " models, "
+              << ThreadPool::shared().threadCount() << " threads" << std::endl;
+    
+    for (int set = PixelConversion::InstructionSet_Scalar; set <= PixelConversion::bestInstructionSet(); ++set) {
+        BatchMath::InstructionSet instructionSet = (BatchMath::InstructionSet) set;
+        
+        double seconds = 0.0;
+        for (unsigned capture = 0; capture < captureCount; ++capture) {
+            captureHeadSensor(instructionSet);
+            seconds += _headSensor.lastCaptureSeconds();
+        }
+        
+        const std::vector<float>& distances = _headSensor.distances();
+        unsigned hits = 0;
+        for (size_t i = 0; i < distances.size(); ++i)
+            hits += distances[i] < _headSensor.maxRange();
         
-        renderScene();
-        glfwSwapBuffers(_window);
+        std::cout << PixelConversion::instructionSetName(instructionSet) << ": "
+                  << (double) _headSensor.rayCount() * captureCount / seconds / 1e6 << " Mrays/s, "
+                  << seconds / captureCount * 1000.0 << " ms per capture, " << hits << " rays hit" << std::endl;
+    }
+    
+    shutdown();
+}
+
+void Application::benchmarkLights(unsigned frameCount) {
+    static const unsigned LightCounts[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 };
+    
+    std::cout << _deferredRenderer->width() << "x" << _deferredRenderer->height() << " framebuffer, " << frameCount
+              << " frames per measurement" << std::endl;
+    
+    // The paths are compared at full resolution
+    _dynamicResolution->setEnabled(false);
+    
+    // The forward path only has the scene light, so it's measured once as the baseline. The other paths are measured
+    // with every light count.
+    _lastFrameTime = glfwGetTime();
+    unsigned lightCountCount = sizeof(LightCounts) / sizeof(LightCounts[0]);
+    for (int step = -1; step < (int) (2 * lightCountCount) && !glfwWindowShouldClose(_window); ++step) {
+        if (step < 0) {
+            _renderPath = RenderPath_Forward;
+            _pointLightCount = 0;
+        } else {
+            _renderPath = step < (int) lightCountCount ? RenderPath_Clustered : RenderPath_Deferred;
+            _pointLightCount = LightCounts[step % lightCountCount];
+        }
         
-        GLenum error = glGetError();
-        if (error != GL_NO_ERROR)
-            std::cerr << "OpenGL error " << error << ": " << (const char *) gluErrorString(error) << std::endl;
+        for (unsigned frame = 0; frame < LightBenchmarkWarmupFrames; ++frame)
+            runFrame();
+        _frameTimer->resetAverage();
+        for (unsigned frame = 0; frame < frameCount; ++frame)
+            runFrame();
         
-        glfwPollEvents();
+        if (_renderPath == RenderPath_Forward)
+            std::cout << "forward, scene light only: ";
+        else
+            std::cout << (_renderPath == RenderPath_Clustered ? "clustered, " : "deferred, ") << _pointLightCount << " point lights: ";
+        std::cout << _frameTimer->averageMilliseconds() << " ms (" << _frameTimer->averageSampleCount() << " frames)";
+        if (_renderPath == RenderPath_Clustered)
+            std::cout << ", " << _lightClusters->lastAssignSeconds() * 1000.0 << " ms assigning on the CPU";
+        std::cout << std::endl;
     }
     
-    glfwDestroyWindow(_window);
-    glfwTerminate();
+    shutdown();
+}
+
+void Application::benchmarkOverdraw(unsigned frameCount) {
+    static const char *PathNames[] = { "forward", "clustered", "deferred" };
+    
+    std::cout << _deferredRenderer->width() << "x" << _deferredRenderer->height() << " framebuffer, " << frameCount
+              << " frames per measurement" << std::endl;
+    
+    // The fragment counts are compared at full resolution
+    _dynamicResolution->setEnabled(false);
+    _lastFrameTime = glfwGetTime();
+    for (int path = RenderPath_Forward; path <= RenderPath_Deferred && !glfwWindowShouldClose(_window); ++path) {
+        for (int order = DrawOrder_Scene; order <= DrawOrder_FrontToBack; ++order) {
+            for (int prepass = 0; prepass < 2; ++prepass) {
+                _renderPath = (RenderPath) path;
+                _drawOrder = (DrawOrder) order;
+                _depthPrepass = prepass != 0;
+                
+                for (unsigned frame = 0; frame < OverdrawBenchmarkWarmupFrames; ++frame)
+                    runFrame();
+                _frameTimer->resetAverage();
+                _fragmentCounter->resetAverage();
+                for (unsigned frame = 0; frame < frameCount; ++frame)
+                    runFrame();
+                
+                std::cout << PathNames[path] << ", " << (_drawOrder == DrawOrder_FrontToBack ? "front to back" : "scene order")
+                          << (_depthPrepass ? ", depth pre-pass: " : ": ") << _frameTimer->averageMilliseconds() << " ms ("
+                          << _frameTimer->averageSampleCount() << " frames), " << shadedFragmentsPerPixel()
+                          << " fragments shaded per pixel" << std::endl;
+            }
+        }
+    }
+    
+    shutdown();
 }
 
-std::map<std::string, Model *> Application::loadRoomModels() {
-    std::map<std::string, ModelData> roomData = loadModelsFromObj("RoomModel.obj");
-    std::map<std::string, Model *> roomModels;
+void Application::runFrame() {
+    _frameArena.reset();
+    unsigned long allocationsBefore = AllocationCounter::threadAllocationCount();
+    
+    double currentTime = glfwGetTime();
+    updatePositions(currentTime - _lastFrameTime);
+    updatePointLights(currentTime);
+    _scene.updateWorldTransforms();
+    if (_scene.recomputedNodeCount() > 0)
+        _sceneBvh.refit(_scene);
+    _lastFrameTime = currentTime;
+    cullScene();
+    
+    if (_headSensorEnabled)
+        captureHeadSensor();
+    
+    _textureStreamer->update();
+    updateTextureResidency();
+    
+    _dynamicResolution->update(*_frameTimer);
+    _frameTimer->begin();
+    renderScene();
+    _frameTimer->end();
     
-    // Ceiling and floor
-    roomModels["Ceiling"] = new Model(roomData["Ceiling"].vertexData, roomData["Ceiling"].textureData, roomData["Ceiling"].normalData, roomData["Ceiling"].indexData,
-                                      GL_TRIANGLES, (GLuint) roomData["Ceiling"].indexData.size(), 0,
-                                      glm::vec4(1.0f), glm::vec4(1.0f), glm::vec4(1.0f), 40.0f,
-                                      "concrete_texture.jpg", "vertex-shader.vsh", "fragment-shader.fsh");
+    _frameAllocations = AllocationCounter::threadAllocationCount() - allocationsBefore;
+    glfwSwapBuffers(_window);
     
-    roomModels["Floor"] = new Model(roomData["Floor"].vertexData, roomData["Floor"].textureData, roomData["Floor"].normalData, roomData["Floor"].indexData,
-                                    GL_TRIANGLES, (GLuint) roomData["Floor"].indexData.size(), 0,
-                                    glm::vec4(1.0f), glm::vec4(1.0f), glm::vec4(1.0f), 40.0f,
-                                    "concrete_texture.jpg", "vertex-shader.vsh", "fragment-shader.fsh");
+    if (_printFrameStats)
+        printFrameStats(currentTime);
     
-    // Walls
-    roomModels["Left_Wall"] = new Model(roomData["Left_Wall"].vertexData, roomData["Left_Wall"].textureData, roomData["Left_Wall"].normalData, roomData["Left_Wall"].indexData,
-                                        GL_TRIANGLES, (GLuint) roomData["Left_Wall"].indexData.size(), 0,
-                                        glm::vec4(1.0f), glm::vec4(1.0f), glm::vec4(1.0f), 20.0f,
-                                        "brick_texture.jpg", "vertex-shader.vsh", "fragment-shader.fsh");
-    roomModels["Right_Wall"] = new Model(roomData["Right_Wall"].vertexData, roomData["Right_Wall"].textureData, roomData["Right_Wall"].normalData, roomData["Right_Wall"].indexData,
-                                         GL_TRIANGLES, (GLuint) roomData["Right_Wall"].indexData.size(), 0,
-                                         glm::vec4(1.0f), glm::vec4(1.0f), glm::vec4(1.0f), 20.0f,
-                                         "brick_texture.jpg", "vertex-shader.vsh", "fragment-shader.fsh");
-    roomModels["Front_Wall"] = new Model(roomData["Front_Wall"].vertexData, roomData["Front_Wall"].textureData, roomData["Front_Wall"].normalData, roomData["Front_Wall"].indexData,
-                                         GL_TRIANGLES, (GLuint) roomData["Front_Wall"].indexData.size(), 0,
-                                         glm::vec4(1.0f), glm::vec4(1.0f), glm::vec4(1.0f), 20.0f,
-                                         "brick_texture.jpg", "vertex-shader.vsh", "fragment-shader.fsh");
-    roomModels["Back_Wall"] = new Model(roomData["Back_Wall"].vertexData, roomData["Back_Wall"].textureData, roomData["Back_Wall"].normalData, roomData["Back_Wall"].indexData,
-                                        GL_TRIANGLES, (GLuint) roomData["Back_Wall"].indexData.size(), 0,
-                                        glm::vec4(1.0f), glm::vec4(1.0f), glm::vec4(1.0f), 20.0f,
-                                        "brick_texture.jpg", "vertex-shader.vsh", "fragment-shader.fsh");
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR)
+        std::cerr << "OpenGL error " << error << ": " << (const char *) gluErrorString(error) << std::endl;
     
-    return roomModels;
+    glfwPollEvents();
 }
 
-std::map<std::string, Model *> Application::loadFurnitureModels() {
-    std::map<std::string, ModelData> furnitureData = loadModelsFromObj("BrownObjectModel.obj");
-    std::map<std::string, Model *> furnitureModels;
+void Application::shutdown() {
+    delete _frameTimer;
+    _frameTimer = nullptr;
+    delete _fragmentCounter;
+    _fragmentCounter = nullptr;
+    delete _occlusionCuller;
+    _occlusionCuller = nullptr;
+    delete _lightClusters;
+    _lightClusters = nullptr;
+    delete _deferredRenderer;
+    _deferredRenderer = nullptr;
+    delete _shadowMaps;
+    _shadowMaps = nullptr;
+    delete _dynamicResolution;
+    _dynamicResolution = nullptr;
     
-    furnitureModels["Cylinder"] = new Model(furnitureData["Cylinder"].vertexData, furnitureData["Cylinder"].textureData, furnitureData["Cylinder"].normalData, furnitureData["Cylinder"].indexData,
-                                            GL_TRIANGLES, (GLuint) furnitureData["Cylinder"].indexData.size(), 0,
-                                            glm::vec4(1.0f), glm::vec4(1.0f), glm::vec4(1.0f), 40.0f,
-                                            "brown_texture.jpg", "vertex-shader.vsh", "fragment-shader.fsh");
+    // Pending uploads and residency entries refer to the library's textures
+    delete _textureStreamer;
+    _textureStreamer = nullptr;
+    delete _textureResidency;
+    _textureResidency = nullptr;
+    delete _textureLibrary;
+    _textureLibrary = nullptr;
     
-    return furnitureModels;
+    glfwDestroyWindow(_window);
+    glfwTerminate();
 }
 
-std::map<std::string, Model *> Application::loadRobotModels() {
-    // Load the arrays from the file
-    std::map<std::string, ModelData> robotData = loadModelsFromObj("RobotModel.obj");
-    std::map<std::string, Model *> robotModels;
+std::vector<Model *> Application::loadSceneModels(const SceneFile& sceneFile) {
+    // A model for each mesh and material combination the nodes use, sharing the meshes read from each OBJ file
+    std::vector<Model *> models(sceneFile.modelCount(), nullptr);
+    std::map<std::string, std::map<std::string, ModelData> > objFiles;
     
-    for (std::map<std::string, ModelData>::const_iterator it = robotData.begin(); it != robotData.end(); ++it) {
-        Model *model = new Model(it->second.vertexData, it->second.textureData, it->second.normalData, it->second.indexData,
-                                 GL_TRIANGLES, 36, 0,
-                                 glm::vec4(1.0f), glm::vec4(1.0f), glm::vec4(1.0f), 120.0f,
-                                 "metal_texture.jpg", "vertex-shader.vsh", "fragment-shader.fsh");
-        robotModels[it->first] = model;
+    for (unsigned i = 0; i < sceneFile.nodeCount(); ++i) {
+        const SceneFile::Node& node = sceneFile.nodes()[i];
+        uint32_t modelIndex = sceneFile.modelIndex(i);
+        if (modelIndex == SceneFile::None || models[modelIndex])
+            continue;
+        
+        const SceneFile::Mesh& mesh = sceneFile.meshes()[node.mesh];
+        const SceneFile::Material& material = sceneFile.materials()[node.material];
+        
+        const char *objFilename = sceneFile.string(mesh.path);
+        if (!objFiles.count(objFilename))
+            objFiles[objFilename] = loadModelsFromObj(objFilename);
+        
+        std::map<std::string, ModelData>::const_iterator data = objFiles[objFilename].find(sceneFile.string(mesh.object));
+        if (data == objFiles[objFilename].end())
+            throw std::runtime_error(std::string("No object ") + sceneFile.string(mesh.object) + " in " + objFilename);
+        
+        models[modelIndex] = new Model(data->second.vertexData, data->second.textureData, data->second.normalData, data->second.indexData,
+                                       GL_TRIANGLES, (GLuint) data->second.indexData.size(), 0,
+                                       glm::make_vec4(material.ambientColor), glm::make_vec4(material.diffuseColor),
+                                       glm::make_vec4(material.specularColor), material.shininess,
+                                       _textureLibrary->layer(sceneFile.string(material.texture)),
+                                       sceneFile.string(material.vertexShader), sceneFile.string(material.fragmentShader));
     }
     
-    return robotModels;
+    return models;
+}
+
+// The handle of a node the application refers to by name. Throws if the scene file doesn't have it.
+static NodeHandle NamedNode(const SceneFile& sceneFile, const std::vector<NodeHandle>& nodes, const char *name) {
+    uint32_t index = sceneFile.findNode(name);
+    if (index == SceneFile::None)
+        throw std::runtime_error(std::string("Scene file has no node named ") + name);
+    
+    return nodes[index];
 }
 
 void Application::createScene() {
-    // Load the room models
-    std::map<std::string, Model *> roomModels = loadRoomModels();
-    
-    RenderNode *ceilingNode = new RenderNode(new ModelInstance(roomModels["Ceiling"]));
-    _scene["Ceiling"] = ceilingNode;
-    RenderNode *floorNode = new RenderNode(new ModelInstance(roomModels["Floor"]));
-    _scene["Floor"] = floorNode;
-    RenderNode *leftWallNode = new RenderNode(new ModelInstance(roomModels["Left_Wall"]));
-    _scene["Left_Wall"] = leftWallNode;
-    RenderNode *rightWallNode = new RenderNode(new ModelInstance(roomModels["Right_Wall"]));
-    _scene["Right_Wall"] = rightWallNode;
-    RenderNode *frontWallNode = new RenderNode(new ModelInstance(roomModels["Front_Wall"]));
-    _scene["Front_Wall"] = frontWallNode;
-    RenderNode *backWallNode = new RenderNode(new ModelInstance(roomModels["Back_Wall"]));
-    _scene["Back_Wall"] = backWallNode;
-    
-    // Load the furniture models
-    std::map<std::string, Model *> furnitureModels = loadFurnitureModels();
-    
-    RenderNode *furniture1Node = new RenderNode(new ModelInstance(furnitureModels["Cylinder"]));
-    furniture1Node->instance->transform.translate = glm::translate(glm::mat4(), glm::vec3(3, -0.5, 4));
-    _scene["Cylinder1"] = furniture1Node;
-
-    RenderNode *furniture2Node = new RenderNode(new ModelInstance(furnitureModels["Cylinder"]));
-    furniture2Node->instance->transform.translate = glm::translate(glm::mat4(), glm::vec3(3, -0.5, -4));
-    _scene["Cylinder2"] = furniture2Node;
-
-    RenderNode *furniture3Node = new RenderNode(new ModelInstance(furnitureModels["Cylinder"]));
-    furniture3Node->instance->transform.translate = glm::translate(glm::mat4(), glm::vec3(-3, -0.5, -4));
-    _scene["Cylinder3"] = furniture3Node;
-    
-    // Load the robot models
-    std::map<std::string, Model *> robotModels = loadRobotModels();
-    RenderNode *headNode = new RenderNode(new ModelInstance(robotModels["Head"]));
-    RenderNode *torsoNode = new RenderNode(new ModelInstance(robotModels["Torso"]));
-    RenderNode *rightArmNode = new RenderNode(new ModelInstance(robotModels["R_Arm"]));
-    RenderNode *rightWristNode = new RenderNode(new ModelInstance(robotModels["R_Wrist"]));
-    RenderNode *leftArmNode = new RenderNode(new ModelInstance(robotModels["L_Arm"]));
-    RenderNode *leftWristNode = new RenderNode(new ModelInstance(robotModels["L_Wrist"]));
-    RenderNode *rightLegNode = new RenderNode(new ModelInstance(robotModels["R_Leg"]));
-    RenderNode *leftLegNode = new RenderNode(new ModelInstance(robotModels["L_Leg"]));
-    
-    // Set the model transform of each part of the robot to the translations we wrote down in Blender
-    headNode->instance->transform.translate = glm::translate(glm::mat4(), glm::vec3(-0.0050, 1.6611, -0.0563));
-    leftArmNode->instance->transform.translate = glm::translate(glm::mat4(), glm::vec3(-0.0672, 0.2466, -1.4236));
-    leftWristNode->instance->transform.translate = glm::translate(glm::mat4(), glm::vec3(-0.0092, -1.2856, -0.0097));
-    rightArmNode->instance->transform.translate = glm::translate(glm::mat4(), glm::vec3(-0.0580, 0.2572, 1.4286));
-    rightWristNode->instance->transform.translate = glm::translate(glm::mat4(), glm::vec3(-0.0092, -1.2856, -0.0097));
-    rightLegNode->instance->transform.translate = glm::translate(glm::mat4(), glm::vec3(0.0881, -1.8537, 0.5387));
-    leftLegNode->instance->transform.translate = glm::translate(glm::mat4(), glm::vec3(0.0881, -1.8541, -0.5452));
-    torsoNode->instance->transform.translate = glm::translate(glm::mat4(), glm::vec3(0.0, 2.0, 0.0));
-    
-    // Attach the Robot parts
-    rightArmNode->children["Right_Wrist"] = rightWristNode;
-    leftArmNode->children["Left_Wrist"] = leftWristNode;
-    torsoNode->children["Left_Leg"] = leftLegNode;
-    torsoNode->children["Right_Leg"] = rightLegNode;
-    torsoNode->children["Left_Arm"] = leftArmNode;
-    torsoNode->children["Right_Arm"] = rightArmNode;
-    torsoNode->children["Head"] = headNode;
-    
-    // Insert the Robot into the scene
-    _scene["Torso"] = torsoNode;
+    SceneFile sceneFile(ResourcePath("Robot.scene"));
+    
+    // Pack every material texture up front, so that all the materials can share one texture array
+    _textureLibrary = new TextureLibrary();
+    std::set<std::string> textureNames;
+    for (unsigned i = 0; i < sceneFile.materialCount(); ++i) {
+        std::string textureName = sceneFile.string(sceneFile.materials()[i].texture);
+        if (textureNames.insert(textureName).second)
+            _textureLibrary->addTexture(textureName);
+    }
+    _textureLibrary->build(_textureFiltering, _textureStreamer);
+    
+    // Start every texture at its coarsest level; the first frames bring in what the camera needs
+    _textureResidency = new TextureResidency();
+    const std::vector<Texture *>& textures = _textureLibrary->textures();
+    for (std::vector<Texture *>::const_iterator it = textures.begin(); it != textures.end(); ++it)
+        _textureResidency->addTexture(*it);
+    
+    // Create the nodes straight from the file's node table
+    std::vector<Model *> models = loadSceneModels(sceneFile);
+    std::vector<NodeHandle> nodes(sceneFile.nodeCount());
+    sceneFile.instantiate(_scene, models.data(), nodes.data());
+    
+    for (unsigned i = 0; i < sceneFile.nodeCount(); ++i) {
+        if (sceneFile.nodes()[i].flags & SceneFile::NodeFlag_Occluder)
+            _occluderNodes.push_back(nodes[i]);
+        if (sceneFile.nodes()[i].flags & SceneFile::NodeFlag_Static)
+            _staticNodes.push_back(nodes[i]);
+    }
+    
+    // The robot's parts, which updatePositions moves
+    _robotNodes.torso = NamedNode(sceneFile, nodes, "Torso");
+    _robotNodes.head = NamedNode(sceneFile, nodes, "Head");
+    _robotNodes.leftArm = NamedNode(sceneFile, nodes, "L_Arm");
+    _robotNodes.leftWrist = NamedNode(sceneFile, nodes, "L_Wrist");
+    _robotNodes.rightArm = NamedNode(sceneFile, nodes, "R_Arm");
+    _robotNodes.rightWrist = NamedNode(sceneFile, nodes, "R_Wrist");
+    _robotNodes.leftLeg = NamedNode(sceneFile, nodes, "L_Leg");
+    _robotNodes.rightLeg = NamedNode(sceneFile, nodes, "R_Leg");
+    
+    _scene.updateWorldTransforms();
+    _sceneBvh.build(_scene);
+}
+
+void Application::renderShadowMaps() {
+    const std::vector<Model *>& models = _scene.models();
+    const std::vector<glm::mat4>& transforms = _scene.worldTransforms();
+    const std::vector<BoundingBox>& bounds = _scene.worldBounds();
+    glm::vec3 lightPosition(_lightSource.position);
+    
+    // Shadows are cast by nodes out of view too
+    ShadowCaster *casters = _frameArena.allocateArray<ShadowCaster>(_scene.nodeCount());
+    if (_shadowMaps->staticMapIsStale(lightPosition)) {
+        unsigned casterCount = 0;
+        for (unsigned i = 0; i < _scene.nodeCount(); ++i) {
+            if (models[i] && _nodeIsStatic[i]) {
+                casters[casterCount].model = models[i];
+                casters[casterCount].transform = &transforms[i];
+                ++casterCount;
+            }
+        }
+        _shadowMaps->renderStaticMap(lightPosition, casters, casterCount);
+    }
+    
+    unsigned casterCount = 0;
+    BoundingBox casterBounds = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+    for (unsigned i = 0; i < _scene.nodeCount(); ++i) {
+        if (models[i] && !_nodeIsStatic[i]) {
+            casters[casterCount].model = models[i];
+            casters[casterCount].transform = &transforms[i];
+            ++casterCount;
+            casterBounds.min = glm::min(casterBounds.min, bounds[i].min);
+            casterBounds.max = glm::max(casterBounds.max, bounds[i].max);
+        }
+    }
+    _shadowMaps->renderDynamicMap(lightPosition, casterBounds, casters, casterCount);
 }
 
 void Application::renderScene() {
-    glClearColor(0, 0, 0, 1);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    renderShadowMaps();
+    _shadowMaps->bind();
+    
+    // Everything below draws at the dynamic resolution, into its framebuffer
+    unsigned renderWidth = _dynamicResolution->width(), renderHeight = _dynamicResolution->height();
+    _dynamicResolution->begin();
+    _lightClusters->resize(renderWidth, renderHeight);
+    _deferredRenderer->setViewport(renderWidth, renderHeight);
+    
+    // The overdraw view replaces the shading, so it draws like the forward paths on every path
+    bool deferred = _renderPath == RenderPath_Deferred && !_showOverdraw;
+    if (deferred) {
+        _deferredRenderer->beginGeometryPass(glm::vec3(_lightSource.ambientColor));
+    } else {
+        glClearColor(0, 0, 0, 1);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        
+        // The forward path reads the same cluster lists, with none of the point lights in them
+        _lightClusters->assign(_camera, _pointLights.data(), _renderPath == RenderPath_Clustered ? _pointLightCount : 0);
+        _lightClusters->bind();
+    }
+    
+    // Collect this frame's draws in the frame arena
+    const std::vector<Model *>& models = _scene.models();
+    const std::vector<glm::mat4>& transforms = _scene.worldTransforms();
+    const std::vector<glm::mat3>& normalMatrices = _scene.normalMatrices();
+    const std::vector<BoundingBox>& bounds = _scene.worldBounds();
+    DrawPacket *packets = _frameArena.allocateArray<DrawPacket>(_scene.nodeCount());
+    unsigned packetCount = 0;
+    for (unsigned i = 0; i < _scene.nodeCount(); ++i) {
+        if (!models[i] || !_nodeVisibility[i])
+            continue;
+        
+        packets[packetCount].model = models[i];
+        packets[packetCount].transform = &transforms[i];
+        packets[packetCount].normalMatrix = &normalMatrices[i];
+        packets[packetCount].node = i;
+        packets[packetCount].viewDepth = glm::dot((bounds[i].min + bounds[i].max) * 0.5f - _camera.position(), _camera.forward());
+        ++packetCount;
+    }
+    
+    if (_drawOrder == DrawOrder_FrontToBack) {
+        std::sort(packets, packets + packetCount, [](const DrawPacket& a, const DrawPacket& b) {
+            return a.viewDepth < b.viewDepth;
+        });
+    }
+    
+    if (_depthPrepass)
+        drawDepthPrepass(packets, packetCount);
+    
+    if (_showOverdraw) {
+        _overdrawProgram->use();
+        _overdrawProgram->setUniform("view", _camera.view());
+        _overdrawProgram->setUniform("projection", _camera.projection());
+        _overdrawProgram->stopUsing();
+        
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+    }
+    
+    // After the pre-pass, the depth buffer already holds the nearest surfaces
+    if (_depthPrepass) {
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
+    
+    // Nodes hidden by the software mode are already out of the packets. Consecutive packets share their program and
+    // texture binds.
+    ModelDrawRun drawRun(_camera, _lightSource, *_lightClusters, *_shadowMaps,
+                         deferred ? _deferredRenderer->geometryProgram() : nullptr);
+    _fragmentCounter->beginFrame();
+    if (_occlusionMode == OcclusionMode_Queries) {
+        drawWithOcclusionQueries(packets, packetCount, drawRun);
+    } else {
+        _fragmentCounter->begin();
+        for (unsigned i = 0; i < packetCount; ++i)
+            drawPacket(packets[i], drawRun);
+        _fragmentCounter->end();
+    }
+    _fragmentCounter->endFrame();
+    drawRun.end();
+    
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    if (_showOverdraw)
+        glDisable(GL_BLEND);
+    
+    if (deferred) {
+        _deferredRenderer->beginLightingPass(_camera);
+        _deferredRenderer->addShadowedLight(_lightSource, *_shadowMaps);
+        _deferredRenderer->addLights(_pointLights.data(), _pointLightCount);
+        _deferredRenderer->endLightingPass(_dynamicResolution->framebuffer());
+    } else {
+        _lightClusters->unbind();
+    }
+    
+    _shadowMaps->unbind();
+    _dynamicResolution->end();
+}
+
+void Application::drawDepthPrepass(const DrawPacket *packets, unsigned packetCount) {
+    _depthPrepassProgram->use();
+    _depthPrepassProgram->setUniform("view", _camera.view());
+    _depthPrepassProgram->setUniform("projection", _camera.projection());
+    
+    // Every packet is drawn, including the ones the occlusion queries will hide - they aren't issued yet, and depth
+    // alone is cheap
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    for (unsigned i = 0; i < packetCount; ++i)
+        packets[i].model->renderDepth(_depthPrepassProgram, *packets[i].transform);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    
+    _depthPrepassProgram->stopUsing();
+}
+
+void Application::drawWithOcclusionQueries(const DrawPacket *packets, unsigned packetCount, ModelDrawRun& drawRun) {
+    // Draw the occluders, so the depth buffer holds them when the other nodes' boxes are queried
+    unsigned *queriedNodes = _frameArena.allocateArray<unsigned>(packetCount);
+    unsigned queriedCount = 0;
+    _fragmentCounter->begin();
+    for (unsigned i = 0; i < packetCount; ++i) {
+        if (_nodeIsOccluder[packets[i].node])
+            drawPacket(packets[i], drawRun);
+        else
+            queriedNodes[queriedCount++] = packets[i].node;
+    }
+    _fragmentCounter->end();
+    
+    // The boxes are tested with the usual depth test, even after a depth pre-pass. The queries turn depth writes back
+    // on when they're done.
+    glDepthFunc(GL_LESS);
+    _occlusionCuller->beginFrame(_scene.nodeCount());
+    _occlusionCuller->issueQueries(queriedNodes, queriedCount, _scene.worldBounds(), _camera);
+    drawRun.invalidate();
+    if (_depthPrepass) {
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
+    
+    _fragmentCounter->begin();
+    for (unsigned i = 0; i < packetCount; ++i) {
+        if (_nodeIsOccluder[packets[i].node])
+            continue;
+        
+        _occlusionCuller->beginDraw(packets[i].node);
+        drawPacket(packets[i], drawRun);
+        _occlusionCuller->endDraw(packets[i].node);
+    }
+    _fragmentCounter->end();
+}
+
+void Application::drawPacket(const DrawPacket& packet, ModelDrawRun& drawRun) {
+    if (_showOverdraw) {
+        _overdrawProgram->use();
+        packet.model->renderDepth(_overdrawProgram, *packet.transform);
+        _overdrawProgram->stopUsing();
+    } else {
+        drawRun.draw(*packet.model, *packet.transform, *packet.normalMatrix);
+    }
+}
+
+void Application::cullScene() {
+    glm::vec4 planes[6];
+    _camera.frustumPlanes(planes);
+    
+    _nodeVisibility = _frameArena.allocateArray<unsigned char>(_scene.nodeCount());
+    _boundsTestCount = _scene.cull(planes, _nodeVisibility);
+    
+    _nodeIsOccluder = _frameArena.allocateArray<unsigned char>(_scene.nodeCount());
+    memset(_nodeIsOccluder, 0, _scene.nodeCount());
+    for (std::vector<NodeHandle>::const_iterator it = _occluderNodes.begin(); it != _occluderNodes.end(); ++it)
+        _nodeIsOccluder[_scene.position(*it)] = 1;
+    
+    _nodeIsStatic = _frameArena.allocateArray<unsigned char>(_scene.nodeCount());
+    memset(_nodeIsStatic, 0, _scene.nodeCount());
+    for (std::vector<NodeHandle>::const_iterator it = _staticNodes.begin(); it != _staticNodes.end(); ++it)
+        _nodeIsStatic[_scene.position(*it)] = 1;
+    
+    _softwareOccludedCount = 0;
+    if (_occlusionMode == OcclusionMode_Software)
+        cullOccludedNodes();
+    
+    const std::vector<Model *>& models = _scene.models();
+    _visibleModelCount = _culledModelCount = 0;
+    for (unsigned i = 0; i < _scene.nodeCount(); ++i) {
+        if (models[i]) {
+            if (_nodeVisibility[i])
+                ++_visibleModelCount;
+            else
+                ++_culledModelCount;
+        }
+    }
+}
+
+void Application::cullOccludedNodes() {
+    const std::vector<Model *>& models = _scene.models();
+    const std::vector<glm::mat4>& transforms = _scene.worldTransforms();
+    const std::vector<BoundingBox>& bounds = _scene.worldBounds();
+    
+    // Rasterize the occluders in view
+    _depthRasterizer.begin(_camera.projection() * _camera.view());
+    for (unsigned i = 0; i < _scene.nodeCount(); ++i) {
+        if (models[i] && _nodeVisibility[i] && _nodeIsOccluder[i])
+            _depthRasterizer.addOccluder(*models[i], transforms[i]);
+    }
+    _depthRasterizer.rasterize();
+    
+    // Hide the other nodes whose boxes are behind them. Only the node's own box is tested, since its children can
+    // reach past it.
+    for (unsigned i = 0; i < _scene.nodeCount(); ++i) {
+        if (models[i] && _nodeVisibility[i] && !_nodeIsOccluder[i] && !_depthRasterizer.isVisible(bounds[i])) {
+            _nodeVisibility[i] = 0;
+            ++_softwareOccludedCount;
+        }
+    }
+}
+
+void Application::captureHeadSensor(BatchMath::InstructionSet instructionSet) {
+    // The head looks down its x axis
+    const glm::mat4& head = _scene.worldTransform(_robotNodes.head);
+    _headSensor.capture(_scene, _sceneBvh, glm::vec3(head[3]), glm::vec3(head[0]), glm::vec3(head[1]), _robotNodes.head, instructionSet);
+}
+
+void Application::updateTextureResidency() {
+    int framebufferWidth, framebufferHeight;
+    glfwGetFramebufferSize(_window, &framebufferWidth, &framebufferHeight);
+    
+    const std::vector<Model *>& models = _scene.models();
+    const std::vector<glm::mat4>& transforms = _scene.worldTransforms();
+    for (unsigned i = 0; i < _scene.nodeCount(); ++i) {
+        // Textures still streaming in stay at their coarsest level, since their finer levels only hold the
+        // placeholder until the last layer lands and the mips are built
+        if (models[i] && _nodeVisibility[i] && _textureLibrary->isLoaded(models[i]->texture))
+            _textureResidency->requestForModel(*models[i], transforms[i], _camera, (float) framebufferHeight);
+    }
+    
+    _textureResidency->update();
+}
+
+void Application::printFrameStats(double currentTime) {
+    if (currentTime - _lastStatsTime < 1.0)
+        return;
+    
+    std::cout << "GPU frame time: " << _frameTimer->averageMilliseconds() << " ms (" << _frameTimer->averageSampleCount() << " frames), "
+              << "texture filtering: " << Texture::filteringName(_textureFiltering) << ", "
+              << _scene.recomputedNodeCount() << " of " << _scene.nodeCount() << " node transforms recomputed, "
+              << _visibleModelCount << " models drawn, " << _culledModelCount << " culled (" << _boundsTestCount << " bounds tested)";
+    
+    if (_textureStreamer->pendingUploads() > 0)
+        std::cout << ", streaming " << _textureStreamer->pendingUploads() << " textures ("
+                  << _textureStreamer->bytesUploadedLastFrame() / 1024 << " KB last frame)";
+    
+    std::cout << ", resident textures: ~" << _textureResidency->residentBytes() / 1024 << " KB of "
+              << _textureResidency->fullResidencyBytes() / 1024 << " KB (estimated from the base levels)";
+    
+    if (_occlusionMode == OcclusionMode_Queries)
+        std::cout << ", occlusion queries: " << _occlusionCuller->queryCount() << " queries, " << _occlusionCuller->conditionalDrawCount()
+                  << " conditional draws, " << _occlusionCuller->skippedDrawCount() << " skipped";
+    else if (_occlusionMode == OcclusionMode_Software)
+        std::cout << ", software occlusion: " << _depthRasterizer.triangleCount() << " occluder triangles, "
+                  << _softwareOccludedCount << " models hidden";
+    
+    if (_renderPath == RenderPath_Deferred)
+        std::cout << ", deferred shading: " << _deferredRenderer->volumeLightCount() << " light volumes, "
+                  << _deferredRenderer->fullScreenLightCount() << " full-screen lights";
+    else if (_renderPath == RenderPath_Clustered)
+        std::cout << ", clustered shading: " << _lightClusters->listEntryCount() << " cluster light entries, up to "
+                  << _lightClusters->maxClusterLightCount() << " per cluster, " << _lightClusters->lastAssignSeconds() * 1000.0
+                  << " ms assigning";
+    else
+        std::cout << ", forward shading";
+    
+    std::cout << ", shadows: static map drawn " << _shadowMaps->staticRenderCount() << " times, "
+              << _shadowMaps->dynamicCasterCount() << " dynamic casters";
+    
+    if (_dynamicResolution->enabled())
+        std::cout << ", dynamic resolution: " << _dynamicResolution->width() << "x" << _dynamicResolution->height() << " ("
+                  << _dynamicResolution->scale() * 100.0f << "%) for a " << _dynamicResolution->budget() << " ms budget";
+    else
+        std::cout << ", full resolution";
+    
+    std::cout << ", " << shadedFragmentsPerPixel() << " fragments shaded per pixel ("
+              << (_drawOrder == DrawOrder_FrontToBack ? "front to back" : "scene order")
+              << (_depthPrepass ? ", depth pre-pass)" : ")");
     
-    MatrixStack matrixStack;
+    if (_headSensorEnabled)
+        std::cout << ", head sensor " << _headSensor.lastCaptureSeconds() * 1000.0 << " ms ("
+                  << _headSensor.rayCount() / _headSensor.lastCaptureSeconds() / 1e6 << " Mrays/s)";
     
-    std::map<std::string, RenderNode *>::const_iterator it;
-    for (it = _scene.begin(); it != _scene.end(); ++it)
-        it->second->renderRecursive(matrixStack, _camera, _lightSource);
+    std::cout << ", " << _frameAllocations << " heap allocations last frame, frame arena peak "
+              << _frameArena.highWaterMark() / 1024 << " KB";
+    
+    std::cout << std::endl;
+    
+    _frameTimer->resetAverage();
+    _fragmentCounter->resetAverage();
+    _lastStatsTime = currentTime;
+}
+
+double Application::shadedFragmentsPerPixel() const {
+    double pixelCount = (double) _dynamicResolution->width() * _dynamicResolution->height();
+    return pixelCount > 0.0 ? _fragmentCounter->averageFragmentCount() / pixelCount : 0.0;
+}
+
+void Application::setTextureFiltering(Texture::Filtering filtering) {
+    _textureFiltering = filtering;
+    
+    const std::vector<Texture *>& textures = _textureLibrary->textures();
+    for (std::vector<Texture *>::const_iterator it = textures.begin(); it != textures.end(); ++it)
+        (*it)->setFiltering(filtering);
+    
+    _frameTimer->resetAverage();
+}
+
+void Application::pickAtViewCenter() {
+    // The cursor is captured for looking around, so picks go through the center of the view. In the robot's view the
+    // camera is inside its head.
+    RayHit hit;
+    NodeHandle ignoredNode = _cameraInHead ? _robotNodes.head : NodeHandle();
+    if (!_sceneBvh.raycast(_scene, _camera.position(), _camera.forward(), _camera.farPlane(), hit, ignoredNode)) {
+        std::cout << "Picked nothing" << std::endl;
+        return;
+    }
+    
+    glm::vec3 headPosition = glm::vec3(_scene.worldTransform(_robotNodes.head) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    bool seenByRobot = _sceneBvh.hasLineOfSight(_scene, headPosition, hit.position, _robotNodes.head);
+    
+    std::cout << "Picked node " << (hit.node.value & (Scene::MaxNodes - 1)) << ", triangle " << hit.triangle << " at distance "
+              << hit.distance << ", " << (seenByRobot ? "visible" : "hidden") << " from the robot's head" << std::endl;
+}
+
+void Application::updatePointLights(double time) {
+    // Each light circles its anchor once every few seconds, bobbing up and down
+    for (unsigned i = 0; i < _pointLightCount; ++i) {
+        const glm::vec4& anchor = _pointLightAnchors[i];
+        float angle = (float) time * 1.3f + anchor.w;
+        _pointLights[i].position = glm::vec4(anchor.x + 0.8f * cosf(angle), anchor.y + 0.3f * sinf(angle * 2.0f),
+                                             anchor.z + 0.8f * sinf(angle), 1.0f);
+    }
 }
 
 void Application::updatePositions(float timeDiff) {
@@ -219,6 +780,23 @@ void Application::updatePositions(float timeDiff) {
         glfwSetCursorPos(_window, 0, 0);
     }
     
+    // Scene light movement with the arrow keys, and up and down with page up/down. Moving it redraws the static
+    // shadow map.
+    glm::vec3 lightDiff(0.0f);
+    if (glfwGetKey(_window, GLFW_KEY_LEFT) == GLFW_PRESS)
+        lightDiff.x -= timeDiff * _robotMovementSpeed;
+    if (glfwGetKey(_window, GLFW_KEY_RIGHT) == GLFW_PRESS)
+        lightDiff.x += timeDiff * _robotMovementSpeed;
+    if (glfwGetKey(_window, GLFW_KEY_UP) == GLFW_PRESS)
+        lightDiff.z -= timeDiff * _robotMovementSpeed;
+    if (glfwGetKey(_window, GLFW_KEY_DOWN) == GLFW_PRESS)
+        lightDiff.z += timeDiff * _robotMovementSpeed;
+    if (glfwGetKey(_window, GLFW_KEY_PAGE_UP) == GLFW_PRESS)
+        lightDiff.y += timeDiff * _robotMovementSpeed;
+    if (glfwGetKey(_window, GLFW_KEY_PAGE_DOWN) == GLFW_PRESS)
+        lightDiff.y -= timeDiff * _robotMovementSpeed;
+    _lightSource.position += glm::vec4(lightDiff, 0.0f);
+    
     // Head movement with z-x-c-v
     if (glfwGetKey(_window, GLFW_KEY_Z) == GLFW_PRESS)
         headHorizontalDiff += 45.0f * timeDiff;
@@ -284,12 +862,14 @@ void Application::updatePositions(float timeDiff) {
     zTrans = -torsoTranslationDiff * sinf(degreesToRadians(_robotOrientations.torsoHorizontal));
     
     // Update the torso model matrices
-    _scene["Torso"]->instance->transform.translate = glm::translate(glm::mat4(), glm::vec3(xTrans, 0.0f, zTrans)) * _scene["Torso"]->instance->transform.translate;
-    _scene["Torso"]->instance->transform.rotate = glm::rotate(glm::mat4(), _robotOrientations.torsoHorizontal, glm::vec3(0.0f, 1.0f, 0.0f));
+    ModelTransform torsoTransform = _scene.localTransform(_robotNodes.torso);
+    torsoTransform.translate = glm::translate(glm::mat4(), glm::vec3(xTrans, 0.0f, zTrans)) * torsoTransform.translate;
+    torsoTransform.rotate = glm::rotate(glm::mat4(), _robotOrientations.torsoHorizontal, glm::vec3(0.0f, 1.0f, 0.0f));
+    _scene.setLocalTransform(_robotNodes.torso, torsoTransform);
     
     // Update the head model matrices
-    _scene["Torso"]->children["Head"]->instance->transform.rotate = glm::rotate(glm::mat4(), _robotOrientations.headHorizontal, glm::vec3(0.0f, 1.0f, 0.0f));
-    _scene["Torso"]->children["Head"]->instance->transform.rotate *= glm::rotate(glm::mat4(), _robotOrientations.headVertical, glm::vec3(0.0f, 0.0f, 1.0f));
+    SetNodeRotation(_scene, _robotNodes.head, glm::rotate(glm::mat4(), _robotOrientations.headHorizontal, glm::vec3(0.0f, 1.0f, 0.0f)) *
+                                              glm::rotate(glm::mat4(), _robotOrientations.headVertical, glm::vec3(0.0f, 0.0f, 1.0f)));
     
     // If the camera is in robot POV, its position and orientation need to be updated as well
     if (_cameraInHead) {
@@ -298,10 +878,10 @@ void Application::updatePositions(float timeDiff) {
     }
     
     // Update the arms and wrists matrices
-    _scene["Torso"]->children["Left_Arm"]->instance->transform.rotate = glm::rotate(glm::mat4(), _robotOrientations.leftArmVertical, glm::vec3(0.0f, 0.0f, 1.0f));
-    _scene["Torso"]->children["Left_Arm"]->children["Left_Wrist"]->instance->transform.rotate = glm::rotate(glm::mat4(), _robotOrientations.leftWristVertical, glm::vec3(0.0f, 0.0f, 1.0f));
-    _scene["Torso"]->children["Right_Arm"]->instance->transform.rotate = glm::rotate(glm::mat4(), _robotOrientations.rightArmVertical, glm::vec3(0.0f, 0.0f, 1.0f));
-    _scene["Torso"]->children["Right_Arm"]->children["Right_Wrist"]->instance->transform.rotate = glm::rotate(glm::mat4(), _robotOrientations.rightWristVertical, glm::vec3(0.0f, 0.0f, 1.0f));
+    SetNodeRotation(_scene, _robotNodes.leftArm, glm::rotate(glm::mat4(), _robotOrientations.leftArmVertical, glm::vec3(0.0f, 0.0f, 1.0f)));
+    SetNodeRotation(_scene, _robotNodes.leftWrist, glm::rotate(glm::mat4(), _robotOrientations.leftWristVertical, glm::vec3(0.0f, 0.0f, 1.0f)));
+    SetNodeRotation(_scene, _robotNodes.rightArm, glm::rotate(glm::mat4(), _robotOrientations.rightArmVertical, glm::vec3(0.0f, 0.0f, 1.0f)));
+    SetNodeRotation(_scene, _robotNodes.rightWrist, glm::rotate(glm::mat4(), _robotOrientations.rightWristVertical, glm::vec3(0.0f, 0.0f, 1.0f)));
 }
 
 // The callback functions just grab the default instance and call the respective Impl function
@@ -313,6 +893,10 @@ void Application::glfwKeyCallback(GLFWwindow *window, int key, int scancode, int
     getInstance().glfwKeyCallbackImpl(window, key, scancode, action, mods);
 }
 
+void Application::glfwMouseButtonCallback(GLFWwindow *window, int button, int action, int mods) {
+    getInstance().glfwMouseButtonCallbackImpl(window, button, action, mods);
+}
+
 void Application::glfwFramebufferResizeCallback(GLFWwindow *window, int width, int height) {
     getInstance().glfwFramebufferResizeCallbackImpl(window, width, height);
 }
@@ -324,6 +908,17 @@ void Application::glfwErrorCallbackImpl(int error, const char *desc) {
 
 void Application::glfwFramebufferResizeCallbackImpl(GLFWwindow *window, int width, int height) {
     _camera.setViewportAspectRatio((float) width / (float) height);
+    
+    // A minimized window has no framebuffer to match
+    if (width > 0 && height > 0) {
+        _deferredRenderer->resize(width, height);
+        _dynamicResolution->resize(width, height);
+    }
+}
+
+void Application::glfwMouseButtonCallbackImpl(GLFWwindow *window, int button, int action, int mods) {
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+        pickAtViewCenter();
 }
 
 void Application::glfwKeyCallbackImpl(GLFWwindow *window, int key, int scancode, int action, int mods) {
@@ -333,7 +928,7 @@ void Application::glfwKeyCallbackImpl(GLFWwindow *window, int key, int scancode,
         
         if (_cameraInHead) {
             // Compute the head's model transformation
-            glm::mat4 transform = _scene["Torso"]->instance->transform.matrix() * _scene["Torso"]->children["Head"]->instance->transform.matrix();
+            glm::mat4 transform = _scene.localTransform(_robotNodes.torso).matrix() * _scene.localTransform(_robotNodes.head).matrix();
             
             // Reset camera
             _camera.setPosition(glm::vec3(0.0, 2.0, 0.0));
@@ -355,6 +950,72 @@ void Application::glfwKeyCallbackImpl(GLFWwindow *window, int key, int scancode,
     if (glfwGetKey(_window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(_window, GL_TRUE);
     
+    // Cycle through the texture filtering modes, to compare their cost
+    if (key == GLFW_KEY_F1 && action == GLFW_PRESS)
+        setTextureFiltering((Texture::Filtering) ((_textureFiltering + 1) % (Texture::Filtering_Anisotropic + 1)));
+    
+    // Cycle through no occlusion culling, GPU queries and the CPU depth buffer
+    if (key == GLFW_KEY_F3 && action == GLFW_PRESS) {
+        _occlusionMode = (OcclusionMode) ((_occlusionMode + 1) % (OcclusionMode_Software + 1));
+        _frameTimer->resetAverage();
+        _fragmentCounter->resetAverage();
+    }
+    
+    // Cycle through forward, clustered forward and deferred shading
+    if (key == GLFW_KEY_F4 && action == GLFW_PRESS) {
+        _renderPath = (RenderPath) ((_renderPath + 1) % (RenderPath_Deferred + 1));
+        _frameTimer->resetAverage();
+        _fragmentCounter->resetAverage();
+    }
+    
+    // Toggle the depth pre-pass, switch between scene order and front to back draws, and toggle the overdraw view
+    if (key == GLFW_KEY_F5 && action == GLFW_PRESS) {
+        _depthPrepass = !_depthPrepass;
+        _frameTimer->resetAverage();
+        _fragmentCounter->resetAverage();
+    }
+    if (key == GLFW_KEY_F6 && action == GLFW_PRESS) {
+        _drawOrder = (DrawOrder) ((_drawOrder + 1) % (DrawOrder_FrontToBack + 1));
+        _frameTimer->resetAverage();
+        _fragmentCounter->resetAverage();
+    }
+    if (key == GLFW_KEY_F7 && action == GLFW_PRESS) {
+        _showOverdraw = !_showOverdraw;
+        _frameTimer->resetAverage();
+        _fragmentCounter->resetAverage();
+    }
+    
+    // Toggle dynamic resolution, and lower/raise its GPU time budget by a millisecond
+    if (key == GLFW_KEY_F8 && action == GLFW_PRESS) {
+        _dynamicResolution->setEnabled(!_dynamicResolution->enabled());
+        _frameTimer->resetAverage();
+        _fragmentCounter->resetAverage();
+    }
+    if (key == GLFW_KEY_F9 && action == GLFW_PRESS)
+        _dynamicResolution->setBudget(std::max(_dynamicResolution->budget() - 1.0, 1.0));
+    if (key == GLFW_KEY_F10 && action == GLFW_PRESS)
+        _dynamicResolution->setBudget(_dynamicResolution->budget() + 1.0);
+    
+    // Halve/double the number of point lights
+    if (key == GLFW_KEY_MINUS && action == GLFW_PRESS) {
+        _pointLightCount /= 2;
+        _frameTimer->resetAverage();
+    }
+    if (key == GLFW_KEY_EQUAL && action == GLFW_PRESS) {
+        _pointLightCount = std::min(std::max(_pointLightCount * 2, 1u), MaxPointLights);
+        _frameTimer->resetAverage();
+    }
+    
+    // Toggle the head sensor
+    if (key == GLFW_KEY_F2 && action == GLFW_PRESS)
+        _headSensorEnabled = !_headSensorEnabled;
+    
+    // Toggle printing the frame statistics
+    if (key == GLFW_KEY_F12 && action == GLFW_PRESS) {
+        _printFrameStats = !_printFrameStats;
+        _frameTimer->resetAverage();
+    }
+    
     // Increase/decrease ambient light
     if (glfwGetKey(_window, GLFW_KEY_RIGHT_BRACKET) == GLFW_PRESS)
         _lightSource.ambientColor += 0.1;
@@ -390,6 +1051,7 @@ void Application::initGlfw(int width, int height) {
     glfwSetCursorPos(_window, 0, 0);
     glfwSetFramebufferSizeCallback(_window, &Application::glfwFramebufferResizeCallback);
     glfwSetKeyCallback(_window, &Application::glfwKeyCallback);
+    glfwSetMouseButtonCallback(_window, &Application::glfwMouseButtonCallback);
     glfwMakeContextCurrent(_window);
 }
 
@@ -438,4 +1100,31 @@ void Application::initLightSource(glm::vec3 position, glm::vec4 diffuseColor, gl
     _lightSource.specularColor = specularColor;
     _lightSource.ambientColor = ambientColor;
     _lightSource.attenuation = attenuation;
+}
+
+// A pseudo-random number in [0, 1), so the point lights come out the same on every run
+static float NextRandom(uint32_t& state) {
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) / 16777216.0f;
+}
+
+void Application::initPointLights() {
+    _pointLights.resize(MaxPointLights);
+    _pointLightAnchors.resize(MaxPointLights);
+    
+    uint32_t state = 1;
+    for (unsigned i = 0; i < MaxPointLights; ++i) {
+        // Anchors spread over the inside of the room, below the ceiling
+        _pointLightAnchors[i] = glm::vec4(-6.5f + 13.0f * NextRandom(state), 0.3f + 3.5f * NextRandom(state),
+                                          -5.0f + 10.0f * NextRandom(state), 6.2831853f * NextRandom(state));
+        
+        glm::vec4 color(0.2f + 0.8f * NextRandom(state), 0.2f + 0.8f * NextRandom(state), 0.2f + 0.8f * NextRandom(state), 1.0f);
+        Light& light = _pointLights[i];
+        light.diffuseColor = color;
+        light.specularColor = color;
+        light.attenuation = 0.5f;
+        light.radius = 1.5f + 1.5f * NextRandom(state);
+    }
+    
+    updatePointLights(0.0);
 }
\ No newline at end of file
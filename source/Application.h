@@ -16,7 +16,21 @@
 #include <GLFW/glfw3.h>
 
 #include "Model.h"
-#include "RenderNode.h"
+#include "Scene.h"
+#include "SceneBvh.h"
+#include "SceneFile.h"
+#include "RangeSensor.h"
+#include "FrameArena.h"
+#include "GpuTimer.h"
+#include "OcclusionCuller.h"
+#include "DepthRasterizer.h"
+#include "DynamicResolution.h"
+#include "FragmentCounter.h"
+#include "LightClusters.h"
+#include "DeferredRenderer.h"
+#include "ShadowMaps.h"
+#include "TextureResidency.h"
+#include "TextureStreamer.h"
 
 class Application {
 public:
@@ -24,12 +38,134 @@ public:
     static Application& getInstance();
     void startAppLoop();
 
+    // Runs frameCount frames after a warm-up and exits, counting the heap allocations made by the frame loop's CPU
+    // work. Returns true if there were none.
+    bool checkFrameAllocations(unsigned frameCount);
+    
+    // Captures the head sensor's image captureCount times with each instruction set and prints the ray throughput
+    void benchmarkHeadSensor(unsigned captureCount);
+    
+    // Runs frameCount frames on the forward path, then on the clustered and deferred paths with 1 to 1000 point lights,
+    // and prints the GPU frame time of each
+    void benchmarkLights(unsigned frameCount);
+
+    // Runs frameCount frames on each render path with every draw order, with and without the depth pre-pass, and
+    // prints the GPU frame time and the fragments shaded per pixel of each
+    void benchmarkOverdraw(unsigned frameCount);
+    
 private:
     GLFWwindow *_window;
     int _width, _height;
     
-    std::map<std::string, RenderNode *> _scene;
+    Scene _scene;
+    
+    // The robot's parts, which updatePositions moves every frame
+    struct RobotNodes {
+        NodeHandle torso;
+        NodeHandle head;
+        NodeHandle leftArm;
+        NodeHandle leftWrist;
+        NodeHandle rightArm;
+        NodeHandle rightWrist;
+        NodeHandle leftLeg;
+        NodeHandle rightLeg;
+    } _robotNodes;
+    
+    // Ray picks against the scene, refit whenever nodes move
+    SceneBvh _sceneBvh;
+    
+    // A range sensor in the robot's head, looking where the head looks. Captures every frame while enabled.
+    RangeSensor _headSensor;
+    bool _headSensorEnabled;
+    TextureLibrary *_textureLibrary;
+    TextureStreamer *_textureStreamer;
+    TextureResidency *_textureResidency;
 
+    // Per-frame temporaries, reset at the start of every frame
+    FrameArena _frameArena;
+    
+    // This frame's culling results: a flag per scene node, in the frame arena, and how many models were drawn or culled
+    unsigned char *_nodeVisibility;
+    unsigned _visibleModelCount, _culledModelCount, _boundsTestCount;
+    
+    // A draw call collected for the current frame. The matrices point into the scene's world transforms and normal
+    // matrices.
+    struct DrawPacket {
+        const Model *model;
+        const glm::mat4 *transform;
+        const glm::mat3 *normalMatrix;
+        unsigned node; /* Position in the scene */
+        float viewDepth; /* Of the center of the node's bounds, along the camera's forward direction */
+    };
+    
+    /* Overdraw control for the shading pass, which runs the expensive fragment shader. Draws go in scene order, or
+     * sorted front to back by view depth, so nearer models fill the depth buffer first and hide more of the farther
+     * ones' fragments. The depth pre-pass draws every model's depth first with a trivial shader, after which the
+     * shading pass only writes the fragments that end up on screen, testing with GL_EQUAL and depth writes off.
+     *
+     * The fragment counter counts the fragments the shading pass shades, and the overdraw view shows them per pixel,
+     * as a color that gets brighter with every fragment. */
+    enum DrawOrder {
+        DrawOrder_Scene,
+        DrawOrder_FrontToBack
+    };
+    
+    DrawOrder _drawOrder;
+    bool _depthPrepass;
+    bool _showOverdraw;
+    FragmentCounter *_fragmentCounter;
+    ShaderProgram *_depthPrepassProgram;
+    ShaderProgram *_overdrawProgram;
+    
+    // Renders the scene below the window's resolution when the GPU frame time goes over budget, and scales it up
+    DynamicResolution *_dynamicResolution;
+    
+    /* Occlusion culling, against the room and the furniture as occluders. With queries, the occluders are drawn first
+     * and the rest are queried against them, which hides nodes a frame late. The software mode rasterizes the occluders
+     * on the CPU while culling, and drops the nodes they hide from this frame's draws. */
+    enum OcclusionMode {
+        OcclusionMode_None,
+        OcclusionMode_Queries,
+        OcclusionMode_Software
+    };
+    
+    OcclusionCuller *_occlusionCuller;
+    DepthRasterizer _depthRasterizer;
+    std::vector<NodeHandle> _occluderNodes;
+    OcclusionMode _occlusionMode;
+    
+    // This frame's flag per scene node for whether it's an occluder, in the frame arena, and how many nodes the
+    // software mode hid
+    unsigned char *_nodeIsOccluder;
+    unsigned _softwareOccludedCount;
+    
+    /* Forward shading draws each model lit by the scene light. Clustered forward shading also lights each pixel with
+     * the point lights listed in its cluster of the view frustum. Deferred shading draws the models into a G-buffer,
+     * then adds the scene light and the point lights over it, so each light costs the pixels it covers rather than
+     * another pass over the models. Forward shading is the default; F4 and the benchmarks switch to the others. */
+    enum RenderPath {
+        RenderPath_Forward,
+        RenderPath_Clustered,
+        RenderPath_Deferred
+    };
+    
+    RenderPath _renderPath;
+    LightClusters *_lightClusters;
+    DeferredRenderer *_deferredRenderer;
+    
+    // Small colored lights circling around the room. The first _pointLightCount are on. Each circles its anchor, which
+    // holds the center in xyz and the phase in w.
+    std::vector<Light> _pointLights;
+    std::vector<glm::vec4> _pointLightAnchors;
+    unsigned _pointLightCount;
+
+    // Shadows of the scene light. The static nodes - the room and the furniture - are drawn into a map that's only
+    // redrawn when the light moves; the rest are drawn into a small map every frame. The flags are per scene node, in
+    // the frame arena.
+    ShadowMaps *_shadowMaps;
+    std::vector<NodeHandle> _staticNodes;
+    unsigned char *_nodeIsStatic;
+    
     float _robotMovementSpeed, _mouseSensitivity;
     
     struct Orientations {
@@ -56,14 +192,25 @@ private:
     
     bool _cameraInHead;
     
+    double _lastFrameTime;
+    
+    // Diagnostics
+    GpuTimer *_frameTimer;
+    unsigned long _frameAllocations; /* operator new calls during the last frame's CPU work */
+    bool _printFrameStats;
+    double _lastStatsTime;
+    Texture::Filtering _textureFiltering;
+    
     // Static functions that are attached as GLFW callbacks - these call the respective *Impl functions
     static void glfwErrorCallback(int error, const char *desc);
     static void glfwKeyCallback(GLFWwindow *window, int key, int scancode, int action, int mods);
+    static void glfwMouseButtonCallback(GLFWwindow *window, int button, int action, int mods);
     static void glfwFramebufferResizeCallback(GLFWwindow *window, int width, int height);
     
     // Callback implementations
     void glfwErrorCallbackImpl(int error, const char *desc);
     void glfwKeyCallbackImpl(GLFWwindow *window, int key, int scancode, int action, int mods);
+    void glfwMouseButtonCallbackImpl(GLFWwindow *window, int button, int action, int mods);
     void glfwFramebufferResizeCallbackImpl(GLFWwindow *window, int width, int height);
     
     // Initialization functions
@@ -71,16 +218,36 @@ private:
     void initOpenGL();
     void initCamera(glm::vec3 position, glm::vec3 lookAt, float nearPlane, float farPlane, float fov);
     void initLightSource(glm::vec3 position, glm::vec4 diffuseColor, glm::vec4 specularColor, glm::vec4 ambientColor, float attenuation);
+    void initPointLights();
     
     // Loading functions
     void createScene();
-    std::map<std::string, Model *> loadRobotModels();
-    std::map<std::string, Model *> loadFurnitureModels();
-    std::map<std::string, Model *> loadRoomModels();
+    std::vector<Model *> loadSceneModels(const SceneFile& sceneFile);
     
     // Rendering pipeline
+    void runFrame();
     void updatePositions(float timeDiff);
+    void updatePointLights(double time);
+    void cullScene();
+    void cullOccludedNodes();
+    void captureHeadSensor(BatchMath::InstructionSet instructionSet = PixelConversion::bestInstructionSet());
+    void updateTextureResidency();
+    void renderShadowMaps();
     void renderScene();
+    void drawDepthPrepass(const DrawPacket *packets, unsigned packetCount);
+    void drawWithOcclusionQueries(const DrawPacket *packets, unsigned packetCount, ModelDrawRun& drawRun);
+    void drawPacket(const DrawPacket& packet, ModelDrawRun& drawRun);
+    void printFrameStats(double currentTime);
+    
+    // The average fragments the fragment counter counted per frame, over the pixels rendered
+    double shadedFragmentsPerPixel() const;
+    void shutdown();
+    
+    // Applies the given filtering to every texture in the library
+    void setTextureFiltering(Texture::Filtering filtering);
+    
+    // Picks the model at the center of the view, and prints whether the robot's head can see the picked point
+    void pickAtViewCenter();
     
     // Private constructor, copy constructor and = operator to prevent init and copy
     Application();
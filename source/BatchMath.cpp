@@ -0,0 +1,411 @@
+//
+//  BatchMath.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 10/9/14.
+//
+//
+
+#include "BatchMath.h"
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BATCH_MATH_X86 1
+#include <immintrin.h>
+
+// Like PixelConversion's kernels, these are compiled for their instruction set regardless of the project-wide flags
+#define TARGET_SSE __attribute__((target("sse2")))
+#define TARGET_AVX __attribute__((target("avx")))
+#endif
+
+// The kernels read and write glm types as plain float arrays
+static_assert(sizeof(glm::mat4) == 16 * sizeof(float), "glm::mat4 must be 16 packed floats");
+static_assert(sizeof(glm::mat3) == 9 * sizeof(float), "glm::mat3 must be 9 packed floats");
+static_assert(sizeof(BoundingBox) == 6 * sizeof(float), "BoundingBox must be 6 packed floats");
+
+static void CheckInstructionSet(BatchMath::InstructionSet instructionSet) {
+    if (instructionSet > PixelConversion::bestInstructionSet())
+        throw std::runtime_error(std::string("CPU doesn't support ") + PixelConversion::instructionSetName(instructionSet));
+}
+
+// Scalar versions
+
+static BoundingBox TransformBox(const BoundingBox& box, const glm::mat4& transform) {
+    // Transform the center, and grow the extent by the absolute value of the rotation and scale (Arvo's method)
+    glm::vec3 center = (box.min + box.max) * 0.5f;
+    glm::vec3 extent = (box.max - box.min) * 0.5f;
+    
+    glm::vec3 newCenter = glm::vec3(transform[0]) * center.x + glm::vec3(transform[1]) * center.y +
+                          glm::vec3(transform[2]) * center.z + glm::vec3(transform[3]);
+    glm::vec3 newExtent = glm::abs(glm::vec3(transform[0])) * extent.x + glm::abs(glm::vec3(transform[1])) * extent.y +
+                          glm::abs(glm::vec3(transform[2])) * extent.z;
+    
+    BoundingBox result;
+    result.min = newCenter - newExtent;
+    result.max = newCenter + newExtent;
+    return result;
+}
+
+static bool SphereVisible(const glm::vec4& sphere, const glm::vec4 *planes) {
+    for (unsigned plane = 0; plane < 6; ++plane) {
+        const glm::vec4& p = planes[plane];
+        if (p.x * sphere.x + p.y * sphere.y + p.z * sphere.z + p.w < -sphere.w)
+            return false;
+    }
+    
+    return true;
+}
+
+#if BATCH_MATH_X86
+
+// SSE kernels
+
+// Each column of the product is the left columns weighted by a column of the right matrix. The left matrix is loaded
+// first and each right column is read before its output column is written, so out may be either input.
+TARGET_SSE static inline void MultiplySSE(const float *left, const float *right, float *out) {
+    __m128 l0 = _mm_loadu_ps(left), l1 = _mm_loadu_ps(left + 4), l2 = _mm_loadu_ps(left + 8), l3 = _mm_loadu_ps(left + 12);
+    
+    for (unsigned column = 0; column < 16; column += 4) {
+        __m128 sum = _mm_mul_ps(l0, _mm_set1_ps(right[column]));
+        sum = _mm_add_ps(sum, _mm_mul_ps(l1, _mm_set1_ps(right[column + 1])));
+        sum = _mm_add_ps(sum, _mm_mul_ps(l2, _mm_set1_ps(right[column + 2])));
+        sum = _mm_add_ps(sum, _mm_mul_ps(l3, _mm_set1_ps(right[column + 3])));
+        _mm_storeu_ps(out + column, sum);
+    }
+}
+
+TARGET_SSE static void MultiplyMatricesSSE(const glm::mat4 *left, const glm::mat4 *right, glm::mat4 *out, unsigned count) {
+    for (unsigned i = 0; i < count; ++i)
+        MultiplySSE(&left[i][0][0], &right[i][0][0], &out[i][0][0]);
+}
+
+TARGET_SSE static void MultiplyMatrixPointersSSE(const glm::mat4 *const *left, const glm::mat4 *const *right, glm::mat4 *const *out, unsigned count) {
+    for (unsigned i = 0; i < count; ++i)
+        MultiplySSE(&(*left[i])[0][0], &(*right[i])[0][0], &(*out[i])[0][0]);
+}
+
+// cross(a, b) in xyz, as (a * b.yzx - a.yzx * b).yzx
+TARGET_SSE static inline __m128 CrossSSE(__m128 a, __m128 b) {
+    __m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+// The inverse transpose of a 3x3 matrix with columns a, b, c has the columns b x c, c x a and a x b over the determinant
+TARGET_SSE static void NormalMatricesSSE(const glm::mat4 *transforms, glm::mat3 *out, unsigned count) {
+    for (unsigned i = 0; i < count; ++i) {
+        const float *m = &transforms[i][0][0];
+        __m128 a = _mm_loadu_ps(m), b = _mm_loadu_ps(m + 4), c = _mm_loadu_ps(m + 8);
+        
+        __m128 bc = CrossSSE(b, c), ca = CrossSSE(c, a), ab = CrossSSE(a, b);
+        
+        __m128 products = _mm_mul_ps(a, bc);
+        __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_shuffle_ps(products, products, 0x00), _mm_shuffle_ps(products, products, 0x55)),
+                                        _mm_shuffle_ps(products, products, 0xaa));
+        __m128 inverseDeterminant = _mm_div_ps(_mm_set1_ps(1.0f), determinant);
+        
+        // Each store spills one float into the next column, which the next store overwrites. The last column can't spill.
+        float *o = &out[i][0][0];
+        _mm_storeu_ps(o, _mm_mul_ps(bc, inverseDeterminant));
+        _mm_storeu_ps(o + 3, _mm_mul_ps(ca, inverseDeterminant));
+        __m128 column2 = _mm_mul_ps(ab, inverseDeterminant);
+        _mm_storel_pi((__m64 *) (o + 6), column2);
+        _mm_store_ss(o + 8, _mm_movehl_ps(column2, column2));
+    }
+}
+
+TARGET_SSE static void TransformBoxesSSE(const BoundingBox *boxes, const glm::mat4 *transforms, BoundingBox *out, unsigned count) {
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    
+    for (unsigned i = 0; i < count; ++i) {
+        // Load the corners as two overlapping vectors, so the last box isn't read past its end
+        const float *box = &boxes[i].min.x;
+        __m128 min = _mm_loadu_ps(box);
+        __m128 max = _mm_loadu_ps(box + 2);
+        max = _mm_shuffle_ps(max, max, _MM_SHUFFLE(3, 3, 2, 1));
+        
+        __m128 center = _mm_mul_ps(_mm_add_ps(min, max), half);
+        __m128 extent = _mm_mul_ps(_mm_sub_ps(max, min), half);
+        
+        const float *m = &transforms[i][0][0];
+        __m128 c0 = _mm_loadu_ps(m), c1 = _mm_loadu_ps(m + 4), c2 = _mm_loadu_ps(m + 8), c3 = _mm_loadu_ps(m + 12);
+        
+        __m128 newCenter = _mm_mul_ps(c0, _mm_shuffle_ps(center, center, 0x00));
+        newCenter = _mm_add_ps(newCenter, _mm_mul_ps(c1, _mm_shuffle_ps(center, center, 0x55)));
+        newCenter = _mm_add_ps(newCenter, _mm_mul_ps(c2, _mm_shuffle_ps(center, center, 0xaa)));
+        newCenter = _mm_add_ps(newCenter, c3);
+        
+        __m128 newExtent = _mm_mul_ps(_mm_and_ps(c0, absMask), _mm_shuffle_ps(extent, extent, 0x00));
+        newExtent = _mm_add_ps(newExtent, _mm_mul_ps(_mm_and_ps(c1, absMask), _mm_shuffle_ps(extent, extent, 0x55)));
+        newExtent = _mm_add_ps(newExtent, _mm_mul_ps(_mm_and_ps(c2, absMask), _mm_shuffle_ps(extent, extent, 0xaa)));
+        
+        __m128 newMin = _mm_sub_ps(newCenter, newExtent);
+        __m128 newMax = _mm_add_ps(newCenter, newExtent);
+        
+        // Store min over the first four floats, then (min.z, max) over the last four
+        float *o = &out[i].min.x;
+        __m128 tail = _mm_shuffle_ps(newMin, newMax, _MM_SHUFFLE(0, 0, 2, 2));
+        tail = _mm_shuffle_ps(tail, newMax, _MM_SHUFFLE(2, 1, 2, 0));
+        _mm_storeu_ps(o, newMin);
+        _mm_storeu_ps(o + 2, tail);
+    }
+}
+
+// Culled lanes of four spheres, given transposed centers and radii
+TARGET_SSE static inline int OutsideFrustumSSE(__m128 x, __m128 y, __m128 z, __m128 radius, const glm::vec4 *planes) {
+    __m128 negativeRadius = _mm_xor_ps(radius, _mm_set1_ps(-0.0f));
+    __m128 outside = _mm_setzero_ps();
+    
+    for (unsigned plane = 0; plane < 6; ++plane) {
+        const glm::vec4& p = planes[plane];
+        __m128 distance = _mm_mul_ps(_mm_set1_ps(p.x), x);
+        distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(p.y), y));
+        distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(p.z), z));
+        distance = _mm_add_ps(distance, _mm_set1_ps(p.w));
+        outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, negativeRadius));
+    }
+    
+    return _mm_movemask_ps(outside);
+}
+
+TARGET_SSE static void TestSpheresAgainstFrustumSSE(const glm::vec4 *spheres, unsigned count, const glm::vec4 *planes, unsigned char *visible) {
+    unsigned i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(&spheres[i].x), y = _mm_loadu_ps(&spheres[i + 1].x);
+        __m128 z = _mm_loadu_ps(&spheres[i + 2].x), radius = _mm_loadu_ps(&spheres[i + 3].x);
+        _MM_TRANSPOSE4_PS(x, y, z, radius);
+        
+        int outside = OutsideFrustumSSE(x, y, z, radius, planes);
+        for (unsigned lane = 0; lane < 4; ++lane)
+            visible[i + lane] = !((outside >> lane) & 1);
+    }
+    
+    for (; i < count; ++i)
+        visible[i] = SphereVisible(spheres[i], planes);
+}
+
+// AVX kernels. The 128-bit halves of each register hold separate matrices or columns, since AVX shuffles stay within
+// their half.
+
+// Two product columns at a time: each half of a right column pair is broadcast against the left columns
+TARGET_AVX static inline void MultiplyAVX(const float *left, const float *right, float *out) {
+    __m256 l0 = _mm256_broadcast_ps((const __m128 *) left), l1 = _mm256_broadcast_ps((const __m128 *) (left + 4));
+    __m256 l2 = _mm256_broadcast_ps((const __m128 *) (left + 8)), l3 = _mm256_broadcast_ps((const __m128 *) (left + 12));
+    
+    for (unsigned column = 0; column < 16; column += 8) {
+        __m256 r = _mm256_loadu_ps(right + column);
+        __m256 sum = _mm256_mul_ps(l0, _mm256_permute_ps(r, 0x00));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(l1, _mm256_permute_ps(r, 0x55)));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(l2, _mm256_permute_ps(r, 0xaa)));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(l3, _mm256_permute_ps(r, 0xff)));
+        _mm256_storeu_ps(out + column, sum);
+    }
+}
+
+TARGET_AVX static void MultiplyMatricesAVX(const glm::mat4 *left, const glm::mat4 *right, glm::mat4 *out, unsigned count) {
+    for (unsigned i = 0; i < count; ++i)
+        MultiplyAVX(&left[i][0][0], &right[i][0][0], &out[i][0][0]);
+}
+
+TARGET_AVX static void MultiplyMatrixPointersAVX(const glm::mat4 *const *left, const glm::mat4 *const *right, glm::mat4 *const *out, unsigned count) {
+    for (unsigned i = 0; i < count; ++i)
+        MultiplyAVX(&(*left[i])[0][0], &(*right[i])[0][0], &(*out[i])[0][0]);
+}
+
+TARGET_AVX static inline __m256 LoadPairAVX(const float *low, const float *high) {
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(low)), _mm_loadu_ps(high), 1);
+}
+
+TARGET_AVX static inline __m256 CrossAVX(__m256 a, __m256 b) {
+    __m256 aYZX = _mm256_permute_ps(a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m256 bYZX = _mm256_permute_ps(b, _MM_SHUFFLE(3, 0, 2, 1));
+    __m256 c = _mm256_sub_ps(_mm256_mul_ps(a, bYZX), _mm256_mul_ps(aYZX, b));
+    return _mm256_permute_ps(c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+// Stores the xyz of a 128-bit column at the end of a mat3
+TARGET_AVX static inline void StoreLastColumn(float *o, __m128 column) {
+    _mm_storel_pi((__m64 *) o, column);
+    _mm_store_ss(o + 2, _mm_movehl_ps(column, column));
+}
+
+TARGET_AVX static void NormalMatricesAVX(const glm::mat4 *transforms, glm::mat3 *out, unsigned count) {
+    unsigned i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const float *m0 = &transforms[i][0][0], *m1 = &transforms[i + 1][0][0];
+        __m256 a = LoadPairAVX(m0, m1), b = LoadPairAVX(m0 + 4, m1 + 4), c = LoadPairAVX(m0 + 8, m1 + 8);
+        
+        __m256 bc = CrossAVX(b, c), ca = CrossAVX(c, a), ab = CrossAVX(a, b);
+        
+        __m256 products = _mm256_mul_ps(a, bc);
+        __m256 determinant = _mm256_add_ps(_mm256_add_ps(_mm256_permute_ps(products, 0x00), _mm256_permute_ps(products, 0x55)),
+                                           _mm256_permute_ps(products, 0xaa));
+        __m256 inverseDeterminant = _mm256_div_ps(_mm256_set1_ps(1.0f), determinant);
+        
+        __m256 column0 = _mm256_mul_ps(bc, inverseDeterminant);
+        __m256 column1 = _mm256_mul_ps(ca, inverseDeterminant);
+        __m256 column2 = _mm256_mul_ps(ab, inverseDeterminant);
+        
+        float *o0 = &out[i][0][0], *o1 = &out[i + 1][0][0];
+        _mm_storeu_ps(o0, _mm256_castps256_ps128(column0));
+        _mm_storeu_ps(o0 + 3, _mm256_castps256_ps128(column1));
+        StoreLastColumn(o0 + 6, _mm256_castps256_ps128(column2));
+        _mm_storeu_ps(o1, _mm256_extractf128_ps(column0, 1));
+        _mm_storeu_ps(o1 + 3, _mm256_extractf128_ps(column1, 1));
+        StoreLastColumn(o1 + 6, _mm256_extractf128_ps(column2, 1));
+    }
+    
+    NormalMatricesSSE(transforms + i, out + i, count - i);
+}
+
+TARGET_AVX static void TransformBoxesAVX(const BoundingBox *boxes, const glm::mat4 *transforms, BoundingBox *out, unsigned count) {
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    
+    unsigned i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const float *box0 = &boxes[i].min.x, *box1 = &boxes[i + 1].min.x;
+        __m256 min = LoadPairAVX(box0, box1);
+        __m256 max = LoadPairAVX(box0 + 2, box1 + 2);
+        max = _mm256_permute_ps(max, _MM_SHUFFLE(3, 3, 2, 1));
+        
+        __m256 center = _mm256_mul_ps(_mm256_add_ps(min, max), half);
+        __m256 extent = _mm256_mul_ps(_mm256_sub_ps(max, min), half);
+        
+        const float *m0 = &transforms[i][0][0], *m1 = &transforms[i + 1][0][0];
+        __m256 c0 = LoadPairAVX(m0, m1), c1 = LoadPairAVX(m0 + 4, m1 + 4);
+        __m256 c2 = LoadPairAVX(m0 + 8, m1 + 8), c3 = LoadPairAVX(m0 + 12, m1 + 12);
+        
+        __m256 newCenter = _mm256_mul_ps(c0, _mm256_permute_ps(center, 0x00));
+        newCenter = _mm256_add_ps(newCenter, _mm256_mul_ps(c1, _mm256_permute_ps(center, 0x55)));
+        newCenter = _mm256_add_ps(newCenter, _mm256_mul_ps(c2, _mm256_permute_ps(center, 0xaa)));
+        newCenter = _mm256_add_ps(newCenter, c3);
+        
+        __m256 newExtent = _mm256_mul_ps(_mm256_and_ps(c0, absMask), _mm256_permute_ps(extent, 0x00));
+        newExtent = _mm256_add_ps(newExtent, _mm256_mul_ps(_mm256_and_ps(c1, absMask), _mm256_permute_ps(extent, 0x55)));
+        newExtent = _mm256_add_ps(newExtent, _mm256_mul_ps(_mm256_and_ps(c2, absMask), _mm256_permute_ps(extent, 0xaa)));
+        
+        __m256 newMin = _mm256_sub_ps(newCenter, newExtent);
+        __m256 newMax = _mm256_add_ps(newCenter, newExtent);
+        __m256 tail = _mm256_shuffle_ps(newMin, newMax, _MM_SHUFFLE(0, 0, 2, 2));
+        tail = _mm256_shuffle_ps(tail, newMax, _MM_SHUFFLE(2, 1, 2, 0));
+        
+        float *o0 = &out[i].min.x, *o1 = &out[i + 1].min.x;
+        _mm_storeu_ps(o0, _mm256_castps256_ps128(newMin));
+        _mm_storeu_ps(o0 + 2, _mm256_castps256_ps128(tail));
+        _mm_storeu_ps(o1, _mm256_extractf128_ps(newMin, 1));
+        _mm_storeu_ps(o1 + 2, _mm256_extractf128_ps(tail, 1));
+    }
+    
+    TransformBoxesSSE(boxes + i, transforms + i, out + i, count - i);
+}
+
+TARGET_AVX static void TestSpheresAgainstFrustumAVX(const glm::vec4 *spheres, unsigned count, const glm::vec4 *planes, unsigned char *visible) {
+    unsigned i = 0;
+    for (; i + 8 <= count; i += 8) {
+        // Spheres 0-3 go in the low halves and 4-7 in the high halves, then each half is transposed like _MM_TRANSPOSE4_PS
+        __m256 r0 = LoadPairAVX(&spheres[i].x, &spheres[i + 4].x), r1 = LoadPairAVX(&spheres[i + 1].x, &spheres[i + 5].x);
+        __m256 r2 = LoadPairAVX(&spheres[i + 2].x, &spheres[i + 6].x), r3 = LoadPairAVX(&spheres[i + 3].x, &spheres[i + 7].x);
+        __m256 t0 = _mm256_unpacklo_ps(r0, r1), t1 = _mm256_unpackhi_ps(r0, r1);
+        __m256 t2 = _mm256_unpacklo_ps(r2, r3), t3 = _mm256_unpackhi_ps(r2, r3);
+        __m256 x = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)), y = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 z = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)), radius = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        
+        __m256 negativeRadius = _mm256_xor_ps(radius, _mm256_set1_ps(-0.0f));
+        __m256 outside = _mm256_setzero_ps();
+        for (unsigned plane = 0; plane < 6; ++plane) {
+            const glm::vec4& p = planes[plane];
+            __m256 distance = _mm256_mul_ps(_mm256_set1_ps(p.x), x);
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(p.y), y));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(p.z), z));
+            distance = _mm256_add_ps(distance, _mm256_set1_ps(p.w));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(distance, negativeRadius, _CMP_LT_OQ));
+        }
+        
+        int mask = _mm256_movemask_ps(outside);
+        for (unsigned lane = 0; lane < 8; ++lane)
+            visible[i + lane] = !((mask >> lane) & 1);
+    }
+    
+    TestSpheresAgainstFrustumSSE(spheres + i, count - i, planes, visible + i);
+}
+
+#endif // BATCH_MATH_X86
+
+void BatchMath::multiplyMatrices(const glm::mat4 *left, const glm::mat4 *right, glm::mat4 *out, unsigned count, InstructionSet instructionSet) {
+    CheckInstructionSet(instructionSet);
+
+#if BATCH_MATH_X86
+    if (instructionSet >= PixelConversion::InstructionSet_AVX2)
+        return MultiplyMatricesAVX(left, right, out, count);
+    
+    if (instructionSet >= PixelConversion::InstructionSet_SSSE3)
+        return MultiplyMatricesSSE(left, right, out, count);
+#endif
+
+    for (unsigned i = 0; i < count; ++i)
+        out[i] = left[i] * right[i];
+}
+
+void BatchMath::multiplyMatrices(const glm::mat4 *const *left, const glm::mat4 *const *right, glm::mat4 *const *out, unsigned count, InstructionSet instructionSet) {
+    CheckInstructionSet(instructionSet);
+
+#if BATCH_MATH_X86
+    if (instructionSet >= PixelConversion::InstructionSet_AVX2)
+        return MultiplyMatrixPointersAVX(left, right, out, count);
+    
+    if (instructionSet >= PixelConversion::InstructionSet_SSSE3)
+        return MultiplyMatrixPointersSSE(left, right, out, count);
+#endif
+
+    for (unsigned i = 0; i < count; ++i)
+        *out[i] = *left[i] * *right[i];
+}
+
+void BatchMath::normalMatrices(const glm::mat4 *transforms, glm::mat3 *out, unsigned count, InstructionSet instructionSet) {
+    CheckInstructionSet(instructionSet);
+
+#if BATCH_MATH_X86
+    if (instructionSet >= PixelConversion::InstructionSet_AVX2)
+        return NormalMatricesAVX(transforms, out, count);
+    
+    if (instructionSet >= PixelConversion::InstructionSet_SSSE3)
+        return NormalMatricesSSE(transforms, out, count);
+#endif
+
+    for (unsigned i = 0; i < count; ++i)
+        out[i] = glm::transpose(glm::inverse(glm::mat3(transforms[i])));
+}
+
+void BatchMath::transformBoxes(const BoundingBox *boxes, const glm::mat4 *transforms, BoundingBox *out, unsigned count, InstructionSet instructionSet) {
+    CheckInstructionSet(instructionSet);
+
+#if BATCH_MATH_X86
+    if (instructionSet >= PixelConversion::InstructionSet_AVX2)
+        return TransformBoxesAVX(boxes, transforms, out, count);
+    
+    if (instructionSet >= PixelConversion::InstructionSet_SSSE3)
+        return TransformBoxesSSE(boxes, transforms, out, count);
+#endif
+
+    for (unsigned i = 0; i < count; ++i)
+        out[i] = TransformBox(boxes[i], transforms[i]);
+}
+
+void BatchMath::testSpheresAgainstFrustum(const glm::vec4 *spheres, unsigned count, const glm::vec4 *planes, unsigned char *visible, InstructionSet instructionSet) {
+    CheckInstructionSet(instructionSet);
+
+#if BATCH_MATH_X86
+    if (instructionSet >= PixelConversion::InstructionSet_AVX2)
+        return TestSpheresAgainstFrustumAVX(spheres, count, planes, visible);
+    
+    if (instructionSet >= PixelConversion::InstructionSet_SSSE3)
+        return TestSpheresAgainstFrustumSSE(spheres, count, planes, visible);
+#endif
+
+    for (unsigned i = 0; i < count; ++i)
+        visible[i] = SphereVisible(spheres[i], planes);
+}
@@ -0,0 +1,58 @@
+//
+//  BatchMath.h
+//  Robot
+//
+//  Created by Itamar Ravid on 10/9/14.
+//
+//
+
+#ifndef __Robot__BatchMath__
+#define __Robot__BatchMath__
+
+#include <glm/glm.hpp>
+
+#include "PixelConversion.h"
+
+// An axis-aligned box, as its minimum and maximum corners
+struct BoundingBox {
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+/* Transform and culling math over arrays, for the scene update and the culling pass. Every function has a scalar
+ * version written with glm, and SIMD versions picked at runtime the same way as PixelConversion's: the SSSE3 level
+ * runs 128-bit SSE kernels, the AVX2 level runs 256-bit AVX kernels. No kernel uses FMA, so the SIMD results are
+ * exactly the scalar ones, except for normal matrices: those use cofactors instead of glm::inverse, and can differ in
+ * the last bits.
+ *
+ * Output arrays may be the same as input arrays, but mustn't partially overlap them. */
+class BatchMath {
+public:
+    typedef PixelConversion::InstructionSet InstructionSet;
+    
+    // out[i] = left[i] * right[i]
+    static void multiplyMatrices(const glm::mat4 *left, const glm::mat4 *right, glm::mat4 *out, unsigned count,
+                                 InstructionSet instructionSet = PixelConversion::bestInstructionSet());
+    
+    // *out[i] = *left[i] * *right[i], for matrices scattered through other arrays
+    static void multiplyMatrices(const glm::mat4 *const *left, const glm::mat4 *const *right, glm::mat4 *const *out, unsigned count,
+                                 InstructionSet instructionSet = PixelConversion::bestInstructionSet());
+    
+    // out[i] = transpose(inverse(mat3(transforms[i]))), which transforms normals. The transforms must be invertible.
+    static void normalMatrices(const glm::mat4 *transforms, glm::mat3 *out, unsigned count,
+                               InstructionSet instructionSet = PixelConversion::bestInstructionSet());
+    
+    // out[i] is the box that bounds boxes[i] after it's transformed by the affine transforms[i]
+    static void transformBoxes(const BoundingBox *boxes, const glm::mat4 *transforms, BoundingBox *out, unsigned count,
+                               InstructionSet instructionSet = PixelConversion::bestInstructionSet());
+    
+    /* Tests spheres (center in xyz, radius in w) against six planes (normal in xyz, distance in w), whose normals
+     * point into the frustum. visible[i] is 1 unless the sphere is entirely behind one of the planes. */
+    static void testSpheresAgainstFrustum(const glm::vec4 *spheres, unsigned count, const glm::vec4 *planes, unsigned char *visible,
+                                          InstructionSet instructionSet = PixelConversion::bestInstructionSet());
+    
+private:
+    BatchMath();
+};
+
+#endif /* defined(__Robot__BatchMath__) */
@@ -7,7 +7,10 @@
 //
 
 #include "Bitmap.h"
+#include "BitmapTransforms.h"
+#include "PixelConversion.h"
 #include <stdexcept>
+#include <utility>
 
 #include <stdlib.h>
 
@@ -15,150 +18,26 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-inline unsigned char AverageRGB(unsigned char rgb[3]) {
-    return (unsigned char)(((double)rgb[0] + (double)rgb[1] + (double)rgb[2]) / 3.0);
-}
-
-static void Grayscale2GrayscaleAlpha(unsigned char* src, unsigned char* dest){
-    dest[0] = src[0];
-    dest[1] = 255;
-}
-
-static void Grayscale2RGB(unsigned char* src, unsigned char* dest){
-    dest[0] = src[0];
-    dest[1] = src[0];
-    dest[2] = src[0];
-}
-
-static void Grayscale2RGBA(unsigned char* src, unsigned char* dest){
-    dest[0] = src[0];
-    dest[1] = src[0];
-    dest[2] = src[0];
-    dest[3] = 255;
-}
-
-static void GrayscaleAlpha2Grayscale(unsigned char* src, unsigned char* dest){
-    dest[0] = src[0];
-}
-
-static void GrayscaleAlpha2RGB(unsigned char* src, unsigned char* dest){
-    dest[0] = src[0];
-    dest[1] = src[0];
-    dest[2] = src[0];
-}
-
-static void GrayscaleAlpha2RGBA(unsigned char* src, unsigned char* dest){
-    dest[0] = src[0];
-    dest[1] = src[0];
-    dest[2] = src[0];
-    dest[3] = src[1];
-}
-
-static void RGB2Grayscale(unsigned char* src, unsigned char* dest){
-    dest[0] = AverageRGB(src);
-}
-
-static void RGB2GrayscaleAlpha(unsigned char* src, unsigned char* dest){
-    dest[0] = AverageRGB(src);
-    dest[1] = 255;
-}
-
-static void RGB2RGBA(unsigned char* src, unsigned char* dest){
-    dest[0] = src[0];
-    dest[1] = src[1];
-    dest[2] = src[2];
-    dest[3] = 255;
-}
-
-static void RGBA2Grayscale(unsigned char* src, unsigned char* dest){
-    dest[0] = AverageRGB(src);
-}
-
-static void RGBA2GrayscaleAlpha(unsigned char* src, unsigned char* dest){
-    dest[0] = AverageRGB(src);
-    dest[1] = src[3];
-}
-
-static void RGBA2RGB(unsigned char* src, unsigned char* dest){
-    dest[0] = src[0];
-    dest[1] = src[1];
-    dest[2] = src[2];
-}
-
-typedef void(*FormatConverterFunc)(unsigned char*, unsigned char*);
-
-// Returns the appropriate conversion function (of those defined above) for converting between the given formats
-static FormatConverterFunc ConverterFuncForFormats(Bitmap::Format srcFormat, Bitmap::Format destFormat) {
-    if (srcFormat == destFormat)
-        throw std::runtime_error("Just use memcpy if pixel formats are the same");
-    
-    switch (srcFormat) {
-            
-        case Bitmap::Format_Grayscale:
-            switch (destFormat) {
-                case Bitmap::Format_GrayscaleAlpha: return Grayscale2GrayscaleAlpha;
-                case Bitmap::Format_RGB:            return Grayscale2RGB;
-                case Bitmap::Format_RGBA:           return Grayscale2RGBA;
-                default:
-                    throw std::runtime_error("Unhandled bitmap format");
-            }
-            break;
-            
-        case Bitmap::Format_GrayscaleAlpha:
-            switch (destFormat) {
-                case Bitmap::Format_Grayscale: return GrayscaleAlpha2Grayscale;
-                case Bitmap::Format_RGB:       return GrayscaleAlpha2RGB;
-                case Bitmap::Format_RGBA:      return GrayscaleAlpha2RGBA;
-                default:
-                    throw std::runtime_error("Unhandled bitmap format");
-            }
-            break;
-            
-        case Bitmap::Format_RGB:
-            switch (destFormat) {
-                case Bitmap::Format_Grayscale:      return RGB2Grayscale;
-                case Bitmap::Format_GrayscaleAlpha: return RGB2GrayscaleAlpha;
-                case Bitmap::Format_RGBA:           return RGB2RGBA;
-                default:
-                    throw std::runtime_error("Unhandled bitmap format");
-            }
-            break;
-            
-        case Bitmap::Format_RGBA:
-            switch (destFormat) {
-                case Bitmap::Format_Grayscale:      return RGBA2Grayscale;
-                case Bitmap::Format_GrayscaleAlpha: return RGBA2GrayscaleAlpha;
-                case Bitmap::Format_RGB:            return RGBA2RGB;
-                default:
-                    throw std::runtime_error("Unhandled bitmap format");
-            }
-            break;
-            
-        default:
-            throw std::runtime_error("Unhandled bitmap format");
-    }
-}
-
-// Returns the offset to the required pixel, taking the formats into account
-inline unsigned GetPixelOffset(unsigned col, unsigned row, unsigned width, unsigned height, Bitmap::Format format) {
-    return ((row * width) + col) * format;
+// Row stride of bitmaps that allocate their own pixels
+static unsigned AlignedStride(unsigned width, Bitmap::Format format) {
+    unsigned rowSize = width * format;
+    return (rowSize + Bitmap::RowAlignment - 1) / Bitmap::RowAlignment * Bitmap::RowAlignment;
 }
 
 // Checks if the two rectangles overlap
 inline bool RectsOverlap(unsigned srcCol, unsigned srcRow, unsigned destCol, unsigned destRow, unsigned width, unsigned height) {
     unsigned colDiff = srcCol > destCol ? srcCol - destCol : destCol - srcCol;
-    if (colDiff < width)
-        return true;
-    
     unsigned rowDiff = srcRow > destRow ? srcRow - destRow : destRow - srcRow;
-    if (rowDiff < height)
-        return true;
     
-    return false;
+    return colDiff < width && rowDiff < height;
 }
 
 Bitmap::Bitmap(unsigned width, unsigned height, Format format, const unsigned char *pixels) : _pixels(NULL) {
-    _set(width, height, format, pixels);
+    _set(width, height, format, pixels, width * format);
+}
+
+Bitmap::Bitmap(unsigned width, unsigned height, Format format, unsigned stride, unsigned char *adoptedPixels) :
+    _format(format), _width(width), _height(height), _stride(stride), _pixels(adoptedPixels) {
 }
 
 Bitmap::~Bitmap() {
@@ -173,17 +52,40 @@ Bitmap Bitmap::bitmapFromFile(std::string path) {
     if (!pixels)
         throw std::runtime_error(std::string("Error loading bitmap at path ") + path + ":\n" + std::string(stbi_failure_reason()));
     
-    Bitmap bmp(width, height, (Format) channels, pixels);
-    stbi_image_free(pixels);
-    return bmp;
+    // stb_image allocates with malloc, and its rows are tightly packed
+    return Bitmap(width, height, (Format) channels, width * channels, pixels);
 }
 
 Bitmap::Bitmap(const Bitmap& other) : _pixels(NULL) {
-    _set(other._width, other._height, other._format, other._pixels);
+    _set(other._width, other._height, other._format, other._pixels, other._stride);
 }
 
 Bitmap& Bitmap::operator = (const Bitmap& other) {
-    _set(other._width, other._height, other._format, other._pixels);
+    if (this != &other)
+        _set(other._width, other._height, other._format, other._pixels, other._stride);
+    return *this;
+}
+
+Bitmap::Bitmap(Bitmap&& other) :
+    _format(other._format), _width(other._width), _height(other._height), _stride(other._stride), _pixels(other._pixels) {
+    other._width = other._height = other._stride = 0;
+    other._pixels = NULL;
+}
+
+Bitmap& Bitmap::operator = (Bitmap&& other) {
+    if (this != &other) {
+        if (_pixels)
+            free(_pixels);
+        
+        _format = other._format;
+        _width = other._width;
+        _height = other._height;
+        _stride = other._stride;
+        _pixels = other._pixels;
+        
+        other._width = other._height = other._stride = 0;
+        other._pixels = NULL;
+    }
     return *this;
 }
 
@@ -199,15 +101,23 @@ Bitmap::Format Bitmap::format() const {
     return _format;
 }
 
+unsigned Bitmap::stride() const {
+    return _stride;
+}
+
 unsigned char *Bitmap::pixelBuffer() const {
     return _pixels;
 }
 
+unsigned char *Bitmap::rowBuffer(unsigned row) const {
+    return _pixels + (size_t) row * _stride;
+}
+
 unsigned char *Bitmap::getPixel(unsigned int column, unsigned int row) const {
     if (column >= _width || row >= _height)
         throw std::runtime_error("Pixel coordinate out of bounds");
     
-    return _pixels + GetPixelOffset(column, row, _width, _height, _format);
+    return rowBuffer(row) + column * _format;
 }
 
 void Bitmap::setPixel(unsigned int column, unsigned int row, const unsigned char *pixel) {
@@ -216,39 +126,13 @@ void Bitmap::setPixel(unsigned int column, unsigned int row, const unsigned char
 }
 
 void Bitmap::flipVertically() {
-    unsigned long rowSize = _format * _width;
-    unsigned char *rowBuffer = new unsigned char[rowSize];
-    unsigned halfRows = _height / 2;
-    
-    for (unsigned rowIdx = 0; rowIdx < halfRows; ++rowIdx) {
-        unsigned char *row = _pixels + GetPixelOffset(0, rowIdx, _width, _height, _format);
-        unsigned char *oppositeRow = _pixels + GetPixelOffset(0, _height - rowIdx - 1, _width, _height, _format);
-        
-        memcpy(rowBuffer, row, rowSize);
-        memcpy(row, oppositeRow, rowSize);
-        memcpy(oppositeRow, rowBuffer, rowSize);
-    }
-    
-    delete rowBuffer;
+    BitmapTransforms::flipVertically(*this);
 }
 
 void Bitmap::rotate90CounterClockwise() {
-    unsigned char *newPixels = (unsigned char *) malloc(_format * _width *_height);
-    
-    for (unsigned row = 0; row < _height; ++row) {
-        for (unsigned col = 0; col < _width; ++col) {
-            unsigned srcOffset = GetPixelOffset(col, row, _width, _height, _format);
-            unsigned destOffset = GetPixelOffset(row, _width - col - 1, _height, _width, _format);
-            memcpy(newPixels + destOffset, _pixels + srcOffset, _format);
-        }
-    }
-    
-    free(_pixels);
-    _pixels = newPixels;
+    Bitmap rotated = BitmapTransforms::rotate90CounterClockwise(*this);
     
-    unsigned swapTmp = _height;
-    _height = _width;
-    _width = swapTmp;
+    *this = std::move(rotated);
 }
 
 void Bitmap::copyRectFromBitmap(const Bitmap& src, unsigned srcCol, unsigned srcRow, unsigned destCol, unsigned destRow, unsigned width, unsigned height) {
@@ -260,34 +144,32 @@ void Bitmap::copyRectFromBitmap(const Bitmap& src, unsigned srcCol, unsigned src
     if (width == 0 || height == 0)
         throw std::runtime_error("Can't copy zero height/width rectangle");
     
-    if (srcCol + width >= src.width() || srcRow + height >= src.height())
+    if (srcCol + width > src.width() || srcRow + height > src.height())
         throw std::runtime_error("Rectangle doesn't fit within source bitmap");
     
-    if (destCol + width >= _width || destRow + height >= _height)
+    if (destCol + width > _width || destRow + height > _height)
         throw std::runtime_error("Rectangle doesn't fit within destination bitmap");
     
     if (_pixels == src._pixels && RectsOverlap(srcCol, srcRow, destCol, destRow, width, height))
         throw std::runtime_error("Source and destination are the same bitmap, and rects overlap. Not allowed!");
     
-    FormatConverterFunc converter = NULL;
+    PixelConversion::RowConverterFunc converter = NULL;
     if(_format != src._format)
-        converter = ConverterFuncForFormats(_format, src._format);
+        converter = PixelConversion::rowConverter(src._format, _format);
     
     for (unsigned row = 0; row < height; ++row) {
-        for (unsigned col = 0; col < width; ++col) {
-            unsigned char *srcPixel = src._pixels + GetPixelOffset(srcCol + col, srcRow + row, src._width, src._height, src._format);
-            unsigned char *destPixel = _pixels + GetPixelOffset(destCol + col, destRow + row, _width, _height, _format);
-            
-            if (converter) {
-                converter(srcPixel, destPixel);
-            } else {
-                memcpy(destPixel, srcPixel, _format);
-            }
+        unsigned char *srcPixels = src.rowBuffer(srcRow + row) + srcCol * src._format;
+        unsigned char *destPixels = rowBuffer(destRow + row) + destCol * _format;
+        
+        if (converter) {
+            converter(srcPixels, destPixels, width);
+        } else {
+            memcpy(destPixels, srcPixels, width * _format);
         }
     }
 }
 
-void Bitmap::_set(unsigned width, unsigned height, Format format, const unsigned char *pixels)
+void Bitmap::_set(unsigned width, unsigned height, Format format, const unsigned char *pixels, unsigned srcStride)
 {
     if (width == 0)
         throw std::runtime_error("Zero width bitmap");
@@ -301,13 +183,23 @@ void Bitmap::_set(unsigned width, unsigned height, Format format, const unsigned
     _width = width;
     _height = height;
     _format = format;
+    _stride = AlignedStride(width, format);
     
-    size_t newSize = _width * _height * _format;
+    size_t newSize = (size_t) _stride * _height;
     if (_pixels)
         _pixels = (unsigned char *) realloc(_pixels, newSize);
     else
         _pixels = (unsigned char *) malloc(newSize);
     
-    if (pixels)
-        memcpy(_pixels, pixels, newSize);
-}
\ No newline at end of file
+    if (!_pixels)
+        throw std::runtime_error("Out of memory allocating bitmap");
+    
+    if (pixels) {
+        if (srcStride == _stride) {
+            memcpy(_pixels, pixels, newSize);
+        } else {
+            for (unsigned row = 0; row < _height; ++row)
+                memcpy(rowBuffer(row), pixels + (size_t) row * srcStride, _width * _format);
+        }
+    }
+}
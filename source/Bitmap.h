@@ -12,7 +12,10 @@
 #include <string>
 
 
-// A wrapper for Bitmaps. Handles loading of image files using stb_image.h.
+/* A wrapper for Bitmaps. Handles loading of image files using stb_image.h.
+ *
+ * Rows are stride() bytes apart. Bitmaps loaded from files keep the decoder's tightly packed rows; all others pad
+ * their rows to a multiple of RowAlignment bytes, so they can be uploaded with the matching GL_UNPACK_ALIGNMENT. */
 class Bitmap {
 public:
     // Represents channels per pixel and channel order. Each channel is an unsigned char.
@@ -23,20 +26,29 @@ public:
         Format_RGBA /* Red/green/blue/alpha */
     };
     
-    // Creates a new Bitmap
+    // Row padding of bitmaps that allocate their own pixels. The largest alignment GL_UNPACK_ALIGNMENT accepts.
+    static const unsigned RowAlignment = 8;
+    
+    // Creates a new Bitmap. If pixels is given, it's copied and must have tightly packed rows.
     Bitmap(unsigned width, unsigned height, Format format, const unsigned char *pixels = nullptr);
     ~Bitmap();
     
-    // Loads a bitmap from a file
+    // Loads a bitmap from a file. The bitmap takes over the decoder's buffer instead of copying it.
     static Bitmap bitmapFromFile(std::string path);
     
     unsigned width() const;
     unsigned height() const;
     Format format() const;
     
-    // Returns a pointer to the raw pixel data. The pixels are saved in a column-major format.
+    // The distance in bytes between the starts of consecutive rows
+    unsigned stride() const;
+    
+    // Returns a pointer to the raw pixel data, stored row by row from the first row
     unsigned char *pixelBuffer() const;
     
+    // Returns a pointer to the first pixel of a row
+    unsigned char *rowBuffer(unsigned row) const;
+    
     // Returns a pointer to the pixel in the specified coordinates.
     unsigned char *getPixel(unsigned column, unsigned row) const;
     
@@ -76,14 +88,21 @@ public:
     // Assignment operator
     Bitmap& operator = (const Bitmap& other);
     
+    // Move constructor and assignment take over the other bitmap's pixels. The other bitmap is left empty.
+    Bitmap(Bitmap&& other);
+    Bitmap& operator = (Bitmap&& other);
+    
 private:
     Format _format;
     unsigned _width;
     unsigned _height;
+    unsigned _stride;
     unsigned char* _pixels;
     
-    void _set(unsigned width, unsigned height, Format format, const unsigned char* pixels);
-    static void _getPixelOffset(unsigned col, unsigned row, unsigned width, unsigned height, Format format);
+    // Takes ownership of a malloc'd buffer
+    Bitmap(unsigned width, unsigned height, Format format, unsigned stride, unsigned char *adoptedPixels);
+    
+    void _set(unsigned width, unsigned height, Format format, const unsigned char* pixels, unsigned srcStride);
 };
 
 #endif /* defined(__Robot__Bitmap__) */
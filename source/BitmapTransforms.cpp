@@ -0,0 +1,266 @@
+//
+//  BitmapTransforms.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 6/9/14.
+//
+//
+
+#include "BitmapTransforms.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "ThreadPool.h"
+
+/* Height of the source bands transposes work on. A band's source rows stay in L1 while it's walked column by column,
+ * and each column becomes at least one whole cache line of a destination row. */
+static const unsigned BandHeight = 64;
+
+// Roughly how many pixels each parallel task handles. Bitmaps smaller than this aren't split at all.
+static const unsigned PixelsPerTask = 256 * 1024;
+
+// Rows per parallel task for bands of the given width
+static unsigned RowsPerTask(unsigned width) {
+    return std::max(PixelsPerTask / std::max(width, 1u), 1u);
+}
+
+// A pixel of the given size, so copies compile to a single load and store
+template <unsigned PixelSize>
+struct Pixel {
+    unsigned char bytes[PixelSize];
+};
+
+/* Moves source pixel (x, y) of the rows [firstRow, endRow) to destination column y and row x, mirroring the
+ * destination rows and/or columns. */
+template <unsigned PixelSize>
+static void TransposeRows(const Bitmap& src, Bitmap& dest, unsigned firstRow, unsigned endRow, bool mirrorRows, bool mirrorCols) {
+    typedef Pixel<PixelSize> PixelType;
+    
+    // Strides needn't be a multiple of the pixel size, so step through the source in bytes
+    const unsigned char *srcPixels = src.pixelBuffer();
+    size_t srcStride = src.stride();
+    unsigned srcWidth = src.width(), srcHeight = src.height();
+    
+    for (unsigned x = 0; x < srcWidth; ++x) {
+        unsigned destRow = mirrorRows ? srcWidth - 1 - x : x;
+        PixelType *destRowPixels = (PixelType *) dest.rowBuffer(destRow);
+        const unsigned char *srcColumn = srcPixels + x * PixelSize;
+        
+        if (mirrorCols) {
+            for (unsigned y = firstRow; y < endRow; ++y)
+                destRowPixels[srcHeight - 1 - y] = *(const PixelType *) (srcColumn + y * srcStride);
+        } else {
+            for (unsigned y = firstRow; y < endRow; ++y)
+                destRowPixels[y] = *(const PixelType *) (srcColumn + y * srcStride);
+        }
+    }
+}
+
+static Bitmap Transpose(const Bitmap& src, bool mirrorRows, bool mirrorCols) {
+    Bitmap dest(src.height(), src.width(), src.format());
+    unsigned bandCount = (src.height() + BandHeight - 1) / BandHeight;
+    unsigned bandsPerTask = std::max(RowsPerTask(src.width()) / BandHeight, 1u);
+    
+    ThreadPool::shared().parallelFor(bandCount, bandsPerTask, [&](unsigned begin, unsigned end) {
+        for (unsigned band = begin; band < end; ++band) {
+            unsigned firstRow = band * BandHeight, endRow = std::min(firstRow + BandHeight, src.height());
+            
+            switch (src.format()) {
+                case Bitmap::Format_Grayscale:      TransposeRows<1>(src, dest, firstRow, endRow, mirrorRows, mirrorCols); break;
+                case Bitmap::Format_GrayscaleAlpha: TransposeRows<2>(src, dest, firstRow, endRow, mirrorRows, mirrorCols); break;
+                case Bitmap::Format_RGB:            TransposeRows<3>(src, dest, firstRow, endRow, mirrorRows, mirrorCols); break;
+                case Bitmap::Format_RGBA:           TransposeRows<4>(src, dest, firstRow, endRow, mirrorRows, mirrorCols); break;
+                default:
+                    throw std::runtime_error("Unhandled bitmap format");
+            }
+        }
+    });
+    
+    return dest;
+}
+
+// Filter kernels, as functions of the distance from the sample centre in source pixels (before widening)
+static float BoxKernel(float x) {
+    return (x >= -0.5f && x < 0.5f) ? 1.0f : 0.0f;
+}
+
+static float TentKernel(float x) {
+    x = std::fabs(x);
+    return x < 1.0f ? 1.0f - x : 0.0f;
+}
+
+static float Sinc(float x) {
+    if (x == 0.0f)
+        return 1.0f;
+    x *= (float) M_PI;
+    return std::sin(x) / x;
+}
+
+static float LanczosKernel(float x) {
+    return std::fabs(x) < 3.0f ? Sinc(x) * Sinc(x / 3.0f) : 0.0f;
+}
+
+static float FilterRadius(BitmapTransforms::Filter filter) {
+    switch (filter) {
+        case BitmapTransforms::Filter_Box:      return 0.5f;
+        case BitmapTransforms::Filter_Bilinear: return 1.0f;
+        case BitmapTransforms::Filter_Lanczos:  return 3.0f;
+        default:
+            throw std::runtime_error("Unhandled resize filter");
+    }
+}
+
+static float FilterWeight(BitmapTransforms::Filter filter, float x) {
+    switch (filter) {
+        case BitmapTransforms::Filter_Box:      return BoxKernel(x);
+        case BitmapTransforms::Filter_Bilinear: return TentKernel(x);
+        case BitmapTransforms::Filter_Lanczos:  return LanczosKernel(x);
+        default:
+            throw std::runtime_error("Unhandled resize filter");
+    }
+}
+
+/* The source pixels and weights that make up each destination pixel along one axis. Every destination pixel has the
+ * same number of taps, starting at first[i]; unused taps have zero weight. Weights are normalised to sum to 1. */
+struct Contributions {
+    unsigned taps;
+    std::vector<unsigned> first;
+    std::vector<float> weights; /* taps per destination pixel */
+};
+
+static Contributions ComputeContributions(unsigned srcSize, unsigned destSize, BitmapTransforms::Filter filter) {
+    float scale = (float) srcSize / destSize;
+    float filterScale = std::max(scale, 1.0f);
+    float support = FilterRadius(filter) * filterScale;
+    
+    Contributions contributions;
+    contributions.taps = std::min((unsigned) std::ceil(support * 2.0f) + 1, srcSize);
+    contributions.first.resize(destSize);
+    contributions.weights.assign((size_t) destSize * contributions.taps, 0.0f);
+    
+    for (unsigned i = 0; i < destSize; ++i) {
+        float center = (i + 0.5f) * scale;
+        int first = std::max((int) std::floor(center - support), 0);
+        first = std::min(first, (int) (srcSize - contributions.taps));
+        contributions.first[i] = (unsigned) first;
+        
+        float *weights = &contributions.weights[(size_t) i * contributions.taps];
+        float total = 0.0f;
+        for (unsigned tap = 0; tap < contributions.taps; ++tap) {
+            weights[tap] = FilterWeight(filter, (first + tap + 0.5f - center) / filterScale);
+            total += weights[tap];
+        }
+        
+        if (total != 0.0f) {
+            for (unsigned tap = 0; tap < contributions.taps; ++tap)
+                weights[tap] /= total;
+        } else {
+            // The filter fell between source pixels; use the nearest one
+            unsigned nearest = std::min((unsigned) center, srcSize - 1);
+            weights[nearest - first] = 1.0f;
+        }
+    }
+    
+    return contributions;
+}
+
+static inline unsigned char RoundToByte(float value) {
+    return (unsigned char) std::min(std::max(value + 0.5f, 0.0f), 255.0f);
+}
+
+void BitmapTransforms::flipVertically(Bitmap& bitmap) {
+    size_t rowSize = (size_t) bitmap.width() * bitmap.format();
+    unsigned height = bitmap.height();
+    
+    ThreadPool::shared().parallelFor(height / 2, RowsPerTask(bitmap.width()), [&](unsigned begin, unsigned end) {
+        for (unsigned row = begin; row < end; ++row) {
+            unsigned char *top = bitmap.rowBuffer(row);
+            std::swap_ranges(top, top + rowSize, bitmap.rowBuffer(height - 1 - row));
+        }
+    });
+}
+
+Bitmap BitmapTransforms::transpose(const Bitmap& bitmap) {
+    return Transpose(bitmap, false, false);
+}
+
+Bitmap BitmapTransforms::rotate90CounterClockwise(const Bitmap& bitmap) {
+    return Transpose(bitmap, true, false);
+}
+
+Bitmap BitmapTransforms::rotate90Clockwise(const Bitmap& bitmap) {
+    return Transpose(bitmap, false, true);
+}
+
+Bitmap BitmapTransforms::resize(const Bitmap& bitmap, unsigned width, unsigned height, Filter filter) {
+    Bitmap result(width, height, bitmap.format());
+    unsigned channels = bitmap.format(), srcWidth = bitmap.width(), srcHeight = bitmap.height();
+    
+    Contributions horizontal = ComputeContributions(srcWidth, width, filter);
+    Contributions vertical = ComputeContributions(srcHeight, height, filter);
+    
+    // Horizontal pass into floats, so the result is only rounded once
+    std::vector<float> intermediate((size_t) width * srcHeight * channels);
+    
+    ThreadPool::shared().parallelFor(srcHeight, RowsPerTask(srcWidth), [&](unsigned begin, unsigned end) {
+        for (unsigned row = begin; row < end; ++row) {
+            const unsigned char *srcRow = bitmap.rowBuffer(row);
+            float *destRow = &intermediate[(size_t) row * width * channels];
+            
+            for (unsigned col = 0; col < width; ++col) {
+                const float *weights = &horizontal.weights[(size_t) col * horizontal.taps];
+                const unsigned char *srcPixel = srcRow + horizontal.first[col] * channels;
+                float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                
+                for (unsigned tap = 0; tap < horizontal.taps; ++tap, srcPixel += channels) {
+                    for (unsigned c = 0; c < channels; ++c)
+                        sum[c] += srcPixel[c] * weights[tap];
+                }
+                
+                for (unsigned c = 0; c < channels; ++c)
+                    destRow[col * channels + c] = sum[c];
+            }
+        }
+    });
+    
+    // Vertical pass. Accumulating whole rows keeps the reads sequential.
+    size_t rowLength = (size_t) width * channels;
+    
+    ThreadPool::shared().parallelFor(height, RowsPerTask(width), [&](unsigned begin, unsigned end) {
+        std::vector<float> sum(rowLength);
+        
+        for (unsigned row = begin; row < end; ++row) {
+            const float *weights = &vertical.weights[(size_t) row * vertical.taps];
+            std::fill(sum.begin(), sum.end(), 0.0f);
+            
+            for (unsigned tap = 0; tap < vertical.taps; ++tap) {
+                if (weights[tap] == 0.0f)
+                    continue;
+                
+                const float *srcRow = &intermediate[(vertical.first[row] + tap) * rowLength];
+                for (size_t i = 0; i < rowLength; ++i)
+                    sum[i] += srcRow[i] * weights[tap];
+            }
+            
+            unsigned char *destRow = result.rowBuffer(row);
+            for (size_t i = 0; i < rowLength; ++i)
+                destRow[i] = RoundToByte(sum[i]);
+        }
+    });
+    
+    return result;
+}
+
+const char *BitmapTransforms::filterName(Filter filter) {
+    switch (filter) {
+        case Filter_Box:      return "box";
+        case Filter_Bilinear: return "bilinear";
+        case Filter_Lanczos:  return "Lanczos";
+        default:
+            throw std::runtime_error("Unhandled resize filter");
+    }
+}
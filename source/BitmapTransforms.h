@@ -0,0 +1,46 @@
+//
+//  BitmapTransforms.h
+//  Robot
+//
+//  Created by Itamar Ravid on 6/9/14.
+//
+//
+
+#ifndef __Robot__BitmapTransforms__
+#define __Robot__BitmapTransforms__
+
+#include "Bitmap.h"
+
+/* Geometric transforms and resampling for bitmaps of any format. Large bitmaps are split into bands of rows that run
+ * on ThreadPool::shared(); small ones run on the calling thread, and so do calls made from inside a loop on the shared
+ * pool, which is already busy. */
+class BitmapTransforms {
+public:
+    // Reconstruction filters for resize
+    enum Filter {
+        Filter_Box, /* Averages the covered source pixels. Nearest neighbour when enlarging */
+        Filter_Bilinear, /* Tent filter. Plain bilinear interpolation when enlarging */
+        Filter_Lanczos /* Lanczos-3. Sharpest, but rings slightly around hard edges */
+    };
+    
+    // Mirrors the rows in place, without allocating
+    static void flipVertically(Bitmap& bitmap);
+    
+    // Returns the bitmap mirrored about its main diagonal: pixel (col, row) moves to (row, col)
+    static Bitmap transpose(const Bitmap& bitmap);
+    
+    static Bitmap rotate90CounterClockwise(const Bitmap& bitmap);
+    static Bitmap rotate90Clockwise(const Bitmap& bitmap);
+    
+    /* Returns a copy of the bitmap resampled to the given dimensions with a separable filter. When shrinking, the
+     * filter is widened to cover every source pixel, so there's no aliasing. Channels are filtered as stored, without
+     * converting sRGB to linear. */
+    static Bitmap resize(const Bitmap& bitmap, unsigned width, unsigned height, Filter filter);
+    
+    static const char *filterName(Filter filter);
+    
+private:
+    BitmapTransforms();
+};
+
+#endif /* defined(__Robot__BitmapTransforms__) */
@@ -0,0 +1,483 @@
+//
+//  BlockCompression.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 3/9/14.
+//
+//
+
+#include "BlockCompression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+
+// A 4x4 block of pixels, expanded to RGBA
+typedef unsigned char BlockPixels[16][4];
+
+// Reads a pixel of any format as RGBA
+static inline void ReadRGBA(const Bitmap& bitmap, unsigned col, unsigned row, unsigned char *rgba) {
+    const unsigned char *pixel = bitmap.getPixel(col, row);
+    
+    switch (bitmap.format()) {
+        case Bitmap::Format_Grayscale:
+            rgba[0] = rgba[1] = rgba[2] = pixel[0];
+            rgba[3] = 255;
+            break;
+        case Bitmap::Format_GrayscaleAlpha:
+            rgba[0] = rgba[1] = rgba[2] = pixel[0];
+            rgba[3] = pixel[1];
+            break;
+        case Bitmap::Format_RGB:
+            rgba[0] = pixel[0];
+            rgba[1] = pixel[1];
+            rgba[2] = pixel[2];
+            rgba[3] = 255;
+            break;
+        case Bitmap::Format_RGBA:
+            rgba[0] = pixel[0];
+            rgba[1] = pixel[1];
+            rgba[2] = pixel[2];
+            rgba[3] = pixel[3];
+            break;
+        default:
+            throw std::runtime_error("Unhandled bitmap format");
+    }
+}
+
+// Gathers the block at the given block coordinates. Pixels outside the bitmap are clamped to the edge.
+static void ReadBlock(const Bitmap& bitmap, unsigned blockCol, unsigned blockRow, BlockPixels pixels) {
+    for (unsigned y = 0; y < 4; ++y) {
+        unsigned row = std::min(blockRow * 4 + y, bitmap.height() - 1);
+        for (unsigned x = 0; x < 4; ++x) {
+            unsigned col = std::min(blockCol * 4 + x, bitmap.width() - 1);
+            ReadRGBA(bitmap, col, row, pixels[y * 4 + x]);
+        }
+    }
+}
+
+static inline int ClampInt(int value, int min, int max) {
+    return value < min ? min : (value > max ? max : value);
+}
+
+static inline unsigned short PackRGB565(const float *rgb) {
+    int r = ClampInt((int) (rgb[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+    int g = ClampInt((int) (rgb[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+    int b = ClampInt((int) (rgb[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+    
+    return (unsigned short) ((r << 11) | (g << 5) | b);
+}
+
+// Expands a 565 colour to 8 bits per channel by bit replication, like the hardware does
+static inline void UnpackRGB565(unsigned short color, int *rgb) {
+    int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+// Builds the 4 entry colour palette of a block. The 3 colour mode (color0 <= color1) only exists in BC1.
+static void BuildColorPalette(unsigned short color0, unsigned short color1, bool allowThreeColorMode, int palette[4][3]) {
+    UnpackRGB565(color0, palette[0]);
+    UnpackRGB565(color1, palette[1]);
+    
+    bool fourColorMode = !allowThreeColorMode || color0 > color1;
+    for (unsigned c = 0; c < 3; ++c) {
+        if (fourColorMode) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        } else {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+    }
+}
+
+static inline unsigned ColorDistance(const unsigned char *pixel, const int *color) {
+    int dr = pixel[0] - color[0], dg = pixel[1] - color[1], db = pixel[2] - color[2];
+    return (unsigned) (dr * dr + dg * dg + db * db);
+}
+
+/* Picks the nearest palette entry for every pixel, using the 4 colour mode. Swaps the endpoints if needed so that
+ * color0 > color1, which is how the 4 colour mode is signalled. Returns the squared error of the block. */
+static unsigned FitColorIndices(const BlockPixels pixels, unsigned short& color0, unsigned short& color1, unsigned& indices) {
+    if (color0 < color1)
+        std::swap(color0, color1);
+    
+    int palette[4][3];
+    BuildColorPalette(color0, color1, false, palette);
+    
+    indices = 0;
+    unsigned error = 0;
+    
+    // Equal endpoints can't signal the 4 colour mode, so only use the first entry - it decodes the same in both modes
+    unsigned paletteSize = color0 == color1 ? 1 : 4;
+    
+    for (unsigned i = 0; i < 16; ++i) {
+        unsigned bestIndex = 0, bestDistance = ColorDistance(pixels[i], palette[0]);
+        for (unsigned p = 1; p < paletteSize; ++p) {
+            unsigned distance = ColorDistance(pixels[i], palette[p]);
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                bestIndex = p;
+            }
+        }
+        
+        indices |= bestIndex << (2 * i);
+        error += bestDistance;
+    }
+    
+    return error;
+}
+
+// Solves for the endpoints that best fit the pixels with the given indices, in the least-squares sense
+static bool RefineColorEndpoints(const BlockPixels pixels, unsigned indices, float *end0, float *end1) {
+    // The weight of color0 for each palette entry
+    static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+    
+    float alpha2 = 0.0f, beta2 = 0.0f, alphaBeta = 0.0f;
+    float alphaX[3] = { 0.0f, 0.0f, 0.0f }, betaX[3] = { 0.0f, 0.0f, 0.0f };
+    
+    for (unsigned i = 0; i < 16; ++i) {
+        float alpha = weights[(indices >> (2 * i)) & 3];
+        float beta = 1.0f - alpha;
+        
+        alpha2 += alpha * alpha;
+        beta2 += beta * beta;
+        alphaBeta += alpha * beta;
+        
+        for (unsigned c = 0; c < 3; ++c) {
+            alphaX[c] += alpha * pixels[i][c];
+            betaX[c] += beta * pixels[i][c];
+        }
+    }
+    
+    float determinant = alpha2 * beta2 - alphaBeta * alphaBeta;
+    if (fabsf(determinant) < 1e-6f)
+        return false;
+    
+    for (unsigned c = 0; c < 3; ++c) {
+        end0[c] = (alphaX[c] * beta2 - betaX[c] * alphaBeta) / determinant;
+        end1[c] = (betaX[c] * alpha2 - alphaX[c] * alphaBeta) / determinant;
+    }
+    
+    return true;
+}
+
+static void WriteColorBlock(unsigned char *out, unsigned short color0, unsigned short color1, unsigned indices) {
+    out[0] = (unsigned char) (color0 & 0xff);
+    out[1] = (unsigned char) (color0 >> 8);
+    out[2] = (unsigned char) (color1 & 0xff);
+    out[3] = (unsigned char) (color1 >> 8);
+    out[4] = (unsigned char) (indices & 0xff);
+    out[5] = (unsigned char) ((indices >> 8) & 0xff);
+    out[6] = (unsigned char) ((indices >> 16) & 0xff);
+    out[7] = (unsigned char) (indices >> 24);
+}
+
+/* Encodes the colour part of a block. The endpoints are initially placed along the principal axis of the block's
+ * colours, at the extremes of the pixels' projections on it, and are then refined once by least squares. */
+static void EncodeColorBlock(const BlockPixels pixels, unsigned char *out) {
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (unsigned i = 0; i < 16; ++i)
+        for (unsigned c = 0; c < 3; ++c)
+            mean[c] += pixels[i][c];
+    for (unsigned c = 0; c < 3; ++c)
+        mean[c] /= 16.0f;
+    
+    // Covariance matrix (symmetric, so only 6 entries are needed)
+    float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    for (unsigned i = 0; i < 16; ++i) {
+        float r = pixels[i][0] - mean[0], g = pixels[i][1] - mean[1], b = pixels[i][2] - mean[2];
+        cov[0] += r * r;
+        cov[1] += r * g;
+        cov[2] += r * b;
+        cov[3] += g * g;
+        cov[4] += g * b;
+        cov[5] += b * b;
+    }
+    
+    // Principal axis by power iteration
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (unsigned iteration = 0; iteration < 8; ++iteration) {
+        float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+        float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+        float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+        
+        float length = sqrtf(x * x + y * y + z * z);
+        if (length < 1e-6f)
+            break;
+        
+        axis[0] = x / length;
+        axis[1] = y / length;
+        axis[2] = z / length;
+    }
+    
+    float minProjection = std::numeric_limits<float>::max(), maxProjection = -std::numeric_limits<float>::max();
+    for (unsigned i = 0; i < 16; ++i) {
+        float projection = (pixels[i][0] - mean[0]) * axis[0] + (pixels[i][1] - mean[1]) * axis[1] + (pixels[i][2] - mean[2]) * axis[2];
+        minProjection = std::min(minProjection, projection);
+        maxProjection = std::max(maxProjection, projection);
+    }
+    
+    float end0[3], end1[3];
+    for (unsigned c = 0; c < 3; ++c) {
+        end0[c] = mean[c] + axis[c] * maxProjection;
+        end1[c] = mean[c] + axis[c] * minProjection;
+    }
+    
+    unsigned short color0 = PackRGB565(end0), color1 = PackRGB565(end1);
+    unsigned indices;
+    unsigned error = FitColorIndices(pixels, color0, color1, indices);
+    
+    if (error > 0 && RefineColorEndpoints(pixels, indices, end0, end1)) {
+        unsigned short refinedColor0 = PackRGB565(end0), refinedColor1 = PackRGB565(end1);
+        unsigned refinedIndices;
+        unsigned refinedError = FitColorIndices(pixels, refinedColor0, refinedColor1, refinedIndices);
+        
+        if (refinedError < error) {
+            color0 = refinedColor0;
+            color1 = refinedColor1;
+            indices = refinedIndices;
+        }
+    }
+    
+    WriteColorBlock(out, color0, color1, indices);
+}
+
+// Builds the 8 entry alpha palette of a BC3 block
+static void BuildAlphaPalette(int alpha0, int alpha1, int palette[8]) {
+    palette[0] = alpha0;
+    palette[1] = alpha1;
+    
+    if (alpha0 > alpha1) {
+        for (int i = 1; i < 7; ++i)
+            palette[i + 1] = ((7 - i) * alpha0 + i * alpha1) / 7;
+    } else {
+        for (int i = 1; i < 5; ++i)
+            palette[i + 1] = ((5 - i) * alpha0 + i * alpha1) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+// Encodes the alpha part of a BC3 block, using the block's alpha range as endpoints
+static void EncodeAlphaBlock(const BlockPixels pixels, unsigned char *out) {
+    int minAlpha = 255, maxAlpha = 0;
+    for (unsigned i = 0; i < 16; ++i) {
+        minAlpha = std::min(minAlpha, (int) pixels[i][3]);
+        maxAlpha = std::max(maxAlpha, (int) pixels[i][3]);
+    }
+    
+    out[0] = (unsigned char) maxAlpha;
+    out[1] = (unsigned char) minAlpha;
+    
+    // 16 3-bit indices
+    unsigned long long indices = 0;
+    if (maxAlpha != minAlpha) {
+        int palette[8];
+        BuildAlphaPalette(maxAlpha, minAlpha, palette);
+        
+        for (unsigned i = 0; i < 16; ++i) {
+            unsigned bestIndex = 0;
+            int bestDistance = 256;
+            for (unsigned p = 0; p < 8; ++p) {
+                int distance = abs(pixels[i][3] - palette[p]);
+                if (distance < bestDistance) {
+                    bestDistance = distance;
+                    bestIndex = p;
+                }
+            }
+            
+            indices |= (unsigned long long) bestIndex << (3 * i);
+        }
+    }
+    
+    for (unsigned b = 0; b < 6; ++b)
+        out[2 + b] = (unsigned char) ((indices >> (8 * b)) & 0xff);
+}
+
+static void DecodeColorBlock(const unsigned char *block, bool allowThreeColorMode, BlockPixels pixels) {
+    unsigned short color0 = (unsigned short) (block[0] | (block[1] << 8));
+    unsigned short color1 = (unsigned short) (block[2] | (block[3] << 8));
+    unsigned indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((unsigned) block[7] << 24);
+    
+    int palette[4][3];
+    BuildColorPalette(color0, color1, allowThreeColorMode, palette);
+    
+    bool threeColorMode = allowThreeColorMode && color0 <= color1;
+    for (unsigned i = 0; i < 16; ++i) {
+        unsigned index = (indices >> (2 * i)) & 3;
+        for (unsigned c = 0; c < 3; ++c)
+            pixels[i][c] = (unsigned char) palette[index][c];
+        
+        // Index 3 is transparent black in the 3 colour mode
+        pixels[i][3] = (threeColorMode && index == 3) ? 0 : 255;
+    }
+}
+
+static void DecodeAlphaBlock(const unsigned char *block, BlockPixels pixels) {
+    int palette[8];
+    BuildAlphaPalette(block[0], block[1], palette);
+    
+    unsigned long long indices = 0;
+    for (unsigned b = 0; b < 6; ++b)
+        indices |= (unsigned long long) block[2 + b] << (8 * b);
+    
+    for (unsigned i = 0; i < 16; ++i)
+        pixels[i][3] = (unsigned char) palette[(indices >> (3 * i)) & 7];
+}
+
+// sRGB <-> linear conversions for the mip downsampler
+static float SrgbToLinear(unsigned char value) {
+    static float table[256];
+    static bool tableReady = false;
+    
+    if (!tableReady) {
+        for (unsigned i = 0; i < 256; ++i) {
+            float c = i / 255.0f;
+            table[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+        }
+        tableReady = true;
+    }
+    
+    return table[value];
+}
+
+static unsigned char LinearToSrgb(float value) {
+    float c = value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+    return (unsigned char) ClampInt((int) (c * 255.0f + 0.5f), 0, 255);
+}
+
+unsigned BlockCompression::blockSize(Format format) {
+    switch (format) {
+        case Format_BC1: return 8;
+        case Format_BC3: return 16;
+        default: throw std::runtime_error("Unrecognised BlockCompression::Format");
+    }
+}
+
+unsigned BlockCompression::compressedSize(unsigned width, unsigned height, Format format) {
+    return ((width + 3) / 4) * ((height + 3) / 4) * blockSize(format);
+}
+
+std::vector<unsigned char> BlockCompression::compress(const Bitmap& bitmap, Format format) {
+    unsigned blocksX = (bitmap.width() + 3) / 4, blocksY = (bitmap.height() + 3) / 4;
+    unsigned size = blockSize(format);
+    
+    std::vector<unsigned char> blocks(blocksX * blocksY * size);
+    BlockPixels pixels;
+    
+    for (unsigned blockRow = 0; blockRow < blocksY; ++blockRow) {
+        for (unsigned blockCol = 0; blockCol < blocksX; ++blockCol) {
+            unsigned char *out = &blocks[(blockRow * blocksX + blockCol) * size];
+            ReadBlock(bitmap, blockCol, blockRow, pixels);
+            
+            if (format == Format_BC3) {
+                EncodeAlphaBlock(pixels, out);
+                out += 8;
+            }
+            
+            EncodeColorBlock(pixels, out);
+        }
+    }
+    
+    return blocks;
+}
+
+Bitmap BlockCompression::decompress(const unsigned char *blocks, unsigned width, unsigned height, Format format) {
+    Bitmap bitmap(width, height, Bitmap::Format_RGBA);
+    unsigned blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    unsigned size = blockSize(format);
+    BlockPixels pixels;
+    
+    for (unsigned blockRow = 0; blockRow < blocksY; ++blockRow) {
+        for (unsigned blockCol = 0; blockCol < blocksX; ++blockCol) {
+            const unsigned char *block = blocks + (blockRow * blocksX + blockCol) * size;
+            
+            if (format == Format_BC3) {
+                DecodeColorBlock(block + 8, false, pixels);
+                DecodeAlphaBlock(block, pixels);
+            } else {
+                DecodeColorBlock(block, true, pixels);
+            }
+            
+            for (unsigned y = 0; y < 4 && blockRow * 4 + y < height; ++y)
+                for (unsigned x = 0; x < 4 && blockCol * 4 + x < width; ++x)
+                    bitmap.setPixel(blockCol * 4 + x, blockRow * 4 + y, pixels[y * 4 + x]);
+        }
+    }
+    
+    return bitmap;
+}
+
+Bitmap BlockCompression::downsample(const Bitmap& bitmap) {
+    unsigned width = std::max(bitmap.width() / 2, 1u), height = std::max(bitmap.height() / 2, 1u);
+    unsigned channels = bitmap.format();
+    
+    // Grayscale+alpha and RGBA keep alpha in their last channel
+    bool hasAlpha = bitmap.format() == Bitmap::Format_GrayscaleAlpha || bitmap.format() == Bitmap::Format_RGBA;
+    unsigned colorChannels = hasAlpha ? channels - 1 : channels;
+    
+    Bitmap result(width, height, bitmap.format());
+    unsigned char pixel[4];
+    
+    for (unsigned row = 0; row < height; ++row) {
+        unsigned srcRow0 = std::min(row * 2, bitmap.height() - 1), srcRow1 = std::min(row * 2 + 1, bitmap.height() - 1);
+        for (unsigned col = 0; col < width; ++col) {
+            unsigned srcCol0 = std::min(col * 2, bitmap.width() - 1), srcCol1 = std::min(col * 2 + 1, bitmap.width() - 1);
+            
+            const unsigned char *sources[4] = {
+                bitmap.getPixel(srcCol0, srcRow0), bitmap.getPixel(srcCol1, srcRow0),
+                bitmap.getPixel(srcCol0, srcRow1), bitmap.getPixel(srcCol1, srcRow1)
+            };
+            
+            for (unsigned c = 0; c < colorChannels; ++c) {
+                float sum = 0.0f;
+                for (unsigned s = 0; s < 4; ++s)
+                    sum += SrgbToLinear(sources[s][c]);
+                pixel[c] = LinearToSrgb(sum / 4.0f);
+            }
+            
+            if (hasAlpha) {
+                unsigned sum = 0;
+                for (unsigned s = 0; s < 4; ++s)
+                    sum += sources[s][colorChannels];
+                pixel[colorChannels] = (unsigned char) ((sum + 2) / 4);
+            }
+            
+            result.setPixel(col, row, pixel);
+        }
+    }
+    
+    return result;
+}
+
+double BlockCompression::psnr(const Bitmap& reference, const Bitmap& compared, bool includeAlpha) {
+    if (reference.width() != compared.width() || reference.height() != compared.height())
+        throw std::runtime_error("Can't compare bitmaps of different dimensions");
+    
+    unsigned channels = includeAlpha ? 4 : 3;
+    double squaredError = 0.0;
+    unsigned char referencePixel[4], comparedPixel[4];
+    
+    for (unsigned row = 0; row < reference.height(); ++row) {
+        for (unsigned col = 0; col < reference.width(); ++col) {
+            ReadRGBA(reference, col, row, referencePixel);
+            ReadRGBA(compared, col, row, comparedPixel);
+            
+            for (unsigned c = 0; c < channels; ++c) {
+                double diff = (double) referencePixel[c] - (double) comparedPixel[c];
+                squaredError += diff * diff;
+            }
+        }
+    }
+    
+    double meanSquaredError = squaredError / ((double) reference.width() * reference.height() * channels);
+    if (meanSquaredError == 0.0)
+        return std::numeric_limits<double>::infinity();
+    
+    return 10.0 * log10(255.0 * 255.0 / meanSquaredError);
+}
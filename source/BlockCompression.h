@@ -0,0 +1,49 @@
+//
+//  BlockCompression.h
+//  Robot
+//
+//  Created by Itamar Ravid on 3/9/14.
+//
+//
+
+#ifndef __Robot__BlockCompression__
+#define __Robot__BlockCompression__
+
+#include <vector>
+
+#include "Bitmap.h"
+
+// CPU encoder/decoder for the S3TC block compressed formats. Used as an asset-build step, so the application
+// can upload pre-compressed textures instead of decoding JPEGs at startup.
+class BlockCompression {
+public:
+    enum Format {
+        Format_BC1, /* DXT1 - 4x4 RGB blocks in 8 bytes (4 bits per texel) */
+        Format_BC3 /* DXT5 - 4x4 RGBA blocks in 16 bytes: BC1 colour plus an interpolated alpha block */
+    };
+    
+    // Size in bytes of one 4x4 block
+    static unsigned blockSize(Format format);
+    
+    // Size in bytes of an image with the given dimensions. Partial blocks at the edges take up a whole block.
+    static unsigned compressedSize(unsigned width, unsigned height, Format format);
+    
+    // Compresses a bitmap of any format. Pixels are expanded to RGBA; edge blocks are padded by clamping.
+    static std::vector<unsigned char> compress(const Bitmap& bitmap, Format format);
+    
+    // Decompresses block data back to an RGBA bitmap. Used to measure the encoder's quality.
+    static Bitmap decompress(const unsigned char *blocks, unsigned width, unsigned height, Format format);
+    
+    /* Returns a half-size copy of the bitmap for building mip chains, using a 2x2 box filter. Colour channels are
+     * averaged in linear space (the bitmaps hold sRGB data), alpha is averaged as is. */
+    static Bitmap downsample(const Bitmap& bitmap);
+    
+    /* Returns the peak signal-to-noise ratio between two bitmaps of the same dimensions, in dB. Only the RGB
+     * channels are compared unless includeAlpha is set. Returns +infinity for identical bitmaps. */
+    static double psnr(const Bitmap& reference, const Bitmap& compared, bool includeAlpha = false);
+    
+private:
+    BlockCompression();
+};
+
+#endif /* defined(__Robot__BlockCompression__) */
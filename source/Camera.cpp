@@ -24,8 +24,11 @@ _verticalAngle(0.0f),
 _fieldOfView(50.0f),
 _nearPlane(0.01f),
 _farPlane(100.0f),
-_viewportAspectRatio(4.0f/3.0f) {
-    
+_viewportAspectRatio(4.0f/3.0f),
+_rotation(),
+_viewDirty(true),
+_projectionDirty(true) {
+
 }
 
 const glm::vec3& Camera::position() const {
@@ -34,10 +37,12 @@ const glm::vec3& Camera::position() const {
 
 void Camera::setPosition(const glm::vec3& position) {
     _position = position;
+    _viewDirty = true;
 }
 
 void Camera::offsetPosition(const glm::vec3 &offset) {
     _position += offset;
+    _viewDirty = true;
 }
 
 float Camera::fieldOfView() const {
@@ -47,6 +52,7 @@ float Camera::fieldOfView() const {
 void Camera::setFieldOfView(float fieldOfView) {
     assert(fieldOfView > 0.0f && fieldOfView < 180.0f);
     _fieldOfView = fieldOfView;
+    _projectionDirty = true;
 }
 
 float Camera::nearPlane() const {
@@ -61,20 +67,18 @@ void Camera::setNearAndFarPlanes(float nearPlane, float farPlane) {
     assert(nearPlane > 0.0f && farPlane > nearPlane);
     _nearPlane = nearPlane;
     _farPlane = farPlane;
+    _projectionDirty = true;
 }
 
-glm::mat4 Camera::orientation() const {
-    glm::mat4 orientation;
-    orientation = glm::rotate(orientation, _verticalAngle, glm::vec3(1, 0, 0));
-    orientation = glm::rotate(orientation, _horizontalAngle, glm::vec3(0, 1, 0));
-    
-    return orientation;
+const glm::mat4& Camera::orientation() const {
+    updateMatrices();
+    return _orientation;
 }
 
 void Camera::offsetOrientation(float upAngle, float rightAngle) {
     _horizontalAngle += rightAngle;
     _verticalAngle += upAngle;
-    normalizeAngles();
+    updateRotation();
 }
 
 void Camera::lookAt(glm::vec3 position) {
@@ -83,7 +87,7 @@ void Camera::lookAt(glm::vec3 position) {
     glm::vec3 direction = glm::normalize(position - _position);
     _verticalAngle = radiansToDegrees(asinf(-direction.y));
     _horizontalAngle = -radiansToDegrees(atan2f(-direction.x, -direction.z));
-    normalizeAngles();
+    updateRotation();
 }
 
 float Camera::viewportAspectRatio() const {
@@ -93,33 +97,59 @@ float Camera::viewportAspectRatio() const {
 void Camera::setViewportAspectRatio(float viewportAspectRatio) {
     assert(viewportAspectRatio > 0.0);
     _viewportAspectRatio = viewportAspectRatio;
+    _projectionDirty = true;
 }
 
-glm::vec3 Camera::forward() const {
-    glm::vec4 forward = glm::inverse(orientation()) * glm::vec4(0, 0, -1, 1);
-    return glm::vec3(forward);
+const glm::vec3& Camera::forward() const {
+    updateMatrices();
+    return _forward;
 }
 
-glm::vec3 Camera::right() const {
-    glm::vec4 right = glm::inverse(orientation()) * glm::vec4(1, 0, 0, 1);
-    return glm::vec3(right);
+const glm::vec3& Camera::right() const {
+    updateMatrices();
+    return _right;
 }
 
-glm::vec3 Camera::up() const {
-    glm::vec4 up = glm::inverse(orientation()) * glm::vec4(0, 1, 0, 1);
-    return glm::vec3(up);
+const glm::vec3& Camera::up() const {
+    updateMatrices();
+    return _up;
 }
 
-glm::mat4 Camera::matrix() const {
-    return projection() * view();
+const glm::mat4& Camera::matrix() const {
+    updateMatrices();
+    return _matrix;
 }
 
-glm::mat4 Camera::projection() const {
-    return glm::perspective(_fieldOfView, _viewportAspectRatio, _nearPlane, _farPlane);
+const glm::mat4& Camera::projection() const {
+    updateMatrices();
+    return _projection;
 }
 
-glm::mat4 Camera::view() const {
-    return orientation() * glm::translate(glm::mat4(), -_position);
+const glm::mat4& Camera::view() const {
+    updateMatrices();
+    return _view;
+}
+
+void Camera::frustumPlanes(glm::vec4 planes[6]) const {
+    // Each plane is the last row of the view-projection matrix plus or minus one of the others (Gribb and Hartmann)
+    const glm::mat4& m = matrix();
+    glm::vec4 rows[4];
+    for (int row = 0; row < 4; ++row)
+        rows[row] = glm::vec4(m[0][row], m[1][row], m[2][row], m[3][row]);
+    
+    for (int axis = 0; axis < 3; ++axis) {
+        planes[axis * 2] = rows[3] + rows[axis];
+        planes[axis * 2 + 1] = rows[3] - rows[axis];
+    }
+    
+    for (int plane = 0; plane < 6; ++plane)
+        planes[plane] = planes[plane] / glm::length(glm::vec3(planes[plane]));
+}
+
+float Camera::pixelsPerUnit(float distance, float viewportHeight) const {
+    // The viewport spans 2 * distance * tan(fov / 2) world units vertically at that distance
+    float halfAngle = _fieldOfView * (float) M_PI / 360.0f;
+    return viewportHeight / (2.0f * distance * tanf(halfAngle));
 }
 
 void Camera::normalizeAngles() {
@@ -134,3 +164,34 @@ void Camera::normalizeAngles() {
         _verticalAngle = -maxVerticalAngle;
 }
 
+void Camera::updateRotation() {
+    normalizeAngles();
+    
+    // The same rotations the angles describe as matrices: vertical around x, after horizontal around y
+    _rotation = glm::angleAxis(_verticalAngle, glm::vec3(1, 0, 0)) * glm::angleAxis(_horizontalAngle, glm::vec3(0, 1, 0));
+    _viewDirty = true;
+}
+
+void Camera::updateMatrices() const {
+    if (!_viewDirty && !_projectionDirty)
+        return;
+    
+    if (_viewDirty) {
+        _orientation = glm::mat4_cast(_rotation);
+        
+        // The orientation is a rotation, so its inverse is its transpose, and the camera's axes in world space are its rows
+        _right = glm::vec3(_orientation[0][0], _orientation[1][0], _orientation[2][0]);
+        _up = glm::vec3(_orientation[0][1], _orientation[1][1], _orientation[2][1]);
+        _forward = -glm::vec3(_orientation[0][2], _orientation[1][2], _orientation[2][2]);
+        
+        // The orientation after a translation by -position
+        _view = _orientation;
+        _view[3] = glm::vec4(-glm::dot(_right, _position), -glm::dot(_up, _position), glm::dot(_forward, _position), 1.0f);
+    }
+    
+    if (_projectionDirty)
+        _projection = glm::perspective(_fieldOfView, _viewportAspectRatio, _nearPlane, _farPlane);
+    
+    _matrix = _projection * _view;
+    _viewDirty = _projectionDirty = false;
+}
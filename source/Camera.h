@@ -10,8 +10,13 @@
 #define __Robot__Camera__
 
 #include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
 
-// A helper class for defining a camera in the 3D space.
+/* A helper class for defining a camera in the 3D space.
+ *
+ * The orientation is kept as a quaternion, built from the horizontal and vertical angles whenever they change. The
+ * matrices and basis vectors are cached, and only recomputed by the first query after a change, so querying them
+ * costs a flag test. References they return stay valid, but their contents change along with the camera. */
 class Camera {
 public:
     Camera();
@@ -34,7 +39,7 @@ public:
     void setNearAndFarPlanes(float nearPlane, float farPlane);
     
     // Returns a rotation matrix corresponding to the direction the camera is looking at. Does not include translation coefficients.
-    glm::mat4 orientation() const;
+    const glm::mat4& orientation() const;
     
     // Offset the camera orientation. The verticle angle is constrained between -85 and 85.
     void offsetOrientation(float upAngle, float rightAngle);
@@ -47,22 +52,29 @@ public:
     void setViewportAspectRatio(float ratio);
     
     // Returns a unit vector representing the camera's face direction.
-    glm::vec3 forward() const;
+    const glm::vec3& forward() const;
     
     // ... up direction
-    glm::vec3 up() const;
+    const glm::vec3& up() const;
     
     // ... right direction
-    glm::vec3 right() const;
+    const glm::vec3& right() const;
     
     // Returns the combined camera transformation matrix. Includes the projection matrix. This is used in the vertex shader.
-    glm::mat4 matrix() const;
+    const glm::mat4& matrix() const;
     
     // Returns the projection matrix.
-    glm::mat4 projection() const;
+    const glm::mat4& projection() const;
     
     // Returns the rotation and translation matrix.
-    glm::mat4 view() const;
+    const glm::mat4& view() const;
+    
+    // The planes of the view frustum in world space, as unit normals in xyz and distances in w. The normals point into
+    // the frustum. The order is left, right, bottom, top, near, far.
+    void frustumPlanes(glm::vec4 planes[6]) const;
+    
+    // The number of pixels one world unit covers at the given distance from the camera, on a viewport of the given height.
+    float pixelsPerUnit(float distance, float viewportHeight) const;
     
 private:
     glm::vec3 _position;
@@ -72,8 +84,20 @@ private:
     float _nearPlane;
     float _farPlane;
     float _viewportAspectRatio;
+    glm::quat _rotation;
+    
+    // Cached results, and which of them are out of date
+    mutable glm::mat4 _orientation, _view, _projection, _matrix;
+    mutable glm::vec3 _forward, _up, _right;
+    mutable bool _viewDirty, _projectionDirty;
     
     void normalizeAngles();
+    
+    // Normalizes the angles and rebuilds the rotation from them
+    void updateRotation();
+    
+    // Recomputes whatever changed since the last query
+    void updateMatrices() const;
 };
 
 #endif /* defined(__Robot__Camera__) */
@@ -0,0 +1,636 @@
+//
+//  CommandLineTools.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 3/9/14.
+//
+//
+
+#include "CommandLineTools.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "BatchMath.h"
+#include "Bitmap.h"
+#include "BitmapTransforms.h"
+#include "BlockCompression.h"
+#include "DepthRasterizer.h"
+#include "KtxFile.h"
+#include "PixelConversion.h"
+#include "Scene.h"
+#include "SceneFile.h"
+#include "ThreadPool.h"
+
+static double SecondsSince(std::chrono::high_resolution_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+static int CompressTexture(int argc, char *argv[]) {
+    if (argc < 4 || argc > 5) {
+        std::cerr << "Usage: " << argv[0] << " --compress-texture <input image> <output.ktx> [bc1|bc3]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    std::string inputPath(argv[2]), outputPath(argv[3]);
+    
+    // Match what textureFromFile does before uploading, so the compressed data can go to GL as is
+    Bitmap bitmap = Bitmap::bitmapFromFile(inputPath);
+    bitmap.flipVertically();
+    
+    bool hasAlpha = bitmap.format() == Bitmap::Format_GrayscaleAlpha || bitmap.format() == Bitmap::Format_RGBA;
+    BlockCompression::Format format = hasAlpha ? BlockCompression::Format_BC3 : BlockCompression::Format_BC1;
+    if (argc == 5) {
+        std::string formatName(argv[4]);
+        if (formatName == "bc1")
+            format = BlockCompression::Format_BC1;
+        else if (formatName == "bc3")
+            format = BlockCompression::Format_BC3;
+        else {
+            std::cerr << "Unknown block format " << formatName << ", expected bc1 or bc3" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    
+    KtxFile ktx(format == BlockCompression::Format_BC1 ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT,
+                format == BlockCompression::Format_BC1 ? GL_RGB : GL_RGBA, bitmap.width(), bitmap.height());
+    
+    double encodeSeconds = 0.0;
+    unsigned long long encodedPixels = 0, uncompressedBytes = 0, compressedBytes = 0;
+    
+    Bitmap level = bitmap;
+    for (unsigned levelIndex = 0; ; ++levelIndex) {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        std::vector<unsigned char> blocks = BlockCompression::compress(level, format);
+        encodeSeconds += SecondsSince(start);
+        
+        encodedPixels += (unsigned long long) level.width() * level.height();
+        uncompressedBytes += (unsigned long long) level.width() * level.height() * level.format();
+        compressedBytes += blocks.size();
+        
+        Bitmap decoded = BlockCompression::decompress(&blocks[0], level.width(), level.height(), format);
+        std::cout << "Level " << levelIndex << " (" << level.width() << "x" << level.height() << "): PSNR "
+                  << BlockCompression::psnr(level, decoded, hasAlpha) << " dB" << std::endl;
+        
+        ktx.addLevel(blocks);
+        
+        if (level.width() == 1 && level.height() == 1)
+            break;
+        level = BlockCompression::downsample(level);
+    }
+    
+    ktx.writeToFile(outputPath);
+    
+    std::cout << "Wrote " << outputPath << ": " << ktx.levelCount() << " levels, " << compressedBytes << " bytes ("
+              << (double) uncompressedBytes / compressedBytes << "x smaller than uncompressed)" << std::endl;
+    std::cout << "Encoded " << encodedPixels << " pixels in " << encodeSeconds * 1000.0 << " ms ("
+              << encodedPixels / encodeSeconds / 1000000.0 << " Mpixels/s)" << std::endl;
+    
+    return EXIT_SUCCESS;
+}
+
+static const char *FormatName(Bitmap::Format format) {
+    switch (format) {
+        case Bitmap::Format_Grayscale:      return "Grayscale";
+        case Bitmap::Format_GrayscaleAlpha: return "GrayscaleAlpha";
+        case Bitmap::Format_RGB:            return "RGB";
+        case Bitmap::Format_RGBA:           return "RGBA";
+        default:
+            throw std::runtime_error("Unhandled bitmap format");
+    }
+}
+
+/* Times copyRectFromBitmap between every pair of formats, then each row converter on its own for every instruction
+ * set the CPU supports, checking the SIMD output is identical to the scalar output. Throughput counts the bytes read
+ * plus the bytes written. */
+static int BenchmarkBitmap(int argc, char *argv[]) {
+    const unsigned width = 4096, height = 1024, repeats = 8;
+    
+    std::cout << "Best instruction set: " << PixelConversion::instructionSetName(PixelConversion::bestInstructionSet())
+              << std::endl;
+    
+    bool allExact = true;
+    for (int srcFormat = Bitmap::Format_Grayscale; srcFormat <= Bitmap::Format_RGBA; ++srcFormat) {
+        Bitmap src(width, height, (Bitmap::Format) srcFormat);
+        for (unsigned i = 0; i < src.stride() * height; ++i)
+            src.pixelBuffer()[i] = (unsigned char) rand();
+        
+        for (int destFormat = Bitmap::Format_Grayscale; destFormat <= Bitmap::Format_RGBA; ++destFormat) {
+            Bitmap dest(width, height, (Bitmap::Format) destFormat);
+            double bytesPerPass = (double) width * height * (srcFormat + destFormat);
+            
+            // Untimed pass, so page faults on the new destination don't count
+            dest.copyRectFromBitmap(src, 0, 0, 0, 0, 0, 0);
+            
+            std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+            for (unsigned repeat = 0; repeat < repeats; ++repeat)
+                dest.copyRectFromBitmap(src, 0, 0, 0, 0, 0, 0);
+            double seconds = SecondsSince(start);
+            
+            std::cout << FormatName((Bitmap::Format) srcFormat) << " -> " << FormatName((Bitmap::Format) destFormat)
+                      << ": copyRectFromBitmap " << bytesPerPass * repeats / seconds / 1e9 << " GB/s";
+            
+            if (srcFormat == destFormat) {
+                std::cout << " (memcpy)" << std::endl;
+                continue;
+            }
+            
+            std::vector<unsigned char> reference(width * destFormat), output(width * destFormat);
+            for (int set = PixelConversion::InstructionSet_Scalar; set <= PixelConversion::bestInstructionSet(); ++set) {
+                PixelConversion::RowConverterFunc converter =
+                    PixelConversion::rowConverter((Bitmap::Format) srcFormat, (Bitmap::Format) destFormat, (PixelConversion::InstructionSet) set);
+                
+                start = std::chrono::high_resolution_clock::now();
+                for (unsigned repeat = 0; repeat < repeats; ++repeat) {
+                    for (unsigned row = 0; row < height; ++row)
+                        converter(src.rowBuffer(row), dest.rowBuffer(row), width);
+                }
+                seconds = SecondsSince(start);
+                
+                // Check a row whose length isn't a multiple of any vector width, so the scalar tails run too
+                unsigned checkWidth = width - 13;
+                PixelConversion::RowConverterFunc scalar =
+                    PixelConversion::rowConverter((Bitmap::Format) srcFormat, (Bitmap::Format) destFormat, PixelConversion::InstructionSet_Scalar);
+                scalar(src.pixelBuffer(), &reference[0], checkWidth);
+                converter(src.pixelBuffer(), &output[0], checkWidth);
+                bool exact = memcmp(&reference[0], &output[0], checkWidth * destFormat) == 0;
+                allExact = allExact && exact;
+                
+                std::cout << ", " << PixelConversion::instructionSetName((PixelConversion::InstructionSet) set) << " "
+                          << bytesPerPass * repeats / seconds / 1e9 << " GB/s" << (exact ? "" : " (MISMATCH)");
+            }
+            std::cout << std::endl;
+        }
+    }
+    
+    if (!allExact) {
+        std::cerr << "SIMD conversion output differs from the scalar output" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    return EXIT_SUCCESS;
+}
+
+// Prints the time an operation took on a bitmap, as pixel and byte throughput (bytes read plus bytes written)
+static void PrintTransformTiming(const char *name, double seconds, double pixels, double bytes) {
+    std::cout << name << ": " << seconds * 1000.0 << " ms, " << pixels / seconds / 1e6 << " Mpixels/s, "
+              << bytes / seconds / 1e9 << " GB/s" << std::endl;
+}
+
+// Times each BitmapTransforms operation on a square RGBA bitmap, 8192 pixels wide by default
+static int BenchmarkTransforms(int argc, char *argv[]) {
+    if (argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " --benchmark-transforms [size]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    unsigned size = argc == 3 ? (unsigned) atoi(argv[2]) : 8192;
+    if (size < 2) {
+        std::cerr << "Size must be at least 2" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    Bitmap bitmap(size, size, Bitmap::Format_RGBA);
+    for (size_t i = 0; i < (size_t) bitmap.stride() * size; ++i)
+        bitmap.pixelBuffer()[i] = (unsigned char) rand();
+    
+    double pixels = (double) size * size, bytes = pixels * 4;
+    std::cout << size << "x" << size << " RGBA, " << ThreadPool::shared().threadCount() << " threads" << std::endl;
+    
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    BitmapTransforms::flipVertically(bitmap);
+    PrintTransformTiming("Flip vertically", SecondsSince(start), pixels, bytes * 2);
+    
+    start = std::chrono::high_resolution_clock::now();
+    Bitmap transposed = BitmapTransforms::transpose(bitmap);
+    PrintTransformTiming("Transpose", SecondsSince(start), pixels, bytes * 2);
+    
+    start = std::chrono::high_resolution_clock::now();
+    Bitmap rotated = BitmapTransforms::rotate90CounterClockwise(bitmap);
+    PrintTransformTiming("Rotate 90 counter-clockwise", SecondsSince(start), pixels, bytes * 2);
+    
+    start = std::chrono::high_resolution_clock::now();
+    rotated = BitmapTransforms::rotate90Clockwise(bitmap);
+    PrintTransformTiming("Rotate 90 clockwise", SecondsSince(start), pixels, bytes * 2);
+    
+    BitmapTransforms::Filter filters[] = { BitmapTransforms::Filter_Box, BitmapTransforms::Filter_Bilinear, BitmapTransforms::Filter_Lanczos };
+    for (unsigned i = 0; i < sizeof(filters) / sizeof(filters[0]); ++i) {
+        start = std::chrono::high_resolution_clock::now();
+        Bitmap resized = BitmapTransforms::resize(bitmap, size / 2, size / 2, filters[i]);
+        
+        std::string name = std::string("Resize to half, ") + BitmapTransforms::filterName(filters[i]);
+        PrintTransformTiming(name.c_str(), SecondsSince(start), pixels, bytes * 1.25);
+    }
+    
+    return EXIT_SUCCESS;
+}
+
+// Times Scene updates on a random hierarchy, where every node has a parent created before it or is a root
+static int BenchmarkScene(int argc, char *argv[]) {
+    if (argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " --benchmark-scene [node count]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    unsigned nodeCount = argc == 3 ? (unsigned) atoi(argv[2]) : 100000;
+    if (nodeCount == 0 || nodeCount > Scene::MaxNodes) {
+        std::cerr << "Node count must be between 1 and " << Scene::MaxNodes << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    const unsigned repeats = 20;
+    Scene scene;
+    std::vector<NodeHandle> nodes;
+    
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    for (unsigned i = 0; i < nodeCount; ++i) {
+        NodeHandle parent = (i > 0 && rand() % 8 != 0) ? nodes[rand() % nodes.size()] : NodeHandle();
+        nodes.push_back(scene.createNode(nullptr, parent));
+        
+        ModelTransform transform(glm::translate(glm::mat4(), glm::vec3(rand() % 100 / 10.0f, 0.0f, rand() % 100 / 10.0f)));
+        transform.rotate = glm::rotate(glm::mat4(), (float) (rand() % 360), glm::vec3(0.0f, 1.0f, 0.0f));
+        scene.setLocalTransform(nodes.back(), transform);
+    }
+    double seconds = SecondsSince(start);
+    std::cout << nodeCount << " nodes created in " << seconds * 1000.0 << " ms" << std::endl;
+    
+    start = std::chrono::high_resolution_clock::now();
+    for (unsigned repeat = 0; repeat < repeats; ++repeat) {
+        scene.invalidateWorldTransforms();
+        scene.updateWorldTransforms();
+    }
+    seconds = SecondsSince(start) / repeats;
+    std::cout << "Full world transform update: " << seconds * 1000.0 << " ms, " << seconds * 1e9 / nodeCount << " ns per node" << std::endl;
+    
+    // Move 1% of the nodes each time. Their descendants are recomputed too.
+    double incrementalSeconds = 0.0;
+    unsigned long long recomputed = 0;
+    for (unsigned repeat = 0; repeat < repeats; ++repeat) {
+        for (unsigned i = 0; i < (nodeCount + 99) / 100; ++i) {
+            NodeHandle node = nodes[rand() % nodes.size()];
+            ModelTransform transform = scene.localTransform(node);
+            transform.translate = glm::translate(transform.translate, glm::vec3(0.0f, 0.1f, 0.0f));
+            scene.setLocalTransform(node, transform);
+        }
+        
+        start = std::chrono::high_resolution_clock::now();
+        scene.updateWorldTransforms();
+        incrementalSeconds += SecondsSince(start);
+        recomputed += scene.recomputedNodeCount();
+    }
+    std::cout << "Incremental update, 1% of nodes moved: " << incrementalSeconds / repeats * 1000.0 << " ms, "
+              << recomputed / repeats << " nodes recomputed" << std::endl;
+    
+    start = std::chrono::high_resolution_clock::now();
+    for (unsigned repeat = 0; repeat < repeats; ++repeat)
+        scene.updateWorldTransforms();
+    seconds = SecondsSince(start) / repeats;
+    std::cout << "Update with nothing moved: " << seconds * 1000.0 << " ms" << std::endl;
+    
+    // Resolve handles in a random order, like gameplay code touching scattered nodes
+    std::vector<NodeHandle> shuffled(nodes);
+    for (size_t i = shuffled.size() - 1; i > 0; --i)
+        std::swap(shuffled[i], shuffled[rand() % (i + 1)]);
+    
+    start = std::chrono::high_resolution_clock::now();
+    float sum = 0.0f;
+    for (unsigned repeat = 0; repeat < repeats; ++repeat) {
+        for (std::vector<NodeHandle>::const_iterator it = shuffled.begin(); it != shuffled.end(); ++it)
+            sum += scene.worldTransform(*it)[3][0];
+    }
+    seconds = SecondsSince(start) / repeats;
+    std::cout << "Random handle lookups: " << seconds * 1e9 / nodeCount << " ns per lookup (checksum " << sum << ")" << std::endl;
+    
+    return EXIT_SUCCESS;
+}
+
+static int ConvertScene(int argc, char *argv[]) {
+    if (argc != 4) {
+        std::cerr << "Usage: " << argv[0] << " --convert-scene <input text> <output.scene>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    SceneFile::convertTextFile(argv[2], argv[3]);
+    
+    SceneFile sceneFile(argv[3]);
+    std::cout << "Wrote " << argv[3] << ": " << sceneFile.nodeCount() << " nodes, " << sceneFile.meshCount() << " meshes, "
+              << sceneFile.materialCount() << " materials" << std::endl;
+    
+    return EXIT_SUCCESS;
+}
+
+/* Writes a random hierarchy in the scene text form, converts it, then times mapping the binary file and creating its
+ * nodes in a scene, 100000 by default. Nodes have no models, so only the scene's own work is timed. */
+static int BenchmarkSceneFile(int argc, char *argv[]) {
+    if (argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " --benchmark-scene-file [node count]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    unsigned nodeCount = argc == 3 ? (unsigned) atoi(argv[2]) : 100000;
+    if (nodeCount == 0 || nodeCount > Scene::MaxNodes) {
+        std::cerr << "Node count must be between 1 and " << Scene::MaxNodes << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    std::string textPath = std::string(P_tmpdir) + "/robot-benchmark.scene.txt", binaryPath = std::string(P_tmpdir) + "/robot-benchmark.scene";
+    {
+        std::ofstream text(textPath.c_str());
+        for (unsigned i = 0; i < nodeCount; ++i) {
+            text << "node n" << i << " ";
+            if (i > 0 && rand() % 8 != 0)
+                text << "n" << rand() % i;
+            else
+                text << "-";
+            text << " - - translate " << rand() % 100 / 10.0f << " 0 " << rand() % 100 / 10.0f << " rotate " << rand() % 360 << " 0 1 0\n";
+        }
+    }
+    
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    SceneFile::convertTextFile(textPath, binaryPath);
+    std::cout << "Converted " << nodeCount << " nodes from text in " << SecondsSince(start) * 1000.0 << " ms" << std::endl;
+    
+    const unsigned repeats = 10;
+    double mapSeconds = 0.0, instantiateSeconds = 0.0;
+    std::vector<NodeHandle> handles(nodeCount);
+    for (unsigned repeat = 0; repeat < repeats; ++repeat) {
+        start = std::chrono::high_resolution_clock::now();
+        SceneFile sceneFile(binaryPath);
+        mapSeconds += SecondsSince(start);
+        
+        Scene scene;
+        start = std::chrono::high_resolution_clock::now();
+        sceneFile.instantiate(scene, nullptr, handles.data());
+        instantiateSeconds += SecondsSince(start);
+    }
+    
+    std::cout << "Map and check: " << mapSeconds / repeats * 1000.0 << " ms, create nodes: " << instantiateSeconds / repeats * 1000.0
+              << " ms (" << instantiateSeconds / repeats * 1e9 / nodeCount << " ns per node)" << std::endl;
+    
+    std::remove(textPath.c_str());
+    std::remove(binaryPath.c_str());
+    return EXIT_SUCCESS;
+}
+
+// A random rotation, non-uniform scale and translation
+static glm::mat4 RandomTransform() {
+    glm::vec3 axis(rand() % 200 - 100, rand() % 200 - 100, rand() % 200 - 100 + 0.5f);
+    glm::mat4 transform = glm::translate(glm::mat4(), glm::vec3(rand() % 200 - 100, rand() % 200 - 100, rand() % 200 - 100));
+    transform = glm::rotate(transform, (float) (rand() % 360), glm::normalize(axis));
+    return glm::scale(transform, glm::vec3(0.5f + rand() % 16 / 10.0f, 0.5f + rand() % 16 / 10.0f, 0.5f + rand() % 16 / 10.0f));
+}
+
+// Largest difference between two float arrays, relative to the reference's magnitude where that's above 1
+static float MaxRelativeError(const float *reference, const float *values, size_t count) {
+    float maxError = 0.0f;
+    for (size_t i = 0; i < count; ++i)
+        maxError = std::max(maxError, fabsf(values[i] - reference[i]) / std::max(fabsf(reference[i]), 1.0f));
+    
+    return maxError;
+}
+
+// Average time of a batch call, in nanoseconds per element
+template <typename Func>
+static double NanosecondsPerElement(unsigned count, unsigned repeats, Func func) {
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    for (unsigned repeat = 0; repeat < repeats; ++repeat)
+        func();
+    
+    return SecondsSince(start) * 1e9 / ((double) count * repeats);
+}
+
+/* Times each BatchMath function for every instruction set the CPU supports. The scalar versions are plain glm, so
+ * they're the baseline, and the SIMD results are checked against them. */
+static int BenchmarkMath(int argc, char *argv[]) {
+    if (argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " --benchmark-math [count]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    unsigned count = argc == 3 ? (unsigned) atoi(argv[2]) : 100000;
+    if (count == 0) {
+        std::cerr << "Count must be positive" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    const unsigned repeats = 20;
+    std::vector<glm::mat4> left(count), right(count), products(count), productReference(count);
+    std::vector<glm::mat3> normals(count), normalReference(count);
+    std::vector<BoundingBox> boxes(count), transformedBoxes(count), boxReference(count);
+    std::vector<glm::vec4> spheres(count);
+    std::vector<unsigned char> visible(count), visibleReference(count);
+    
+    for (unsigned i = 0; i < count; ++i) {
+        left[i] = RandomTransform();
+        right[i] = RandomTransform();
+        
+        glm::vec3 corner(rand() % 200 - 100, rand() % 200 - 100, rand() % 200 - 100);
+        boxes[i].min = corner;
+        boxes[i].max = corner + glm::vec3(rand() % 20 + 1, rand() % 20 + 1, rand() % 20 + 1);
+        
+        // About half the spheres are outside the frustum, and some straddle it
+        spheres[i] = glm::vec4(rand() % 200 - 100, rand() % 200 - 100, rand() % 200 - 100, rand() % 100 / 10.0f);
+    }
+    
+    // A 100-unit cube around the origin, standing in for a view frustum
+    const glm::vec4 planes[6] = {
+        glm::vec4(1.0f, 0.0f, 0.0f, 50.0f), glm::vec4(-1.0f, 0.0f, 0.0f, 50.0f),
+        glm::vec4(0.0f, 1.0f, 0.0f, 50.0f), glm::vec4(0.0f, -1.0f, 0.0f, 50.0f),
+        glm::vec4(0.0f, 0.0f, 1.0f, 50.0f), glm::vec4(0.0f, 0.0f, -1.0f, 50.0f)
+    };
+    
+    bool allMatch = true;
+    for (int set = PixelConversion::InstructionSet_Scalar; set <= PixelConversion::bestInstructionSet(); ++set) {
+        BatchMath::InstructionSet instructionSet = (BatchMath::InstructionSet) set;
+        
+        double multiplyTime = NanosecondsPerElement(count, repeats, [&] {
+            BatchMath::multiplyMatrices(&left[0], &right[0], &products[0], count, instructionSet);
+        });
+        double normalTime = NanosecondsPerElement(count, repeats, [&] {
+            BatchMath::normalMatrices(&left[0], &normals[0], count, instructionSet);
+        });
+        double boxTime = NanosecondsPerElement(count, repeats, [&] {
+            BatchMath::transformBoxes(&boxes[0], &left[0], &transformedBoxes[0], count, instructionSet);
+        });
+        double sphereTime = NanosecondsPerElement(count, repeats, [&] {
+            BatchMath::testSpheresAgainstFrustum(&spheres[0], count, planes, &visible[0], instructionSet);
+        });
+        
+        std::cout << PixelConversion::instructionSetName(instructionSet) << ": mat4 multiply " << multiplyTime
+                  << " ns, normal matrix " << normalTime << " ns, box transform " << boxTime << " ns, sphere test "
+                  << sphereTime << " ns";
+        
+        if (set == PixelConversion::InstructionSet_Scalar) {
+            productReference = products;
+            normalReference = normals;
+            boxReference = transformedBoxes;
+            visibleReference = visible;
+            
+            size_t visibleCount = std::count(visible.begin(), visible.end(), 1);
+            std::cout << " (" << visibleCount << " of " << count << " spheres visible)" << std::endl;
+            continue;
+        }
+        
+        bool productsExact = memcmp(&products[0], &productReference[0], count * sizeof(glm::mat4)) == 0;
+        bool boxesExact = memcmp(&transformedBoxes[0], &boxReference[0], count * sizeof(BoundingBox)) == 0;
+        bool visibleExact = visible == visibleReference;
+        float normalError = MaxRelativeError(&normalReference[0][0][0], &normals[0][0][0], count * 9);
+        bool normalsClose = normalError < 1e-4f;
+        allMatch = allMatch && productsExact && boxesExact && visibleExact && normalsClose;
+        
+        std::cout << " (normal matrix error " << normalError << ")";
+        if (!productsExact)
+            std::cout << " (MULTIPLY MISMATCH)";
+        if (!normalsClose)
+            std::cout << " (NORMAL MATRIX MISMATCH)";
+        if (!boxesExact)
+            std::cout << " (BOX MISMATCH)";
+        if (!visibleExact)
+            std::cout << " (SPHERE MISMATCH)";
+        std::cout << std::endl;
+    }
+    
+    if (!allMatch) {
+        std::cerr << "SIMD batch math output differs from the scalar output" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    return EXIT_SUCCESS;
+}
+
+/* Rasterizes random boxes with the DepthRasterizer for every instruction set the CPU supports, on pools of a few
+ * sizes. The rasterizer promises the same buffer whatever the instruction set and thread count, so every buffer is
+ * checked against the scalar, single-threaded one. */
+static int BenchmarkRasterizer(int argc, char *argv[]) {
+    if (argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " --benchmark-rasterizer [box count]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    unsigned boxCount = argc == 3 ? (unsigned) atoi(argv[2]) : 1000;
+    if (boxCount == 0) {
+        std::cerr << "Box count must be positive" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    // A unit cube, 12 triangles
+    const glm::vec3 cubeVertices[8] = {
+        glm::vec3(-0.5f, -0.5f, -0.5f), glm::vec3(0.5f, -0.5f, -0.5f), glm::vec3(0.5f, 0.5f, -0.5f), glm::vec3(-0.5f, 0.5f, -0.5f),
+        glm::vec3(-0.5f, -0.5f, 0.5f), glm::vec3(0.5f, -0.5f, 0.5f), glm::vec3(0.5f, 0.5f, 0.5f), glm::vec3(-0.5f, 0.5f, 0.5f)
+    };
+    const GLuint cubeIndices[36] = {
+        0, 2, 1, 0, 3, 2, 4, 5, 6, 4, 6, 7, 0, 1, 5, 0, 5, 4,
+        3, 6, 2, 3, 7, 6, 0, 4, 7, 0, 7, 3, 1, 2, 6, 1, 6, 5
+    };
+    
+    // Boxes all around a camera at the origin, so some are behind it and some cross the near plane
+    const unsigned width = 512, height = 256, repeats = 20;
+    glm::mat4 viewProjection = glm::perspective(60.0f, (float) width / height, 0.1f, 500.0f) *
+                               glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    DepthRasterizer rasterizer(width, height);
+    rasterizer.begin(viewProjection);
+    for (unsigned i = 0; i < boxCount; ++i)
+        rasterizer.addTriangles(cubeVertices, 8, cubeIndices, 36, glm::scale(RandomTransform(), glm::vec3(8.0f)));
+    
+    std::vector<unsigned> threadCounts;
+    threadCounts.push_back(1);
+    threadCounts.push_back(2);
+    if (ThreadPool::defaultThreadCount() > 2)
+        threadCounts.push_back(ThreadPool::defaultThreadCount());
+    
+    std::vector<float> reference;
+    bool allMatch = true;
+    for (std::vector<unsigned>::const_iterator threads = threadCounts.begin(); threads != threadCounts.end(); ++threads) {
+        ThreadPool pool(*threads);
+        
+        for (int set = PixelConversion::InstructionSet_Scalar; set <= PixelConversion::bestInstructionSet(); ++set) {
+            BatchMath::InstructionSet instructionSet = (BatchMath::InstructionSet) set;
+            
+            std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+            for (unsigned repeat = 0; repeat < repeats; ++repeat)
+                rasterizer.rasterize(instructionSet, pool);
+            double milliseconds = SecondsSince(start) * 1000.0 / repeats;
+            
+            std::cout << PixelConversion::instructionSetName(instructionSet) << ", " << *threads
+                      << (*threads == 1 ? " thread: " : " threads: ") << milliseconds << " ms for " << rasterizer.triangleCount() << " triangles";
+            
+            const std::vector<float>& depth = rasterizer.depth();
+            if (reference.empty()) {
+                reference = depth;
+                size_t covered = depth.size() - std::count(depth.begin(), depth.end(), 0.0f);
+                std::cout << " (" << covered * 100 / depth.size() << "% of the pixels covered)" << std::endl;
+                continue;
+            }
+            
+            bool exact = memcmp(&depth[0], &reference[0], depth.size() * sizeof(float)) == 0;
+            allMatch = allMatch && exact;
+            std::cout << (exact ? "" : " (MISMATCH)") << std::endl;
+        }
+    }
+    
+    if (!allMatch) {
+        std::cerr << "Depth buffers differ between instruction sets or thread counts" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    return EXIT_SUCCESS;
+}
+
+bool runCommandLineTool(int argc, char *argv[], int& exitCode) {
+    if (argc < 2)
+        return false;
+    
+    std::string command(argv[1]);
+    if (command == "--compress-texture") {
+        exitCode = CompressTexture(argc, argv);
+        return true;
+    }
+    
+    if (command == "--benchmark-bitmap") {
+        exitCode = BenchmarkBitmap(argc, argv);
+        return true;
+    }
+    
+    if (command == "--benchmark-transforms") {
+        exitCode = BenchmarkTransforms(argc, argv);
+        return true;
+    }
+    
+    if (command == "--benchmark-scene") {
+        exitCode = BenchmarkScene(argc, argv);
+        return true;
+    }
+    
+    if (command == "--convert-scene") {
+        exitCode = ConvertScene(argc, argv);
+        return true;
+    }
+    
+    if (command == "--benchmark-scene-file") {
+        exitCode = BenchmarkSceneFile(argc, argv);
+        return true;
+    }
+    
+    if (command == "--benchmark-math") {
+        exitCode = BenchmarkMath(argc, argv);
+        return true;
+    }
+    
+    if (command == "--benchmark-rasterizer") {
+        exitCode = BenchmarkRasterizer(argc, argv);
+        return true;
+    }
+    
+    return false;
+}
@@ -0,0 +1,44 @@
+//
+//  CommandLineTools.h
+//  Robot
+//
+//  Created by Itamar Ravid on 3/9/14.
+//
+//
+
+#ifndef __Robot__CommandLineTools__
+#define __Robot__CommandLineTools__
+
+/* Asset pipeline commands, run from the command line instead of starting the application. They don't create a
+ * window or a GL context. Returns false if the arguments don't name a tool; otherwise runs it and sets exitCode.
+ *
+ *   Robot --compress-texture <input image> <output.ktx> [bc1|bc3]
+ *       Compresses an image and its mip chain to a KTX file. bc3 is the default for images with alpha.
+ *
+ *   Robot --benchmark-bitmap
+ *       Measures pixel format conversion throughput for every format pair and instruction set, and checks the SIMD
+ *       converters against the scalar ones.
+ *
+ *   Robot --benchmark-transforms [size]
+ *       Times the flip, transpose, rotate and resize operations on a size x size RGBA bitmap (8192 by default).
+ *
+ *   Robot --benchmark-scene [node count]
+ *       Times full and incremental world transform updates and handle lookups on a random scene hierarchy (100000 nodes
+ *       by default).
+ *
+ *   Robot --convert-scene <input text> <output.scene>
+ *       Converts a scene from its text form to the binary form the application loads. See SceneFile.h for the format.
+ *
+ *   Robot --benchmark-scene-file [node count]
+ *       Times mapping a binary scene file with a random hierarchy and creating its nodes (100000 by default).
+ *
+ *   Robot --benchmark-math [count]
+ *       Times the BatchMath kernels against scalar glm on count random transforms, boxes and spheres (100000 by
+ *       default), and checks the SIMD results against the scalar ones.
+ *
+ *   Robot --benchmark-rasterizer [box count]
+ *       Times the depth rasterizer on count random boxes (1000 by default) for every instruction set on 1, 2 and all
+ *       hardware threads, and checks that every depth buffer matches the scalar, single-threaded one. */
+bool runCommandLineTool(int argc, char *argv[], int& exitCode);
+
+#endif /* defined(__Robot__CommandLineTools__) */
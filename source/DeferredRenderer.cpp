@@ -0,0 +1,264 @@
+//
+//  DeferredRenderer.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 17/9/14.
+//
+//
+
+#include "DeferredRenderer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "Loaders.h"
+
+static const GLfloat CubeVertices[] = {
+    0, 0, 0,  1, 0, 0,  0, 1, 0,  1, 1, 0,
+    0, 0, 1,  1, 0, 1,  0, 1, 1,  1, 1, 1
+};
+
+static const GLubyte CubeIndices[] = {
+    0, 2, 1,  1, 2, 3, /* z = 0 */
+    4, 5, 6,  5, 7, 6, /* z = 1 */
+    0, 1, 4,  1, 5, 4, /* y = 0 */
+    2, 6, 3,  3, 6, 7, /* y = 1 */
+    0, 4, 2,  2, 4, 6, /* x = 0 */
+    1, 3, 5,  3, 7, 5  /* x = 1 */
+};
+
+// The first three cube vertices span the triangle the light shader stretches over the screen
+static const GLsizei FullScreenTriangleIndexCount = 3;
+
+// Texture units of the G-buffer in the lighting pass
+enum {
+    TextureUnit_DiffuseAlbedo,
+    TextureUnit_SpecularAlbedo,
+    TextureUnit_NormalShininess,
+    TextureUnit_Depth
+};
+
+// A texture with a single level, sampled texel by texel
+static GLuint CreateBufferTexture(GLenum internalFormat, GLenum format, GLenum type, unsigned width, unsigned height) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
+    return texture;
+}
+
+DeferredRenderer::DeferredRenderer(unsigned width, unsigned height) : _width(width), _height(height), _viewportWidth(width),
+    _viewportHeight(height), _volumeLightCount(0), _fullScreenLightCount(0) {
+    _geometryProgram = programWithShaders("deferred-geometry.vsh", "deferred-geometry.fsh");
+    _lightProgram = programWithShaders("deferred-light.vsh", "deferred-light.fsh");
+    
+    _lightProgram->use();
+    _lightProgram->setUniform("diffuseAlbedoTexture", TextureUnit_DiffuseAlbedo);
+    _lightProgram->setUniform("specularAlbedoTexture", TextureUnit_SpecularAlbedo);
+    _lightProgram->setUniform("normalShininessTexture", TextureUnit_NormalShininess);
+    _lightProgram->setUniform("depthTexture", TextureUnit_Depth);
+    _lightProgram->setUniform("staticShadowMap", (GLint) ShadowMaps::TextureUnit_Static);
+    _lightProgram->setUniform("dynamicShadowMap", (GLint) ShadowMaps::TextureUnit_Dynamic);
+    _lightProgram->stopUsing();
+    
+    glGenVertexArrays(1, &_volumeVao);
+    glGenBuffers(1, &_volumeVbo);
+    glGenBuffers(1, &_volumeEbo);
+    
+    glBindVertexArray(_volumeVao);
+    glBindBuffer(GL_ARRAY_BUFFER, _volumeVbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(CubeVertices), CubeVertices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(ShaderProgram::VertexAttribute_Position);
+    glVertexAttribPointer(ShaderProgram::VertexAttribute_Position, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _volumeEbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(CubeIndices), CubeIndices, GL_STATIC_DRAW);
+    glBindVertexArray(0);
+    
+    _createBuffers();
+}
+
+DeferredRenderer::~DeferredRenderer() {
+    _deleteBuffers();
+    
+    glDeleteVertexArrays(1, &_volumeVao);
+    glDeleteBuffers(1, &_volumeVbo);
+    glDeleteBuffers(1, &_volumeEbo);
+}
+
+void DeferredRenderer::resize(unsigned width, unsigned height) {
+    if (width == _width && height == _height)
+        return;
+    
+    _width = width;
+    _height = height;
+    _viewportWidth = width;
+    _viewportHeight = height;
+    _deleteBuffers();
+    _createBuffers();
+}
+
+void DeferredRenderer::setViewport(unsigned width, unsigned height) {
+    _viewportWidth = std::min(width, _width);
+    _viewportHeight = std::min(height, _height);
+}
+
+unsigned DeferredRenderer::width() const {
+    return _width;
+}
+
+unsigned DeferredRenderer::height() const {
+    return _height;
+}
+
+void DeferredRenderer::beginGeometryPass(const glm::vec3& ambientLight) {
+    glBindFramebuffer(GL_FRAMEBUFFER, _geometryFramebuffer);
+    glViewport(0, 0, _viewportWidth, _viewportHeight);
+    glClearColor(0, 0, 0, 1);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    
+    _geometryProgram->use();
+    _geometryProgram->setUniform("ambientLight", ambientLight);
+    _geometryProgram->stopUsing();
+}
+
+ShaderProgram *DeferredRenderer::geometryProgram() const {
+    return _geometryProgram;
+}
+
+void DeferredRenderer::beginLightingPass(const Camera& camera) {
+    glBindFramebuffer(GL_FRAMEBUFFER, _lightingFramebuffer);
+    
+    _lightProgram->use();
+    _lightProgram->setUniform("viewProjection", camera.matrix());
+    _lightProgram->setUniform("inverseViewProjection", glm::inverse(camera.matrix()));
+    _lightProgram->setUniform("viewportSize", (GLfloat) _viewportWidth, (GLfloat) _viewportHeight);
+    _lightProgram->setUniform("cameraPosition", camera.position());
+    
+    glActiveTexture(GL_TEXTURE0 + TextureUnit_DiffuseAlbedo);
+    glBindTexture(GL_TEXTURE_2D, _diffuseAlbedoTexture);
+    glActiveTexture(GL_TEXTURE0 + TextureUnit_SpecularAlbedo);
+    glBindTexture(GL_TEXTURE_2D, _specularAlbedoTexture);
+    glActiveTexture(GL_TEXTURE0 + TextureUnit_NormalShininess);
+    glBindTexture(GL_TEXTURE_2D, _normalShininessTexture);
+    glActiveTexture(GL_TEXTURE0 + TextureUnit_Depth);
+    glBindTexture(GL_TEXTURE_2D, _depthTexture);
+    glActiveTexture(GL_TEXTURE0);
+    
+    // Lights add up. The shader finds the surface from the depth texture, so there's no depth test.
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glCullFace(GL_FRONT);
+    glBindVertexArray(_volumeVao);
+    
+    _volumeLightCount = _fullScreenLightCount = 0;
+}
+
+void DeferredRenderer::addLights(const Light *lights, unsigned count) {
+    _lightProgram->setUniform("shadowed", 0);
+    for (unsigned i = 0; i < count; ++i)
+        _drawLight(lights[i]);
+}
+
+void DeferredRenderer::addShadowedLight(const Light& light, const ShadowMaps& shadowMaps) {
+    _lightProgram->setUniform("shadowed", 1);
+    shadowMaps.setUniforms(_lightProgram);
+    _drawLight(light);
+}
+
+void DeferredRenderer::endLightingPass(GLuint framebuffer) {
+    glBindVertexArray(0);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+    glDepthMask(GL_TRUE);
+    glEnable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    
+    for (int unit = TextureUnit_Depth; unit >= TextureUnit_DiffuseAlbedo; --unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    _lightProgram->stopUsing();
+    
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, _lightingFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+    glBlitFramebuffer(0, 0, _viewportWidth, _viewportHeight, 0, 0, _viewportWidth, _viewportHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+unsigned DeferredRenderer::volumeLightCount() const {
+    return _volumeLightCount;
+}
+
+unsigned DeferredRenderer::fullScreenLightCount() const {
+    return _fullScreenLightCount;
+}
+
+void DeferredRenderer::_drawLight(const Light& light) {
+    _lightProgram->setUniform("volume", glm::vec4(glm::vec3(light.position), light.radius));
+    _lightProgram->setUniform("light.position", light.position);
+    _lightProgram->setUniform("light.diffuse", light.diffuseColor);
+    _lightProgram->setUniform("light.specular", light.specularColor);
+    _lightProgram->setUniform("light.attenuation", light.attenuation);
+    _lightProgram->setUniform("light.radius", light.radius);
+    
+    // Only the back faces of a volume are drawn, so it's shaded once even with the camera inside it
+    if (light.radius > 0.0f) {
+        glEnable(GL_CULL_FACE);
+        glDrawElements(GL_TRIANGLES, sizeof(CubeIndices), GL_UNSIGNED_BYTE, nullptr);
+        ++_volumeLightCount;
+    } else {
+        glDisable(GL_CULL_FACE);
+        glDrawElements(GL_TRIANGLES, FullScreenTriangleIndexCount, GL_UNSIGNED_BYTE, nullptr);
+        ++_fullScreenLightCount;
+    }
+}
+
+void DeferredRenderer::_createBuffers() {
+    _lightingTexture = CreateBufferTexture(GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, _width, _height);
+    _diffuseAlbedoTexture = CreateBufferTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, _width, _height);
+    _specularAlbedoTexture = CreateBufferTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, _width, _height);
+    _normalShininessTexture = CreateBufferTexture(GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, _width, _height);
+    _depthTexture = CreateBufferTexture(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, _width, _height);
+    
+    // The draw buffers follow the output locations in the geometry shader
+    static const GLenum DrawBuffers[] = {
+        GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3
+    };
+    
+    glGenFramebuffers(1, &_geometryFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, _geometryFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _lightingTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, _diffuseAlbedoTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, _specularAlbedoTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, _normalShininessTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, _depthTexture, 0);
+    glDrawBuffers(sizeof(DrawBuffers) / sizeof(DrawBuffers[0]), DrawBuffers);
+    bool geometryComplete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    
+    // The lighting pass samples the G-buffer, so it can't be bound for drawing at the same time
+    glGenFramebuffers(1, &_lightingFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, _lightingFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _lightingTexture, 0);
+    bool lightingComplete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (!geometryComplete || !lightingComplete)
+        throw std::runtime_error("Deferred shading framebuffers are incomplete");
+}
+
+void DeferredRenderer::_deleteBuffers() {
+    glDeleteFramebuffers(1, &_geometryFramebuffer);
+    glDeleteFramebuffers(1, &_lightingFramebuffer);
+    
+    GLuint textures[] = { _lightingTexture, _diffuseAlbedoTexture, _specularAlbedoTexture, _normalShininessTexture, _depthTexture };
+    glDeleteTextures(sizeof(textures) / sizeof(textures[0]), textures);
+}
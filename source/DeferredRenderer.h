@@ -0,0 +1,91 @@
+//
+//  DeferredRenderer.h
+//  Robot
+//
+//  Created by Itamar Ravid on 17/9/14.
+//
+//
+
+#ifndef __Robot__DeferredRenderer__
+#define __Robot__DeferredRenderer__
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Camera.h"
+#include "Light.h"
+#include "ShaderProgram.h"
+#include "ShadowMaps.h"
+
+/* Deferred shading, for scenes lit by many small lights. The geometry pass draws the models once into a G-buffer -
+ * diffuse and specular albedo, normal and shininess, and depth - and writes the ambient term into a lighting buffer.
+ * The lighting pass then adds each light to the lighting buffer, reading the surface back from the G-buffer, so a
+ * light costs the pixels it covers instead of another pass over the models.
+ *
+ * Lights with a radius are drawn as the back faces of a box around their sphere, so only the pixels they can reach
+ * are shaded, whether or not the camera is inside. Lights without one cover the whole screen. The lighting buffer is
+ * half-float, so many lights can add up past 1 before the result is copied to the window.
+ *
+ * The models are drawn with geometryProgram() through a ModelDrawRun. */
+class DeferredRenderer {
+public:
+    // Creates the buffers at the given framebuffer size
+    DeferredRenderer(unsigned width, unsigned height);
+    ~DeferredRenderer();
+    
+    // Recreates the buffers when the framebuffer size changes
+    void resize(unsigned width, unsigned height);
+    
+    unsigned width() const;
+    unsigned height() const;
+    
+    // Draws into the lower-left width x height of the buffers, for rendering below the framebuffer's resolution. The
+    // size is clamped to the buffers', and resize() resets it to all of them.
+    void setViewport(unsigned width, unsigned height);
+    
+    // Binds and clears the G-buffer. Models drawn with geometryProgram() until beginLightingPass() fill it.
+    void beginGeometryPass(const glm::vec3& ambientLight);
+    ShaderProgram *geometryProgram() const;
+    
+    // Adds lights to the lighting buffer, between beginLightingPass() and endLightingPass()
+    void beginLightingPass(const Camera& camera);
+    void addLights(const Light *lights, unsigned count);
+    
+    // Adds a light shadowed by the shadow maps, which must be bound
+    void addShadowedLight(const Light& light, const ShadowMaps& shadowMaps);
+    
+    // Copies the lighting buffer's viewport to the same part of a framebuffer, by default the window's, and leaves that
+    // framebuffer bound
+    void endLightingPass(GLuint framebuffer = 0);
+    
+    // Lights drawn since the last beginLightingPass(), as volumes and over the whole screen
+    unsigned volumeLightCount() const;
+    unsigned fullScreenLightCount() const;
+    
+private:
+    unsigned _width, _height;
+    unsigned _viewportWidth, _viewportHeight;
+    
+    // The geometry pass renders to every texture, the lighting pass only to the lighting texture, which it blends into
+    GLuint _geometryFramebuffer, _lightingFramebuffer;
+    GLuint _lightingTexture, _diffuseAlbedoTexture, _specularAlbedoTexture, _normalShininessTexture, _depthTexture;
+    
+    ShaderProgram *_geometryProgram;
+    ShaderProgram *_lightProgram;
+    
+    // A unit cube, which the light shader stretches over each light's sphere, or turns into a full-screen triangle
+    GLuint _volumeVao, _volumeVbo, _volumeEbo;
+    
+    unsigned _volumeLightCount, _fullScreenLightCount;
+    
+    // Draws a light with the light program's shadow settings as they are
+    void _drawLight(const Light& light);
+    
+    void _createBuffers();
+    void _deleteBuffers();
+    
+    DeferredRenderer(const DeferredRenderer& other);
+    DeferredRenderer& operator = (const DeferredRenderer& other);
+};
+
+#endif /* defined(__Robot__DeferredRenderer__) */
@@ -0,0 +1,311 @@
+//
+//  DepthRasterizer.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 15/9/14.
+//
+//
+
+#include "DepthRasterizer.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#include "ThreadPool.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DEPTH_RASTERIZER_X86 1
+#include <immintrin.h>
+
+// Compiled for their instruction set regardless of the project-wide flags, like BatchMath's kernels
+#define TARGET_SSE __attribute__((target("sse2")))
+#define TARGET_AVX __attribute__((target("avx")))
+#endif
+
+// Rows are rasterized in steps of the widest kernel, so spans start and end on multiples of it
+static const unsigned SpanAlignment = 8;
+
+static_assert(DepthRasterizer::TileWidth % SpanAlignment == 0, "Tiles must hold whole SIMD steps");
+
+static void CheckInstructionSet(BatchMath::InstructionSet instructionSet) {
+    if (instructionSet > PixelConversion::bestInstructionSet())
+        throw std::runtime_error(std::string("CPU doesn't support ") + PixelConversion::instructionSetName(instructionSet));
+}
+
+// Row kernels: keep the nearest depth of the triangle at each pixel of [x0, x1) in a row whose centers are at py. The
+// edge functions and depth are evaluated the same way by every kernel, so they write the same values.
+
+static void RasterizeRow(const float *a, const float *b, const float *c, float depthX, float depthY, float depth0, float py,
+                         unsigned x0, unsigned x1, float *row) {
+    for (unsigned x = x0; x < x1; ++x) {
+        float px = (float) x + 0.5f;
+        if (a[0] * px + b[0] * py + c[0] >= 0.0f && a[1] * px + b[1] * py + c[1] >= 0.0f && a[2] * px + b[2] * py + c[2] >= 0.0f) {
+            float depth = depthX * px + depthY * py + depth0;
+            row[x] = std::max(row[x], depth);
+        }
+    }
+}
+
+#if DEPTH_RASTERIZER_X86
+
+TARGET_SSE static void RasterizeRowSSE(const float *a, const float *b, const float *c, float depthX, float depthY, float depth0, float py,
+                                       unsigned x0, unsigned x1, float *row) {
+    const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f), zero = _mm_setzero_ps();
+    __m128 a0 = _mm_set1_ps(a[0]), a1 = _mm_set1_ps(a[1]), a2 = _mm_set1_ps(a[2]);
+    __m128 by0 = _mm_set1_ps(b[0] * py), by1 = _mm_set1_ps(b[1] * py), by2 = _mm_set1_ps(b[2] * py);
+    __m128 c0 = _mm_set1_ps(c[0]), c1 = _mm_set1_ps(c[1]), c2 = _mm_set1_ps(c[2]);
+    __m128 dx = _mm_set1_ps(depthX), dy = _mm_set1_ps(depthY * py), d0 = _mm_set1_ps(depth0);
+    
+    for (unsigned x = x0; x < x1; x += 4) {
+        __m128 px = _mm_add_ps(_mm_set1_ps((float) x), laneOffsets);
+        __m128 e0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, px), by0), c0);
+        __m128 e1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a1, px), by1), c1);
+        __m128 e2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a2, px), by2), c2);
+        __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+        if (!_mm_movemask_ps(inside))
+            continue;
+        
+        __m128 depth = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, px), dy), d0);
+        __m128 old = _mm_loadu_ps(row + x);
+        __m128 nearest = _mm_max_ps(old, depth);
+        _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+    }
+}
+
+TARGET_AVX static void RasterizeRowAVX(const float *a, const float *b, const float *c, float depthX, float depthY, float depth0, float py,
+                                       unsigned x0, unsigned x1, float *row) {
+    const __m256 laneOffsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f), zero = _mm256_setzero_ps();
+    __m256 a0 = _mm256_set1_ps(a[0]), a1 = _mm256_set1_ps(a[1]), a2 = _mm256_set1_ps(a[2]);
+    __m256 by0 = _mm256_set1_ps(b[0] * py), by1 = _mm256_set1_ps(b[1] * py), by2 = _mm256_set1_ps(b[2] * py);
+    __m256 c0 = _mm256_set1_ps(c[0]), c1 = _mm256_set1_ps(c[1]), c2 = _mm256_set1_ps(c[2]);
+    __m256 dx = _mm256_set1_ps(depthX), dy = _mm256_set1_ps(depthY * py), d0 = _mm256_set1_ps(depth0);
+    
+    for (unsigned x = x0; x < x1; x += 8) {
+        __m256 px = _mm256_add_ps(_mm256_set1_ps((float) x), laneOffsets);
+        __m256 e0 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a0, px), by0), c0);
+        __m256 e1 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a1, px), by1), c1);
+        __m256 e2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a2, px), by2), c2);
+        __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GE_OQ), _mm256_cmp_ps(e1, zero, _CMP_GE_OQ)),
+                                      _mm256_cmp_ps(e2, zero, _CMP_GE_OQ));
+        if (!_mm256_movemask_ps(inside))
+            continue;
+        
+        __m256 depth = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, px), dy), d0);
+        __m256 old = _mm256_loadu_ps(row + x);
+        _mm256_storeu_ps(row + x, _mm256_blendv_ps(old, _mm256_max_ps(old, depth), inside));
+    }
+}
+
+#endif
+
+DepthRasterizer::DepthRasterizer(unsigned width, unsigned height) : _viewProjection(), _depth(), _triangles(), _clipVertices() {
+    if (width == 0 || height == 0)
+        throw std::runtime_error("Depth buffer must have at least one pixel");
+    
+    _width = (width + TileWidth - 1) / TileWidth * TileWidth;
+    _height = (height + TileHeight - 1) / TileHeight * TileHeight;
+    _depth.resize(_width * _height, 0.0f);
+}
+
+void DepthRasterizer::begin(const glm::mat4& viewProjection) {
+    _viewProjection = viewProjection;
+    _triangles.clear();
+}
+
+void DepthRasterizer::addOccluder(const Model& model, const glm::mat4& transform) {
+    if (model.drawType != GL_TRIANGLES || model.vertexPositions.empty())
+        return;
+    
+    size_t begin = std::min((size_t) model.drawStart, model.triangleIndices.size());
+    size_t end = std::min(model.triangleIndices.size(), begin + (size_t) model.drawCount);
+    addTriangles(&model.vertexPositions[0], model.vertexPositions.size(), model.triangleIndices.data() + begin, end - begin, transform);
+}
+
+void DepthRasterizer::addTriangles(const glm::vec3 *vertices, size_t vertexCount, const GLuint *indices, size_t indexCount,
+                                   const glm::mat4& transform) {
+    glm::mat4 toClip = _viewProjection * transform;
+    _clipVertices.resize(vertexCount);
+    for (size_t i = 0; i < vertexCount; ++i)
+        _clipVertices[i] = toClip * glm::vec4(vertices[i], 1.0f);
+    
+    for (size_t i = 0; i + 3 <= indexCount; i += 3) {
+        if (indices[i] >= vertexCount || indices[i + 1] >= vertexCount || indices[i + 2] >= vertexCount)
+            continue;
+        
+        const glm::vec4 *corners[3] = { &_clipVertices[indices[i]], &_clipVertices[indices[i + 1]], &_clipVertices[indices[i + 2]] };
+        
+        // Skip triangles entirely outside one of the side planes
+        bool outside = false;
+        for (int axis = 0; axis < 2 && !outside; ++axis) {
+            outside = ((*corners[0])[axis] > corners[0]->w && (*corners[1])[axis] > corners[1]->w && (*corners[2])[axis] > corners[2]->w) ||
+                      ((*corners[0])[axis] < -corners[0]->w && (*corners[1])[axis] < -corners[1]->w && (*corners[2])[axis] < -corners[2]->w);
+        }
+        if (outside)
+            continue;
+        
+        // Clip against the near plane, z >= -w, which leaves a triangle or a quad
+        glm::vec4 polygon[4];
+        unsigned polygonSize = 0;
+        for (unsigned corner = 0; corner < 3; ++corner) {
+            const glm::vec4& current = *corners[corner];
+            const glm::vec4& next = *corners[(corner + 1) % 3];
+            float currentDistance = current.z + current.w, nextDistance = next.z + next.w;
+            
+            if (currentDistance >= 0.0f)
+                polygon[polygonSize++] = current;
+            if ((currentDistance >= 0.0f) != (nextDistance >= 0.0f))
+                polygon[polygonSize++] = current + (next - current) * (currentDistance / (currentDistance - nextDistance));
+        }
+        
+        for (unsigned corner = 2; corner < polygonSize; ++corner)
+            _addTriangle(polygon[0], polygon[corner - 1], polygon[corner]);
+    }
+}
+
+void DepthRasterizer::_addTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c) {
+    // To pixel coordinates, with the depth as 1/w
+    glm::vec3 screen[3];
+    const glm::vec4 *clip[3] = { &a, &b, &c };
+    for (unsigned i = 0; i < 3; ++i) {
+        float inverseW = 1.0f / clip[i]->w;
+        screen[i] = glm::vec3((clip[i]->x * inverseW * 0.5f + 0.5f) * _width, (clip[i]->y * inverseW * 0.5f + 0.5f) * _height, inverseW);
+    }
+    
+    // Make the winding counter-clockwise, so inside is where every edge function is positive
+    float area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y) - (screen[1].y - screen[0].y) * (screen[2].x - screen[0].x);
+    if (area == 0.0f)
+        return;
+    if (area < 0.0f) {
+        std::swap(screen[1], screen[2]);
+        area = -area;
+    }
+    
+    float minX = std::min(std::min(screen[0].x, screen[1].x), screen[2].x), maxX = std::max(std::max(screen[0].x, screen[1].x), screen[2].x);
+    float minY = std::min(std::min(screen[0].y, screen[1].y), screen[2].y), maxY = std::max(std::max(screen[0].y, screen[1].y), screen[2].y);
+    if (maxX <= 0.0f || maxY <= 0.0f || minX >= _width || minY >= _height)
+        return;
+    
+    Triangle triangle;
+    triangle.minX = (unsigned) std::max(0.0f, floorf(minX));
+    triangle.minY = (unsigned) std::max(0.0f, floorf(minY));
+    triangle.maxX = (unsigned) std::min((float) _width, ceilf(maxX));
+    triangle.maxY = (unsigned) std::min((float) _height, ceilf(maxY));
+    
+    // Edge i is opposite vertex i, and is zero along it. Depth is the vertices' depths weighted by the edge functions.
+    float inverseArea = 1.0f / area;
+    triangle.depthX = triangle.depthY = triangle.depth0 = 0.0f;
+    for (unsigned i = 0; i < 3; ++i) {
+        const glm::vec3& from = screen[(i + 1) % 3], & to = screen[(i + 2) % 3];
+        triangle.edgeA[i] = from.y - to.y;
+        triangle.edgeB[i] = to.x - from.x;
+        triangle.edgeC[i] = -(triangle.edgeA[i] * from.x + triangle.edgeB[i] * from.y);
+        
+        triangle.depthX += triangle.edgeA[i] * screen[i].z * inverseArea;
+        triangle.depthY += triangle.edgeB[i] * screen[i].z * inverseArea;
+        triangle.depth0 += triangle.edgeC[i] * screen[i].z * inverseArea;
+    }
+    
+    _triangles.push_back(triangle);
+}
+
+void DepthRasterizer::rasterize(BatchMath::InstructionSet instructionSet, ThreadPool& pool) {
+    CheckInstructionSet(instructionSet);
+    
+    unsigned tileCount = (_width / TileWidth) * (_height / TileHeight);
+    pool.parallelFor(tileCount, 1, [this, instructionSet](unsigned begin, unsigned end) {
+        for (unsigned tile = begin; tile < end; ++tile)
+            _rasterizeTile(tile, instructionSet);
+    });
+}
+
+void DepthRasterizer::_rasterizeTile(unsigned tile, BatchMath::InstructionSet instructionSet) {
+    unsigned tileX0 = tile % (_width / TileWidth) * TileWidth, tileY0 = tile / (_width / TileWidth) * TileHeight;
+    unsigned tileX1 = tileX0 + TileWidth, tileY1 = tileY0 + TileHeight;
+    
+    for (unsigned y = tileY0; y < tileY1; ++y)
+        std::fill(&_depth[y * _width + tileX0], &_depth[y * _width + tileX1], 0.0f);
+    
+    for (std::vector<Triangle>::const_iterator it = _triangles.begin(); it != _triangles.end(); ++it) {
+        const Triangle& triangle = *it;
+        if (triangle.maxX <= tileX0 || triangle.minX >= tileX1 || triangle.maxY <= tileY0 || triangle.minY >= tileY1)
+            continue;
+        
+        // Whole SIMD steps within the tile. The pixels this adds outside the triangle fail its edge tests.
+        unsigned x0 = std::max(tileX0, triangle.minX / SpanAlignment * SpanAlignment);
+        unsigned x1 = std::min(tileX1, (triangle.maxX + SpanAlignment - 1) / SpanAlignment * SpanAlignment);
+        unsigned y0 = std::max(tileY0, triangle.minY), y1 = std::min(tileY1, triangle.maxY);
+        
+        for (unsigned y = y0; y < y1; ++y) {
+            float *row = &_depth[y * _width];
+            float py = (float) y + 0.5f;
+
+#if DEPTH_RASTERIZER_X86
+            if (instructionSet >= PixelConversion::InstructionSet_AVX2) {
+                RasterizeRowAVX(triangle.edgeA, triangle.edgeB, triangle.edgeC, triangle.depthX, triangle.depthY, triangle.depth0, py, x0, x1, row);
+                continue;
+            }
+            if (instructionSet >= PixelConversion::InstructionSet_SSSE3) {
+                RasterizeRowSSE(triangle.edgeA, triangle.edgeB, triangle.edgeC, triangle.depthX, triangle.depthY, triangle.depth0, py, x0, x1, row);
+                continue;
+            }
+#endif
+            RasterizeRow(triangle.edgeA, triangle.edgeB, triangle.edgeC, triangle.depthX, triangle.depthY, triangle.depth0, py, x0, x1, row);
+        }
+    }
+}
+
+bool DepthRasterizer::isVisible(const BoundingBox& box) const {
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, nearestDepth = 0.0f;
+    for (unsigned corner = 0; corner < 8; ++corner) {
+        glm::vec3 point(corner & 1 ? box.max.x : box.min.x, corner & 2 ? box.max.y : box.min.y, corner & 4 ? box.max.z : box.min.z);
+        glm::vec4 clip = _viewProjection * glm::vec4(point, 1.0f);
+        
+        // Depth can't be bounded for boxes reaching behind the near plane
+        if (clip.z + clip.w < 0.0f)
+            return true;
+        
+        float inverseW = 1.0f / clip.w;
+        float x = (clip.x * inverseW * 0.5f + 0.5f) * _width, y = (clip.y * inverseW * 0.5f + 0.5f) * _height;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        nearestDepth = std::max(nearestDepth, inverseW);
+    }
+    
+    // Every pixel the box's screen rectangle touches
+    unsigned x0 = (unsigned) std::max(0.0f, floorf(minX)), x1 = (unsigned) std::min((float) _width, ceilf(maxX));
+    unsigned y0 = (unsigned) std::max(0.0f, floorf(minY)), y1 = (unsigned) std::min((float) _height, ceilf(maxY));
+    if (maxX <= 0.0f || maxY <= 0.0f || minX >= _width || minY >= _height)
+        return false;
+    
+    // Visible if any of them is farther than the box's nearest point
+    for (unsigned y = y0; y < y1; ++y) {
+        const float *row = &_depth[y * _width];
+        for (unsigned x = x0; x < x1; ++x) {
+            if (row[x] < nearestDepth)
+                return true;
+        }
+    }
+    
+    return false;
+}
+
+const std::vector<float>& DepthRasterizer::depth() const {
+    return _depth;
+}
+
+unsigned DepthRasterizer::width() const {
+    return _width;
+}
+
+unsigned DepthRasterizer::height() const {
+    return _height;
+}
+
+unsigned DepthRasterizer::triangleCount() const {
+    return (unsigned) _triangles.size();
+}
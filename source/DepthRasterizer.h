@@ -0,0 +1,89 @@
+//
+//  DepthRasterizer.h
+//  Robot
+//
+//  Created by Itamar Ravid on 15/9/14.
+//
+//
+
+#ifndef __Robot__DepthRasterizer__
+#define __Robot__DepthRasterizer__
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "BatchMath.h"
+#include "Model.h"
+#include "ThreadPool.h"
+
+/* A low resolution depth buffer rasterized on the CPU, for occlusion culling without reading anything back from the
+ * GPU. Occluder triangles are rasterized into it, and occludee boxes are tested against it in the same frame.
+ *
+ * The buffer holds 1/w, the reciprocal of the view depth, which interpolates linearly in screen space; larger is
+ * nearer, and 0 means nothing was drawn. Pixels are covered when their center is inside a triangle. The buffer is
+ * split into tiles which the shared thread pool rasterizes in parallel, each row 4 or 8 pixels at a time with SSE or
+ * AVX, picked like BatchMath's kernels. Every level evaluates the same expressions per pixel, so the
+ * buffer doesn't depend on the instruction set or the number of threads. */
+class DepthRasterizer {
+public:
+    // Tile widths are a multiple of the widest SIMD step, and the buffer width a multiple of the tile width
+    static const unsigned TileWidth = 64;
+    static const unsigned TileHeight = 32;
+    
+    // The size is rounded up to whole tiles
+    DepthRasterizer(unsigned width, unsigned height);
+    
+    // Starts a frame from a camera, dropping the last frame's occluders
+    void begin(const glm::mat4& viewProjection);
+    
+    // Adds the triangles of a model drawn with the given transform. Triangles crossing the near plane are clipped.
+    void addOccluder(const Model& model, const glm::mat4& transform);
+    
+    // Adds indexed triangles that aren't a model's, like addOccluder. Indices past the vertices are skipped.
+    void addTriangles(const glm::vec3 *vertices, size_t vertexCount, const GLuint *indices, size_t indexCount,
+                      const glm::mat4& transform);
+    
+    // Clears the buffer and rasterizes the occluders added since begin(), with the tiles spread over the pool
+    void rasterize(BatchMath::InstructionSet instructionSet = PixelConversion::bestInstructionSet(),
+                   ThreadPool& pool = ThreadPool::shared());
+    
+    /* Whether any part of a world-space box might be visible past the occluders. Boxes that cross the near plane are
+     * always visible; boxes outside the screen never are. */
+    bool isVisible(const BoundingBox& box) const;
+    
+    // The depth buffer, bottom row first
+    const std::vector<float>& depth() const;
+    unsigned width() const;
+    unsigned height() const;
+    
+    unsigned triangleCount() const;
+    
+private:
+    // A triangle set up for rasterization, in pixel coordinates. Points are inside when all three edge functions,
+    // a * x + b * y + c, are non-negative, and their depth is depthX * x + depthY * y + depth0.
+    struct Triangle {
+        float edgeA[3], edgeB[3], edgeC[3];
+        float depthX, depthY, depth0;
+        unsigned minX, minY, maxX, maxY; /* Covered pixels, max exclusive */
+    };
+    
+    unsigned _width, _height;
+    glm::mat4 _viewProjection;
+    
+    std::vector<float> _depth;
+    std::vector<Triangle> _triangles;
+    
+    // Scratch space for addOccluder, kept so steady frames don't allocate
+    std::vector<glm::vec4> _clipVertices;
+    
+    // Sets up a triangle from clip-space vertices in front of the near plane
+    void _addTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c);
+    
+    void _rasterizeTile(unsigned tile, BatchMath::InstructionSet instructionSet);
+    
+    DepthRasterizer(const DepthRasterizer& other);
+    DepthRasterizer& operator = (const DepthRasterizer& other);
+};
+
+#endif /* defined(__Robot__DepthRasterizer__) */
@@ -0,0 +1,159 @@
+//
+//  DynamicResolution.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 20/9/14.
+//
+//
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "DynamicResolution.h"
+
+// The smallest fraction of the window's width and height the scene is drawn at
+static const float MinScale = 0.5f;
+
+// Frame times are aimed at TargetFraction of the budget. The scale is kept while they stay between the other two
+// fractions, so it doesn't change every frame.
+static const double TargetFraction = 0.85, LowerFraction = 0.75, UpperFraction = 0.95;
+
+// The most the scale changes in one step: down quickly to absorb a spike, up slowly so it doesn't overshoot
+static const float MaxDecreaseFactor = 0.7f, MaxIncreaseFactor = 1.05f;
+
+DynamicResolution::DynamicResolution(unsigned windowWidth, unsigned windowHeight, double budgetMilliseconds) : _windowWidth(windowWidth),
+    _windowHeight(windowHeight), _enabled(true), _budget(budgetMilliseconds), _scale(1.0f), _width(windowWidth),
+    _height(windowHeight), _lastResultCount(0), _staleResults(0) {
+    _createBuffers();
+}
+
+DynamicResolution::~DynamicResolution() {
+    _deleteBuffers();
+}
+
+void DynamicResolution::resize(unsigned windowWidth, unsigned windowHeight) {
+    if (windowWidth == _windowWidth && windowHeight == _windowHeight)
+        return;
+    
+    _deleteBuffers();
+    _windowWidth = windowWidth;
+    _windowHeight = windowHeight;
+    _createBuffers();
+    _setScale(_scale);
+}
+
+void DynamicResolution::setEnabled(bool enabled) {
+    _enabled = enabled;
+    _setScale(1.0f);
+}
+
+bool DynamicResolution::enabled() const {
+    return _enabled;
+}
+
+void DynamicResolution::setBudget(double milliseconds) {
+    _budget = milliseconds;
+}
+
+double DynamicResolution::budget() const {
+    return _budget;
+}
+
+void DynamicResolution::update(const GpuTimer& frameTimer) {
+    unsigned newResults = frameTimer.resultCount() - _lastResultCount;
+    _lastResultCount = frameTimer.resultCount();
+    if (!_enabled || newResults == 0)
+        return;
+    
+    // The timer reports frames late, so the results right after a change are still of the old scale. When several
+    // come in at once, the latest one is the only one read, so it's enough for it to be new.
+    if (newResults <= _staleResults) {
+        _staleResults -= newResults;
+        return;
+    }
+    _staleResults = 0;
+    
+    double gpuMilliseconds = frameTimer.lastMilliseconds();
+    if (gpuMilliseconds <= 0.0)
+        return;
+    
+    double fraction = gpuMilliseconds / _budget;
+    if (fraction >= LowerFraction && fraction <= UpperFraction)
+        return;
+    
+    float factor = (float) sqrt(TargetFraction / fraction);
+    factor = std::min(std::max(factor, MaxDecreaseFactor), MaxIncreaseFactor);
+    float scale = std::min(std::max(_scale * factor, MinScale), 1.0f);
+    if (scale != _scale)
+        _setScale(scale);
+}
+
+float DynamicResolution::scale() const {
+    return _scale;
+}
+
+unsigned DynamicResolution::width() const {
+    return _width;
+}
+
+unsigned DynamicResolution::height() const {
+    return _height;
+}
+
+GLuint DynamicResolution::framebuffer() const {
+    return _enabled ? _framebuffer : 0;
+}
+
+void DynamicResolution::begin() const {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer());
+    glViewport(0, 0, _width, _height);
+}
+
+void DynamicResolution::end() const {
+    if (!_enabled)
+        return;
+    
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, _framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, _width, _height, 0, 0, _windowWidth, _windowHeight, GL_COLOR_BUFFER_BIT,
+                      _width == _windowWidth && _height == _windowHeight ? GL_NEAREST : GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, _windowWidth, _windowHeight);
+}
+
+void DynamicResolution::_setScale(float scale) {
+    _scale = _enabled ? scale : 1.0f;
+    _width = std::max((unsigned) lroundf(_windowWidth * _scale), 1u);
+    _height = std::max((unsigned) lroundf(_windowHeight * _scale), 1u);
+    
+    // Every measurement still in flight was drawn at the old scale
+    _staleResults = GpuTimer::QueryCount;
+}
+
+void DynamicResolution::_createBuffers() {
+    glGenRenderbuffers(1, &_colorRenderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, _colorRenderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, _windowWidth, _windowHeight);
+    
+    glGenRenderbuffers(1, &_depthRenderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, _depthRenderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, _windowWidth, _windowHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    
+    glGenFramebuffers(1, &_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, _colorRenderbuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, _depthRenderbuffer);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    
+    if (!complete)
+        throw std::runtime_error("Dynamic resolution framebuffer is incomplete");
+}
+
+void DynamicResolution::_deleteBuffers() {
+    glDeleteFramebuffers(1, &_framebuffer);
+    glDeleteRenderbuffers(1, &_colorRenderbuffer);
+    glDeleteRenderbuffers(1, &_depthRenderbuffer);
+}
@@ -0,0 +1,83 @@
+//
+//  DynamicResolution.h
+//  Robot
+//
+//  Created by Itamar Ravid on 20/9/14.
+//
+//
+
+#ifndef __Robot__DynamicResolution__
+#define __Robot__DynamicResolution__
+
+#include <GL/glew.h>
+
+#include "GpuTimer.h"
+
+/* Renders the scene at a lower resolution when the GPU can't keep up, and scales it up to the window.
+ *
+ * The scene is drawn into the lower-left part of an offscreen framebuffer the size of the window, which end()
+ * stretches over the window with a linear blit. update() is fed the GPU time of each frame and keeps it under a budget
+ * by scaling the width and height of the drawn part between half of the window's and all of it. The time goes down with
+ * the pixel count, so the scale moves with the square root of how far the time is from the target. It drops quickly
+ * when frames go over the budget, and climbs back slowly when there's room. After each change it waits until the timer
+ * has returned a result for a frame drawn at the new scale, since the ones still in flight were drawn at the old one.
+ *
+ * While disabled, the scene is drawn straight into the window at full resolution. */
+class DynamicResolution {
+public:
+    // Creates the framebuffer at the window's framebuffer size, with the GPU time budget per frame in milliseconds
+    DynamicResolution(unsigned windowWidth, unsigned windowHeight, double budgetMilliseconds);
+    ~DynamicResolution();
+    
+    // Recreates the framebuffer when the window's framebuffer size changes
+    void resize(unsigned windowWidth, unsigned windowHeight);
+    
+    // Enabling or disabling starts again from full resolution
+    void setEnabled(bool enabled);
+    bool enabled() const;
+    
+    void setBudget(double milliseconds);
+    double budget() const;
+    
+    // Adjusts the scale for the next frames from the frame timer's latest result. Does nothing until the timer has a
+    // new result, so each result is acted on once.
+    void update(const GpuTimer& frameTimer);
+    
+    // The fraction of the window's width and height the scene is drawn at, and the size that makes
+    float scale() const;
+    unsigned width() const;
+    unsigned height() const;
+    
+    // The framebuffer the scene is drawn into, which is the window's while disabled
+    GLuint framebuffer() const;
+    
+    // Binds the framebuffer, with the viewport over the drawn size, and scales the result up to the window afterwards,
+    // leaving the window's framebuffer bound
+    void begin() const;
+    void end() const;
+    
+private:
+    unsigned _windowWidth, _windowHeight;
+    bool _enabled;
+    double _budget;
+    
+    float _scale;
+    unsigned _width, _height;
+    
+    // The timer's result count at the last update, and how many of the results still to come are of frames drawn
+    // before the last change
+    unsigned _lastResultCount;
+    unsigned _staleResults;
+    
+    GLuint _framebuffer, _colorRenderbuffer, _depthRenderbuffer;
+    
+    void _setScale(float scale);
+    
+    void _createBuffers();
+    void _deleteBuffers();
+    
+    DynamicResolution(const DynamicResolution& other);
+    DynamicResolution& operator = (const DynamicResolution& other);
+};
+
+#endif /* defined(__Robot__DynamicResolution__) */
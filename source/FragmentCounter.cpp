@@ -0,0 +1,105 @@
+//
+//  FragmentCounter.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 20/9/14.
+//
+//
+
+#include <cassert>
+
+#include "FragmentCounter.h"
+
+FragmentCounter::FragmentCounter() : _current(0), _counting(false), _lastFragmentCount(0), _totalFragmentCount(0.0), _sampleCount(0) {
+    glGenQueries(FrameCount * MaxSections, &_queries[0][0]);
+    for (unsigned i = 0; i < FrameCount; ++i) {
+        _sectionCounts[i] = 0;
+        _pending[i] = false;
+    }
+}
+
+FragmentCounter::~FragmentCounter() {
+    glDeleteQueries(FrameCount * MaxSections, &_queries[0][0]);
+}
+
+void FragmentCounter::beginFrame() {
+    _collectResults();
+    
+    // If every frame is still in flight the GPU is more than FrameCount frames behind - skip this frame rather than
+    // waiting for it
+    _counting = !_pending[_current];
+    if (_counting)
+        _sectionCounts[_current] = 0;
+}
+
+void FragmentCounter::endFrame() {
+    if (!_counting)
+        return;
+    
+    _pending[_current] = true;
+    _current = (_current + 1) % FrameCount;
+    _counting = false;
+}
+
+void FragmentCounter::begin() {
+    if (!_counting)
+        return;
+    
+    assert(_sectionCounts[_current] < MaxSections);
+    glBeginQuery(GL_SAMPLES_PASSED, _queries[_current][_sectionCounts[_current]]);
+}
+
+void FragmentCounter::end() {
+    if (!_counting)
+        return;
+    
+    glEndQuery(GL_SAMPLES_PASSED);
+    ++_sectionCounts[_current];
+}
+
+GLuint64 FragmentCounter::lastFragmentCount() const {
+    return _lastFragmentCount;
+}
+
+double FragmentCounter::averageFragmentCount() const {
+    return _sampleCount > 0 ? _totalFragmentCount / _sampleCount : 0.0;
+}
+
+unsigned FragmentCounter::averageSampleCount() const {
+    return _sampleCount;
+}
+
+void FragmentCounter::resetAverage() {
+    _totalFragmentCount = 0.0;
+    _sampleCount = 0;
+}
+
+void FragmentCounter::_collectResults() {
+    // Read back the finished frames, oldest first
+    for (unsigned i = 0; i < FrameCount; ++i) {
+        unsigned frame = (_current + i) % FrameCount;
+        if (!_pending[frame])
+            continue;
+        
+        bool available = true;
+        for (unsigned section = 0; section < _sectionCounts[frame] && available; ++section) {
+            GLint sectionAvailable = 0;
+            glGetQueryObjectiv(_queries[frame][section], GL_QUERY_RESULT_AVAILABLE, &sectionAvailable);
+            available = sectionAvailable != 0;
+        }
+        if (!available)
+            break;
+        
+        GLuint64 fragmentCount = 0;
+        for (unsigned section = 0; section < _sectionCounts[frame]; ++section) {
+            GLuint64 sectionFragmentCount = 0;
+            glGetQueryObjectui64v(_queries[frame][section], GL_QUERY_RESULT, &sectionFragmentCount);
+            fragmentCount += sectionFragmentCount;
+        }
+        _pending[frame] = false;
+        
+        _lastFragmentCount = fragmentCount;
+        _totalFragmentCount += fragmentCount;
+        ++_sampleCount;
+    }
+}
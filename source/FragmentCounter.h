@@ -0,0 +1,58 @@
+//
+//  FragmentCounter.h
+//  Robot
+//
+//  Created by Itamar Ravid on 20/9/14.
+//
+//
+
+#ifndef __Robot__FragmentCounter__
+#define __Robot__FragmentCounter__
+
+#include <GL/glew.h>
+
+/* Counts the fragments that pass the depth test in a frame, with GL_SAMPLES_PASSED queries - for the shading pass,
+ * that's the fragments that get shaded. A frame can be counted in a few sections, so the passes in between can run
+ * occlusion queries of their own, which can't be nested with these. Like GpuTimer, frames are kept in a small ring
+ * and only read back once their queries are available, so reading the counter never stalls the pipeline. */
+class FragmentCounter {
+public:
+    FragmentCounter();
+    ~FragmentCounter();
+    
+    // Marks the start/end of a frame, and of each counted section within it. A frame holds up to MaxSections sections.
+    void beginFrame();
+    void endFrame();
+    void begin();
+    void end();
+    
+    // Fragments counted in the most recently completed frame
+    GLuint64 lastFragmentCount() const;
+    
+    // Average per frame of all the frames completed since the last call to resetAverage()
+    double averageFragmentCount() const;
+    unsigned averageSampleCount() const;
+    void resetAverage();
+    
+private:
+    static const unsigned FrameCount = 4, MaxSections = 4;
+    
+    GLuint _queries[FrameCount][MaxSections];
+    unsigned _sectionCounts[FrameCount];
+    bool _pending[FrameCount];
+    unsigned _current;
+    
+    // Whether the current frame is being counted. It isn't if its queries are all still in flight.
+    bool _counting;
+    
+    GLuint64 _lastFragmentCount;
+    double _totalFragmentCount;
+    unsigned _sampleCount;
+    
+    void _collectResults();
+    
+    FragmentCounter(const FragmentCounter& other);
+    FragmentCounter& operator = (const FragmentCounter& other);
+};
+
+#endif /* defined(__Robot__FragmentCounter__) */
@@ -0,0 +1,61 @@
+//
+//  FrameArena.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 11/9/14.
+//
+//
+
+#include "FrameArena.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+FrameArena::FrameArena(size_t capacity) : _buffer(new unsigned char[capacity]), _capacity(capacity), _offset(0), _highWaterMark(0) {
+}
+
+FrameArena::~FrameArena() {
+    delete[] _buffer;
+}
+
+void *FrameArena::allocate(size_t size, size_t alignment) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+        throw std::runtime_error("Arena alignment must be a power of two");
+    
+    // Align the address rather than the offset, since new[] only guarantees the buffer's fundamental alignment
+    size_t address = reinterpret_cast<size_t>(_buffer + _offset);
+    size_t start = _offset + ((alignment - (address & (alignment - 1))) & (alignment - 1));
+    if (start > _capacity || size > _capacity - start)
+        throw std::runtime_error("Frame arena is out of space");
+    
+    _offset = start + size;
+    _highWaterMark = std::max(_highWaterMark, _offset);
+    return _buffer + start;
+}
+
+void FrameArena::reset() {
+    _offset = 0;
+}
+
+size_t FrameArena::mark() const {
+    return _offset;
+}
+
+void FrameArena::rewind(size_t marker) {
+    if (marker > _offset)
+        throw std::runtime_error("Can't rewind the frame arena forward");
+    
+    _offset = marker;
+}
+
+size_t FrameArena::capacity() const {
+    return _capacity;
+}
+
+size_t FrameArena::bytesUsed() const {
+    return _offset;
+}
+
+size_t FrameArena::highWaterMark() const {
+    return _highWaterMark;
+}
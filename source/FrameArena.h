@@ -0,0 +1,73 @@
+//
+//  FrameArena.h
+//  Robot
+//
+//  Created by Itamar Ravid on 11/9/14.
+//
+//
+
+#ifndef __Robot__FrameArena__
+#define __Robot__FrameArena__
+
+#include <cstddef>
+#include <type_traits>
+
+/* A fixed-capacity linear allocator for temporaries that only live for one frame, like draw lists. Allocating bumps
+ * an offset into one block that's allocated up front, and reset() frees everything at the start of the next frame,
+ * so the frame loop never touches the heap.
+ *
+ * Allocations also nest like a stack: a Scope rewinds the arena to where it was when the scope started. Running out
+ * of space throws rather than falling back to the heap - highWaterMark() shows how much a frame really needs. */
+class FrameArena {
+public:
+    explicit FrameArena(size_t capacity);
+    ~FrameArena();
+    
+    // Returns size bytes aligned to alignment, which must be a power of two. The memory isn't initialized.
+    void *allocate(size_t size, size_t alignment = 16);
+    
+    // An uninitialized array of count objects, for types that don't need destructors
+    template <typename T>
+    T *allocateArray(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena memory is freed without running destructors");
+        return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+    }
+    
+    // Frees everything allocated since the last reset
+    void reset();
+    
+    // Frees everything allocated after mark() returned the given offset
+    size_t mark() const;
+    void rewind(size_t marker);
+    
+    // Rewinds the arena when it goes out of scope
+    class Scope {
+    public:
+        explicit Scope(FrameArena& arena) : _arena(arena), _marker(arena.mark()) {}
+        ~Scope() { _arena.rewind(_marker); }
+    
+    private:
+        FrameArena& _arena;
+        size_t _marker;
+        
+        Scope(const Scope& other);
+        Scope& operator = (const Scope& other);
+    };
+    
+    size_t capacity() const;
+    size_t bytesUsed() const;
+    
+    // The most bytes used at once since the arena was created
+    size_t highWaterMark() const;
+    
+private:
+    unsigned char *_buffer;
+    size_t _capacity;
+    size_t _offset;
+    size_t _highWaterMark;
+    
+    FrameArena(const FrameArena& other);
+    FrameArena& operator = (const FrameArena& other);
+};
+
+#endif /* defined(__Robot__FrameArena__) */
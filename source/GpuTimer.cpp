@@ -0,0 +1,83 @@
+//
+//  GpuTimer.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 2/9/14.
+//
+//
+
+#include "GpuTimer.h"
+
+GpuTimer::GpuTimer() : _current(0), _lastMilliseconds(0.0), _totalMilliseconds(0.0), _sampleCount(0), _resultCount(0) {
+    glGenQueries(QueryCount, _queries);
+    for (unsigned i = 0; i < QueryCount; ++i)
+        _pending[i] = false;
+}
+
+GpuTimer::~GpuTimer() {
+    glDeleteQueries(QueryCount, _queries);
+}
+
+void GpuTimer::begin() {
+    _collectResults();
+    
+    // If every query is still in flight the GPU is more than QueryCount frames behind - skip this measurement
+    // rather than waiting for it
+    if (_pending[_current])
+        return;
+    
+    glBeginQuery(GL_TIME_ELAPSED, _queries[_current]);
+}
+
+void GpuTimer::end() {
+    if (_pending[_current])
+        return;
+    
+    glEndQuery(GL_TIME_ELAPSED);
+    _pending[_current] = true;
+    _current = (_current + 1) % QueryCount;
+}
+
+double GpuTimer::lastMilliseconds() const {
+    return _lastMilliseconds;
+}
+
+double GpuTimer::averageMilliseconds() const {
+    return _sampleCount > 0 ? _totalMilliseconds / _sampleCount : 0.0;
+}
+
+unsigned GpuTimer::averageSampleCount() const {
+    return _sampleCount;
+}
+
+void GpuTimer::resetAverage() {
+    _totalMilliseconds = 0.0;
+    _sampleCount = 0;
+}
+
+unsigned GpuTimer::resultCount() const {
+    return _resultCount;
+}
+
+void GpuTimer::_collectResults() {
+    // Read back the finished queries, oldest first
+    for (unsigned i = 0; i < QueryCount; ++i) {
+        unsigned query = (_current + i) % QueryCount;
+        if (!_pending[query])
+            continue;
+        
+        GLint available = 0;
+        glGetQueryObjectiv(_queries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+        
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(_queries[query], GL_QUERY_RESULT, &nanoseconds);
+        _pending[query] = false;
+        
+        _lastMilliseconds = nanoseconds / 1000000.0;
+        _totalMilliseconds += _lastMilliseconds;
+        ++_sampleCount;
+        ++_resultCount;
+    }
+}
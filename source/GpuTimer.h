@@ -0,0 +1,56 @@
+//
+//  GpuTimer.h
+//  Robot
+//
+//  Created by Itamar Ravid on 2/9/14.
+//
+//
+
+#ifndef __Robot__GpuTimer__
+#define __Robot__GpuTimer__
+
+#include <GL/glew.h>
+
+// Measures GPU time of a section of the frame with GL_TIME_ELAPSED queries. Queries are kept in a small ring
+// and are only read back once they're available, so reading the timer never stalls the pipeline.
+class GpuTimer {
+public:
+    // Measurements that can be in flight at once, so results come back at most this many measurements late
+    static const unsigned QueryCount = 4;
+    
+    GpuTimer();
+    ~GpuTimer();
+    
+    // Marks the start/end of the measured section. Calls can't be nested with other GL_TIME_ELAPSED queries.
+    void begin();
+    void end();
+    
+    // Time of the most recently completed measurement, in milliseconds
+    double lastMilliseconds() const;
+    
+    // Average of all the measurements completed since the last call to resetAverage()
+    double averageMilliseconds() const;
+    unsigned averageSampleCount() const;
+    void resetAverage();
+    
+    // Measurements completed since the timer was created. Unlike averageSampleCount(), it's never reset, so it tells
+    // when new results come in.
+    unsigned resultCount() const;
+    
+private:
+    GLuint _queries[QueryCount];
+    bool _pending[QueryCount];
+    unsigned _current;
+    
+    double _lastMilliseconds;
+    double _totalMilliseconds;
+    unsigned _sampleCount;
+    unsigned _resultCount;
+    
+    void _collectResults();
+    
+    GpuTimer(const GpuTimer& other);
+    GpuTimer& operator = (const GpuTimer& other);
+};
+
+#endif /* defined(__Robot__GpuTimer__) */
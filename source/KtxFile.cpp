@@ -0,0 +1,250 @@
+//
+//  KtxFile.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 3/9/14.
+//
+//
+
+#include "KtxFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <stdint.h>
+
+static const unsigned char KtxIdentifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+static const unsigned KtxEndianness = 0x04030201;
+
+// Bitmaps are flipped before upload, so the stored image starts at the bottom row
+static const char KtxOrientationKey[] = "KTXorientation";
+static const char KtxOrientationValue[] = "S=r,T=u";
+
+// The fields following the identifier, in file order
+struct KtxHeader {
+    unsigned endianness;
+    unsigned glType;
+    unsigned glTypeSize;
+    unsigned glFormat;
+    unsigned glInternalFormat;
+    unsigned glBaseInternalFormat;
+    unsigned pixelWidth;
+    unsigned pixelHeight;
+    unsigned pixelDepth;
+    unsigned numberOfArrayElements;
+    unsigned numberOfFaces;
+    unsigned numberOfMipmapLevels;
+    unsigned bytesOfKeyValueData;
+};
+
+// Bytes per 4x4 block of the S3TC formats, or 0 for formats that aren't supported
+static unsigned BlockBytesForFormat(GLenum internalFormat) {
+    switch (internalFormat) {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+            return 8;
+        case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+static inline unsigned PaddedSize(unsigned size) {
+    return (size + 3) & ~3u;
+}
+
+static inline unsigned SwapBytes(unsigned value) {
+    return ((value & 0xff) << 24) | ((value & 0xff00) << 8) | ((value >> 8) & 0xff00) | (value >> 24);
+}
+
+static unsigned ReadUInt(std::ifstream& file, bool swapBytes) {
+    unsigned value = 0;
+    file.read((char *) &value, sizeof(value));
+    return swapBytes ? SwapBytes(value) : value;
+}
+
+static void WriteUInt(std::ofstream& file, unsigned value) {
+    file.write((const char *) &value, sizeof(value));
+}
+
+KtxFile::KtxFile() : _internalFormat(0), _baseInternalFormat(0), _width(0), _height(0), _levels() {
+}
+
+KtxFile::KtxFile(GLenum internalFormat, GLenum baseInternalFormat, unsigned width, unsigned height) :
+    _internalFormat(internalFormat), _baseInternalFormat(baseInternalFormat), _width(width), _height(height), _levels() {
+}
+
+KtxFile KtxFile::ktxFromFile(const std::string& path) {
+    std::ifstream file;
+    file.open(path.c_str(), std::ios::in | std::ios::binary);
+    
+    if (!file.is_open())
+        throw std::runtime_error("Failed to open KTX file: " + path);
+    
+    unsigned char identifier[12];
+    file.read((char *) identifier, sizeof(identifier));
+    if (!file || memcmp(identifier, KtxIdentifier, sizeof(identifier)) != 0)
+        throw std::runtime_error("Not a KTX 1.1 file: " + path);
+    
+    // The endianness field tells us whether the rest of the header needs swapping
+    KtxHeader header;
+    file.read((char *) &header.endianness, sizeof(header.endianness));
+    bool swapBytes = header.endianness != KtxEndianness;
+    if (swapBytes && SwapBytes(header.endianness) != KtxEndianness)
+        throw std::runtime_error("Invalid KTX endianness marker: " + path);
+    
+    header.glType = ReadUInt(file, swapBytes);
+    header.glTypeSize = ReadUInt(file, swapBytes);
+    header.glFormat = ReadUInt(file, swapBytes);
+    header.glInternalFormat = ReadUInt(file, swapBytes);
+    header.glBaseInternalFormat = ReadUInt(file, swapBytes);
+    header.pixelWidth = ReadUInt(file, swapBytes);
+    header.pixelHeight = ReadUInt(file, swapBytes);
+    header.pixelDepth = ReadUInt(file, swapBytes);
+    header.numberOfArrayElements = ReadUInt(file, swapBytes);
+    header.numberOfFaces = ReadUInt(file, swapBytes);
+    header.numberOfMipmapLevels = ReadUInt(file, swapBytes);
+    header.bytesOfKeyValueData = ReadUInt(file, swapBytes);
+    
+    if (!file)
+        throw std::runtime_error("Truncated KTX header: " + path);
+    
+    // glType and glFormat are zero for compressed textures
+    if (header.glType != 0 || header.glFormat != 0)
+        throw std::runtime_error("Only block compressed KTX files are supported: " + path);
+    
+    if (header.pixelDepth > 1 || header.numberOfArrayElements > 0 || header.numberOfFaces != 1 ||
+        header.pixelWidth == 0 || header.pixelHeight == 0)
+        throw std::runtime_error("Only single-face 2D KTX files are supported: " + path);
+    
+    unsigned blockBytes = BlockBytesForFormat(header.glInternalFormat);
+    if (blockBytes == 0)
+        throw std::runtime_error("Only S3TC compressed KTX files are supported: " + path);
+    
+    // A level per halving of the larger dimension, down to 1x1
+    unsigned maxLevels = 1;
+    while ((std::max(header.pixelWidth, header.pixelHeight) >> maxLevels) > 0)
+        ++maxLevels;
+    if (header.numberOfMipmapLevels > maxLevels)
+        throw std::runtime_error("Too many mip levels in KTX file: " + path);
+    
+    KtxFile ktx(header.glInternalFormat, header.glBaseInternalFormat, header.pixelWidth, header.pixelHeight);
+    
+    // We don't need any of the key/value pairs
+    file.seekg(header.bytesOfKeyValueData, std::ios::cur);
+    
+    unsigned levels = header.numberOfMipmapLevels > 0 ? header.numberOfMipmapLevels : 1;
+    for (unsigned level = 0; level < levels; ++level) {
+        unsigned imageSize = ReadUInt(file, swapBytes);
+        
+        // Checked before allocating, so a corrupt size can't ask for more than the level holds
+        unsigned width = std::max(header.pixelWidth >> level, 1u), height = std::max(header.pixelHeight >> level, 1u);
+        uint64_t expectedSize = (uint64_t) ((width + 3) / 4) * ((height + 3) / 4) * blockBytes;
+        if (!file || imageSize != expectedSize)
+            throw std::runtime_error("Wrong image size for a KTX mip level: " + path);
+        
+        std::vector<unsigned char> data(imageSize);
+        if (imageSize > 0)
+            file.read((char *) &data[0], imageSize);
+        file.seekg(PaddedSize(imageSize) - imageSize, std::ios::cur);
+        
+        if (!file)
+            throw std::runtime_error("Truncated KTX image data: " + path);
+        
+        ktx.addLevel(data);
+    }
+    
+    return ktx;
+}
+
+void KtxFile::writeToFile(const std::string& path) const {
+    std::ofstream file;
+    file.open(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    
+    if (!file.is_open())
+        throw std::runtime_error("Failed to open KTX file for writing: " + path);
+    
+    // One key/value pair: its size, then the key and value as null-terminated strings, padded to 4 bytes
+    unsigned keyValueSize = sizeof(KtxOrientationKey) + sizeof(KtxOrientationValue);
+    unsigned keyValueBytes = 4 + PaddedSize(keyValueSize);
+    
+    file.write((const char *) KtxIdentifier, sizeof(KtxIdentifier));
+    WriteUInt(file, KtxEndianness);
+    WriteUInt(file, 0); // glType
+    WriteUInt(file, 1); // glTypeSize
+    WriteUInt(file, 0); // glFormat
+    WriteUInt(file, _internalFormat);
+    WriteUInt(file, _baseInternalFormat);
+    WriteUInt(file, _width);
+    WriteUInt(file, _height);
+    WriteUInt(file, 0); // pixelDepth
+    WriteUInt(file, 0); // numberOfArrayElements
+    WriteUInt(file, 1); // numberOfFaces
+    WriteUInt(file, (unsigned) _levels.size());
+    WriteUInt(file, keyValueBytes);
+    
+    static const char padding[4] = { 0, 0, 0, 0 };
+    WriteUInt(file, keyValueSize);
+    file.write(KtxOrientationKey, sizeof(KtxOrientationKey));
+    file.write(KtxOrientationValue, sizeof(KtxOrientationValue));
+    file.write(padding, PaddedSize(keyValueSize) - keyValueSize);
+    
+    for (unsigned level = 0; level < _levels.size(); ++level) {
+        unsigned imageSize = (unsigned) _levels[level].size();
+        WriteUInt(file, imageSize);
+        if (imageSize > 0)
+            file.write((const char *) &_levels[level][0], imageSize);
+        file.write(padding, PaddedSize(imageSize) - imageSize);
+    }
+    
+    if (!file)
+        throw std::runtime_error("Failed writing KTX file: " + path);
+}
+
+GLenum KtxFile::internalFormat() const {
+    return _internalFormat;
+}
+
+GLenum KtxFile::baseInternalFormat() const {
+    return _baseInternalFormat;
+}
+
+unsigned KtxFile::width() const {
+    return _width;
+}
+
+unsigned KtxFile::height() const {
+    return _height;
+}
+
+unsigned KtxFile::levelCount() const {
+    return (unsigned) _levels.size();
+}
+
+const std::vector<unsigned char>& KtxFile::level(unsigned level) const {
+    if (level >= _levels.size())
+        throw std::runtime_error("KTX mip level out of bounds");
+    
+    return _levels[level];
+}
+
+void KtxFile::addLevel(const std::vector<unsigned char>& data) {
+    _levels.push_back(data);
+}
+
+unsigned KtxFile::levelWidth(unsigned level) const {
+    unsigned width = _width >> level;
+    return width > 0 ? width : 1;
+}
+
+unsigned KtxFile::levelHeight(unsigned level) const {
+    unsigned height = _height >> level;
+    return height > 0 ? height : 1;
+}
@@ -0,0 +1,55 @@
+//
+//  KtxFile.h
+//  Robot
+//
+//  Created by Itamar Ravid on 3/9/14.
+//
+//
+
+#ifndef __Robot__KtxFile__
+#define __Robot__KtxFile__
+
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+/* A KTX 1.1 container holding a block compressed 2D texture and its mip levels. Only the subset of the format
+ * that the asset pipeline writes is supported: a single face, no array layers and no depth. */
+class KtxFile {
+public:
+    KtxFile();
+    KtxFile(GLenum internalFormat, GLenum baseInternalFormat, unsigned width, unsigned height);
+    
+    // Loads a KTX file from disk. Throws if the file is missing, malformed or not block compressed.
+    static KtxFile ktxFromFile(const std::string& path);
+    
+    // Writes the container to disk
+    void writeToFile(const std::string& path) const;
+    
+    // The compressed internal format, e.g. GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+    GLenum internalFormat() const;
+    // The base format, e.g. GL_RGB
+    GLenum baseInternalFormat() const;
+    
+    unsigned width() const;
+    unsigned height() const;
+    
+    // Mip levels, starting with the full-size level 0
+    unsigned levelCount() const;
+    const std::vector<unsigned char>& level(unsigned level) const;
+    void addLevel(const std::vector<unsigned char>& data);
+    
+    // Dimensions of the given mip level
+    unsigned levelWidth(unsigned level) const;
+    unsigned levelHeight(unsigned level) const;
+    
+private:
+    GLenum _internalFormat;
+    GLenum _baseInternalFormat;
+    unsigned _width;
+    unsigned _height;
+    std::vector<std::vector<unsigned char> > _levels;
+};
+
+#endif /* defined(__Robot__KtxFile__) */
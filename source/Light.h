@@ -22,8 +22,11 @@ struct Light {
     glm::vec4 ambientColor;
     // Attentuation coefficient
     float attenuation;
+    // Distance past which the light has no effect, with the attenuation fading to zero on the way. 0 means it reaches
+    // everything.
+    float radius;
     
-    Light() : position(0, 0, 0, 1), diffuseColor(1.0f), specularColor(1.0f), ambientColor(1.0f), attenuation(0.02f) {}
+    Light() : position(0, 0, 0, 1), diffuseColor(1.0f), specularColor(1.0f), ambientColor(1.0f), attenuation(0.02f), radius(0.0f) {}
 };
 
 #endif
@@ -0,0 +1,266 @@
+//
+//  LightClusters.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 18/9/14.
+//
+//
+
+#include "LightClusters.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+#include "ThreadPool.h"
+
+// Creates a buffer texture over a new buffer, with a texel of the given format per element
+static void CreateTextureBuffer(GLenum internalFormat, GLuint& buffer, GLuint& texture) {
+    glGenBuffers(1, &buffer);
+    glGenTextures(1, &texture);
+    
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, internalFormat, buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+// Replaces a buffer's contents, letting the driver orphan the old storage instead of waiting on draws that read it
+static void UploadTextureBuffer(GLuint buffer, const void *data, size_t size) {
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, size, data, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+/* The tiles along one axis that the view-space range [low, high] covers, anywhere between the view depths nearDepth
+ * and farDepth. scale is the projection's scale for the axis. Returns false if the range is off the screen. */
+static bool TileRange(float low, float high, float nearDepth, float farDepth, float scale, unsigned tileCount, unsigned& first, unsigned& last) {
+    // Projected coordinates change monotonically with depth, so the extremes are at the ends of the depth range
+    float ndcLow = scale * std::min(low / nearDepth, low / farDepth);
+    float ndcHigh = scale * std::max(high / nearDepth, high / farDepth);
+    if (ndcHigh < -1.0f || ndcLow > 1.0f)
+        return false;
+    
+    ndcLow = std::max(ndcLow, -1.0f);
+    ndcHigh = std::min(ndcHigh, 1.0f);
+    first = (unsigned) ((ndcLow * 0.5f + 0.5f) * tileCount);
+    last = std::min((unsigned) ((ndcHigh * 0.5f + 0.5f) * tileCount), tileCount - 1);
+    return true;
+}
+
+LightClusters::LightClusters(unsigned width, unsigned height) : _width(width), _height(height), _nearPlane(1.0f), _farPlane(2.0f),
+    _sliceScale(0.0f), _sliceBias(0.0f), _ranges(2 * ClusterCount, 0), _indices(1, 0), _lightData(3), _boxes(),
+    _cursors(ClusterCount, 0), _lightCount(0), _listEntryCount(0), _maxClusterLightCount(0), _droppedEntryCount(0), _lastAssignSeconds(0.0) {
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    _maxIndexCount = (unsigned) maxTexels;
+    
+    CreateTextureBuffer(GL_RG32UI, _rangeBuffer, _rangeTexture);
+    CreateTextureBuffer(GL_R16UI, _indexBuffer, _indexTexture);
+    CreateTextureBuffer(GL_RGBA32F, _lightBuffer, _lightTexture);
+}
+
+LightClusters::~LightClusters() {
+    GLuint buffers[] = { _rangeBuffer, _indexBuffer, _lightBuffer };
+    GLuint textures[] = { _rangeTexture, _indexTexture, _lightTexture };
+    glDeleteTextures(3, textures);
+    glDeleteBuffers(3, buffers);
+}
+
+void LightClusters::resize(unsigned width, unsigned height) {
+    _width = width;
+    _height = height;
+}
+
+void LightClusters::assign(const Camera& camera, const Light *lights, unsigned count) {
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    
+    if (count > MaxLights)
+        throw std::runtime_error("Too many lights for the light clusters");
+    
+    // Slice s starts at the view depth near * (far / near) ^ (s / ClusterCountZ)
+    _nearPlane = camera.nearPlane();
+    _farPlane = camera.farPlane();
+    _sliceScale = ClusterCountZ / logf(_farPlane / _nearPlane);
+    _sliceBias = -logf(_nearPlane) * _sliceScale;
+    for (unsigned slice = 0; slice <= ClusterCountZ; ++slice)
+        _sliceDepths[slice] = _nearPlane * powf(_farPlane / _nearPlane, (float) slice / ClusterCountZ);
+    
+    const glm::mat4& view = camera.view();
+    const glm::mat4& projection = camera.projection();
+    
+    _lightCount = count;
+    _lightData.resize(std::max(3 * count, 1u));
+    _boxes.clear();
+    for (unsigned i = 0; i < count; ++i) {
+        const Light& light = lights[i];
+        _lightData[3 * i] = glm::vec4(glm::vec3(light.position), light.radius);
+        _lightData[3 * i + 1] = glm::vec4(glm::vec3(light.diffuseColor), light.attenuation);
+        _lightData[3 * i + 2] = light.specularColor;
+        
+        _addLight(view, projection, light, i);
+    }
+    
+    // Count each cluster's lights, lay the lists out one after the other, then fill them in light order. Slices
+    // don't share clusters, so they're counted and filled in parallel.
+    ThreadPool::shared().parallelFor(ClusterCountZ, 1, [this](unsigned begin, unsigned end) {
+        for (unsigned z = begin; z < end; ++z)
+            _countSlice(z);
+    });
+    
+    uint32_t offset = 0, total = 0;
+    _maxClusterLightCount = 0;
+    for (unsigned cluster = 0; cluster < ClusterCount; ++cluster) {
+        total += _ranges[2 * cluster + 1];
+        uint32_t clusterCount = std::min(_ranges[2 * cluster + 1], _maxIndexCount - offset);
+        _ranges[2 * cluster] = offset;
+        _ranges[2 * cluster + 1] = clusterCount;
+        _cursors[cluster] = 0;
+        
+        offset += clusterCount;
+        _maxClusterLightCount = std::max(_maxClusterLightCount, clusterCount);
+    }
+    _listEntryCount = offset;
+    _droppedEntryCount = total - offset;
+    
+    _indices.resize(std::max(offset, 1u));
+    ThreadPool::shared().parallelFor(ClusterCountZ, 1, [this](unsigned begin, unsigned end) {
+        for (unsigned z = begin; z < end; ++z)
+            _fillSlice(z);
+    });
+    
+    _upload();
+    
+    _lastAssignSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void LightClusters::bind() const {
+    glActiveTexture(GL_TEXTURE0 + TextureUnit_Ranges);
+    glBindTexture(GL_TEXTURE_BUFFER, _rangeTexture);
+    glActiveTexture(GL_TEXTURE0 + TextureUnit_Indices);
+    glBindTexture(GL_TEXTURE_BUFFER, _indexTexture);
+    glActiveTexture(GL_TEXTURE0 + TextureUnit_Lights);
+    glBindTexture(GL_TEXTURE_BUFFER, _lightTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void LightClusters::unbind() const {
+    for (int unit = TextureUnit_Lights; unit >= TextureUnit_Ranges; --unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void LightClusters::setUniforms(ShaderProgram *program) const {
+    program->setUniform("clusterLightRanges", (GLint) TextureUnit_Ranges);
+    program->setUniform("clusterLightIndices", (GLint) TextureUnit_Indices);
+    program->setUniform("pointLights", (GLint) TextureUnit_Lights);
+    program->setUniform("clusterCounts", (GLint) ClusterCountX, (GLint) ClusterCountY, (GLint) ClusterCountZ);
+    program->setUniform("clusterParameters", glm::vec4((float) ClusterCountX / _width, (float) ClusterCountY / _height, _sliceScale, _sliceBias));
+}
+
+unsigned LightClusters::lightCount() const {
+    return _lightCount;
+}
+
+unsigned LightClusters::listEntryCount() const {
+    return _listEntryCount;
+}
+
+unsigned LightClusters::maxClusterLightCount() const {
+    return _maxClusterLightCount;
+}
+
+unsigned LightClusters::droppedEntryCount() const {
+    return _droppedEntryCount;
+}
+
+double LightClusters::lastAssignSeconds() const {
+    return _lastAssignSeconds;
+}
+
+unsigned LightClusters::_slice(float depth) const {
+    float slice = logf(depth) * _sliceScale + _sliceBias;
+    if (slice <= 0.0f)
+        return 0;
+    
+    return std::min((unsigned) slice, ClusterCountZ - 1);
+}
+
+void LightClusters::_addLight(const glm::mat4& view, const glm::mat4& projection, const Light& light, uint32_t index) {
+    if (light.radius <= 0.0f) {
+        ClusterBox box = { index, 0, ClusterCountX - 1, 0, ClusterCountY - 1, 0, ClusterCountZ - 1 };
+        _boxes.push_back(box);
+        return;
+    }
+    
+    // The sphere's bounding box in view space, cut to the frustum's depth range
+    glm::vec3 center = glm::vec3(view * glm::vec4(glm::vec3(light.position), 1.0f));
+    float radius = light.radius;
+    float nearDepth = -center.z - radius, farDepth = -center.z + radius;
+    if (farDepth < _nearPlane || nearDepth > _farPlane)
+        return;
+    
+    nearDepth = std::max(nearDepth, _nearPlane);
+    farDepth = std::min(farDepth, _farPlane);
+    
+    unsigned lastSlice = _slice(farDepth);
+    for (unsigned slice = _slice(nearDepth); slice <= lastSlice; ++slice) {
+        // The box narrows on the screen with depth, so each slice gets the tiles of its own part of the box
+        float sliceNear = std::max(nearDepth, _sliceDepths[slice]);
+        float sliceFar = std::max(sliceNear, std::min(farDepth, _sliceDepths[slice + 1]));
+        
+        unsigned firstX, lastX, firstY, lastY;
+        if (!TileRange(center.x - radius, center.x + radius, sliceNear, sliceFar, projection[0][0], ClusterCountX, firstX, lastX) ||
+            !TileRange(center.y - radius, center.y + radius, sliceNear, sliceFar, projection[1][1], ClusterCountY, firstY, lastY))
+            continue;
+        
+        ClusterBox box = { index, (uint8_t) firstX, (uint8_t) lastX, (uint8_t) firstY, (uint8_t) lastY, (uint8_t) slice, (uint8_t) slice };
+        _boxes.push_back(box);
+    }
+}
+
+void LightClusters::_countSlice(unsigned z) {
+    uint32_t *ranges = &_ranges[2 * ClusterCountX * ClusterCountY * z];
+    for (unsigned cluster = 0; cluster < ClusterCountX * ClusterCountY; ++cluster)
+        ranges[2 * cluster + 1] = 0;
+    
+    for (std::vector<ClusterBox>::const_iterator box = _boxes.begin(); box != _boxes.end(); ++box) {
+        if (z < box->firstZ || z > box->lastZ)
+            continue;
+        
+        for (unsigned y = box->firstY; y <= box->lastY; ++y) {
+            for (unsigned x = box->firstX; x <= box->lastX; ++x)
+                ++ranges[2 * (x + ClusterCountX * y) + 1];
+        }
+    }
+}
+
+void LightClusters::_fillSlice(unsigned z) {
+    const uint32_t *ranges = &_ranges[2 * ClusterCountX * ClusterCountY * z];
+    uint32_t *cursors = &_cursors[ClusterCountX * ClusterCountY * z];
+    
+    for (std::vector<ClusterBox>::const_iterator box = _boxes.begin(); box != _boxes.end(); ++box) {
+        if (z < box->firstZ || z > box->lastZ)
+            continue;
+        
+        for (unsigned y = box->firstY; y <= box->lastY; ++y) {
+            for (unsigned x = box->firstX; x <= box->lastX; ++x) {
+                unsigned cluster = x + ClusterCountX * y;
+                if (cursors[cluster] < ranges[2 * cluster + 1])
+                    _indices[ranges[2 * cluster] + cursors[cluster]++] = (uint16_t) box->light;
+            }
+        }
+    }
+}
+
+void LightClusters::_upload() {
+    UploadTextureBuffer(_rangeBuffer, _ranges.data(), _ranges.size() * sizeof(uint32_t));
+    UploadTextureBuffer(_indexBuffer, _indices.data(), _indices.size() * sizeof(uint16_t));
+    UploadTextureBuffer(_lightBuffer, _lightData.data(), _lightData.size() * sizeof(glm::vec4));
+}
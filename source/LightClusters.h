@@ -0,0 +1,127 @@
+//
+//  LightClusters.h
+//  Robot
+//
+//  Created by Itamar Ravid on 18/9/14.
+//
+//
+
+#ifndef __Robot__LightClusters__
+#define __Robot__LightClusters__
+
+#include <stdint.h>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Camera.h"
+#include "Light.h"
+#include "ShaderProgram.h"
+
+/* Light lists for clustered forward shading. The view frustum is split into clusters - ClusterCountX by ClusterCountY
+ * tiles of the window, by ClusterCountZ slices of depth - and each light is listed in the clusters its sphere reaches.
+ * The forward fragment shader finds its cluster from its window position and view depth, and only loops over that
+ * cluster's lights, so a pixel pays for the lights near it rather than for every light. Unlike deferred shading, the
+ * models are still lit in the pass that draws them.
+ *
+ * Depth slices are spaced exponentially between the camera's near and far planes, so clusters are about as deep as
+ * they are wide. Lights are tested against each cluster with the bounding box of their sphere. Lights without a radius
+ * are listed in every cluster.
+ *
+ * Lights are assigned on the CPU, and the lists are uploaded to texture buffers for the shader, since the context has
+ * neither compute shaders nor storage buffers. */
+class LightClusters {
+public:
+    static const unsigned ClusterCountX = 16, ClusterCountY = 9, ClusterCountZ = 24;
+    static const unsigned ClusterCount = ClusterCountX * ClusterCountY * ClusterCountZ;
+    
+    // Lights are indexed with 16 bits in the lists
+    static const unsigned MaxLights = 0xffff;
+    
+    // The texture units the buffers are bound to. Unit 0 is left for the material texture.
+    enum TextureUnit {
+        TextureUnit_Ranges = 1,
+        TextureUnit_Indices,
+        TextureUnit_Lights
+    };
+    
+    // The tiles are laid over a framebuffer of the given size
+    LightClusters(unsigned width, unsigned height);
+    ~LightClusters();
+    
+    void resize(unsigned width, unsigned height);
+    
+    // Lists each light in the clusters of the camera's frustum it reaches, and uploads the lists. Throws if there are
+    // more than MaxLights lights.
+    void assign(const Camera& camera, const Light *lights, unsigned count);
+    
+    // Bind the buffers to their texture units around the draws that read them
+    void bind() const;
+    void unbind() const;
+    
+    // Sets a program's cluster uniforms for the last assignment. The program must be in use.
+    void setUniforms(ShaderProgram *program) const;
+    
+    // The last assignment's lights, entries in the cluster lists, and the most lights in a single cluster
+    unsigned lightCount() const;
+    unsigned listEntryCount() const;
+    unsigned maxClusterLightCount() const;
+    
+    // Entries left out of the last assignment's lists because they didn't fit in a texture buffer
+    unsigned droppedEntryCount() const;
+    
+    // CPU time of the last assignment
+    double lastAssignSeconds() const;
+    
+private:
+    // A box of clusters a light reaches, inclusive on both ends
+    struct ClusterBox {
+        uint32_t light;
+        uint8_t firstX, lastX, firstY, lastY, firstZ, lastZ;
+    };
+    
+    unsigned _width, _height;
+    
+    // The camera's planes and the factors that turn log(depth) into a slice, as of the last assignment
+    float _nearPlane, _farPlane, _sliceScale, _sliceBias;
+    
+    // The data of the texture buffers: an offset and count in the list per cluster, the lists of light indices, and
+    // three texels per light (position and radius, diffuse color and attenuation, specular color)
+    std::vector<uint32_t> _ranges;
+    std::vector<uint16_t> _indices;
+    std::vector<glm::vec4> _lightData;
+    
+    // This assignment's boxes, and how many entries of each cluster are in the lists so far
+    std::vector<ClusterBox> _boxes;
+    std::vector<uint32_t> _cursors;
+    
+    // The view depth where each slice starts, and where the last one ends
+    float _sliceDepths[ClusterCountZ + 1];
+    
+    // The most texels a texture buffer can hold
+    unsigned _maxIndexCount;
+    
+    GLuint _rangeBuffer, _indexBuffer, _lightBuffer;
+    GLuint _rangeTexture, _indexTexture, _lightTexture;
+    
+    unsigned _lightCount, _listEntryCount, _maxClusterLightCount, _droppedEntryCount;
+    double _lastAssignSeconds;
+    
+    // The slice holding a view depth, clamped to the grid
+    unsigned _slice(float depth) const;
+    
+    // Appends boxes over the clusters the light reaches
+    void _addLight(const glm::mat4& view, const glm::mat4& projection, const Light& light, uint32_t index);
+    
+    // Count the lights of each cluster in a slice, then list them once the lists are laid out
+    void _countSlice(unsigned z);
+    void _fillSlice(unsigned z);
+    
+    void _upload();
+    
+    LightClusters(const LightClusters& other);
+    LightClusters& operator = (const LightClusters& other);
+};
+
+#endif /* defined(__Robot__LightClusters__) */
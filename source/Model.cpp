@@ -8,33 +8,38 @@
 
 #include "Loaders.h"
 #include "Model.h"
+#include "ShadowMaps.h"
+
+#include <algorithm>
+#include <cmath>
 
 // Constructor
-Model::Model() : shaders(nullptr), texture(nullptr),
-    vbo(0), tbo(0), nbo(0), vao(0), ebo(0),
+Model::Model() : shaders(nullptr), texture(nullptr), textureLayer(0),
+    vbo(0), tbo(0), nbo(0), vao(0), depthVao(0), ebo(0),
     drawType(GL_TRIANGLES), drawStart(0), drawCount(0),
-    ambientColor(1.0f), diffuseColor(1.0f), specularColor(1.0f), shininess(0.0f) {
+    ambientColor(1.0f), diffuseColor(1.0f), specularColor(1.0f), shininess(0.0f),
+    boundsCenter(0.0f), boundsRadius(0.0f), boundingBox(), vertexPositions(), triangleIndices(), textureDensity(0.0f) {
     genBuffers();
 }
 
 Model::Model(GLenum drawType, GLuint drawCount, GLuint drawStart,
                 glm::vec4 ambientColor, glm::vec4 diffuseColor, glm::vec4 specularColor, GLfloat shininess,
-                const char *texturePath, const char *vertexShaderPath, const char *fragmentShaderPath) :
-                drawType(drawType), drawCount(drawCount), drawStart(drawStart),
-                ambientColor(ambientColor), diffuseColor(diffuseColor), specularColor(specularColor), shininess(shininess) {
+                const TextureLayer& texture, const char *vertexShaderPath, const char *fragmentShaderPath) :
+                texture(texture.texture), textureLayer(texture.layer), drawType(drawType), drawCount(drawCount), drawStart(drawStart),
+                ambientColor(ambientColor), diffuseColor(diffuseColor), specularColor(specularColor), shininess(shininess),
+                boundsCenter(0.0f), boundsRadius(0.0f), boundingBox(), vertexPositions(), triangleIndices(), textureDensity(0.0f) {
     shaders = programWithShaders(vertexShaderPath, fragmentShaderPath);
-    texture = textureFromFile(texturePath);
     genBuffers();
 }
 
 Model::Model(const std::vector<glm::vec3>& vertexData, const std::vector<glm::vec2>& textureData, const std::vector<glm::vec3>& normalData, const std::vector<GLuint>& elementData,
      GLenum drawType, GLuint drawCount, GLuint drawStart,
      glm::vec4 ambientColor, glm::vec4 diffuseColor, glm::vec4 specularColor, GLfloat shininess,
-     const char *texturePath, const char *vertexShaderPath, const char *fragmentShaderPath) :
-     drawType(drawType), drawCount(drawCount), drawStart(drawStart),
-     ambientColor(ambientColor), diffuseColor(diffuseColor), specularColor(specularColor), shininess(shininess) {
+     const TextureLayer& texture, const char *vertexShaderPath, const char *fragmentShaderPath) :
+     texture(texture.texture), textureLayer(texture.layer), drawType(drawType), drawCount(drawCount), drawStart(drawStart),
+     ambientColor(ambientColor), diffuseColor(diffuseColor), specularColor(specularColor), shininess(shininess),
+     boundsCenter(0.0f), boundsRadius(0.0f), boundingBox(), vertexPositions(), triangleIndices(), textureDensity(0.0f) {
     shaders = programWithShaders(vertexShaderPath, fragmentShaderPath);
-    texture = textureFromFile(texturePath);
     genBuffers();
     loadData(vertexData, textureData, normalData, elementData);
 }
@@ -44,6 +49,7 @@ void Model::genBuffers() {
     glGenBuffers(1, &nbo);
     glGenBuffers(1, &tbo);
     glGenVertexArrays(1, &vao);
+    glGenVertexArrays(1, &depthVao);
     glGenBuffers(1, &ebo);
 }
 
@@ -74,46 +80,143 @@ void Model::loadData(const std::vector<glm::vec3>& vertexData, const std::vector
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, elementData.size() * sizeof(GLuint), &elementData[0], GL_STATIC_DRAW);
     
+    // The depth-only stream reads the same position and index buffers, and nothing else
+    glBindVertexArray(depthVao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glEnableVertexAttribArray(ShaderProgram::VertexAttribute_Position);
+    glVertexAttribPointer(ShaderProgram::VertexAttribute_Position, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), NULL);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    
+    glBindVertexArray(0);
+    
+    vertexPositions = vertexData;
+    triangleIndices = elementData;
+    computeBounds(vertexData, textureData, elementData);
+}
+
+void Model::computeBounds(const std::vector<glm::vec3>& vertexData, const std::vector<glm::vec2>& textureData, const std::vector<GLuint>& elementData) {
+    if (vertexData.empty())
+        return;
+    
+    glm::vec3 minimum = vertexData[0], maximum = vertexData[0];
+    for (std::vector<glm::vec3>::const_iterator it = vertexData.begin(); it != vertexData.end(); ++it) {
+        minimum = glm::min(minimum, *it);
+        maximum = glm::max(maximum, *it);
+    }
+    
+    boundingBox.min = minimum;
+    boundingBox.max = maximum;
+    
+    boundsCenter = (minimum + maximum) * 0.5f;
+    boundsRadius = 0.0f;
+    for (std::vector<glm::vec3>::const_iterator it = vertexData.begin(); it != vertexData.end(); ++it)
+        boundsRadius = std::max(boundsRadius, glm::length(*it - boundsCenter));
+    
+    // Ratio of the texture coordinate area to the surface area. Its square root is the density along one axis.
+    float surfaceArea = 0.0f, textureArea = 0.0f;
+    for (size_t i = 0; i + 2 < elementData.size(); i += 3) {
+        GLuint a = elementData[i], b = elementData[i + 1], c = elementData[i + 2];
+        if (a >= vertexData.size() || b >= vertexData.size() || c >= vertexData.size() ||
+            a >= textureData.size() || b >= textureData.size() || c >= textureData.size())
+            continue;
+        
+        surfaceArea += 0.5f * glm::length(glm::cross(vertexData[b] - vertexData[a], vertexData[c] - vertexData[a]));
+        
+        glm::vec2 u = textureData[b] - textureData[a], v = textureData[c] - textureData[a];
+        textureArea += 0.5f * fabsf(u.x * v.y - u.y * v.x);
+    }
+    
+    textureDensity = surfaceArea > 0.0f ? sqrtf(textureArea / surfaceArea) : 0.0f;
+}
+
+void Model::renderDepth(ShaderProgram *program, const glm::mat4& transform) const {
+    program->setUniform("model", transform);
+    
+    glBindVertexArray(depthVao);
+    glDrawElements(drawType, drawCount, GL_UNSIGNED_INT, 0);
     glBindVertexArray(0);
 }
 
-ModelInstance::ModelInstance() : model(nullptr), transform() {}
+ModelDrawRun::ModelDrawRun(const Camera& camera, const Light& lightSource, const LightClusters& lightClusters,
+                           const ShadowMaps& shadowMaps, ShaderProgram *program) : _camera(camera),
+    _lightSource(lightSource), _lightClusters(lightClusters), _shadowMaps(shadowMaps), _overrideProgram(program),
+    _program(nullptr), _texture(nullptr), _material(nullptr), _preparedProgramCount(0) {
+}
+
+void ModelDrawRun::draw(const Model& model, const glm::mat4& transform, const glm::mat3& normalMatrix) {
+    ShaderProgram *program = _overrideProgram ? _overrideProgram : model.shaders;
+    if (program != _program) {
+        program->use();
+        _prepareProgram(program);
+        _program = program;
+        
+        // The material uniforms are the program's, left from whichever model it drew last
+        _material = nullptr;
+    }
+    
+    if (model.texture != _texture) {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(model.texture->target(), model.texture->handle());
+        _texture = model.texture;
+    }
+    
+    // Set the per-instance uniforms
+    program->setUniform("model", transform);
+    program->setUniform("normalModel", normalMatrix);
+    program->setUniform("materialLayer", model.textureLayer);
+    if (&model != _material) {
+        program->setUniform("material.ambient", model.ambientColor);
+        program->setUniform("material.diffuse", model.diffuseColor);
+        program->setUniform("material.specular", model.specularColor);
+        program->setUniform("material.shininess", model.shininess);
+        _material = &model;
+    }
+    
+    glBindVertexArray(model.vao);
+    glDrawElements(model.drawType, model.drawCount, GL_UNSIGNED_INT, 0);
+}
 
-ModelInstance::ModelInstance(Model *model) : model(model), transform() {}
+void ModelDrawRun::invalidate() {
+    _program = nullptr;
+    _texture = nullptr;
+    _material = nullptr;
+}
 
-void ModelInstance::render(const glm::mat4 transform, Camera& cameraPosition, Light& lightSource) {
-    ShaderProgram *shaders = model->shaders;
-    
-    // Start using the shader program
-    shaders->use();
-    
-    // Set the uniforms
-    shaders->setUniform("model", transform);
-    shaders->setUniform("view", cameraPosition.view());
-    shaders->setUniform("projection", cameraPosition.projection());
-    
-    shaders->setUniform("materialTexture", 0);
-    shaders->setUniform("material.ambient", model->ambientColor);
-    shaders->setUniform("material.diffuse", model->diffuseColor);
-    shaders->setUniform("material.specular", model->specularColor);
-    shaders->setUniform("material.shininess", model->shininess);
-    
-    shaders->setUniform("light.position", lightSource.position);
-    shaders->setUniform("light.diffuse", lightSource.diffuseColor);
-    shaders->setUniform("light.specular", lightSource.specularColor);
-    shaders->setUniform("light.ambient", lightSource.ambientColor);
-    shaders->setUniform("light.attenuation", lightSource.attenuation);
-    
-    // Bind texture
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, model->texture->handle());
-    
-    // Bind VAO and draw
-    glBindVertexArray(model->vao);
-    glDrawElements(model->drawType, model->drawCount, GL_UNSIGNED_INT, 0);
-    
-    // Unbind everything
+void ModelDrawRun::end() {
     glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    shaders->stopUsing();
-}
\ No newline at end of file
+    if (_texture) {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(_texture->target(), 0);
+    }
+    if (_program)
+        _program->stopUsing();
+    
+    invalidate();
+    _preparedProgramCount = 0;
+}
+
+void ModelDrawRun::_prepareProgram(ShaderProgram *program) {
+    for (unsigned i = 0; i < _preparedProgramCount; ++i) {
+        if (_preparedPrograms[i] == program)
+            return;
+    }
+    
+    program->setUniform("view", _camera.view());
+    program->setUniform("projection", _camera.projection());
+    program->setUniform("materialTexture", 0);
+    
+    if (!_overrideProgram) {
+        program->setUniform("light.position", _lightSource.position);
+        program->setUniform("light.diffuse", _lightSource.diffuseColor);
+        program->setUniform("light.specular", _lightSource.specularColor);
+        program->setUniform("light.ambient", _lightSource.ambientColor);
+        program->setUniform("light.attenuation", _lightSource.attenuation);
+        program->setUniform("light.radius", _lightSource.radius);
+        _lightClusters.setUniforms(program);
+        _shadowMaps.setUniforms(program);
+    }
+    
+    // Past MaxPrograms, the extra programs just get their uniforms set every time they're bound
+    if (_preparedProgramCount < MaxPrograms)
+        _preparedPrograms[_preparedProgramCount++] = program;
+}
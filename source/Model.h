@@ -11,10 +11,15 @@
 
 #include <glm/glm.hpp>
 
+#include "BatchMath.h"
 #include "ShaderProgram.h"
 #include "Texture.h"
+#include "TextureLibrary.h"
 #include "Camera.h"
 #include "Light.h"
+#include "LightClusters.h"
+
+class ShadowMaps;
 
 struct ModelData {
     std::vector<glm::vec3> vertexData;
@@ -29,18 +34,27 @@ struct ModelTransform {
     glm::mat4 translate;
     
     ModelTransform() : scale(), rotate(), translate() {}
+    explicit ModelTransform(const glm::mat4& translate) : scale(), rotate(), translate(translate) {}
+    
     glm::mat4 matrix() const { return translate * rotate * scale; }
+    
+    bool operator == (const ModelTransform& other) const { return translate == other.translate && rotate == other.rotate && scale == other.scale; }
+    bool operator != (const ModelTransform& other) const { return !(*this == other); }
 };
 
 class Model {
 public:
     ShaderProgram *shaders;
+    
+    // Texture array and the layer holding this model's material
     Texture *texture;
+    GLint textureLayer;
     
     GLuint vbo; // Vertex buffer
     GLuint tbo; // Texture coordinates buffer
     GLuint nbo; // Normal coordinates buffer
     GLuint vao; // Vertex array
+    GLuint depthVao; // Vertex array with only the positions, for depth-only passes
     GLuint ebo; // Index buffer
     
     // Vertex parameters
@@ -54,29 +68,82 @@ public:
     glm::vec4 specularColor;
     GLfloat shininess;
     
+    // Bounding sphere and box of the vertices, in model space
+    glm::vec3 boundsCenter;
+    GLfloat boundsRadius;
+    BoundingBox boundingBox;
+    
+    // Copies of the vertex positions and indices, for picking rays against the triangles on the CPU
+    std::vector<glm::vec3> vertexPositions;
+    std::vector<GLuint> triangleIndices;
+    
+    // Texture coordinate units per model space unit, averaged over the triangles' areas. Used to estimate which mip
+    // levels of the texture are visible.
+    GLfloat textureDensity;
+    
     Model();
     Model(GLenum drawType, GLuint drawCount, GLuint drawStart,
           glm::vec4 ambientColor, glm::vec4 diffuseColor, glm::vec4 specularColor, GLfloat shininess,
-          const char *texturePath, const char *vertexShaderPath, const char *fragmentShaderPath);
+          const TextureLayer& texture, const char *vertexShaderPath, const char *fragmentShaderPath);
     Model(const std::vector<glm::vec3>& vertexData, const std::vector<glm::vec2>& textureData, const std::vector<glm::vec3>& normalData, const std::vector<GLuint>& elementData,
           GLenum drawType, GLuint drawCount, GLuint drawStart,
           glm::vec4 ambientColor, glm::vec4 diffuseColor, glm::vec4 specularColor, GLfloat shininess,
-          const char *texturePath, const char *vertexShaderPath, const char *fragmentShaderPath);
+          const TextureLayer& texture, const char *vertexShaderPath, const char *fragmentShaderPath);
     void loadData(const std::vector<glm::vec3>& vertexData, const std::vector<glm::vec2>& textureData, const std::vector<glm::vec3>& normalData, const std::vector<GLuint>& elementData);
+    
+    // Draws the model's positions alone with a depth-only program, which must be in use, setting only its "model"
+    // uniform
+    void renderDepth(ShaderProgram *program, const glm::mat4& transform) const;
 private:
     void genBuffers();
+    void computeBounds(const std::vector<glm::vec3>& vertexData, const std::vector<glm::vec2>& textureData, const std::vector<GLuint>& elementData);
 };
 
-class ModelInstance {
+/* Draws a run of models, keeping the state consecutive draws share bound between them. A draw only binds the program
+ * and the texture array when they differ from the previous draw's, and otherwise sets just the per-instance uniforms -
+ * the model and normal matrices and the texture layer - plus the material colors when the model changes. The uniforms
+ * shared by the whole run, the camera's and the lights', are set on each program the first time the run binds it,
+ * since programs keep their uniforms.
+ *
+ * Anything that binds another program or texture in the middle of a run must call invalidate() before the next draw. */
+class ModelDrawRun {
 public:
-    // The model itself
-    Model *model;
-    // The transformation to be applied to this instance
-    ModelTransform transform;
-    
-    ModelInstance();
-    ModelInstance(Model *model);
-    void render(const glm::mat4 transform, Camera& cameraPosition, Light& lightSource);
+    // Draws with each model's own program, lit by the light source with the shadow maps' shadows, and by the clusters'
+    // point lights, which must all outlive the run. The clusters and the shadow maps must be bound. If program isn't
+    // null it's used for every model instead, with the transform and material uniforms but no light - for passes like
+    // the G-buffer pass, which read the same vertex streams.
+    ModelDrawRun(const Camera& camera, const Light& lightSource, const LightClusters& lightClusters,
+                 const ShadowMaps& shadowMaps, ShaderProgram *program = nullptr);
+    
+    void draw(const Model& model, const glm::mat4& transform, const glm::mat3& normalMatrix);
+    
+    // Forgets the bound state, so the next draw binds everything again
+    void invalidate();
+    
+    // Unbinds what the run left bound
+    void end();
+    
+private:
+    // Programs a run can set its uniforms on. The models share a handful of programs.
+    static const unsigned MaxPrograms = 16;
+    
+    const Camera& _camera;
+    const Light& _lightSource;
+    const LightClusters& _lightClusters;
+    const ShadowMaps& _shadowMaps;
+    ShaderProgram *_overrideProgram;
+    
+    ShaderProgram *_program;
+    const Texture *_texture;
+    const Model *_material;
+    
+    ShaderProgram *_preparedPrograms[MaxPrograms];
+    unsigned _preparedProgramCount;
+    
+    void _prepareProgram(ShaderProgram *program);
+    
+    ModelDrawRun(const ModelDrawRun& other);
+    ModelDrawRun& operator = (const ModelDrawRun& other);
 };
 
 #endif
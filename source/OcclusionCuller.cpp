@@ -0,0 +1,173 @@
+//
+//  OcclusionCuller.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 14/9/14.
+//
+//
+
+#include "OcclusionCuller.h"
+
+#include <algorithm>
+
+#include "Loaders.h"
+
+static const GLfloat CubeVertices[] = {
+    0, 0, 0,  1, 0, 0,  0, 1, 0,  1, 1, 0,
+    0, 0, 1,  1, 0, 1,  0, 1, 1,  1, 1, 1
+};
+
+static const GLubyte CubeIndices[] = {
+    0, 2, 1,  1, 2, 3, /* z = 0 */
+    4, 5, 6,  5, 7, 6, /* z = 1 */
+    0, 1, 4,  1, 5, 4, /* y = 0 */
+    2, 6, 3,  3, 6, 7, /* y = 1 */
+    0, 4, 2,  2, 4, 6, /* x = 0 */
+    1, 3, 5,  3, 7, 5  /* x = 1 */
+};
+
+OcclusionCuller::OcclusionCuller() : _frame(0), _visible(), _queryCount(0), _conditionalDrawCount(0), _skippedDrawCount(0) {
+    // Conservative queries may count samples that a precise test wouldn't, which is cheaper and fine for culling.
+    // They need GL 4.3 or ARB_ES3_compatibility, which not every driver has.
+    _queryTarget = GLEW_ARB_ES3_compatibility ? GL_ANY_SAMPLES_PASSED_CONSERVATIVE : GL_ANY_SAMPLES_PASSED;
+    
+    _boxProgram = programWithShaders("occlusion-box.vsh", "occlusion-box.fsh");
+    
+    glGenVertexArrays(1, &_boxVao);
+    glGenBuffers(1, &_boxVbo);
+    glGenBuffers(1, &_boxEbo);
+    
+    glBindVertexArray(_boxVao);
+    glBindBuffer(GL_ARRAY_BUFFER, _boxVbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(CubeVertices), CubeVertices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(_boxProgram->attrib("vert"));
+    glVertexAttribPointer(_boxProgram->attrib("vert"), 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _boxEbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(CubeIndices), CubeIndices, GL_STATIC_DRAW);
+    glBindVertexArray(0);
+}
+
+OcclusionCuller::~OcclusionCuller() {
+    for (unsigned set = 0; set < FrameCount; ++set) {
+        if (!_queries[set].empty())
+            glDeleteQueries((GLsizei) _queries[set].size(), &_queries[set][0]);
+    }
+    
+    glDeleteVertexArrays(1, &_boxVao);
+    glDeleteBuffers(1, &_boxVbo);
+    glDeleteBuffers(1, &_boxEbo);
+}
+
+void OcclusionCuller::beginFrame(unsigned nodeCount) {
+    _frame = (_frame + 1) % FrameCount;
+    
+    for (unsigned set = 0; set < FrameCount; ++set) {
+        size_t oldCount = _queries[set].size();
+        if (oldCount >= nodeCount)
+            continue;
+        
+        _queries[set].resize(nodeCount);
+        glGenQueries((GLsizei) (nodeCount - oldCount), &_queries[set][oldCount]);
+        _queryStates[set].resize(nodeCount, QueryState_Unused);
+    }
+    
+    if (_visible.size() < nodeCount)
+        _visible.resize(nodeCount, 1);
+    
+    // Read back last frame's results, skipping the ones that haven't arrived rather than waiting for them
+    unsigned previous = (_frame + FrameCount - 1) % FrameCount;
+    std::vector<unsigned char>& previousStates = _queryStates[previous];
+    _skippedDrawCount = 0;
+    for (unsigned position = 0; position < nodeCount; ++position) {
+        if (previousStates[position] == QueryState_Unused)
+            continue;
+        
+        GLuint query = _queries[previous][position];
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+        
+        GLuint samplesPassed = 0;
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT, &samplesPassed);
+        _visible[position] = samplesPassed != 0;
+        
+        if (!samplesPassed && previousStates[position] == QueryState_Conditional)
+            ++_skippedDrawCount;
+        previousStates[position] = QueryState_Unused;
+    }
+    
+    // This frame's set was last issued two frames ago. Results that never arrived by now are dropped.
+    std::fill(_queryStates[_frame].begin(), _queryStates[_frame].end(), (unsigned char) QueryState_Unused);
+    _queryCount = 0;
+    _conditionalDrawCount = 0;
+}
+
+void OcclusionCuller::issueQueries(const unsigned *positions, unsigned count, const std::vector<BoundingBox>& worldBounds, const Camera& camera) {
+    _boxProgram->use();
+    _boxProgram->setUniform("viewProjection", camera.projection() * camera.view());
+    
+    // Boxes only test depth. Back faces count too, since the camera can be near or inside a box.
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_CULL_FACE);
+    glBindVertexArray(_boxVao);
+    
+    // A box that reaches the camera can be clipped by the near plane and pass no samples, even though its node is in
+    // plain view. Those nodes aren't queried, so they're always drawn.
+    const glm::vec3& eye = camera.position();
+    float margin = camera.nearPlane() * 2.0f;
+    
+    for (unsigned i = 0; i < count; ++i) {
+        unsigned position = positions[i];
+        const BoundingBox& box = worldBounds[position];
+        if (eye.x >= box.min.x - margin && eye.y >= box.min.y - margin && eye.z >= box.min.z - margin &&
+            eye.x <= box.max.x + margin && eye.y <= box.max.y + margin && eye.z <= box.max.z + margin) {
+            _visible[position] = 1;
+            continue;
+        }
+        
+        _boxProgram->setUniform("boxMin", box.min);
+        _boxProgram->setUniform("boxSize", box.max - box.min);
+        
+        glBeginQuery(_queryTarget, _queries[_frame][position]);
+        glDrawElements(GL_TRIANGLES, sizeof(CubeIndices), GL_UNSIGNED_BYTE, nullptr);
+        glEndQuery(_queryTarget);
+        
+        _queryStates[_frame][position] = QueryState_Issued;
+        ++_queryCount;
+    }
+    
+    glBindVertexArray(0);
+    glEnable(GL_CULL_FACE);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    _boxProgram->stopUsing();
+}
+
+void OcclusionCuller::beginDraw(unsigned position) {
+    if (_queryStates[_frame][position] == QueryState_Unused || _visible[position])
+        return;
+    
+    // The GPU waits for the query, which was issued just before; the CPU doesn't
+    glBeginConditionalRender(_queries[_frame][position], GL_QUERY_WAIT);
+    _queryStates[_frame][position] = QueryState_Conditional;
+    ++_conditionalDrawCount;
+}
+
+void OcclusionCuller::endDraw(unsigned position) {
+    if (_queryStates[_frame][position] == QueryState_Conditional)
+        glEndConditionalRender();
+}
+
+unsigned OcclusionCuller::queryCount() const {
+    return _queryCount;
+}
+
+unsigned OcclusionCuller::conditionalDrawCount() const {
+    return _conditionalDrawCount;
+}
+
+unsigned OcclusionCuller::skippedDrawCount() const {
+    return _skippedDrawCount;
+}
@@ -0,0 +1,80 @@
+//
+//  OcclusionCuller.h
+//  Robot
+//
+//  Created by Itamar Ravid on 14/9/14.
+//
+//
+
+#ifndef __Robot__OcclusionCuller__
+#define __Robot__OcclusionCuller__
+
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "BatchMath.h"
+#include "Camera.h"
+#include "ShaderProgram.h"
+
+/* Occlusion culling with hardware queries, for nodes hidden behind large occluders like the room's walls.
+ *
+ * Every frame, after the occluders are drawn, issueQueries() draws the world bounds of each other node inside an
+ * occlusion query, with color and depth writes off. The nodes are then drawn between beginDraw() and endDraw():
+ * nodes whose query found them visible last frame are drawn as usual, and the rest are drawn under conditional
+ * rendering on this frame's query, so the GPU skips them if their box is still hidden. Last frame's results are only
+ * read once they're available, so the CPU never waits for the GPU; until they arrive, the older results stand.
+ *
+ * Queries are kept per node position, so they assume nodes aren't removed from the scene. */
+class OcclusionCuller {
+public:
+    OcclusionCuller();
+    ~OcclusionCuller();
+    
+    // Starts a frame over a scene with nodeCount nodes, reading back whichever of last frame's results have arrived
+    void beginFrame(unsigned nodeCount);
+    
+    // Issues a query for each of the node positions, against what's in the depth buffer
+    void issueQueries(const unsigned *positions, unsigned count, const std::vector<BoundingBox>& worldBounds, const Camera& camera);
+    
+    // Wrap the draw of a node, which makes it conditional if the node was hidden last frame
+    void beginDraw(unsigned position);
+    void endDraw(unsigned position);
+    
+    // This frame's queries and conditional draws
+    unsigned queryCount() const;
+    unsigned conditionalDrawCount() const;
+    
+    // Conditional draws the GPU skipped, as of the last frame whose results were read back
+    unsigned skippedDrawCount() const;
+    
+private:
+    // What a node's query in a frame was used for
+    enum QueryState {
+        QueryState_Unused,
+        QueryState_Issued,
+        QueryState_Conditional /* Issued, and the node's draw depended on it */
+    };
+    
+    // Query sets used by alternating frames, so last frame's queries can be read while this frame's are issued
+    static const unsigned FrameCount = 2;
+    
+    GLenum _queryTarget;
+    std::vector<GLuint> _queries[FrameCount];
+    std::vector<unsigned char> _queryStates[FrameCount];
+    unsigned _frame;
+    
+    // The latest result read back for each node, 1 for nodes never found hidden
+    std::vector<unsigned char> _visible;
+    
+    unsigned _queryCount, _conditionalDrawCount, _skippedDrawCount;
+    
+    // A unit cube, which the box shader stretches over each node's bounds
+    ShaderProgram *_boxProgram;
+    GLuint _boxVao, _boxVbo, _boxEbo;
+    
+    OcclusionCuller(const OcclusionCuller& other);
+    OcclusionCuller& operator = (const OcclusionCuller& other);
+};
+
+#endif /* defined(__Robot__OcclusionCuller__) */
@@ -0,0 +1,478 @@
+//
+//  PixelConversion.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 5/9/14.
+//
+//
+
+#include "PixelConversion.h"
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXEL_CONVERSION_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+
+// The kernels are compiled for their instruction set regardless of the project-wide flags, and only called after
+// checking the CPU supports them.
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Average of the first three channels. Integer division gives the same result as dividing the sum as doubles.
+static inline unsigned char AverageRGB(const unsigned char *rgb) {
+    return (unsigned char)((rgb[0] + rgb[1] + rgb[2]) / 3);
+}
+
+// Scalar converters
+
+static void Grayscale2GrayscaleAlpha(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    for (unsigned i = 0; i < pixelCount; ++i, src += 1, dest += 2) {
+        dest[0] = src[0];
+        dest[1] = 255;
+    }
+}
+
+static void Grayscale2RGB(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    for (unsigned i = 0; i < pixelCount; ++i, src += 1, dest += 3) {
+        dest[0] = src[0];
+        dest[1] = src[0];
+        dest[2] = src[0];
+    }
+}
+
+static void Grayscale2RGBA(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    for (unsigned i = 0; i < pixelCount; ++i, src += 1, dest += 4) {
+        dest[0] = src[0];
+        dest[1] = src[0];
+        dest[2] = src[0];
+        dest[3] = 255;
+    }
+}
+
+static void GrayscaleAlpha2Grayscale(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    for (unsigned i = 0; i < pixelCount; ++i, src += 2, dest += 1) {
+        dest[0] = src[0];
+    }
+}
+
+static void GrayscaleAlpha2RGB(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    for (unsigned i = 0; i < pixelCount; ++i, src += 2, dest += 3) {
+        dest[0] = src[0];
+        dest[1] = src[0];
+        dest[2] = src[0];
+    }
+}
+
+static void GrayscaleAlpha2RGBA(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    for (unsigned i = 0; i < pixelCount; ++i, src += 2, dest += 4) {
+        dest[0] = src[0];
+        dest[1] = src[0];
+        dest[2] = src[0];
+        dest[3] = src[1];
+    }
+}
+
+static void RGB2Grayscale(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    for (unsigned i = 0; i < pixelCount; ++i, src += 3, dest += 1) {
+        dest[0] = AverageRGB(src);
+    }
+}
+
+static void RGB2GrayscaleAlpha(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    for (unsigned i = 0; i < pixelCount; ++i, src += 3, dest += 2) {
+        dest[0] = AverageRGB(src);
+        dest[1] = 255;
+    }
+}
+
+static void RGB2RGBA(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    for (unsigned i = 0; i < pixelCount; ++i, src += 3, dest += 4) {
+        dest[0] = src[0];
+        dest[1] = src[1];
+        dest[2] = src[2];
+        dest[3] = 255;
+    }
+}
+
+static void RGBA2Grayscale(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    for (unsigned i = 0; i < pixelCount; ++i, src += 4, dest += 1) {
+        dest[0] = AverageRGB(src);
+    }
+}
+
+static void RGBA2GrayscaleAlpha(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    for (unsigned i = 0; i < pixelCount; ++i, src += 4, dest += 2) {
+        dest[0] = AverageRGB(src);
+        dest[1] = src[3];
+    }
+}
+
+static void RGBA2RGB(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    for (unsigned i = 0; i < pixelCount; ++i, src += 4, dest += 3) {
+        dest[0] = src[0];
+        dest[1] = src[1];
+        dest[2] = src[2];
+    }
+}
+
+#if PIXEL_CONVERSION_X86
+
+// SSSE3 converters
+
+/* Each kernel converts as many pixels as it can in whole vectors, then hands the rest of the row to the scalar
+ * converter. Loads and stores never touch memory past the end of either row. */
+
+#define X 0x80 /* pshufb index that zeroes the byte */
+
+// Spreads the first 4 RGB pixels of a register into 32-bit lanes, with a zero 4th byte
+#define SHUFFLE_RGB_TO_LANES _mm_setr_epi8(0, 1, 2, X, 3, 4, 5, X, 6, 7, 8, X, 9, 10, 11, X)
+
+/* Averages the first three bytes of each 32-bit lane, exactly like AverageRGB. The result is in the low 16 bits of
+ * each lane, with the high bits clear. x / 3 == (x * 0xAAAB) >> 17 for every sum of three bytes. */
+TARGET_SSSE3 static inline __m128i AverageRGBLanes(__m128i pixels) {
+    const __m128i byteMask = _mm_set1_epi32(0xff);
+    __m128i sum = _mm_add_epi32(_mm_and_si128(pixels, byteMask), _mm_and_si128(_mm_srli_epi32(pixels, 8), byteMask));
+    sum = _mm_add_epi32(sum, _mm_and_si128(_mm_srli_epi32(pixels, 16), byteMask));
+    return _mm_srli_epi16(_mm_mulhi_epu16(sum, _mm_set1_epi16((short)0xAAAB)), 1);
+}
+
+// Packs the low 16 bits of the 32-bit lanes of two registers into one register of 16-bit values
+TARGET_SSSE3 static inline __m128i PackLow16(__m128i a, __m128i b) {
+    // Sign-extending first keeps the signed saturation of packs from touching the values
+    return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+}
+
+TARGET_SSSE3 static void Grayscale2GrayscaleAlphaSSSE3(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    const __m128i alpha = _mm_set1_epi8((char)0xff);
+    unsigned i = 0;
+    for (; i + 16 <= pixelCount; i += 16) {
+        __m128i gray = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dest + i * 2), _mm_unpacklo_epi8(gray, alpha));
+        _mm_storeu_si128((__m128i *)(dest + i * 2 + 16), _mm_unpackhi_epi8(gray, alpha));
+    }
+    Grayscale2GrayscaleAlpha(src + i, dest + i * 2, pixelCount - i);
+}
+
+TARGET_SSSE3 static void Grayscale2RGBSSSE3(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    const __m128i shuffle0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    const __m128i shuffle1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+    const __m128i shuffle2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+    unsigned i = 0;
+    for (; i + 16 <= pixelCount; i += 16) {
+        __m128i gray = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dest + i * 3), _mm_shuffle_epi8(gray, shuffle0));
+        _mm_storeu_si128((__m128i *)(dest + i * 3 + 16), _mm_shuffle_epi8(gray, shuffle1));
+        _mm_storeu_si128((__m128i *)(dest + i * 3 + 32), _mm_shuffle_epi8(gray, shuffle2));
+    }
+    Grayscale2RGB(src + i, dest + i * 3, pixelCount - i);
+}
+
+TARGET_SSSE3 static void Grayscale2RGBASSSE3(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    const __m128i alpha = _mm_set1_epi8((char)0xff);
+    unsigned i = 0;
+    for (; i + 16 <= pixelCount; i += 16) {
+        __m128i gray = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i grayGrayLow = _mm_unpacklo_epi8(gray, gray);
+        __m128i grayGrayHigh = _mm_unpackhi_epi8(gray, gray);
+        __m128i grayAlphaLow = _mm_unpacklo_epi8(gray, alpha);
+        __m128i grayAlphaHigh = _mm_unpackhi_epi8(gray, alpha);
+        _mm_storeu_si128((__m128i *)(dest + i * 4), _mm_unpacklo_epi16(grayGrayLow, grayAlphaLow));
+        _mm_storeu_si128((__m128i *)(dest + i * 4 + 16), _mm_unpackhi_epi16(grayGrayLow, grayAlphaLow));
+        _mm_storeu_si128((__m128i *)(dest + i * 4 + 32), _mm_unpacklo_epi16(grayGrayHigh, grayAlphaHigh));
+        _mm_storeu_si128((__m128i *)(dest + i * 4 + 48), _mm_unpackhi_epi16(grayGrayHigh, grayAlphaHigh));
+    }
+    Grayscale2RGBA(src + i, dest + i * 4, pixelCount - i);
+}
+
+TARGET_SSSE3 static void GrayscaleAlpha2GrayscaleSSSE3(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    const __m128i grayMask = _mm_set1_epi16(0xff);
+    unsigned i = 0;
+    for (; i + 16 <= pixelCount; i += 16) {
+        __m128i low = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + i * 2)), grayMask);
+        __m128i high = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + i * 2 + 16)), grayMask);
+        _mm_storeu_si128((__m128i *)(dest + i), _mm_packus_epi16(low, high));
+    }
+    GrayscaleAlpha2Grayscale(src + i * 2, dest + i, pixelCount - i);
+}
+
+TARGET_SSSE3 static void GrayscaleAlpha2RGBSSSE3(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    const __m128i shuffle0 = _mm_setr_epi8(0, 0, 0, 2, 2, 2, 4, 4, 4, 6, 6, 6, 8, 8, 8, 10);
+    const __m128i shuffle1 = _mm_setr_epi8(10, 10, 12, 12, 12, 14, 14, 14, X, X, X, X, X, X, X, X);
+    unsigned i = 0;
+    for (; i + 8 <= pixelCount; i += 8) {
+        __m128i grayAlpha = _mm_loadu_si128((const __m128i *)(src + i * 2));
+        _mm_storeu_si128((__m128i *)(dest + i * 3), _mm_shuffle_epi8(grayAlpha, shuffle0));
+        _mm_storel_epi64((__m128i *)(dest + i * 3 + 16), _mm_shuffle_epi8(grayAlpha, shuffle1));
+    }
+    GrayscaleAlpha2RGB(src + i * 2, dest + i * 3, pixelCount - i);
+}
+
+TARGET_SSSE3 static void GrayscaleAlpha2RGBASSSE3(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    const __m128i grayMask = _mm_set1_epi16(0xff);
+    unsigned i = 0;
+    for (; i + 8 <= pixelCount; i += 8) {
+        __m128i grayAlpha = _mm_loadu_si128((const __m128i *)(src + i * 2));
+        __m128i gray = _mm_and_si128(grayAlpha, grayMask);
+        __m128i grayGray = _mm_or_si128(gray, _mm_slli_epi16(gray, 8));
+        _mm_storeu_si128((__m128i *)(dest + i * 4), _mm_unpacklo_epi16(grayGray, grayAlpha));
+        _mm_storeu_si128((__m128i *)(dest + i * 4 + 16), _mm_unpackhi_epi16(grayGray, grayAlpha));
+    }
+    GrayscaleAlpha2RGBA(src + i * 2, dest + i * 4, pixelCount - i);
+}
+
+TARGET_SSSE3 static void RGB2GrayscaleSSSE3(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    const __m128i shuffle = SHUFFLE_RGB_TO_LANES;
+    unsigned i = 0;
+    // The last load reads 4 bytes past the 16 pixels it converts
+    for (; i + 18 <= pixelCount; i += 16) {
+        const unsigned char *rgb = src + i * 3;
+        __m128i gray0 = AverageRGBLanes(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)rgb), shuffle));
+        __m128i gray1 = AverageRGBLanes(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(rgb + 12)), shuffle));
+        __m128i gray2 = AverageRGBLanes(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(rgb + 24)), shuffle));
+        __m128i gray3 = AverageRGBLanes(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(rgb + 36)), shuffle));
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(gray0, gray1), _mm_packs_epi32(gray2, gray3));
+        _mm_storeu_si128((__m128i *)(dest + i), packed);
+    }
+    RGB2Grayscale(src + i * 3, dest + i, pixelCount - i);
+}
+
+TARGET_SSSE3 static void RGB2GrayscaleAlphaSSSE3(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    const __m128i shuffle = SHUFFLE_RGB_TO_LANES;
+    const __m128i alpha = _mm_set1_epi32(0xff00);
+    unsigned i = 0;
+    for (; i + 10 <= pixelCount; i += 8) {
+        const unsigned char *rgb = src + i * 3;
+        __m128i gray0 = AverageRGBLanes(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)rgb), shuffle));
+        __m128i gray1 = AverageRGBLanes(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(rgb + 12)), shuffle));
+        _mm_storeu_si128((__m128i *)(dest + i * 2), PackLow16(_mm_or_si128(gray0, alpha), _mm_or_si128(gray1, alpha)));
+    }
+    RGB2GrayscaleAlpha(src + i * 3, dest + i * 2, pixelCount - i);
+}
+
+TARGET_SSSE3 static void RGB2RGBASSSE3(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    const __m128i shuffle = SHUFFLE_RGB_TO_LANES;
+    const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+    unsigned i = 0;
+    for (; i + 6 <= pixelCount; i += 4) {
+        __m128i rgb = _mm_loadu_si128((const __m128i *)(src + i * 3));
+        _mm_storeu_si128((__m128i *)(dest + i * 4), _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha));
+    }
+    RGB2RGBA(src + i * 3, dest + i * 4, pixelCount - i);
+}
+
+TARGET_SSSE3 static void RGBA2GrayscaleSSSE3(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    unsigned i = 0;
+    for (; i + 16 <= pixelCount; i += 16) {
+        const __m128i *rgba = (const __m128i *)(src + i * 4);
+        __m128i gray0 = AverageRGBLanes(_mm_loadu_si128(rgba));
+        __m128i gray1 = AverageRGBLanes(_mm_loadu_si128(rgba + 1));
+        __m128i gray2 = AverageRGBLanes(_mm_loadu_si128(rgba + 2));
+        __m128i gray3 = AverageRGBLanes(_mm_loadu_si128(rgba + 3));
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(gray0, gray1), _mm_packs_epi32(gray2, gray3));
+        _mm_storeu_si128((__m128i *)(dest + i), packed);
+    }
+    RGBA2Grayscale(src + i * 4, dest + i, pixelCount - i);
+}
+
+TARGET_SSSE3 static void RGBA2GrayscaleAlphaSSSE3(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    unsigned i = 0;
+    for (; i + 8 <= pixelCount; i += 8) {
+        const __m128i *rgba = (const __m128i *)(src + i * 4);
+        __m128i pixels0 = _mm_loadu_si128(rgba);
+        __m128i pixels1 = _mm_loadu_si128(rgba + 1);
+        __m128i grayAlpha0 = _mm_or_si128(AverageRGBLanes(pixels0), _mm_slli_epi32(_mm_srli_epi32(pixels0, 24), 8));
+        __m128i grayAlpha1 = _mm_or_si128(AverageRGBLanes(pixels1), _mm_slli_epi32(_mm_srli_epi32(pixels1, 24), 8));
+        _mm_storeu_si128((__m128i *)(dest + i * 2), PackLow16(grayAlpha0, grayAlpha1));
+    }
+    RGBA2GrayscaleAlpha(src + i * 4, dest + i * 2, pixelCount - i);
+}
+
+TARGET_SSSE3 static void RGBA2RGBSSSE3(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, X, X, X, X);
+    unsigned i = 0;
+    // Each store writes 4 bytes past the pixels it converts, which the next store overwrites
+    for (; i + 6 <= pixelCount; i += 4) {
+        __m128i rgba = _mm_loadu_si128((const __m128i *)(src + i * 4));
+        _mm_storeu_si128((__m128i *)(dest + i * 3), _mm_shuffle_epi8(rgba, shuffle));
+    }
+    RGBA2RGB(src + i * 4, dest + i * 3, pixelCount - i);
+}
+
+// AVX2 converters
+
+// AVX2 kernels for the conversions texture loading actually hits. The other pairs use the SSSE3 kernels.
+
+// Loads 8 RGB pixels (reading 32 bytes) and spreads them into 32-bit lanes, with a zero 4th byte
+TARGET_AVX2 static inline __m256i LoadRGBLanes(const unsigned char *rgb) {
+    // Move bytes 12..27 into the high 128-bit lane, since pshufb can't cross lanes
+    const __m256i permute = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+    const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, X, 3, 4, 5, X, 6, 7, 8, X, 9, 10, 11, X,
+                                             0, 1, 2, X, 3, 4, 5, X, 6, 7, 8, X, 9, 10, 11, X);
+    __m256i pixels = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i *)rgb), permute);
+    return _mm256_shuffle_epi8(pixels, shuffle);
+}
+
+// Same as AverageRGBLanes
+TARGET_AVX2 static inline __m256i AverageRGBLanes256(__m256i pixels) {
+    const __m256i byteMask = _mm256_set1_epi32(0xff);
+    __m256i sum = _mm256_add_epi32(_mm256_and_si256(pixels, byteMask), _mm256_and_si256(_mm256_srli_epi32(pixels, 8), byteMask));
+    sum = _mm256_add_epi32(sum, _mm256_and_si256(_mm256_srli_epi32(pixels, 16), byteMask));
+    return _mm256_srli_epi16(_mm256_mulhi_epu16(sum, _mm256_set1_epi16((short)0xAAAB)), 1);
+}
+
+// Packs the gray values in the 32-bit lanes of four registers (8 pixels each) into 32 bytes, in order
+TARGET_AVX2 static inline __m256i PackGray256(__m256i gray0, __m256i gray1, __m256i gray2, __m256i gray3) {
+    // The packs work within 128-bit lanes, so the 4-pixel groups come out interleaved
+    __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(gray0, gray1), _mm256_packs_epi32(gray2, gray3));
+    return _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+TARGET_AVX2 static void RGB2GrayscaleAVX2(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    unsigned i = 0;
+    // The last load reads 8 bytes past the 32 pixels it converts
+    for (; i + 35 <= pixelCount; i += 32) {
+        const unsigned char *rgb = src + i * 3;
+        __m256i gray0 = AverageRGBLanes256(LoadRGBLanes(rgb));
+        __m256i gray1 = AverageRGBLanes256(LoadRGBLanes(rgb + 24));
+        __m256i gray2 = AverageRGBLanes256(LoadRGBLanes(rgb + 48));
+        __m256i gray3 = AverageRGBLanes256(LoadRGBLanes(rgb + 72));
+        _mm256_storeu_si256((__m256i *)(dest + i), PackGray256(gray0, gray1, gray2, gray3));
+    }
+    RGB2GrayscaleSSSE3(src + i * 3, dest + i, pixelCount - i);
+}
+
+TARGET_AVX2 static void RGB2RGBAAVX2(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    const __m256i alpha = _mm256_set1_epi32((int)0xff000000);
+    unsigned i = 0;
+    for (; i + 11 <= pixelCount; i += 8) {
+        _mm256_storeu_si256((__m256i *)(dest + i * 4), _mm256_or_si256(LoadRGBLanes(src + i * 3), alpha));
+    }
+    RGB2RGBASSSE3(src + i * 3, dest + i * 4, pixelCount - i);
+}
+
+TARGET_AVX2 static void RGBA2GrayscaleAVX2(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    unsigned i = 0;
+    for (; i + 32 <= pixelCount; i += 32) {
+        const __m256i *rgba = (const __m256i *)(src + i * 4);
+        __m256i gray0 = AverageRGBLanes256(_mm256_loadu_si256(rgba));
+        __m256i gray1 = AverageRGBLanes256(_mm256_loadu_si256(rgba + 1));
+        __m256i gray2 = AverageRGBLanes256(_mm256_loadu_si256(rgba + 2));
+        __m256i gray3 = AverageRGBLanes256(_mm256_loadu_si256(rgba + 3));
+        _mm256_storeu_si256((__m256i *)(dest + i), PackGray256(gray0, gray1, gray2, gray3));
+    }
+    RGBA2GrayscaleSSSE3(src + i * 4, dest + i, pixelCount - i);
+}
+
+TARGET_AVX2 static void RGBA2RGBAVX2(const unsigned char *src, unsigned char *dest, unsigned pixelCount) {
+    const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, X, X, X, X,
+                                             0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, X, X, X, X);
+    // Closes the gap between the 12 bytes in each 128-bit lane
+    const __m256i permute = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    unsigned i = 0;
+    // Each store writes 8 bytes past the pixels it converts, which the next store overwrites
+    for (; i + 11 <= pixelCount; i += 8) {
+        __m256i rgba = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+        __m256i rgb = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(rgba, shuffle), permute);
+        _mm256_storeu_si256((__m256i *)(dest + i * 3), rgb);
+    }
+    RGBA2RGBSSSE3(src + i * 4, dest + i * 3, pixelCount - i);
+}
+
+#undef X
+
+#endif // PIXEL_CONVERSION_X86
+
+// Dispatch
+
+// Converters indexed by [source format - 1][destination format - 1]. Null where there's no kernel for the pair.
+typedef PixelConversion::RowConverterFunc ConverterTable[4][4];
+
+static const ConverterTable ScalarConverters = {
+    { NULL, Grayscale2GrayscaleAlpha, Grayscale2RGB, Grayscale2RGBA },
+    { GrayscaleAlpha2Grayscale, NULL, GrayscaleAlpha2RGB, GrayscaleAlpha2RGBA },
+    { RGB2Grayscale, RGB2GrayscaleAlpha, NULL, RGB2RGBA },
+    { RGBA2Grayscale, RGBA2GrayscaleAlpha, RGBA2RGB, NULL }
+};
+
+#if PIXEL_CONVERSION_X86
+static const ConverterTable SSSE3Converters = {
+    { NULL, Grayscale2GrayscaleAlphaSSSE3, Grayscale2RGBSSSE3, Grayscale2RGBASSSE3 },
+    { GrayscaleAlpha2GrayscaleSSSE3, NULL, GrayscaleAlpha2RGBSSSE3, GrayscaleAlpha2RGBASSSE3 },
+    { RGB2GrayscaleSSSE3, RGB2GrayscaleAlphaSSSE3, NULL, RGB2RGBASSSE3 },
+    { RGBA2GrayscaleSSSE3, RGBA2GrayscaleAlphaSSSE3, RGBA2RGBSSSE3, NULL }
+};
+
+static const ConverterTable AVX2Converters = {
+    { NULL, NULL, NULL, NULL },
+    { NULL, NULL, NULL, NULL },
+    { RGB2GrayscaleAVX2, NULL, NULL, RGB2RGBAAVX2 },
+    { RGBA2GrayscaleAVX2, NULL, RGBA2RGBAVX2, NULL }
+};
+#endif
+
+static PixelConversion::InstructionSet DetectInstructionSet() {
+#if PIXEL_CONVERSION_X86
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & (1 << 9)))
+        return PixelConversion::InstructionSet_Scalar;
+
+    // AVX2 also needs the OS to save the YMM registers (OSXSAVE, and XCR0 bits 1 and 2)
+    bool osSavesYmm = false;
+    if ((ecx & (1 << 27)) && (ecx & (1 << 28))) {
+        unsigned xcr0Low, xcr0High;
+        __asm__ volatile ("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+        osSavesYmm = (xcr0Low & 6) == 6;
+    }
+
+    if (osSavesYmm && __get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        if (ebx & (1 << 5))
+            return PixelConversion::InstructionSet_AVX2;
+    }
+
+    return PixelConversion::InstructionSet_SSSE3;
+#else
+    return PixelConversion::InstructionSet_Scalar;
+#endif
+}
+
+PixelConversion::InstructionSet PixelConversion::bestInstructionSet() {
+    static InstructionSet instructionSet = DetectInstructionSet();
+    return instructionSet;
+}
+
+PixelConversion::RowConverterFunc PixelConversion::rowConverter(Bitmap::Format srcFormat, Bitmap::Format destFormat, InstructionSet instructionSet) {
+    if (srcFormat == destFormat)
+        throw std::runtime_error("Just use memcpy if pixel formats are the same");
+
+    if (srcFormat < Bitmap::Format_Grayscale || srcFormat > Bitmap::Format_RGBA ||
+        destFormat < Bitmap::Format_Grayscale || destFormat > Bitmap::Format_RGBA)
+        throw std::runtime_error("Unhandled bitmap format");
+
+    if (instructionSet > bestInstructionSet())
+        throw std::runtime_error(std::string("CPU doesn't support ") + instructionSetName(instructionSet));
+
+    unsigned srcIndex = srcFormat - 1, destIndex = destFormat - 1;
+
+#if PIXEL_CONVERSION_X86
+    if (instructionSet >= InstructionSet_AVX2 && AVX2Converters[srcIndex][destIndex])
+        return AVX2Converters[srcIndex][destIndex];
+
+    if (instructionSet >= InstructionSet_SSSE3)
+        return SSSE3Converters[srcIndex][destIndex];
+#endif
+
+    return ScalarConverters[srcIndex][destIndex];
+}
+
+const char *PixelConversion::instructionSetName(InstructionSet instructionSet) {
+    switch (instructionSet) {
+        case InstructionSet_Scalar: return "scalar";
+        case InstructionSet_SSSE3:  return "SSSE3";
+        case InstructionSet_AVX2:   return "AVX2";
+        default:
+            throw std::runtime_error("Unhandled instruction set");
+    }
+}
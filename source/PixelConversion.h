@@ -0,0 +1,42 @@
+//
+//  PixelConversion.h
+//  Robot
+//
+//  Created by Itamar Ravid on 5/9/14.
+//
+//
+
+#ifndef __Robot__PixelConversion__
+#define __Robot__PixelConversion__
+
+#include "Bitmap.h"
+
+/* Whole-row pixel format converters, used by Bitmap::copyRectFromBitmap. Every pair of Bitmap formats has a scalar
+ * converter, and SIMD versions that are picked at runtime according to what the CPU supports. The SIMD versions
+ * produce exactly the same output as the scalar ones. */
+class PixelConversion {
+public:
+    // Instruction sets with converter kernels, in increasing order of preference
+    enum InstructionSet {
+        InstructionSet_Scalar,
+        InstructionSet_SSSE3, /* 128-bit kernels. SSSE3 is needed for byte shuffles, every x86-64 Mac has it */
+        InstructionSet_AVX2 /* 256-bit kernels for the most common conversions, SSSE3 for the rest */
+    };
+    
+    // Converts pixelCount pixels from src to dest. The buffers must not overlap.
+    typedef void (*RowConverterFunc)(const unsigned char *src, unsigned char *dest, unsigned pixelCount);
+    
+    // The best instruction set supported by this CPU (detected once)
+    static InstructionSet bestInstructionSet();
+    
+    /* Returns the converter between two different formats, using the given instruction set or the best one below it
+     * that has a kernel for this pair. Throws if the formats are the same - rows can just be memcpy'd then. */
+    static RowConverterFunc rowConverter(Bitmap::Format srcFormat, Bitmap::Format destFormat, InstructionSet instructionSet = bestInstructionSet());
+    
+    static const char *instructionSetName(InstructionSet instructionSet);
+    
+private:
+    PixelConversion();
+};
+
+#endif /* defined(__Robot__PixelConversion__) */
@@ -0,0 +1,83 @@
+//
+//  RangeSensor.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 13/9/14.
+//
+//
+
+#include "RangeSensor.h"
+
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+#include "MathUtils.h"
+
+RangeSensor::RangeSensor(unsigned width, unsigned height, float fieldOfView, float maxRange) :
+    _width(width), _height(height), _maxRange(maxRange), _localDirections(), _origins(), _directions(), _distances(),
+    _lastCaptureSeconds(0.0) {
+    if (width == 0 || height == 0)
+        throw std::runtime_error("Range sensor must have at least one pixel");
+    
+    // Pixel centers on the image plane at distance 1
+    float halfHeight = tanf(degreesToRadians(fieldOfView) * 0.5f);
+    float halfWidth = halfHeight * (float) width / (float) height;
+    
+    _localDirections.resize(width * height);
+    for (unsigned y = 0; y < height; ++y) {
+        float planeY = halfHeight * (1.0f - 2.0f * (y + 0.5f) / height);
+        for (unsigned x = 0; x < width; ++x) {
+            float planeX = halfWidth * (2.0f * (x + 0.5f) / width - 1.0f);
+            _localDirections[y * width + x] = glm::normalize(glm::vec3(planeX, planeY, -1.0f));
+        }
+    }
+    
+    _origins.resize(width * height);
+    _directions.resize(width * height);
+    _distances.resize(width * height, maxRange);
+}
+
+void RangeSensor::capture(const Scene& scene, const SceneBvh& bvh, const glm::vec3& position, const glm::vec3& forward, const glm::vec3& up,
+                          NodeHandle ignoredNode, BatchMath::InstructionSet instructionSet) {
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    
+    // Sensor space to world space. The rotation is orthonormal, so the directions stay unit length.
+    glm::vec3 back = -glm::normalize(forward);
+    glm::vec3 right = glm::normalize(glm::cross(up, back));
+    glm::vec3 trueUp = glm::cross(back, right);
+    
+    for (size_t i = 0; i < _localDirections.size(); ++i) {
+        const glm::vec3& local = _localDirections[i];
+        _origins[i] = position;
+        _directions[i] = right * local.x + trueUp * local.y + back * local.z;
+    }
+    
+    bvh.raycastBatch(scene, &_origins[0], &_directions[0], rayCount(), _maxRange, &_distances[0], ignoredNode, instructionSet);
+    
+    _lastCaptureSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+const std::vector<float>& RangeSensor::distances() const {
+    return _distances;
+}
+
+unsigned RangeSensor::width() const {
+    return _width;
+}
+
+unsigned RangeSensor::height() const {
+    return _height;
+}
+
+unsigned RangeSensor::rayCount() const {
+    return _width * _height;
+}
+
+float RangeSensor::maxRange() const {
+    return _maxRange;
+}
+
+double RangeSensor::lastCaptureSeconds() const {
+    return _lastCaptureSeconds;
+}
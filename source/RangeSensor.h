@@ -0,0 +1,60 @@
+//
+//  RangeSensor.h
+//  Robot
+//
+//  Created by Itamar Ravid on 13/9/14.
+//
+//
+
+#ifndef __Robot__RangeSensor__
+#define __Robot__RangeSensor__
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "SceneBvh.h"
+
+/* A simulated range sensor, like a depth camera: traces a ray per pixel through a SceneBvh and keeps the distance
+ * image. The rays fan out from a single point through a pinhole grid, so the rays of neighbouring pixels in a row -
+ * which the BVH traces together as a packet - stay coherent. */
+class RangeSensor {
+public:
+    // fieldOfView is vertical, in degrees. maxRange is in world units.
+    RangeSensor(unsigned width, unsigned height, float fieldOfView, float maxRange);
+    
+    /* Traces the image from a pose: rays leave position around forward, with up towards the top rows. Pixels that see
+     * nothing within range are set to maxRange. ignoredNode is usually the model the sensor is mounted in. */
+    void capture(const Scene& scene, const SceneBvh& bvh, const glm::vec3& position, const glm::vec3& forward, const glm::vec3& up,
+                 NodeHandle ignoredNode = NodeHandle(), BatchMath::InstructionSet instructionSet = PixelConversion::bestInstructionSet());
+    
+    // The distance image, rows from top to bottom, in world units along each pixel's ray
+    const std::vector<float>& distances() const;
+    
+    unsigned width() const;
+    unsigned height() const;
+    unsigned rayCount() const;
+    float maxRange() const;
+    
+    // Wall clock time of the last capture, in seconds
+    double lastCaptureSeconds() const;
+    
+private:
+    unsigned _width, _height;
+    float _maxRange;
+    
+    // Unit ray directions in sensor space, with x to the right, y up and -z forward
+    std::vector<glm::vec3> _localDirections;
+    
+    // The last capture's rays in world space, and what they hit
+    std::vector<glm::vec3> _origins;
+    std::vector<glm::vec3> _directions;
+    std::vector<float> _distances;
+    
+    double _lastCaptureSeconds;
+    
+    RangeSensor(const RangeSensor&);
+    RangeSensor& operator=(const RangeSensor&);
+};
+
+#endif /* defined(__Robot__RangeSensor__) */
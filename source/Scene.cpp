@@ -0,0 +1,452 @@
+//
+//  Scene.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 9/9/14.
+//
+//
+
+#include "Scene.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <stdexcept>
+
+#include "BatchMath.h"
+
+static const uint32_t IndexMask = Scene::MaxNodes - 1;
+
+// Generations wrap within the bits left over by the index, skipping 0 so that no handle is ever null
+static uint32_t NextGeneration(uint32_t generation) {
+    generation = (generation + 1) & (0xffffffff >> NodeHandle::IndexBits);
+    return generation == 0 ? 1 : generation;
+}
+
+static const glm::mat4 Identity;
+
+/* Nodes whose matrices are recomputed together with BatchMath. No node in a batch is the parent of another, so all the
+ * local matrices can be computed first and then all the world matrices. Batches hold pointers into the scene arrays,
+ * since the dirty nodes are scattered through them. */
+struct TransformBatch {
+    static const unsigned Capacity = 128;
+    
+    // Position of the first node in the batch
+    uint32_t start;
+    
+    // locals[i] = translates[i] * rotates[i] * scales[i]
+    const glm::mat4 *translates[Capacity];
+    const glm::mat4 *rotates[Capacity];
+    const glm::mat4 *scales[Capacity];
+    glm::mat4 *locals[Capacity];
+    unsigned localCount;
+    
+    // worlds[i] = parents[i] * children[i]
+    const glm::mat4 *parents[Capacity];
+    const glm::mat4 *children[Capacity];
+    glm::mat4 *worlds[Capacity];
+    unsigned worldCount;
+    
+    TransformBatch() : start(0), localCount(0), worldCount(0) {}
+    
+    void flush() {
+        BatchMath::multiplyMatrices(translates, rotates, locals, localCount);
+        BatchMath::multiplyMatrices(locals, scales, locals, localCount);
+        BatchMath::multiplyMatrices(parents, children, worlds, worldCount);
+        localCount = worldCount = 0;
+    }
+};
+
+/* Nodes whose subtree bounds are tested together with BatchMath. Like TransformBatch, no node in a batch is the parent
+ * of another, since a node is only tested once its parent's result is known. */
+struct CullBatch {
+    static const unsigned Capacity = 256;
+    
+    glm::vec4 spheres[Capacity];
+    uint32_t positions[Capacity];
+    unsigned char results[Capacity];
+    unsigned count;
+    
+    CullBatch() : count(0) {}
+    
+    void flush(const glm::vec4 *planes, unsigned char *visible) {
+        BatchMath::testSpheresAgainstFrustum(spheres, count, planes, results);
+        for (unsigned i = 0; i < count; ++i)
+            visible[positions[i]] = results[i];
+        count = 0;
+    }
+};
+
+// A box with no contents, which any box merged into it replaces
+static BoundingBox EmptyBox() {
+    BoundingBox box;
+    box.min = glm::vec3(FLT_MAX);
+    box.max = glm::vec3(-FLT_MAX);
+    return box;
+}
+
+Scene::Scene() : _localTransforms(), _localMatrices(), _worldTransforms(), _normalMatrices(), _parents(), _models(), _slots(),
+    _modelBounds(), _worldBounds(), _subtreeBounds(), _subtreeBoundsDirty(false), _localDirty(), _worldChanged(),
+    _recomputedNodeCount(0), _positions(), _generations(), _freeSlots() {
+}
+
+NodeHandle Scene::createNode(Model *model, NodeHandle parent, const ModelTransform& transform) {
+    uint32_t parentPosition = parent.isNull() ? NoParent : _position(parent);
+    
+    uint32_t slot;
+    if (!_freeSlots.empty()) {
+        slot = _freeSlots.back();
+        _freeSlots.pop_back();
+    } else {
+        if (_positions.size() == MaxNodes)
+            throw std::runtime_error("Too many scene nodes");
+        
+        slot = (uint32_t) _positions.size();
+        _positions.push_back(0);
+        _generations.push_back(1);
+    }
+    
+    // Appending keeps the order topological, since the parent is already in the arrays
+    _positions[slot] = (uint32_t) _slots.size();
+    _localTransforms.push_back(transform);
+    _localMatrices.push_back(glm::mat4());
+    _worldTransforms.push_back(parentPosition == NoParent ? glm::mat4() : _worldTransforms[parentPosition]);
+    _normalMatrices.push_back(glm::mat3());
+    _parents.push_back(parentPosition);
+    _models.push_back(model);
+    _slots.push_back(slot);
+    _modelBounds.push_back(model ? model->boundingBox : BoundingBox());
+    _worldBounds.push_back(BoundingBox());
+    _subtreeBounds.push_back(EmptyBox());
+    _localDirty.push_back(1);
+    _worldChanged.push_back(0);
+    
+    return _handle(slot);
+}
+
+void Scene::removeNode(NodeHandle node) {
+    uint32_t first = _position(node);
+    
+    // Descendants come after their ancestors, so one pass from the node finds the whole subtree
+    std::vector<bool> removed(_slots.size() - first, false);
+    removed[0] = true;
+    for (uint32_t position = first + 1; position < _slots.size(); ++position) {
+        uint32_t parent = _parents[position];
+        removed[position - first] = parent != NoParent && parent >= first && removed[parent - first];
+    }
+    
+    // Compact the arrays, keeping their order. Parents move before their children, so their new positions are known.
+    std::vector<uint32_t> newPositions(_slots.size() - first);
+    uint32_t write = first;
+    for (uint32_t position = first; position < _slots.size(); ++position) {
+        uint32_t slot = _slots[position];
+        
+        if (removed[position - first]) {
+            _generations[slot] = NextGeneration(_generations[slot]);
+            _freeSlots.push_back(slot);
+            continue;
+        }
+        
+        uint32_t parent = _parents[position];
+        if (parent != NoParent && parent >= first)
+            parent = newPositions[parent - first];
+        
+        newPositions[position - first] = write;
+        _localTransforms[write] = _localTransforms[position];
+        _localMatrices[write] = _localMatrices[position];
+        _worldTransforms[write] = _worldTransforms[position];
+        _normalMatrices[write] = _normalMatrices[position];
+        _parents[write] = parent;
+        _models[write] = _models[position];
+        _slots[write] = slot;
+        _modelBounds[write] = _modelBounds[position];
+        _worldBounds[write] = _worldBounds[position];
+        _localDirty[write] = _localDirty[position];
+        _worldChanged[write] = _worldChanged[position];
+        _positions[slot] = write;
+        ++write;
+    }
+    
+    _localTransforms.resize(write);
+    _localMatrices.resize(write);
+    _worldTransforms.resize(write);
+    _normalMatrices.resize(write);
+    _parents.resize(write);
+    _models.resize(write);
+    _slots.resize(write);
+    _modelBounds.resize(write);
+    _worldBounds.resize(write);
+    _subtreeBounds.resize(write);
+    _localDirty.resize(write);
+    _worldChanged.resize(write);
+    
+    // The removed models no longer count towards their ancestors' subtrees
+    _subtreeBoundsDirty = true;
+}
+
+void Scene::clear() {
+    for (std::vector<uint32_t>::const_iterator it = _slots.begin(); it != _slots.end(); ++it) {
+        _generations[*it] = NextGeneration(_generations[*it]);
+        _freeSlots.push_back(*it);
+    }
+    
+    _localTransforms.clear();
+    _localMatrices.clear();
+    _worldTransforms.clear();
+    _normalMatrices.clear();
+    _parents.clear();
+    _models.clear();
+    _slots.clear();
+    _modelBounds.clear();
+    _worldBounds.clear();
+    _subtreeBounds.clear();
+    _localDirty.clear();
+    _worldChanged.clear();
+}
+
+void Scene::reserve(unsigned nodeCount) {
+    _localTransforms.reserve(nodeCount);
+    _localMatrices.reserve(nodeCount);
+    _worldTransforms.reserve(nodeCount);
+    _normalMatrices.reserve(nodeCount);
+    _parents.reserve(nodeCount);
+    _models.reserve(nodeCount);
+    _slots.reserve(nodeCount);
+    _modelBounds.reserve(nodeCount);
+    _worldBounds.reserve(nodeCount);
+    _subtreeBounds.reserve(nodeCount);
+    _localDirty.reserve(nodeCount);
+    _worldChanged.reserve(nodeCount);
+    
+    // Slots are only added when none are free
+    if (nodeCount > _slots.size() + _freeSlots.size()) {
+        _positions.reserve(_positions.size() + nodeCount - _slots.size() - _freeSlots.size());
+        _generations.reserve(_positions.capacity());
+    }
+}
+
+bool Scene::contains(NodeHandle node) const {
+    uint32_t slot = node.value & IndexMask;
+    if (node.isNull() || slot >= _generations.size() || _generations[slot] != node.value >> NodeHandle::IndexBits)
+        return false;
+    
+    // Free slots keep their bumped generation, which no live handle has
+    uint32_t position = _positions[slot];
+    return position < _slots.size() && _slots[position] == slot;
+}
+
+const ModelTransform& Scene::localTransform(NodeHandle node) const {
+    return _localTransforms[_position(node)];
+}
+
+void Scene::setLocalTransform(NodeHandle node, const ModelTransform& transform) {
+    uint32_t position = _position(node);
+    
+    // Callers often set the same transform every frame, which shouldn't cost an update
+    if (_localTransforms[position] != transform) {
+        _localTransforms[position] = transform;
+        _localDirty[position] = 1;
+    }
+}
+
+const glm::mat4& Scene::worldTransform(NodeHandle node) const {
+    return _worldTransforms[_position(node)];
+}
+
+Model *Scene::model(NodeHandle node) const {
+    return _models[_position(node)];
+}
+
+NodeHandle Scene::parent(NodeHandle node) const {
+    uint32_t parent = _parents[_position(node)];
+    return parent == NoParent ? NodeHandle() : _handle(_slots[parent]);
+}
+
+void Scene::updateWorldTransforms() {
+    TransformBatch batch;
+    unsigned recomputed = 0;
+    
+    // Parents are visited first, so their _worldChanged flags are already set for this update
+    size_t count = _slots.size();
+    for (size_t position = 0; position < count; ++position) {
+        uint32_t parent = _parents[position];
+        bool parentChanged = parent != NoParent && _worldChanged[parent];
+        
+        if (!_localDirty[position] && !parentChanged) {
+            _worldChanged[position] = 0;
+            continue;
+        }
+        
+        // The parent's world transform must be computed before this node's can be
+        if (batch.worldCount == TransformBatch::Capacity || (parentChanged && parent >= batch.start)) {
+            batch.flush();
+            batch.start = (uint32_t) position;
+        }
+        
+        if (_localDirty[position]) {
+            unsigned index = batch.localCount++;
+            batch.translates[index] = &_localTransforms[position].translate;
+            batch.rotates[index] = &_localTransforms[position].rotate;
+            batch.scales[index] = &_localTransforms[position].scale;
+            batch.locals[index] = &_localMatrices[position];
+            _localDirty[position] = 0;
+        }
+        
+        // Roots are multiplied by the identity, which leaves the local matrix unchanged
+        unsigned index = batch.worldCount++;
+        batch.parents[index] = parent == NoParent ? &Identity : &_worldTransforms[parent];
+        batch.children[index] = &_localMatrices[position];
+        batch.worlds[index] = &_worldTransforms[position];
+        
+        _worldChanged[position] = 1;
+        ++recomputed;
+    }
+    
+    batch.flush();
+    _recomputedNodeCount = recomputed;
+    
+    if (recomputed > 0)
+        _subtreeBoundsDirty = true;
+    _updateBounds();
+}
+
+void Scene::invalidateWorldTransforms() {
+    std::fill(_localDirty.begin(), _localDirty.end(), 1);
+}
+
+unsigned Scene::recomputedNodeCount() const {
+    return _recomputedNodeCount;
+}
+
+unsigned Scene::cull(const glm::vec4 *planes, unsigned char *visible) const {
+    // While a node waits in the batch, its flag holds Pending, so its children know to flush the batch first
+    static const unsigned char Pending = 2;
+    
+    CullBatch batch;
+    unsigned tested = 0;
+    
+    size_t count = _slots.size();
+    for (size_t position = 0; position < count; ++position) {
+        uint32_t parent = _parents[position];
+        if (parent != NoParent) {
+            if (visible[parent] == Pending) {
+                tested += batch.count;
+                batch.flush(planes, visible);
+            }
+            
+            // The parent's subtree bounds contain this node's, so it's out of view too
+            if (!visible[parent]) {
+                visible[position] = 0;
+                continue;
+            }
+        }
+        
+        const BoundingBox& bounds = _subtreeBounds[position];
+        if (bounds.min.x > bounds.max.x) {
+            visible[position] = 0;
+            continue;
+        }
+        
+        if (batch.count == CullBatch::Capacity) {
+            tested += batch.count;
+            batch.flush(planes, visible);
+        }
+        
+        // Test the box's bounding sphere
+        unsigned index = batch.count++;
+        batch.spheres[index] = glm::vec4((bounds.min + bounds.max) * 0.5f, glm::length(bounds.max - bounds.min) * 0.5f);
+        batch.positions[index] = (uint32_t) position;
+        visible[position] = Pending;
+    }
+    
+    tested += batch.count;
+    batch.flush(planes, visible);
+    return tested;
+}
+
+unsigned Scene::nodeCount() const {
+    return (unsigned) _slots.size();
+}
+
+NodeHandle Scene::nodeAt(unsigned position) const {
+    if (position >= _slots.size())
+        throw std::runtime_error("Scene node position out of range");
+    
+    return _handle(_slots[position]);
+}
+
+unsigned Scene::position(NodeHandle node) const {
+    return _position(node);
+}
+
+const std::vector<Model *>& Scene::models() const {
+    return _models;
+}
+
+const std::vector<glm::mat4>& Scene::worldTransforms() const {
+    return _worldTransforms;
+}
+
+const std::vector<glm::mat3>& Scene::normalMatrices() const {
+    return _normalMatrices;
+}
+
+const std::vector<unsigned char>& Scene::worldChanged() const {
+    return _worldChanged;
+}
+
+const std::vector<BoundingBox>& Scene::worldBounds() const {
+    return _worldBounds;
+}
+
+const BoundingBox& Scene::worldBounds(NodeHandle node) const {
+    return _worldBounds[_position(node)];
+}
+
+uint32_t Scene::_position(NodeHandle node) const {
+    if (!contains(node))
+        throw std::runtime_error("Scene node handle doesn't refer to an existing node");
+    
+    return _positions[node.value & IndexMask];
+}
+
+NodeHandle Scene::_handle(uint32_t slot) const {
+    return NodeHandle((_generations[slot] << NodeHandle::IndexBits) | slot);
+}
+
+void Scene::_updateBounds() {
+    // Transform the model bounds of each run of nodes whose world transform changed in one batch, and recompute their
+    // normal matrices, so the shaders don't invert the model matrix per vertex
+    size_t count = _slots.size();
+    for (size_t position = 0; position < count; ) {
+        if (!_worldChanged[position]) {
+            ++position;
+            continue;
+        }
+        
+        size_t end = position + 1;
+        while (end < count && _worldChanged[end])
+            ++end;
+        
+        BatchMath::transformBoxes(&_modelBounds[position], &_worldTransforms[position], &_worldBounds[position], (unsigned) (end - position));
+        BatchMath::normalMatrices(&_worldTransforms[position], &_normalMatrices[position], (unsigned) (end - position));
+        position = end;
+    }
+    
+    if (!_subtreeBoundsDirty)
+        return;
+    
+    // Children come after their parents, so going backwards completes each subtree before it's merged into its parent
+    for (size_t position = 0; position < count; ++position)
+        _subtreeBounds[position] = _models[position] ? _worldBounds[position] : EmptyBox();
+    
+    for (size_t position = count; position-- > 0; ) {
+        uint32_t parent = _parents[position];
+        if (parent == NoParent)
+            continue;
+        
+        _subtreeBounds[parent].min = glm::min(_subtreeBounds[parent].min, _subtreeBounds[position].min);
+        _subtreeBounds[parent].max = glm::max(_subtreeBounds[parent].max, _subtreeBounds[position].max);
+    }
+    
+    _subtreeBoundsDirty = false;
+}
@@ -0,0 +1,154 @@
+//
+//  Scene.h
+//  Robot
+//
+//  Created by Itamar Ravid on 9/9/14.
+//
+//
+
+#ifndef __Robot__Scene__
+#define __Robot__Scene__
+
+#include <stdint.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "BatchMath.h"
+#include "Model.h"
+
+/* Refers to a scene node. The low IndexBits bits select a slot in the scene, the rest hold the slot's generation
+ * when the node was created. Removing a node bumps its slot's generation, so handles to it stop resolving instead of
+ * reaching whichever node reuses the slot. The default handle refers to nothing. */
+struct NodeHandle {
+    static const unsigned IndexBits = 20;
+    
+    uint32_t value;
+    
+    NodeHandle() : value(0) {}
+    explicit NodeHandle(uint32_t value) : value(value) {}
+    
+    bool isNull() const { return value == 0; }
+    bool operator == (const NodeHandle& other) const { return value == other.value; }
+    bool operator != (const NodeHandle& other) const { return value != other.value; }
+};
+
+/* A transform hierarchy stored as parallel arrays: local transforms, parent indices, world matrices and models.
+ * Nodes are kept in topological order - a parent always comes before its children - so updateWorldTransforms() is a
+ * single pass over the arrays. Nodes are reached through NodeHandles, which resolve in constant time through a slot
+ * table. Nodes without a model only carry a transform for their children.
+ *
+ * Local transforms are changed through setLocalTransform(), which marks the node dirty. The update only recomputes
+ * the dirty nodes and the descendants of nodes whose world transform changed; nodes that don't move, like the room,
+ * keep their cached matrices and cost a flag test. The recomputed matrices are multiplied in batches with BatchMath.
+ *
+ * The update also keeps world-space bounding boxes of each node's model and of each node's whole subtree, which
+ * cull() tests against the view frustum. */
+class Scene {
+public:
+    // The number of distinct slots a handle can address
+    static const unsigned MaxNodes = 1u << NodeHandle::IndexBits;
+    
+    Scene();
+    
+    // Adds a node under the given parent, or at the root if parent is null, with the given local transform
+    NodeHandle createNode(Model *model, NodeHandle parent = NodeHandle(), const ModelTransform& transform = ModelTransform());
+    
+    // Removes a node and all its descendants. Takes time linear in the number of nodes, since the arrays are compacted.
+    void removeNode(NodeHandle node);
+    
+    // Removes every node. Outstanding handles stop resolving.
+    void clear();
+    
+    // Reserves room for nodeCount nodes, so creating that many doesn't reallocate the arrays
+    void reserve(unsigned nodeCount);
+    
+    // Checks whether a handle refers to a node that still exists
+    bool contains(NodeHandle node) const;
+    
+    // The node's transform relative to its parent. Setting a different transform marks the node dirty, and the change
+    // shows up in the world transforms after the next update.
+    const ModelTransform& localTransform(NodeHandle node) const;
+    void setLocalTransform(NodeHandle node, const ModelTransform& transform);
+    
+    // The node's transform relative to the world, as of the last updateWorldTransforms()
+    const glm::mat4& worldTransform(NodeHandle node) const;
+    
+    Model *model(NodeHandle node) const;
+    NodeHandle parent(NodeHandle node) const;
+    
+    // Recomputes the world transforms of the dirty nodes and their descendants, parents first
+    void updateWorldTransforms();
+    
+    // Marks every node dirty, so the next update recomputes all of them
+    void invalidateWorldTransforms();
+    
+    // The number of world transforms the last update recomputed
+    unsigned recomputedNodeCount() const;
+    
+    /* Sets visible[i] for the node at position i to whether it's in view of the frustum planes (as returned by
+     * Camera::frustumPlanes), as of the last update. Nodes are tested with the bounds of their whole subtree, and only
+     * if their parent's subtree is in view, so a subtree out of view is rejected with a single test. Nodes whose
+     * subtree has no models are never visible. Returns the number of bounds tested. */
+    unsigned cull(const glm::vec4 *planes, unsigned char *visible) const;
+    
+    // The node arrays, in topological order. Entries at the same position belong to the same node.
+    unsigned nodeCount() const;
+    NodeHandle nodeAt(unsigned position) const;
+    unsigned position(NodeHandle node) const;
+    const std::vector<Model *>& models() const;
+    const std::vector<glm::mat4>& worldTransforms() const;
+    
+    // transpose(inverse(mat3(worldTransform))) of each node, which transforms its normals to world space, as of the
+    // last update. Only recomputed for the nodes whose world transform changed.
+    const std::vector<glm::mat3>& normalMatrices() const;
+    
+    // Whether the last update changed each node's world transform
+    const std::vector<unsigned char>& worldChanged() const;
+    
+    // World-space bounds of each node's model, as of the last update. Nodes without a model have an empty box at the
+    // origin.
+    const std::vector<BoundingBox>& worldBounds() const;
+    const BoundingBox& worldBounds(NodeHandle node) const;
+    
+private:
+    // Marks a root in _parents
+    static const uint32_t NoParent = 0xffffffff;
+    
+    // Node data, by position in topological order. The local matrices cache ModelTransform::matrix().
+    std::vector<ModelTransform> _localTransforms;
+    std::vector<glm::mat4> _localMatrices;
+    std::vector<glm::mat4> _worldTransforms;
+    std::vector<glm::mat3> _normalMatrices;
+    std::vector<uint32_t> _parents;
+    std::vector<Model *> _models;
+    std::vector<uint32_t> _slots;
+    
+    // Model-space bounds of the node's model, the same in world space, and the union of the world bounds of every
+    // model in the node's subtree (inverted, with min above max, if the subtree has no models)
+    std::vector<BoundingBox> _modelBounds;
+    std::vector<BoundingBox> _worldBounds;
+    std::vector<BoundingBox> _subtreeBounds;
+    bool _subtreeBoundsDirty;
+    
+    // Set when the local transform changed since the last update, and when the last update changed the world transform
+    std::vector<unsigned char> _localDirty;
+    std::vector<unsigned char> _worldChanged;
+    
+    unsigned _recomputedNodeCount;
+    
+    // Slot data, by the index in the handle. _positions is only meaningful for slots that hold a node.
+    std::vector<uint32_t> _positions;
+    std::vector<uint32_t> _generations;
+    std::vector<uint32_t> _freeSlots;
+    
+    // Position of a node in the arrays. Throws if the handle doesn't resolve.
+    uint32_t _position(NodeHandle node) const;
+    NodeHandle _handle(uint32_t slot) const;
+    
+    // Recomputes the world bounds and normal matrices of the nodes whose world transform changed, then the subtree
+    // bounds
+    void _updateBounds();
+};
+
+#endif /* defined(__Robot__Scene__) */
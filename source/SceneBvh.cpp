@@ -0,0 +1,843 @@
+//
+//  SceneBvh.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 12/9/14.
+//
+//
+
+#include "SceneBvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#include "Model.h"
+#include "ThreadPool.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCENE_BVH_X86 1
+#include <immintrin.h>
+
+// Compiled for their instruction set regardless of the project-wide flags, like BatchMath's kernels
+#define TARGET_SSE __attribute__((target("sse2")))
+#define TARGET_AVX __attribute__((target("avx")))
+#endif
+
+// Split candidates per axis
+static const unsigned BinCount = 12;
+
+// Leaves can hold more items than this when the heuristic can't find a split that pays off
+static const unsigned MaxLeafItems = 4;
+
+static BoundingBox EmptyBox() {
+    BoundingBox box;
+    box.min = glm::vec3(FLT_MAX);
+    box.max = glm::vec3(-FLT_MAX);
+    return box;
+}
+
+static bool IsEmpty(const BoundingBox& box) {
+    return box.min.x > box.max.x;
+}
+
+static void Merge(BoundingBox& box, const BoundingBox& other) {
+    box.min = glm::min(box.min, other.min);
+    box.max = glm::max(box.max, other.max);
+}
+
+static float SurfaceArea(const BoundingBox& box) {
+    if (IsEmpty(box))
+        return 0.0f;
+    
+    glm::vec3 size = box.max - box.min;
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+static bool Overlaps(const BoundingBox& a, const BoundingBox& b) {
+    return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y && b.min.y <= a.max.y &&
+           a.min.z <= b.max.z && b.min.z <= a.max.z;
+}
+
+static unsigned BinIndex(float centroid, float minimum, float extent) {
+    unsigned bin = (unsigned) ((centroid - minimum) / extent * BinCount);
+    return std::min(bin, BinCount - 1);
+}
+
+// Slab test. Sets entry to where the ray enters the box, which can be behind the origin if it starts inside.
+static bool RayHitsBox(const BoundingBox& box, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance, float& entry) {
+    if (IsEmpty(box))
+        return false;
+    
+    glm::vec3 t1 = (box.min - origin) * inverseDirection;
+    glm::vec3 t2 = (box.max - origin) * inverseDirection;
+    glm::vec3 near = glm::min(t1, t2), far = glm::max(t1, t2);
+    
+    entry = std::max(std::max(near.x, near.y), near.z);
+    float exit = std::min(std::min(far.x, far.y), far.z);
+    return exit >= std::max(entry, 0.0f) && entry <= maxDistance;
+}
+
+// The transform applied to a point and to a vector, written out so the packet tracers can repeat the same operations
+static glm::vec3 TransformVector(const glm::mat4& m, const glm::vec3& v) {
+    return glm::vec3(m[0][0] * v.x + m[1][0] * v.y + m[2][0] * v.z,
+                     m[0][1] * v.x + m[1][1] * v.y + m[2][1] * v.z,
+                     m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z);
+}
+
+static glm::vec3 TransformPoint(const glm::mat4& m, const glm::vec3& p) {
+    return TransformVector(m, p) + glm::vec3(m[3]);
+}
+
+static void CheckInstructionSet(BatchMath::InstructionSet instructionSet) {
+    if (instructionSet > PixelConversion::bestInstructionSet())
+        throw std::runtime_error(std::string("CPU doesn't support ") + PixelConversion::instructionSetName(instructionSet));
+}
+
+/* Tests a ray against the triangles of a model, given the inverse of the transform it's drawn with. The test runs in
+ * model space; affine transforms keep distances along the ray proportional, so the distance found there is the world
+ * space one. Returns true and lowers maxDistance if a triangle is nearer than it. */
+static bool RayHitsModel(const Model& model, const glm::mat4& inverseTransform, const glm::vec3& origin, const glm::vec3& direction,
+                         float& maxDistance, unsigned& triangle) {
+    if (model.drawType != GL_TRIANGLES)
+        return false;
+    
+    glm::vec3 localOrigin = TransformPoint(inverseTransform, origin);
+    glm::vec3 localDirection = TransformVector(inverseTransform, direction);
+    
+    const std::vector<glm::vec3>& vertices = model.vertexPositions;
+    const std::vector<GLuint>& indices = model.triangleIndices;
+    size_t begin = (size_t) model.drawStart, end = std::min(indices.size(), begin + (size_t) model.drawCount);
+    
+    bool hit = false;
+    for (size_t i = begin; i + 3 <= end; i += 3) {
+        GLuint a = indices[i], b = indices[i + 1], c = indices[i + 2];
+        if (a >= vertices.size() || b >= vertices.size() || c >= vertices.size())
+            continue;
+        
+        // Moller-Trumbore, counting both sides of the triangle
+        glm::vec3 edge1 = vertices[b] - vertices[a], edge2 = vertices[c] - vertices[a];
+        glm::vec3 p = glm::cross(localDirection, edge2);
+        float determinant = glm::dot(edge1, p);
+        if (fabsf(determinant) < 1e-12f)
+            continue;
+        
+        float inverseDeterminant = 1.0f / determinant;
+        glm::vec3 s = localOrigin - vertices[a];
+        float u = glm::dot(s, p) * inverseDeterminant;
+        if (u < 0.0f || u > 1.0f)
+            continue;
+        
+        glm::vec3 q = glm::cross(s, edge1);
+        float v = glm::dot(localDirection, q) * inverseDeterminant;
+        if (v < 0.0f || u + v > 1.0f)
+            continue;
+        
+        float distance = glm::dot(edge2, q) * inverseDeterminant;
+        if (distance >= 0.0f && distance < maxDistance) {
+            maxDistance = distance;
+            triangle = (unsigned) ((i - begin) / 3);
+            hit = true;
+        }
+    }
+    
+    return hit;
+}
+
+SceneBvh::SceneBvh() : _nodes(), _items(), _itemBounds(), _itemInverseTransforms() {
+}
+
+void SceneBvh::build(const Scene& scene) {
+    _nodes.clear();
+    _items.clear();
+    _itemBounds.clear();
+    _itemInverseTransforms.clear();
+    
+    const std::vector<Model *>& models = scene.models();
+    const std::vector<BoundingBox>& bounds = scene.worldBounds();
+    std::vector<glm::vec3> centroids;
+    for (unsigned position = 0; position < scene.nodeCount(); ++position) {
+        if (!models[position])
+            continue;
+        
+        _items.push_back(scene.nodeAt(position));
+        _itemBounds.push_back(bounds[position]);
+        centroids.push_back((bounds[position].min + bounds[position].max) * 0.5f);
+    }
+    
+    if (_items.empty())
+        return;
+    
+    std::vector<uint32_t> order(_items.size());
+    for (uint32_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    
+    // A binary tree over n leaves has at most 2n - 1 nodes
+    _nodes.reserve(_items.size() * 2);
+    _nodes.push_back(Node());
+    _build(0, 0, (uint32_t) order.size(), 0, centroids, order);
+    
+    // Put the items in leaf order, so leaves refer to contiguous ranges
+    std::vector<NodeHandle> items(_items.size());
+    std::vector<BoundingBox> itemBounds(_items.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        items[i] = _items[order[i]];
+        itemBounds[i] = _itemBounds[order[i]];
+    }
+    _items.swap(items);
+    _itemBounds.swap(itemBounds);
+    
+    _itemInverseTransforms.resize(_items.size());
+    for (size_t i = 0; i < _items.size(); ++i)
+        _itemInverseTransforms[i] = glm::inverse(scene.worldTransform(_items[i]));
+}
+
+void SceneBvh::_build(uint32_t nodeIndex, uint32_t begin, uint32_t end, unsigned depth, const std::vector<glm::vec3>& centroids, std::vector<uint32_t>& order) {
+    BoundingBox bounds = EmptyBox(), centroidBounds = EmptyBox();
+    for (uint32_t i = begin; i < end; ++i) {
+        Merge(bounds, _itemBounds[order[i]]);
+        centroidBounds.min = glm::min(centroidBounds.min, centroids[order[i]]);
+        centroidBounds.max = glm::max(centroidBounds.max, centroids[order[i]]);
+    }
+    
+    uint32_t count = end - begin;
+    _nodes[nodeIndex].bounds = bounds;
+    _nodes[nodeIndex].first = begin;
+    _nodes[nodeIndex].count = count;
+    
+    if (count == 1 || depth >= MaxDepth)
+        return;
+    
+    // The cost of a split is each side's area times its item count, the expected number of item tests for a ray
+    int bestAxis = -1;
+    unsigned bestSplit = 0;
+    float bestCost = FLT_MAX;
+    for (int axis = 0; axis < 3; ++axis) {
+        float minimum = centroidBounds.min[axis], extent = centroidBounds.max[axis] - minimum;
+        if (extent <= 0.0f)
+            continue;
+        
+        BoundingBox binBounds[BinCount];
+        unsigned binCounts[BinCount] = { 0 };
+        for (unsigned bin = 0; bin < BinCount; ++bin)
+            binBounds[bin] = EmptyBox();
+        
+        for (uint32_t i = begin; i < end; ++i) {
+            unsigned bin = BinIndex(centroids[order[i]][axis], minimum, extent);
+            Merge(binBounds[bin], _itemBounds[order[i]]);
+            ++binCounts[bin];
+        }
+        
+        // Sweep from the right for the area and count right of each split, then from the left for the cost
+        float rightAreas[BinCount];
+        unsigned rightCounts[BinCount];
+        BoundingBox right = EmptyBox();
+        unsigned rightCount = 0;
+        for (unsigned bin = BinCount - 1; bin > 0; --bin) {
+            Merge(right, binBounds[bin]);
+            rightCount += binCounts[bin];
+            rightAreas[bin] = SurfaceArea(right);
+            rightCounts[bin] = rightCount;
+        }
+        
+        BoundingBox left = EmptyBox();
+        unsigned leftCount = 0;
+        for (unsigned split = 1; split < BinCount; ++split) {
+            Merge(left, binBounds[split - 1]);
+            leftCount += binCounts[split - 1];
+            if (leftCount == 0 || rightCounts[split] == 0)
+                continue;
+            
+            float cost = SurfaceArea(left) * leftCount + rightAreas[split] * rightCounts[split];
+            if (cost < bestCost) {
+                bestAxis = axis;
+                bestSplit = split;
+                bestCost = cost;
+            }
+        }
+    }
+    
+    // Small nodes stay leaves unless splitting saves item tests
+    float leafCost = SurfaceArea(bounds) * count;
+    if (count <= MaxLeafItems && (bestAxis < 0 || bestCost >= leafCost))
+        return;
+    
+    uint32_t middle = begin + count / 2;
+    if (bestAxis >= 0) {
+        float minimum = centroidBounds.min[bestAxis], extent = centroidBounds.max[bestAxis] - minimum;
+        uint32_t *split = std::partition(&order[0] + begin, &order[0] + end, [&](uint32_t item) {
+            return BinIndex(centroids[item][bestAxis], minimum, extent) < bestSplit;
+        });
+        middle = (uint32_t) (split - &order[0]);
+    }
+    
+    uint32_t leftIndex = (uint32_t) _nodes.size();
+    _nodes.push_back(Node());
+    _nodes.push_back(Node());
+    _nodes[nodeIndex].first = leftIndex;
+    _nodes[nodeIndex].count = 0;
+    
+    _build(leftIndex, begin, middle, depth + 1, centroids, order);
+    _build(leftIndex + 1, middle, end, depth + 1, centroids, order);
+}
+
+void SceneBvh::refit(const Scene& scene) {
+    // The inverses are the expensive part, and most items, like the room, don't move
+    const std::vector<unsigned char>& worldChanged = scene.worldChanged();
+    for (size_t i = 0; i < _items.size(); ++i) {
+        if (!scene.contains(_items[i])) {
+            _itemBounds[i] = EmptyBox();
+            continue;
+        }
+        
+        unsigned position = scene.position(_items[i]);
+        if (!worldChanged[position])
+            continue;
+        
+        _itemBounds[i] = scene.worldBounds()[position];
+        _itemInverseTransforms[i] = glm::inverse(scene.worldTransforms()[position]);
+    }
+    
+    // Children are always created after their parent, so going backwards refits them first
+    for (size_t index = _nodes.size(); index-- > 0; ) {
+        Node& node = _nodes[index];
+        node.bounds = EmptyBox();
+        
+        if (node.count > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i)
+                Merge(node.bounds, _itemBounds[i]);
+        } else {
+            Merge(node.bounds, _nodes[node.first].bounds);
+            Merge(node.bounds, _nodes[node.first + 1].bounds);
+        }
+    }
+}
+
+bool SceneBvh::raycast(const Scene& scene, const glm::vec3& origin, const glm::vec3& direction, float maxDistance, RayHit& hit,
+                       NodeHandle ignoredNode) const {
+    if (_nodes.empty())
+        return false;
+    
+    glm::vec3 inverseDirection = glm::vec3(1.0f) / direction;
+    bool found = false;
+    
+    // Each level leaves at most one sibling on the stack
+    uint32_t stack[MaxDepth + 2];
+    unsigned stackSize = 0;
+    stack[stackSize++] = 0;
+    
+    while (stackSize > 0) {
+        const Node& node = _nodes[stack[--stackSize]];
+        float entry;
+        if (!RayHitsBox(node.bounds, origin, inverseDirection, maxDistance, entry))
+            continue;
+        
+        if (node.count > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                NodeHandle item = _items[i];
+                if (item == ignoredNode || !scene.contains(item) || !RayHitsBox(_itemBounds[i], origin, inverseDirection, maxDistance, entry))
+                    continue;
+                
+                unsigned triangle;
+                if (RayHitsModel(*scene.model(item), _itemInverseTransforms[i], origin, direction, maxDistance, triangle)) {
+                    hit.node = item;
+                    hit.triangle = triangle;
+                    found = true;
+                }
+            }
+            continue;
+        }
+        
+        // Visit the nearer child first, so hits in it shorten the ray for the other one
+        float leftEntry, rightEntry;
+        bool hitsLeft = RayHitsBox(_nodes[node.first].bounds, origin, inverseDirection, maxDistance, leftEntry);
+        bool hitsRight = RayHitsBox(_nodes[node.first + 1].bounds, origin, inverseDirection, maxDistance, rightEntry);
+        if (hitsLeft && hitsRight) {
+            bool leftFirst = leftEntry <= rightEntry;
+            stack[stackSize++] = leftFirst ? node.first + 1 : node.first;
+            stack[stackSize++] = leftFirst ? node.first : node.first + 1;
+        } else if (hitsLeft) {
+            stack[stackSize++] = node.first;
+        } else if (hitsRight) {
+            stack[stackSize++] = node.first + 1;
+        }
+    }
+    
+    if (found) {
+        hit.distance = maxDistance;
+        hit.position = origin + direction * maxDistance;
+    }
+    
+    return found;
+}
+
+#if SCENE_BVH_X86
+
+// The widest packet
+static const unsigned MaxPacketWidth = 8;
+
+/* Gathers the rays of a packet into rows per component: origin xyz, direction xyz, inverse direction xyz, and 1 for
+ * the rays that exist. Lanes past count repeat the first ray. */
+static void GatherPacket(const glm::vec3 *origins, const glm::vec3 *directions, unsigned count, unsigned width, float rows[10][MaxPacketWidth]) {
+    for (unsigned lane = 0; lane < width; ++lane) {
+        unsigned ray = lane < count ? lane : 0;
+        glm::vec3 inverseDirection = glm::vec3(1.0f) / directions[ray];
+        
+        rows[0][lane] = origins[ray].x;
+        rows[1][lane] = origins[ray].y;
+        rows[2][lane] = origins[ray].z;
+        rows[3][lane] = directions[ray].x;
+        rows[4][lane] = directions[ray].y;
+        rows[5][lane] = directions[ray].z;
+        rows[6][lane] = inverseDirection.x;
+        rows[7][lane] = inverseDirection.y;
+        rows[8][lane] = inverseDirection.z;
+        rows[9][lane] = lane < count ? 1.0f : 0.0f;
+    }
+}
+
+/* Ray packets: each SIMD lane traces its own ray, and the packet descends into every tree node any of its rays hits.
+ * The arithmetic is the scalar tests' operation for operation, without FMA, so every lane finds exactly the distance
+ * raycast() would. Lanes past the end of the batch are inactive and never hit anything. */
+
+struct PacketSSE {
+    __m128 originX, originY, originZ;
+    __m128 directionX, directionY, directionZ;
+    __m128 inverseX, inverseY, inverseZ;
+    __m128 distance;
+    __m128 active;
+};
+
+struct PacketAVX {
+    __m256 originX, originY, originZ;
+    __m256 directionX, directionY, directionZ;
+    __m256 inverseX, inverseY, inverseZ;
+    __m256 distance;
+    __m256 active;
+};
+
+struct RayPackets {
+    // SSE kernels
+    
+    // The lanes whose ray hits the box, with the entry distances
+    TARGET_SSE static inline __m128 hitsBoxSSE(const BoundingBox& box, const PacketSSE& packet, __m128& entry) {
+        __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.min.x), packet.originX), packet.inverseX);
+        __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.min.y), packet.originY), packet.inverseY);
+        __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.min.z), packet.originZ), packet.inverseZ);
+        __m128 t2x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.max.x), packet.originX), packet.inverseX);
+        __m128 t2y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.max.y), packet.originY), packet.inverseY);
+        __m128 t2z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.max.z), packet.originZ), packet.inverseZ);
+        
+        entry = _mm_max_ps(_mm_max_ps(_mm_min_ps(t1x, t2x), _mm_min_ps(t1y, t2y)), _mm_min_ps(t1z, t2z));
+        __m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t1x, t2x), _mm_max_ps(t1y, t2y)), _mm_max_ps(t1z, t2z));
+        
+        __m128 entryAhead = _mm_max_ps(entry, _mm_setzero_ps());
+        __m128 hits = _mm_and_ps(_mm_cmpge_ps(exit, entryAhead), _mm_cmple_ps(entry, packet.distance));
+        return _mm_and_ps(hits, packet.active);
+    }
+    
+    // The smallest entry distance among the lanes that hit
+    TARGET_SSE static inline float nearestEntrySSE(__m128 entry, __m128 hits) {
+        __m128 v = _mm_or_ps(_mm_and_ps(hits, entry), _mm_andnot_ps(hits, _mm_set1_ps(FLT_MAX)));
+        v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+        v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+        return _mm_cvtss_f32(v);
+    }
+    
+    // Row r of the upper 3x3 of m times (x, y, z), as in TransformVector
+    TARGET_SSE static inline __m128 transformRowSSE(const glm::mat4& m, int r, __m128 x, __m128 y, __m128 z) {
+        __m128 sum = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][r]), x), _mm_mul_ps(_mm_set1_ps(m[1][r]), y));
+        return _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(m[2][r]), z));
+    }
+    
+    // Lowers the distances of the lanes in rays that hit a triangle of the model
+    TARGET_SSE static void hitsModelSSE(const Model& model, const glm::mat4& inverseTransform, __m128 rays, PacketSSE& packet) {
+        if (model.drawType != GL_TRIANGLES)
+            return;
+        
+        __m128 ox = _mm_add_ps(transformRowSSE(inverseTransform, 0, packet.originX, packet.originY, packet.originZ), _mm_set1_ps(inverseTransform[3][0]));
+        __m128 oy = _mm_add_ps(transformRowSSE(inverseTransform, 1, packet.originX, packet.originY, packet.originZ), _mm_set1_ps(inverseTransform[3][1]));
+        __m128 oz = _mm_add_ps(transformRowSSE(inverseTransform, 2, packet.originX, packet.originY, packet.originZ), _mm_set1_ps(inverseTransform[3][2]));
+        __m128 dx = transformRowSSE(inverseTransform, 0, packet.directionX, packet.directionY, packet.directionZ);
+        __m128 dy = transformRowSSE(inverseTransform, 1, packet.directionX, packet.directionY, packet.directionZ);
+        __m128 dz = transformRowSSE(inverseTransform, 2, packet.directionX, packet.directionY, packet.directionZ);
+        
+        const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), epsilon = _mm_set1_ps(1e-12f);
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        
+        const std::vector<glm::vec3>& vertices = model.vertexPositions;
+        const std::vector<GLuint>& indices = model.triangleIndices;
+        size_t begin = (size_t) model.drawStart, end = std::min(indices.size(), begin + (size_t) model.drawCount);
+        
+        for (size_t i = begin; i + 3 <= end; i += 3) {
+            GLuint a = indices[i], b = indices[i + 1], c = indices[i + 2];
+            if (a >= vertices.size() || b >= vertices.size() || c >= vertices.size())
+                continue;
+            
+            glm::vec3 edge1 = vertices[b] - vertices[a], edge2 = vertices[c] - vertices[a];
+            __m128 e1x = _mm_set1_ps(edge1.x), e1y = _mm_set1_ps(edge1.y), e1z = _mm_set1_ps(edge1.z);
+            __m128 e2x = _mm_set1_ps(edge2.x), e2y = _mm_set1_ps(edge2.y), e2z = _mm_set1_ps(edge2.z);
+            
+            __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(e2y, dz));
+            __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(e2z, dx));
+            __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(e2x, dy));
+            __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+            __m128 inverseDeterminant = _mm_div_ps(one, determinant);
+            
+            __m128 sx = _mm_sub_ps(ox, _mm_set1_ps(vertices[a].x));
+            __m128 sy = _mm_sub_ps(oy, _mm_set1_ps(vertices[a].y));
+            __m128 sz = _mm_sub_ps(oz, _mm_set1_ps(vertices[a].z));
+            __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inverseDeterminant);
+            
+            __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(e1y, sz));
+            __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(e1z, sx));
+            __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(e1x, sy));
+            __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverseDeterminant);
+            __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverseDeterminant);
+            
+            __m128 uv = _mm_add_ps(u, v);
+            __m128 hits = _mm_and_ps(rays, _mm_cmpge_ps(_mm_and_ps(determinant, absMask), epsilon));
+            hits = _mm_and_ps(hits, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+            hits = _mm_and_ps(hits, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(uv, one)));
+            hits = _mm_and_ps(hits, _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmplt_ps(t, packet.distance)));
+            packet.distance = _mm_or_ps(_mm_and_ps(hits, t), _mm_andnot_ps(hits, packet.distance));
+        }
+    }
+    
+    TARGET_SSE static void tracePacketSSE(const SceneBvh& bvh, const Scene& scene, PacketSSE& packet, NodeHandle ignoredNode) {
+        const std::vector<SceneBvh::Node>& nodes = bvh._nodes;
+        uint32_t stack[SceneBvh::MaxDepth + 2];
+        unsigned stackSize = 0;
+        stack[stackSize++] = 0;
+        
+        while (stackSize > 0) {
+            const SceneBvh::Node& node = nodes[stack[--stackSize]];
+            __m128 entry;
+            if (IsEmpty(node.bounds) || !_mm_movemask_ps(hitsBoxSSE(node.bounds, packet, entry)))
+                continue;
+            
+            if (node.count > 0) {
+                for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                    NodeHandle item = bvh._items[i];
+                    if (item == ignoredNode || !scene.contains(item) || IsEmpty(bvh._itemBounds[i]))
+                        continue;
+                    
+                    // Only the rays that hit the model's box test its triangles, like raycast() does
+                    __m128 hits = hitsBoxSSE(bvh._itemBounds[i], packet, entry);
+                    if (_mm_movemask_ps(hits))
+                        hitsModelSSE(*scene.model(item), bvh._itemInverseTransforms[i], hits, packet);
+                }
+                continue;
+            }
+            
+            // Visit the child the packet reaches first before the other one
+            const BoundingBox& left = nodes[node.first].bounds, & right = nodes[node.first + 1].bounds;
+            __m128 leftEntry, rightEntry;
+            __m128 leftHits = IsEmpty(left) ? _mm_setzero_ps() : hitsBoxSSE(left, packet, leftEntry);
+            __m128 rightHits = IsEmpty(right) ? _mm_setzero_ps() : hitsBoxSSE(right, packet, rightEntry);
+            bool hitsLeft = _mm_movemask_ps(leftHits) != 0, hitsRight = _mm_movemask_ps(rightHits) != 0;
+            
+            if (hitsLeft && hitsRight) {
+                bool leftFirst = nearestEntrySSE(leftEntry, leftHits) <= nearestEntrySSE(rightEntry, rightHits);
+                stack[stackSize++] = leftFirst ? node.first + 1 : node.first;
+                stack[stackSize++] = leftFirst ? node.first : node.first + 1;
+            } else if (hitsLeft) {
+                stack[stackSize++] = node.first;
+            } else if (hitsRight) {
+                stack[stackSize++] = node.first + 1;
+            }
+        }
+    }
+    
+    TARGET_SSE static void traceSSE(const SceneBvh& bvh, const Scene& scene, const glm::vec3 *origins, const glm::vec3 *directions, unsigned count,
+                                    float maxDistance, float *distances, NodeHandle ignoredNode) {
+        for (unsigned first = 0; first < count; first += 4) {
+            unsigned lanes = std::min(count - first, 4u);
+            float rows[10][MaxPacketWidth];
+            GatherPacket(origins + first, directions + first, lanes, 4, rows);
+            
+            PacketSSE packet;
+            packet.originX = _mm_loadu_ps(rows[0]);
+            packet.originY = _mm_loadu_ps(rows[1]);
+            packet.originZ = _mm_loadu_ps(rows[2]);
+            packet.directionX = _mm_loadu_ps(rows[3]);
+            packet.directionY = _mm_loadu_ps(rows[4]);
+            packet.directionZ = _mm_loadu_ps(rows[5]);
+            packet.inverseX = _mm_loadu_ps(rows[6]);
+            packet.inverseY = _mm_loadu_ps(rows[7]);
+            packet.inverseZ = _mm_loadu_ps(rows[8]);
+            packet.distance = _mm_set1_ps(maxDistance);
+            packet.active = _mm_cmpgt_ps(_mm_loadu_ps(rows[9]), _mm_setzero_ps());
+            
+            tracePacketSSE(bvh, scene, packet, ignoredNode);
+            
+            float result[MaxPacketWidth];
+            _mm_storeu_ps(result, packet.distance);
+            for (unsigned lane = 0; lane < lanes; ++lane)
+                distances[first + lane] = result[lane];
+        }
+    }
+    
+    // AVX kernels, the same with 8 lanes
+    
+    // The lanes whose ray hits the box, with the entry distances
+    TARGET_AVX static inline __m256 hitsBoxAVX(const BoundingBox& box, const PacketAVX& packet, __m256& entry) {
+        __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box.min.x), packet.originX), packet.inverseX);
+        __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box.min.y), packet.originY), packet.inverseY);
+        __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box.min.z), packet.originZ), packet.inverseZ);
+        __m256 t2x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box.max.x), packet.originX), packet.inverseX);
+        __m256 t2y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box.max.y), packet.originY), packet.inverseY);
+        __m256 t2z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box.max.z), packet.originZ), packet.inverseZ);
+        
+        entry = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t1x, t2x), _mm256_min_ps(t1y, t2y)), _mm256_min_ps(t1z, t2z));
+        __m256 exit = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t1x, t2x), _mm256_max_ps(t1y, t2y)), _mm256_max_ps(t1z, t2z));
+        
+        __m256 entryAhead = _mm256_max_ps(entry, _mm256_setzero_ps());
+        __m256 hits = _mm256_and_ps(_mm256_cmp_ps(exit, entryAhead, _CMP_GE_OQ), _mm256_cmp_ps(entry, packet.distance, _CMP_LE_OQ));
+        return _mm256_and_ps(hits, packet.active);
+    }
+    
+    // The smallest entry distance among the lanes that hit
+    TARGET_AVX static inline float nearestEntryAVX(__m256 entry, __m256 hits) {
+        __m256 v = _mm256_or_ps(_mm256_and_ps(hits, entry), _mm256_andnot_ps(hits, _mm256_set1_ps(FLT_MAX)));
+        v = _mm256_min_ps(v, _mm256_permute2f128_ps(v, v, 1));
+        v = _mm256_min_ps(v, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+        v = _mm256_min_ps(v, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+        return _mm_cvtss_f32(_mm256_castps256_ps128(v));
+    }
+    
+    // Row r of the upper 3x3 of m times (x, y, z), as in TransformVector
+    TARGET_AVX static inline __m256 transformRowAVX(const glm::mat4& m, int r, __m256 x, __m256 y, __m256 z) {
+        __m256 sum = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[0][r]), x), _mm256_mul_ps(_mm256_set1_ps(m[1][r]), y));
+        return _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(m[2][r]), z));
+    }
+    
+    // Lowers the distances of the lanes in rays that hit a triangle of the model
+    TARGET_AVX static void hitsModelAVX(const Model& model, const glm::mat4& inverseTransform, __m256 rays, PacketAVX& packet) {
+        if (model.drawType != GL_TRIANGLES)
+            return;
+        
+        __m256 ox = _mm256_add_ps(transformRowAVX(inverseTransform, 0, packet.originX, packet.originY, packet.originZ), _mm256_set1_ps(inverseTransform[3][0]));
+        __m256 oy = _mm256_add_ps(transformRowAVX(inverseTransform, 1, packet.originX, packet.originY, packet.originZ), _mm256_set1_ps(inverseTransform[3][1]));
+        __m256 oz = _mm256_add_ps(transformRowAVX(inverseTransform, 2, packet.originX, packet.originY, packet.originZ), _mm256_set1_ps(inverseTransform[3][2]));
+        __m256 dx = transformRowAVX(inverseTransform, 0, packet.directionX, packet.directionY, packet.directionZ);
+        __m256 dy = transformRowAVX(inverseTransform, 1, packet.directionX, packet.directionY, packet.directionZ);
+        __m256 dz = transformRowAVX(inverseTransform, 2, packet.directionX, packet.directionY, packet.directionZ);
+        
+        const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f), epsilon = _mm256_set1_ps(1e-12f);
+        const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        
+        const std::vector<glm::vec3>& vertices = model.vertexPositions;
+        const std::vector<GLuint>& indices = model.triangleIndices;
+        size_t begin = (size_t) model.drawStart, end = std::min(indices.size(), begin + (size_t) model.drawCount);
+        
+        for (size_t i = begin; i + 3 <= end; i += 3) {
+            GLuint a = indices[i], b = indices[i + 1], c = indices[i + 2];
+            if (a >= vertices.size() || b >= vertices.size() || c >= vertices.size())
+                continue;
+            
+            glm::vec3 edge1 = vertices[b] - vertices[a], edge2 = vertices[c] - vertices[a];
+            __m256 e1x = _mm256_set1_ps(edge1.x), e1y = _mm256_set1_ps(edge1.y), e1z = _mm256_set1_ps(edge1.z);
+            __m256 e2x = _mm256_set1_ps(edge2.x), e2y = _mm256_set1_ps(edge2.y), e2z = _mm256_set1_ps(edge2.z);
+            
+            __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(e2y, dz));
+            __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(e2z, dx));
+            __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(e2x, dy));
+            __m256 determinant = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+            __m256 inverseDeterminant = _mm256_div_ps(one, determinant);
+            
+            __m256 sx = _mm256_sub_ps(ox, _mm256_set1_ps(vertices[a].x));
+            __m256 sy = _mm256_sub_ps(oy, _mm256_set1_ps(vertices[a].y));
+            __m256 sz = _mm256_sub_ps(oz, _mm256_set1_ps(vertices[a].z));
+            __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), inverseDeterminant);
+            
+            __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(e1y, sz));
+            __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(e1z, sx));
+            __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(e1x, sy));
+            __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inverseDeterminant);
+            __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inverseDeterminant);
+            
+            __m256 uv = _mm256_add_ps(u, v);
+            __m256 hits = _mm256_and_ps(rays, _mm256_cmp_ps(_mm256_and_ps(determinant, absMask), epsilon, _CMP_GE_OQ));
+            hits = _mm256_and_ps(hits, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+            hits = _mm256_and_ps(hits, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(uv, one, _CMP_LE_OQ)));
+            hits = _mm256_and_ps(hits, _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GE_OQ), _mm256_cmp_ps(t, packet.distance, _CMP_LT_OQ)));
+            packet.distance = _mm256_or_ps(_mm256_and_ps(hits, t), _mm256_andnot_ps(hits, packet.distance));
+        }
+    }
+    
+    TARGET_AVX static void tracePacketAVX(const SceneBvh& bvh, const Scene& scene, PacketAVX& packet, NodeHandle ignoredNode) {
+        const std::vector<SceneBvh::Node>& nodes = bvh._nodes;
+        uint32_t stack[SceneBvh::MaxDepth + 2];
+        unsigned stackSize = 0;
+        stack[stackSize++] = 0;
+        
+        while (stackSize > 0) {
+            const SceneBvh::Node& node = nodes[stack[--stackSize]];
+            __m256 entry;
+            if (IsEmpty(node.bounds) || !_mm256_movemask_ps(hitsBoxAVX(node.bounds, packet, entry)))
+                continue;
+            
+            if (node.count > 0) {
+                for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                    NodeHandle item = bvh._items[i];
+                    if (item == ignoredNode || !scene.contains(item) || IsEmpty(bvh._itemBounds[i]))
+                        continue;
+                    
+                    // Only the rays that hit the model's box test its triangles, like raycast() does
+                    __m256 hits = hitsBoxAVX(bvh._itemBounds[i], packet, entry);
+                    if (_mm256_movemask_ps(hits))
+                        hitsModelAVX(*scene.model(item), bvh._itemInverseTransforms[i], hits, packet);
+                }
+                continue;
+            }
+            
+            // Visit the child the packet reaches first before the other one
+            const BoundingBox& left = nodes[node.first].bounds, & right = nodes[node.first + 1].bounds;
+            __m256 leftEntry, rightEntry;
+            __m256 leftHits = IsEmpty(left) ? _mm256_setzero_ps() : hitsBoxAVX(left, packet, leftEntry);
+            __m256 rightHits = IsEmpty(right) ? _mm256_setzero_ps() : hitsBoxAVX(right, packet, rightEntry);
+            bool hitsLeft = _mm256_movemask_ps(leftHits) != 0, hitsRight = _mm256_movemask_ps(rightHits) != 0;
+            
+            if (hitsLeft && hitsRight) {
+                bool leftFirst = nearestEntryAVX(leftEntry, leftHits) <= nearestEntryAVX(rightEntry, rightHits);
+                stack[stackSize++] = leftFirst ? node.first + 1 : node.first;
+                stack[stackSize++] = leftFirst ? node.first : node.first + 1;
+            } else if (hitsLeft) {
+                stack[stackSize++] = node.first;
+            } else if (hitsRight) {
+                stack[stackSize++] = node.first + 1;
+            }
+        }
+    }
+    
+    TARGET_AVX static void traceAVX(const SceneBvh& bvh, const Scene& scene, const glm::vec3 *origins, const glm::vec3 *directions, unsigned count,
+                                    float maxDistance, float *distances, NodeHandle ignoredNode) {
+        for (unsigned first = 0; first < count; first += 8) {
+            unsigned lanes = std::min(count - first, 8u);
+            float rows[10][MaxPacketWidth];
+            GatherPacket(origins + first, directions + first, lanes, 8, rows);
+            
+            PacketAVX packet;
+            packet.originX = _mm256_loadu_ps(rows[0]);
+            packet.originY = _mm256_loadu_ps(rows[1]);
+            packet.originZ = _mm256_loadu_ps(rows[2]);
+            packet.directionX = _mm256_loadu_ps(rows[3]);
+            packet.directionY = _mm256_loadu_ps(rows[4]);
+            packet.directionZ = _mm256_loadu_ps(rows[5]);
+            packet.inverseX = _mm256_loadu_ps(rows[6]);
+            packet.inverseY = _mm256_loadu_ps(rows[7]);
+            packet.inverseZ = _mm256_loadu_ps(rows[8]);
+            packet.distance = _mm256_set1_ps(maxDistance);
+            packet.active = _mm256_cmp_ps(_mm256_loadu_ps(rows[9]), _mm256_setzero_ps(), _CMP_GT_OQ);
+            
+            tracePacketAVX(bvh, scene, packet, ignoredNode);
+            
+            float result[MaxPacketWidth];
+            _mm256_storeu_ps(result, packet.distance);
+            for (unsigned lane = 0; lane < lanes; ++lane)
+                distances[first + lane] = result[lane];
+        }
+    }
+};
+
+#endif
+
+// A raycastBatch call, shared by the pool's threads
+struct RayBatch {
+    const SceneBvh *bvh;
+    const Scene *scene;
+    const glm::vec3 *origins;
+    const glm::vec3 *directions;
+    unsigned count;
+    float maxDistance;
+    float *distances;
+    NodeHandle ignoredNode;
+    BatchMath::InstructionSet instructionSet;
+};
+
+// Rays per pool task, a multiple of every packet width
+static const unsigned RaysPerTask = 256;
+
+static void TraceRayRange(const RayBatch& batch, unsigned first, unsigned count) {
+    const glm::vec3 *origins = batch.origins + first, *directions = batch.directions + first;
+    float *distances = batch.distances + first;
+
+#if SCENE_BVH_X86
+    if (batch.instructionSet >= PixelConversion::InstructionSet_AVX2) {
+        RayPackets::traceAVX(*batch.bvh, *batch.scene, origins, directions, count, batch.maxDistance, distances, batch.ignoredNode);
+        return;
+    }
+    if (batch.instructionSet >= PixelConversion::InstructionSet_SSSE3) {
+        RayPackets::traceSSE(*batch.bvh, *batch.scene, origins, directions, count, batch.maxDistance, distances, batch.ignoredNode);
+        return;
+    }
+#endif
+
+    for (unsigned i = 0; i < count; ++i) {
+        RayHit hit;
+        distances[i] = batch.bvh->raycast(*batch.scene, origins[i], directions[i], batch.maxDistance, hit, batch.ignoredNode) ?
+                       hit.distance : batch.maxDistance;
+    }
+}
+
+void SceneBvh::raycastBatch(const Scene& scene, const glm::vec3 *origins, const glm::vec3 *directions, unsigned count, float maxDistance,
+                            float *distances, NodeHandle ignoredNode, BatchMath::InstructionSet instructionSet) const {
+    CheckInstructionSet(instructionSet);
+    
+    if (_nodes.empty()) {
+        std::fill(distances, distances + count, maxDistance);
+        return;
+    }
+    
+    RayBatch batch = { this, &scene, origins, directions, count, maxDistance, distances, ignoredNode, instructionSet };
+    
+    // Capturing only a pointer keeps the loop function small enough not to allocate
+    const RayBatch *batchPointer = &batch;
+    ThreadPool::shared().parallelFor((count + RaysPerTask - 1) / RaysPerTask, 1, [batchPointer](unsigned begin, unsigned end) {
+        unsigned first = begin * RaysPerTask;
+        unsigned last = std::min(end * RaysPerTask, batchPointer->count);
+        TraceRayRange(*batchPointer, first, last - first);
+    });
+}
+
+bool SceneBvh::hasLineOfSight(const Scene& scene, const glm::vec3& from, const glm::vec3& to, NodeHandle ignoredNode) const {
+    // Stop just short of the target, so a triangle the target point lies on doesn't block it
+    RayHit hit;
+    return !raycast(scene, from, to - from, 0.999f, hit, ignoredNode);
+}
+
+void SceneBvh::overlapping(const BoundingBox& box, std::vector<NodeHandle>& nodes) const {
+    if (_nodes.empty())
+        return;
+    
+    uint32_t stack[MaxDepth + 2];
+    unsigned stackSize = 0;
+    stack[stackSize++] = 0;
+    
+    while (stackSize > 0) {
+        const Node& node = _nodes[stack[--stackSize]];
+        if (IsEmpty(node.bounds) || !Overlaps(node.bounds, box))
+            continue;
+        
+        if (node.count > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                if (!IsEmpty(_itemBounds[i]) && Overlaps(_itemBounds[i], box))
+                    nodes.push_back(_items[i]);
+            }
+        } else {
+            stack[stackSize++] = node.first;
+            stack[stackSize++] = node.first + 1;
+        }
+    }
+}
+
+unsigned SceneBvh::nodeCount() const {
+    return (unsigned) _nodes.size();
+}
+
+unsigned SceneBvh::itemCount() const {
+    return (unsigned) _items.size();
+}
@@ -0,0 +1,97 @@
+//
+//  SceneBvh.h
+//  Robot
+//
+//  Created by Itamar Ravid on 12/9/14.
+//
+//
+
+#ifndef __Robot__SceneBvh__
+#define __Robot__SceneBvh__
+
+#include <stdint.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "BatchMath.h"
+#include "Scene.h"
+
+// The nearest triangle a ray hit
+struct RayHit {
+    NodeHandle node;
+    unsigned triangle; /* Index of the triangle in the model's draw range */
+    float distance; /* Along the ray, in multiples of its direction */
+    glm::vec3 position; /* In world space */
+};
+
+/* A bounding volume hierarchy over the world bounds of the scene's models, for ray picks and overlap queries.
+ *
+ * build() splits the nodes with the surface area heuristic, over 12 bins per axis. When nodes only move, refit()
+ * recomputes the boxes bottom-up and keeps the tree, which costs a linear pass instead of a build. The tree stays
+ * correct through any number of refits, but gets looser as nodes move far from where they were built, so rebuild it
+ * after large changes. Nodes created or removed since the build aren't seen until the next build.
+ *
+ * Rays are tested against the triangles of the models whose boxes they hit, using the CPU copies in Model. Only
+ * GL_TRIANGLES models can be hit. Queries see the nodes where they were at the last build or refit.
+ *
+ * raycastBatch() traces many rays at once, as SIMD packets of 4 (SSSE3 level) or 8 (AVX2 level) rays spread over the
+ * shared thread pool. A packet visits every tree node any of its rays hits, so it pays off for coherent rays, like the
+ * pixels of a depth image. */
+class SceneBvh {
+public:
+    SceneBvh();
+    
+    // Rebuilds the tree over every node in the scene that has a model
+    void build(const Scene& scene);
+    
+    // Updates the boxes to the scene's current world bounds, keeping the tree structure. Only the items the scene's last
+    // update moved are recomputed, so refit after every update that moves nodes, before the next one.
+    void refit(const Scene& scene);
+    
+    /* Finds the nearest triangle along the ray from origin in direction, up to maxDistance times direction away.
+     * Triangles of ignoredNode are skipped, so rays can start inside a model. Returns false if nothing was hit. */
+    bool raycast(const Scene& scene, const glm::vec3& origin, const glm::vec3& direction, float maxDistance, RayHit& hit,
+                 NodeHandle ignoredNode = NodeHandle()) const;
+    
+    /* Traces count rays and sets distances[i] to the distance to the nearest hit along directions[i], in multiples
+     * of it, or to maxDistance if nothing is nearer. The distances are the ones raycast() finds. */
+    void raycastBatch(const Scene& scene, const glm::vec3 *origins, const glm::vec3 *directions, unsigned count, float maxDistance,
+                      float *distances, NodeHandle ignoredNode = NodeHandle(),
+                      BatchMath::InstructionSet instructionSet = PixelConversion::bestInstructionSet()) const;
+    
+    // Whether the segment between two points is free of triangles, other than ignoredNode's
+    bool hasLineOfSight(const Scene& scene, const glm::vec3& from, const glm::vec3& to, NodeHandle ignoredNode = NodeHandle()) const;
+    
+    // Appends the nodes whose world bounds overlap the box
+    void overlapping(const BoundingBox& box, std::vector<NodeHandle>& nodes) const;
+    
+    unsigned nodeCount() const;
+    unsigned itemCount() const;
+    
+private:
+    // Leaves hold count items starting at first. Inner nodes have count 0, and their children at first and first + 1.
+    struct Node {
+        BoundingBox bounds;
+        uint32_t first;
+        uint32_t count;
+    };
+    
+    // Deeper trees are cut off with larger leaves, so traversal fits in a fixed stack
+    static const unsigned MaxDepth = 64;
+    
+    std::vector<Node> _nodes;
+    
+    // The items in leaf order, and their world bounds and inverse world transforms as of the last build or refit
+    std::vector<NodeHandle> _items;
+    std::vector<BoundingBox> _itemBounds;
+    std::vector<glm::mat4> _itemInverseTransforms;
+    
+    // The SIMD packet tracers, which walk the tree directly
+    friend struct RayPackets;
+    
+    // Builds the subtree of a node over order[begin, end), which it reorders. Item bounds are still in scene order.
+    void _build(uint32_t nodeIndex, uint32_t begin, uint32_t end, unsigned depth, const std::vector<glm::vec3>& centroids, std::vector<uint32_t>& order);
+};
+
+#endif /* defined(__Robot__SceneBvh__) */
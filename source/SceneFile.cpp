@@ -0,0 +1,392 @@
+//
+//  SceneFile.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 16/9/14.
+//
+//
+
+#include "SceneFile.h"
+
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glm/gtc/quaternion.hpp>
+
+static const char SceneMagic[4] = { 'R', 'S', 'C', 'N' };
+static const uint32_t SceneVersion = 1;
+
+// Written in the machine's byte order, so files from a machine with the other order are rejected
+static const uint32_t SceneEndianness = 0x04030201;
+
+struct SceneFile::Header {
+    char magic[4];
+    uint32_t endianness;
+    uint32_t version;
+    uint32_t meshCount;
+    uint32_t materialCount;
+    uint32_t nodeCount;
+    uint32_t stringBytes;
+};
+
+// The tables are read in place, so their layout is the file format
+static_assert(sizeof(SceneFile::Mesh) == 8, "Mesh entries must be packed");
+static_assert(sizeof(SceneFile::Material) == 64, "Material entries must be packed");
+static_assert(sizeof(SceneFile::Node) == 60, "Node entries must be packed");
+
+SceneFile::SceneFile(const std::string& path) : _mapping(nullptr), _size(0), _header(nullptr), _meshes(nullptr), _materials(nullptr),
+    _nodes(nullptr), _strings(nullptr), _modelIndices(), _modelCount(0) {
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0)
+        throw std::runtime_error("Failed to open scene file: " + path);
+    
+    struct stat status;
+    if (fstat(file, &status) != 0 || status.st_size < (off_t) sizeof(Header)) {
+        close(file);
+        throw std::runtime_error("Malformed scene file, too short: " + path);
+    }
+    
+    _size = (size_t) status.st_size;
+    _mapping = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (_mapping == MAP_FAILED) {
+        _mapping = nullptr;
+        throw std::runtime_error("Failed to map scene file: " + path);
+    }
+    
+    // Unmaps on the way out if the checks throw
+    try {
+        const char *bytes = (const char *) _mapping;
+        _header = (const Header *) bytes;
+        if (memcmp(_header->magic, SceneMagic, sizeof(SceneMagic)) != 0 || _header->endianness != SceneEndianness)
+            throw std::runtime_error("Not a scene file: " + path);
+        if (_header->version != SceneVersion)
+            throw std::runtime_error("Unsupported scene file version: " + path);
+        
+        uint64_t expectedSize = sizeof(Header) + (uint64_t) _header->meshCount * sizeof(Mesh) + (uint64_t) _header->materialCount * sizeof(Material)
+                              + (uint64_t) _header->nodeCount * sizeof(Node) + _header->stringBytes;
+        if (expectedSize != _size)
+            throw std::runtime_error("Malformed scene file, wrong size: " + path);
+        
+        _meshes = (const Mesh *) (bytes + sizeof(Header));
+        _materials = (const Material *) (_meshes + _header->meshCount);
+        _nodes = (const Node *) (_materials + _header->materialCount);
+        _strings = (const char *) (_nodes + _header->nodeCount);
+        
+        // The string block starts with the empty string, and every string in it is terminated
+        if (_header->stringBytes == 0 || _strings[0] != '\0' || _strings[_header->stringBytes - 1] != '\0')
+            throw std::runtime_error("Malformed scene file, bad string block: " + path);
+        
+        uint32_t stringBytes = _header->stringBytes;
+        for (unsigned i = 0; i < _header->meshCount; ++i) {
+            if (_meshes[i].path >= stringBytes || _meshes[i].object >= stringBytes)
+                throw std::runtime_error("Malformed scene file, bad mesh: " + path);
+        }
+        
+        for (unsigned i = 0; i < _header->materialCount; ++i) {
+            const Material& material = _materials[i];
+            if (material.texture >= stringBytes || material.vertexShader >= stringBytes || material.fragmentShader >= stringBytes)
+                throw std::runtime_error("Malformed scene file, bad material: " + path);
+        }
+        
+        // Parents must come first, so the nodes can be created in order
+        if (_header->nodeCount > Scene::MaxNodes)
+            throw std::runtime_error("Malformed scene file, too many nodes: " + path);
+        for (unsigned i = 0; i < _header->nodeCount; ++i) {
+            const Node& node = _nodes[i];
+            bool validMesh = node.mesh == None ? node.material == None : node.mesh < _header->meshCount && node.material < _header->materialCount;
+            if (node.name >= stringBytes || (node.parent != None && node.parent >= i) || !validMesh)
+                throw std::runtime_error("Malformed scene file, bad node: " + path);
+        }
+        
+        // Number the combinations the nodes actually use, rather than every mesh with every material, which can be
+        // far more than the nodes
+        std::unordered_map<uint64_t, uint32_t> combinations;
+        _modelIndices.assign(_header->nodeCount, (uint32_t) None);
+        for (unsigned i = 0; i < _header->nodeCount; ++i) {
+            const Node& node = _nodes[i];
+            if (node.mesh == None)
+                continue;
+            
+            uint64_t combination = (uint64_t) node.mesh << 32 | node.material;
+            std::pair<std::unordered_map<uint64_t, uint32_t>::iterator, bool> inserted =
+                combinations.insert(std::make_pair(combination, _modelCount));
+            if (inserted.second)
+                ++_modelCount;
+            _modelIndices[i] = inserted.first->second;
+        }
+    } catch (...) {
+        munmap(_mapping, _size);
+        throw;
+    }
+}
+
+SceneFile::~SceneFile() {
+    munmap(_mapping, _size);
+}
+
+// The tables of a scene being converted, with each distinct string stored once
+struct SceneFileBuilder {
+    std::vector<SceneFile::Mesh> meshes;
+    std::vector<SceneFile::Material> materials;
+    std::vector<SceneFile::Node> nodes;
+    std::vector<char> strings;
+    
+    std::map<std::string, uint32_t> stringOffsets, meshIndices, materialIndices, nodeIndices;
+    
+    SceneFileBuilder() : strings(1, '\0') {}
+    
+    uint32_t addString(const std::string& value) {
+        if (value.empty())
+            return 0;
+        
+        std::map<std::string, uint32_t>::const_iterator it = stringOffsets.find(value);
+        if (it != stringOffsets.end())
+            return it->second;
+        
+        uint32_t offset = (uint32_t) strings.size();
+        strings.insert(strings.end(), value.begin(), value.end());
+        strings.push_back('\0');
+        stringOffsets[value] = offset;
+        return offset;
+    }
+};
+
+// Looks up the index of a named entry, with - meaning none
+static uint32_t FindEntry(const std::map<std::string, uint32_t>& indices, const std::string& name, const char *kind) {
+    if (name == "-")
+        return SceneFile::None;
+    
+    std::map<std::string, uint32_t>::const_iterator it = indices.find(name);
+    if (it == indices.end())
+        throw std::runtime_error(std::string("Unknown ") + kind + " " + name);
+    
+    return it->second;
+}
+
+static void ReadFloats(std::istringstream& line, float *values, unsigned count, const std::string& keyword) {
+    for (unsigned i = 0; i < count; ++i) {
+        if (!(line >> values[i]))
+            throw std::runtime_error("Expected " + std::to_string(count) + " numbers after " + keyword);
+    }
+}
+
+static void ParseMesh(std::istringstream& line, SceneFileBuilder& builder) {
+    std::string name, path, object;
+    if (!(line >> name >> path >> object))
+        throw std::runtime_error("Expected mesh <name> <obj file> <object name>");
+    if (builder.meshIndices.count(name))
+        throw std::runtime_error("Duplicate mesh " + name);
+    
+    SceneFile::Mesh mesh;
+    mesh.path = builder.addString(path);
+    mesh.object = builder.addString(object);
+    
+    builder.meshIndices[name] = (uint32_t) builder.meshes.size();
+    builder.meshes.push_back(mesh);
+}
+
+static void ParseMaterial(std::istringstream& line, SceneFileBuilder& builder) {
+    std::string name, texture, vertexShader, fragmentShader;
+    SceneFile::Material material;
+    if (!(line >> name >> texture >> vertexShader >> fragmentShader >> material.shininess))
+        throw std::runtime_error("Expected material <name> <texture> <vertex shader> <fragment shader> <shininess>");
+    if (builder.materialIndices.count(name))
+        throw std::runtime_error("Duplicate material " + name);
+    
+    material.texture = builder.addString(texture);
+    material.vertexShader = builder.addString(vertexShader);
+    material.fragmentShader = builder.addString(fragmentShader);
+    for (unsigned i = 0; i < 4; ++i)
+        material.ambientColor[i] = material.diffuseColor[i] = material.specularColor[i] = 1.0f;
+    
+    std::string keyword;
+    while (line >> keyword) {
+        if (keyword == "ambient")
+            ReadFloats(line, material.ambientColor, 4, keyword);
+        else if (keyword == "diffuse")
+            ReadFloats(line, material.diffuseColor, 4, keyword);
+        else if (keyword == "specular")
+            ReadFloats(line, material.specularColor, 4, keyword);
+        else
+            throw std::runtime_error("Unknown material property " + keyword);
+    }
+    
+    builder.materialIndices[name] = (uint32_t) builder.materials.size();
+    builder.materials.push_back(material);
+}
+
+static void ParseNode(std::istringstream& line, SceneFileBuilder& builder) {
+    std::string name, parent, mesh, material;
+    if (!(line >> name >> parent >> mesh >> material))
+        throw std::runtime_error("Expected node <name|-> <parent|-> <mesh|-> <material|->");
+    if (name != "-" && builder.nodeIndices.count(name))
+        throw std::runtime_error("Duplicate node " + name);
+    
+    SceneFile::Node node;
+    node.name = name == "-" ? 0 : builder.addString(name);
+    node.parent = FindEntry(builder.nodeIndices, parent, "node");
+    node.mesh = FindEntry(builder.meshIndices, mesh, "mesh");
+    node.material = FindEntry(builder.materialIndices, material, "material");
+    if ((node.mesh == SceneFile::None) != (node.material == SceneFile::None))
+        throw std::runtime_error("A node with a mesh needs a material, and only then");
+    
+    node.flags = 0;
+    float translation[3] = { 0.0f, 0.0f, 0.0f }, scale[3] = { 1.0f, 1.0f, 1.0f }, rotation[4] = { 0.0f, 0.0f, 1.0f, 0.0f };
+    
+    std::string keyword;
+    while (line >> keyword) {
+        if (keyword == "translate")
+            ReadFloats(line, translation, 3, keyword);
+        else if (keyword == "rotate")
+            ReadFloats(line, rotation, 4, keyword);
+        else if (keyword == "scale")
+            ReadFloats(line, scale, 3, keyword);
+        else if (keyword == "static")
+            node.flags |= SceneFile::NodeFlag_Static;
+        else if (keyword == "occluder")
+            node.flags |= SceneFile::NodeFlag_Occluder;
+        else
+            throw std::runtime_error("Unknown node property " + keyword);
+    }
+    
+    // Angles are in degrees, like everywhere else glm takes them
+    glm::quat quaternion = glm::angleAxis(rotation[0], glm::normalize(glm::vec3(rotation[1], rotation[2], rotation[3])));
+    node.rotation[0] = quaternion.x;
+    node.rotation[1] = quaternion.y;
+    node.rotation[2] = quaternion.z;
+    node.rotation[3] = quaternion.w;
+    memcpy(node.translation, translation, sizeof(translation));
+    memcpy(node.scale, scale, sizeof(scale));
+    
+    if (name != "-")
+        builder.nodeIndices[name] = (uint32_t) builder.nodes.size();
+    builder.nodes.push_back(node);
+}
+
+void SceneFile::convertTextFile(const std::string& textPath, const std::string& binaryPath) {
+    std::ifstream textFile(textPath.c_str());
+    if (!textFile.is_open())
+        throw std::runtime_error("Failed to open scene text file: " + textPath);
+    
+    SceneFileBuilder builder;
+    std::string currentLine;
+    for (unsigned lineNumber = 1; std::getline(textFile, currentLine); ++lineNumber) {
+        std::istringstream line(currentLine.substr(0, currentLine.find('#')));
+        
+        std::string directive;
+        if (!(line >> directive))
+            continue;
+        
+        try {
+            if (directive == "mesh")
+                ParseMesh(line, builder);
+            else if (directive == "material")
+                ParseMaterial(line, builder);
+            else if (directive == "node")
+                ParseNode(line, builder);
+            else
+                throw std::runtime_error("Unknown entry " + directive);
+        } catch (const std::runtime_error& e) {
+            throw std::runtime_error(textPath + ":" + std::to_string(lineNumber) + ": " + e.what());
+        }
+    }
+    
+    if (builder.nodes.size() > Scene::MaxNodes)
+        throw std::runtime_error("Too many nodes in " + textPath);
+    
+    std::ofstream binaryFile;
+    binaryFile.open(binaryPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!binaryFile.is_open())
+        throw std::runtime_error("Failed to open scene file for writing: " + binaryPath);
+    
+    Header header;
+    memcpy(header.magic, SceneMagic, sizeof(SceneMagic));
+    header.endianness = SceneEndianness;
+    header.version = SceneVersion;
+    header.meshCount = (uint32_t) builder.meshes.size();
+    header.materialCount = (uint32_t) builder.materials.size();
+    header.nodeCount = (uint32_t) builder.nodes.size();
+    header.stringBytes = (uint32_t) builder.strings.size();
+    
+    binaryFile.write((const char *) &header, sizeof(header));
+    binaryFile.write((const char *) builder.meshes.data(), builder.meshes.size() * sizeof(Mesh));
+    binaryFile.write((const char *) builder.materials.data(), builder.materials.size() * sizeof(Material));
+    binaryFile.write((const char *) builder.nodes.data(), builder.nodes.size() * sizeof(Node));
+    binaryFile.write(builder.strings.data(), builder.strings.size());
+    
+    if (!binaryFile)
+        throw std::runtime_error("Failed to write scene file: " + binaryPath);
+}
+
+unsigned SceneFile::meshCount() const {
+    return _header->meshCount;
+}
+
+const SceneFile::Mesh *SceneFile::meshes() const {
+    return _meshes;
+}
+
+unsigned SceneFile::materialCount() const {
+    return _header->materialCount;
+}
+
+const SceneFile::Material *SceneFile::materials() const {
+    return _materials;
+}
+
+unsigned SceneFile::nodeCount() const {
+    return _header->nodeCount;
+}
+
+const SceneFile::Node *SceneFile::nodes() const {
+    return _nodes;
+}
+
+const char *SceneFile::string(uint32_t offset) const {
+    return _strings + offset;
+}
+
+uint32_t SceneFile::findNode(const char *name) const {
+    for (uint32_t i = 0; i < _header->nodeCount; ++i) {
+        if (_nodes[i].name != 0 && strcmp(_strings + _nodes[i].name, name) == 0)
+            return i;
+    }
+    
+    return None;
+}
+
+unsigned SceneFile::modelCount() const {
+    return _modelCount;
+}
+
+uint32_t SceneFile::modelIndex(uint32_t node) const {
+    return _modelIndices[node];
+}
+
+void SceneFile::instantiate(Scene& scene, Model *const *models, NodeHandle *handles) const {
+    scene.reserve(scene.nodeCount() + _header->nodeCount);
+    
+    for (uint32_t i = 0; i < _header->nodeCount; ++i) {
+        const Node& node = _nodes[i];
+        ModelTransform transform;
+        transform.translate[3] = glm::vec4(node.translation[0], node.translation[1], node.translation[2], 1.0f);
+        transform.rotate = glm::mat4_cast(glm::quat(node.rotation[3], node.rotation[0], node.rotation[1], node.rotation[2]));
+        transform.scale[0][0] = node.scale[0];
+        transform.scale[1][1] = node.scale[1];
+        transform.scale[2][2] = node.scale[2];
+        
+        Model *model = _modelIndices[i] == None ? nullptr : models[_modelIndices[i]];
+        handles[i] = scene.createNode(model, node.parent == None ? NodeHandle() : handles[node.parent], transform);
+    }
+}
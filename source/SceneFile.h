@@ -0,0 +1,124 @@
+//
+//  SceneFile.h
+//  Robot
+//
+//  Created by Itamar Ravid on 16/9/14.
+//
+//
+
+#ifndef __Robot__SceneFile__
+#define __Robot__SceneFile__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "Scene.h"
+
+/* A scene description in a compact binary form, mapped into memory and read in place. It holds flat tables of meshes,
+ * materials and nodes, and a block of the strings they refer to. Nodes are in topological order, with each node's
+ * parent as an index of an earlier node, so they can be created in file order without resolving any names.
+ *
+ * The binary form is made from a text form by convertTextFile() (Robot --convert-scene). The text form has one entry
+ * per line, and # starts a comment:
+ *
+ *   mesh <name> <obj file> <object name>
+ *   material <name> <texture> <vertex shader> <fragment shader> <shininess> [ambient|diffuse|specular <r> <g> <b> <a>]...
+ *   node <name|-> <parent|-> <mesh|-> <material|-> [translate <x> <y> <z>] [rotate <degrees> <x> <y> <z>]
+ *        [scale <x> <y> <z>] [static] [occluder]
+ *
+ * Entries can only refer to entries above them. Colors default to white. Nodes named - can't be referred to.
+ *
+ * The binary form is in the machine's byte order: a header, the mesh, material and node tables, then the strings. */
+class SceneFile {
+public:
+    // Marks a missing parent, mesh or material
+    static const uint32_t None = 0xffffffff;
+    
+    enum NodeFlags {
+        NodeFlag_Static = 1, /* Never moves after loading */
+        NodeFlag_Occluder = 2 /* Large enough to hide other nodes */
+    };
+    
+    // Names and paths are offsets into the string block. Offset 0 is the empty string.
+    struct Mesh {
+        uint32_t path; /* OBJ file */
+        uint32_t object; /* Object name in the file */
+    };
+    
+    struct Material {
+        uint32_t texture;
+        uint32_t vertexShader;
+        uint32_t fragmentShader;
+        float ambientColor[4];
+        float diffuseColor[4];
+        float specularColor[4];
+        float shininess;
+    };
+    
+    // The local transform is translate * rotate * scale, with the rotation as a quaternion (x, y, z, w)
+    struct Node {
+        uint32_t name;
+        uint32_t parent;
+        uint32_t mesh;
+        uint32_t material;
+        uint32_t flags;
+        float translation[3];
+        float rotation[4];
+        float scale[3];
+    };
+    
+    // Maps a binary scene file and checks its tables. Throws if it's missing or malformed.
+    explicit SceneFile(const std::string& path);
+    ~SceneFile();
+    
+    // Parses a scene's text form and writes its binary form. Throws with the line number on errors.
+    static void convertTextFile(const std::string& textPath, const std::string& binaryPath);
+    
+    unsigned meshCount() const;
+    const Mesh *meshes() const;
+    
+    unsigned materialCount() const;
+    const Material *materials() const;
+    
+    unsigned nodeCount() const;
+    const Node *nodes() const;
+    
+    const char *string(uint32_t offset) const;
+    
+    // The index of the node with the given name, or None. Searches the whole table, so it's meant for the few nodes
+    // code refers to by name.
+    uint32_t findNode(const char *name) const;
+    
+    // The number of distinct mesh and material combinations the nodes use
+    unsigned modelCount() const;
+    
+    // The index of the i-th node's mesh and material combination, from 0 to modelCount(), or None if the node has no
+    // mesh. Combinations are numbered in the order nodes first use them.
+    uint32_t modelIndex(uint32_t node) const;
+    
+    /* Creates every node in the scene, in file order, with models[modelIndex(i)] as the i-th node's model. handles[i] is set to
+     * the i-th node's handle. Touches no strings, so it costs a node creation and a transform per node. */
+    void instantiate(Scene& scene, Model *const *models, NodeHandle *handles) const;
+    
+private:
+    struct Header;
+    
+    void *_mapping;
+    size_t _size;
+    
+    const Header *_header;
+    const Mesh *_meshes;
+    const Material *_materials;
+    const Node *_nodes;
+    const char *_strings;
+    
+    // Each node's model index, numbered when the file is mapped
+    std::vector<uint32_t> _modelIndices;
+    uint32_t _modelCount;
+    
+    SceneFile(const SceneFile& other);
+    SceneFile& operator = (const SceneFile& other);
+};
+
+#endif /* defined(__Robot__SceneFile__) */
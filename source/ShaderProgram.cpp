@@ -20,6 +20,11 @@ ShaderProgram::ShaderProgram(const std::vector<Shader>& shaders) : _handle(0) {
     for (unsigned i = 0; i < shaders.size(); ++i)
         glAttachShader(_handle, shaders[i].handle());
     
+    // Names the program doesn't use are ignored
+    glBindAttribLocation(_handle, VertexAttribute_Position, "vert");
+    glBindAttribLocation(_handle, VertexAttribute_TextureCoord, "vertTextureCoord");
+    glBindAttribLocation(_handle, VertexAttribute_Normal, "vertNormal");
+    
     glLinkProgram(_handle);
     
     for (unsigned i = 0; i < shaders.size(); ++i)
@@ -16,6 +16,14 @@
 // A Program wrapper. Represents linked Shader objects.
 class ShaderProgram {
 public:
+    // The locations every program binds the model vertex streams to, so a model's vertex array can be drawn by any
+    // program, whichever of the streams it reads
+    enum VertexAttribute {
+        VertexAttribute_Position = 0, /* vert */
+        VertexAttribute_TextureCoord = 1, /* vertTextureCoord */
+        VertexAttribute_Normal = 2 /* vertNormal */
+    };
+    
     ShaderProgram(const std::vector<Shader>& shaders);
     ~ShaderProgram();
     
@@ -0,0 +1,223 @@
+//
+//  ShadowMaps.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 19/9/14.
+//
+//
+
+#include "ShadowMaps.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Loaders.h"
+
+// The depth range of the cube map's faces, which covers the room from anywhere inside it
+static const float StaticNearPlane = 0.05f, StaticFarPlane = 40.0f;
+
+// The nearest the dynamic map's near plane gets to the light, and the widest its frustum gets, as the sine of half its
+// field of view, for when the light is close to or inside the dynamic casters' bounds
+static const float DynamicMinNearPlane = 0.05f, DynamicMaxHalfAngleSine = 0.95f;
+
+// Looking directions and up vectors of the cube map's faces, in the order of GL_TEXTURE_CUBE_MAP_POSITIVE_X onwards
+static const float CubeFaceDirections[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+static const float CubeFaceUps[6][3] = { { 0, -1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0, -1, 0 }, { 0, -1, 0 } };
+
+// Sets a depth texture up for hardware comparisons, filtered over the neighboring texels
+static void SetComparisonParameters(GLenum target, GLenum wrap) {
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, wrap);
+    glTexParameteri(target, GL_TEXTURE_WRAP_R, wrap);
+    glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(target, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+}
+
+// A framebuffer with nothing but a depth attachment
+static GLuint CreateDepthFramebuffer(GLenum textureTarget, GLuint texture) {
+    GLuint framebuffer;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textureTarget, texture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    
+    if (!complete)
+        throw std::runtime_error("Shadow map framebuffer is incomplete");
+    
+    return framebuffer;
+}
+
+ShadowMaps::ShadowMaps(unsigned staticSize, unsigned dynamicSize) : _staticSize(staticSize), _dynamicSize(dynamicSize),
+    _staticLightPosition(0.0f), _staticMapValid(false), _dynamicShadowMatrix(), _staticRenderCount(0), _dynamicCasterCount(0) {
+    _depthProgram = programWithShaders("shadow-depth.vsh", "shadow-depth.fsh");
+    
+    // Filtered lookups near a face's edge read the neighboring faces
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    
+    glGenTextures(1, &_staticTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, _staticTexture);
+    SetComparisonParameters(GL_TEXTURE_CUBE_MAP, GL_CLAMP_TO_EDGE);
+    for (unsigned face = 0; face < 6; ++face)
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_DEPTH_COMPONENT24, staticSize, staticSize, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    
+    // Outside the dynamic map's frustum, nothing dynamic casts a shadow
+    static const GLfloat Unshadowed[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    glGenTextures(1, &_dynamicTexture);
+    glBindTexture(GL_TEXTURE_2D, _dynamicTexture);
+    SetComparisonParameters(GL_TEXTURE_2D, GL_CLAMP_TO_BORDER);
+    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, Unshadowed);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, dynamicSize, dynamicSize, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
+    _staticFramebuffer = CreateDepthFramebuffer(GL_TEXTURE_CUBE_MAP_POSITIVE_X, _staticTexture);
+    _dynamicFramebuffer = CreateDepthFramebuffer(GL_TEXTURE_2D, _dynamicTexture);
+    
+    // Until the first dynamic map is drawn, it holds no shadows
+    glBindFramebuffer(GL_FRAMEBUFFER, _dynamicFramebuffer);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+ShadowMaps::~ShadowMaps() {
+    glDeleteFramebuffers(1, &_staticFramebuffer);
+    glDeleteFramebuffers(1, &_dynamicFramebuffer);
+    glDeleteTextures(1, &_staticTexture);
+    glDeleteTextures(1, &_dynamicTexture);
+}
+
+bool ShadowMaps::staticMapIsStale(const glm::vec3& lightPosition) const {
+    return !_staticMapValid || lightPosition != _staticLightPosition;
+}
+
+void ShadowMaps::invalidateStaticMap() {
+    _staticMapValid = false;
+}
+
+void ShadowMaps::renderStaticMap(const glm::vec3& lightPosition, const ShadowCaster *casters, unsigned count) {
+    _beginDepthPass(_staticFramebuffer, _staticSize);
+    
+    glm::mat4 projection = glm::perspective(90.0f, 1.0f, StaticNearPlane, StaticFarPlane);
+    for (unsigned face = 0; face < 6; ++face) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, _staticTexture, 0);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        
+        glm::vec3 direction(CubeFaceDirections[face][0], CubeFaceDirections[face][1], CubeFaceDirections[face][2]);
+        glm::vec3 up(CubeFaceUps[face][0], CubeFaceUps[face][1], CubeFaceUps[face][2]);
+        _depthProgram->setUniform("lightViewProjection", projection * glm::lookAt(lightPosition, lightPosition + direction, up));
+        
+        for (unsigned i = 0; i < count; ++i)
+            casters[i].model->renderDepth(_depthProgram, *casters[i].transform);
+    }
+    
+    _endDepthPass();
+    
+    _staticLightPosition = lightPosition;
+    _staticMapValid = true;
+    ++_staticRenderCount;
+}
+
+void ShadowMaps::renderDynamicMap(const glm::vec3& lightPosition, const BoundingBox& casterBounds, const ShadowCaster *casters, unsigned count) {
+    _beginDepthPass(_dynamicFramebuffer, _dynamicSize);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    _dynamicCasterCount = count;
+    
+    // With nothing to draw the cleared map shadows nothing, whatever its frustum
+    if (count == 0) {
+        _endDepthPass();
+        return;
+    }
+    
+    // Fit the frustum around the bounding sphere of the casters
+    glm::vec3 center = (casterBounds.min + casterBounds.max) * 0.5f;
+    float radius = glm::length(casterBounds.max - casterBounds.min) * 0.5f;
+    glm::vec3 toCenter = center - lightPosition;
+    float distance = glm::length(toCenter);
+    glm::vec3 direction = distance > 1e-4f ? toCenter / distance : glm::vec3(0.0f, -1.0f, 0.0f);
+    
+    float halfAngleSine = distance > radius ? std::min(radius / distance, DynamicMaxHalfAngleSine) : DynamicMaxHalfAngleSine;
+    float fieldOfView = asinf(halfAngleSine) * 360.0f / (float) M_PI;
+    float nearPlane = std::max(distance - radius, DynamicMinNearPlane);
+    float farPlane = std::max(distance + radius, nearPlane * 2.0f);
+    glm::vec3 up = fabsf(direction.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    
+    glm::mat4 viewProjection = glm::perspective(fieldOfView, 1.0f, nearPlane, farPlane) *
+                               glm::lookAt(lightPosition, lightPosition + direction, up);
+    _depthProgram->setUniform("lightViewProjection", viewProjection);
+    
+    for (unsigned i = 0; i < count; ++i)
+        casters[i].model->renderDepth(_depthProgram, *casters[i].transform);
+    
+    _endDepthPass();
+    
+    // Clip space to texture coordinates and depth
+    glm::mat4 clipToTexture(glm::vec4(0.5f, 0.0f, 0.0f, 0.0f), glm::vec4(0.0f, 0.5f, 0.0f, 0.0f),
+                            glm::vec4(0.0f, 0.0f, 0.5f, 0.0f), glm::vec4(0.5f, 0.5f, 0.5f, 1.0f));
+    _dynamicShadowMatrix = clipToTexture * viewProjection;
+}
+
+void ShadowMaps::bind() const {
+    glActiveTexture(GL_TEXTURE0 + TextureUnit_Static);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, _staticTexture);
+    glActiveTexture(GL_TEXTURE0 + TextureUnit_Dynamic);
+    glBindTexture(GL_TEXTURE_2D, _dynamicTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void ShadowMaps::unbind() const {
+    glActiveTexture(GL_TEXTURE0 + TextureUnit_Dynamic);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0 + TextureUnit_Static);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void ShadowMaps::setUniforms(ShaderProgram *program) const {
+    // The depth a cube face stores for a point at distance d along its axis is x + y / d, before the viewport transform
+    float depthRange = StaticFarPlane - StaticNearPlane;
+    program->setUniform("staticShadowMap", (GLint) TextureUnit_Static);
+    program->setUniform("dynamicShadowMap", (GLint) TextureUnit_Dynamic);
+    program->setUniform("staticShadowDepth", (StaticFarPlane + StaticNearPlane) / depthRange, -2.0f * StaticFarPlane * StaticNearPlane / depthRange);
+    program->setUniform("dynamicShadowMatrix", _dynamicShadowMatrix);
+}
+
+unsigned ShadowMaps::staticRenderCount() const {
+    return _staticRenderCount;
+}
+
+unsigned ShadowMaps::dynamicCasterCount() const {
+    return _dynamicCasterCount;
+}
+
+void ShadowMaps::_beginDepthPass(GLuint framebuffer, unsigned size) {
+    glGetIntegerv(GL_VIEWPORT, _savedViewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, size, size);
+    
+    // Both sides of the casters are drawn, since the room's walls are single-sided. The offset keeps lit surfaces
+    // from shadowing themselves.
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+    
+    _depthProgram->use();
+}
+
+void ShadowMaps::_endDepthPass() {
+    _depthProgram->stopUsing();
+    
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glEnable(GL_CULL_FACE);
+    
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(_savedViewport[0], _savedViewport[1], _savedViewport[2], _savedViewport[3]);
+}
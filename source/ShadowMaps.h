@@ -0,0 +1,96 @@
+//
+//  ShadowMaps.h
+//  Robot
+//
+//  Created by Itamar Ravid on 19/9/14.
+//
+//
+
+#ifndef __Robot__ShadowMaps__
+#define __Robot__ShadowMaps__
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "BatchMath.h"
+#include "Model.h"
+#include "ShaderProgram.h"
+
+// A model drawn into a shadow map. The transform points into the scene's world transforms.
+struct ShadowCaster {
+    const Model *model;
+    const glm::mat4 *transform;
+};
+
+/* Shadows of the scene's point light, split by how often the casters move.
+ *
+ * The static casters - the room and the furniture - are drawn into a depth cube map around the light, which is only
+ * drawn again when the light moves or the map is invalidated. The dynamic casters - the robot's parts - are drawn
+ * every frame into a small map, whose frustum is fitted from the light around their bounds. Shaders sample both and
+ * multiply the results, so the cost of a frame's shadows only grows with the dynamic geometry.
+ *
+ * Both maps are drawn with the models' position-only vertex arrays, and compared with hardware filtering. */
+class ShadowMaps {
+public:
+    // The texture units the maps are bound to, after the material texture and the light clusters
+    enum TextureUnit {
+        TextureUnit_Static = 4,
+        TextureUnit_Dynamic
+    };
+    
+    // staticSize is the size of each face of the cube map, dynamicSize the size of the dynamic map
+    ShadowMaps(unsigned staticSize, unsigned dynamicSize);
+    ~ShadowMaps();
+    
+    // Whether the static map needs to be drawn for a light at the given position
+    bool staticMapIsStale(const glm::vec3& lightPosition) const;
+    
+    // Makes the static map stale, for when the static casters change
+    void invalidateStaticMap();
+    
+    // Draws the static casters into the faces of the cube map around the light
+    void renderStaticMap(const glm::vec3& lightPosition, const ShadowCaster *casters, unsigned count);
+    
+    // Draws the dynamic casters into the dynamic map, from the light towards casterBounds, which must hold them
+    void renderDynamicMap(const glm::vec3& lightPosition, const BoundingBox& casterBounds, const ShadowCaster *casters, unsigned count);
+    
+    // Bind the maps to their texture units around the draws that read them
+    void bind() const;
+    void unbind() const;
+    
+    // Sets a program's shadow uniforms for the maps. The program must be in use.
+    void setUniforms(ShaderProgram *program) const;
+    
+    // How many times the static map was drawn, and the casters drawn into the dynamic map last frame
+    unsigned staticRenderCount() const;
+    unsigned dynamicCasterCount() const;
+    
+private:
+    unsigned _staticSize, _dynamicSize;
+    
+    GLuint _staticTexture, _dynamicTexture;
+    GLuint _staticFramebuffer, _dynamicFramebuffer;
+    
+    ShaderProgram *_depthProgram;
+    
+    // The light position the static map was drawn from, unless it's stale
+    glm::vec3 _staticLightPosition;
+    bool _staticMapValid;
+    
+    // Maps world space to the dynamic map's texture coordinates and depth
+    glm::mat4 _dynamicShadowMatrix;
+    
+    unsigned _staticRenderCount, _dynamicCasterCount;
+    
+    // The viewport to restore after a depth pass
+    GLint _savedViewport[4];
+    
+    // Set up a depth pass into a framebuffer, and restore the previous state afterwards
+    void _beginDepthPass(GLuint framebuffer, unsigned size);
+    void _endDepthPass();
+    
+    ShadowMaps(const ShadowMaps& other);
+    ShadowMaps& operator = (const ShadowMaps& other);
+};
+
+#endif /* defined(__Robot__ShadowMaps__) */
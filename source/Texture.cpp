@@ -8,6 +8,8 @@
 
 #include "Texture.h"
 
+#include <algorithm>
+
 static GLenum TextureFormatForBitmapFormat(Bitmap::Format format, bool srgb)
 {
     switch (format) {
@@ -19,18 +21,196 @@ static GLenum TextureFormatForBitmapFormat(Bitmap::Format format, bool srgb)
     }
 }
 
-Texture::Texture(const Bitmap& bitmap, GLint minMagFiler, GLint wrapMode) : _originalWidth((GLfloat) bitmap.width()), _originalHeight((GLfloat) bitmap.height()) {
-    glGenTextures(1, &_handle);
-    glBindTexture(GL_TEXTURE_2D, _handle);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minMagFiler);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, minMagFiler);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapMode);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapMode);
+/* Sets the pixel unpack state so GL reads the bitmap's rows where they are, without repacking them. The alignment
+ * covers the padded rows Bitmap allocates; anything else falls back to an explicit row length. */
+static void SetUnpackStateForBitmap(const Bitmap& bitmap) {
+    unsigned rowSize = bitmap.width() * bitmap.format();
+    
+    for (GLint alignment = 8; alignment >= 1; alignment /= 2) {
+        if ((rowSize + alignment - 1) / alignment * alignment == bitmap.stride()) {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            return;
+        }
+    }
+    
+    if (bitmap.stride() % bitmap.format() != 0)
+        throw std::runtime_error("Bitmap stride isn't a whole number of pixels");
+    
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint) (bitmap.stride() / bitmap.format()));
+}
+
+// Restores the default unpack state
+static void ResetUnpackState() {
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+// The color streamed textures show until their bitmaps land: an opaque mid-gray
+static const unsigned char PlaceholderValue = 128, PlaceholderAlpha = 255;
+
+// Returns one tightly packed width x height image of the placeholder color in the given format
+static std::vector<unsigned char> PlaceholderImage(unsigned width, unsigned height, Bitmap::Format format) {
+    std::vector<unsigned char> pixels((size_t) width * height * format, PlaceholderValue);
+    
+    // The alpha channel is the last one of the formats that have it
+    if (format == Bitmap::Format_GrayscaleAlpha || format == Bitmap::Format_RGBA) {
+        for (size_t i = format - 1; i < pixels.size(); i += format)
+            pixels[i] = PlaceholderAlpha;
+    }
+    
+    return pixels;
+}
+
+static bool FilteringIsMipmapped(Texture::Filtering filtering) {
+    return filtering == Texture::Filtering_Bilinear || filtering == Texture::Filtering_Trilinear || filtering == Texture::Filtering_Anisotropic;
+}
+
+static GLint MinFilterForFiltering(Texture::Filtering filtering) {
+    switch (filtering) {
+        case Texture::Filtering_Nearest: return GL_NEAREST;
+        case Texture::Filtering_Linear: return GL_LINEAR;
+        case Texture::Filtering_Bilinear: return GL_LINEAR_MIPMAP_NEAREST;
+        case Texture::Filtering_Trilinear: return GL_LINEAR_MIPMAP_LINEAR;
+        case Texture::Filtering_Anisotropic: return GL_LINEAR_MIPMAP_LINEAR;
+        default: throw std::runtime_error("Unrecognised Texture::Filtering");
+    }
+}
+
+Texture::Texture(const Bitmap& bitmap, Filtering filtering, GLint wrapMode, GLfloat maxAnisotropy) :
+    _target(GL_TEXTURE_2D), _layerCount(1), _originalWidth((GLfloat) bitmap.width()), _originalHeight((GLfloat) bitmap.height()),
+    _filtering(filtering), _levelCount(1), _baseLevel(0), _compressed(false), _bytesPerPixel(bitmap.format()), _compressedLevelSizes() {
+    _create(wrapMode);
     
+    SetUnpackStateForBitmap(bitmap);
     glTexImage2D(GL_TEXTURE_2D, 0, TextureFormatForBitmapFormat(bitmap.format(), true), (GLsizei) bitmap.width(), (GLsizei) bitmap.height(), 0,
                  TextureFormatForBitmapFormat(bitmap.format(), false), GL_UNSIGNED_BYTE, bitmap.pixelBuffer());
+    ResetUnpackState();
+    
+    _applyFiltering(maxAnisotropy);
+    
+    glBindTexture(_target, 0);
+}
+
+Texture::Texture(const KtxFile& ktx, Filtering filtering, GLint wrapMode, GLfloat maxAnisotropy) :
+    _target(GL_TEXTURE_2D), _layerCount(1), _originalWidth((GLfloat) ktx.width()), _originalHeight((GLfloat) ktx.height()),
+    _filtering(filtering), _levelCount((GLint) ktx.levelCount()), _baseLevel(0), _compressed(true), _bytesPerPixel(0), _compressedLevelSizes() {
+    if (ktx.levelCount() == 0)
+        throw std::runtime_error("KTX container has no image data");
+    
+    _create(wrapMode);
+    
+    for (unsigned level = 0; level < ktx.levelCount(); ++level) {
+        const std::vector<unsigned char>& data = ktx.level(level);
+        _compressedLevelSizes.push_back((GLsizeiptr) data.size());
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, ktx.internalFormat(), (GLsizei) ktx.levelWidth(level), (GLsizei) ktx.levelHeight(level), 0,
+                               (GLsizei) data.size(), &data[0]);
+    }
+    
+    _applyFiltering(maxAnisotropy);
+    
+    glBindTexture(_target, 0);
+}
+
+Texture::Texture(const std::vector<const Bitmap *>& layers, Filtering filtering, GLint wrapMode, GLfloat maxAnisotropy) :
+    _target(GL_TEXTURE_2D_ARRAY), _layerCount((GLint) layers.size()), _filtering(filtering), _levelCount(1), _baseLevel(0), _compressed(false),
+    _bytesPerPixel(0), _compressedLevelSizes() {
+    if (layers.empty())
+        throw std::runtime_error("No layers provided for the texture array");
+    
+    const Bitmap& first = *layers[0];
+    for (unsigned i = 1; i < layers.size(); ++i) {
+        if (layers[i]->width() != first.width() || layers[i]->height() != first.height() || layers[i]->format() != first.format())
+            throw std::runtime_error("Texture array layers must have the same dimensions and format");
+    }
+    
+    _originalWidth = (GLfloat) first.width();
+    _originalHeight = (GLfloat) first.height();
+    _bytesPerPixel = first.format();
+    
+    _create(wrapMode);
+    
+    // Allocate all the layers, then fill them one by one
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, TextureFormatForBitmapFormat(first.format(), true), (GLsizei) first.width(), (GLsizei) first.height(), _layerCount, 0,
+                 TextureFormatForBitmapFormat(first.format(), false), GL_UNSIGNED_BYTE, NULL);
+    
+    for (unsigned i = 0; i < layers.size(); ++i) {
+        SetUnpackStateForBitmap(*layers[i]);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, (GLsizei) first.width(), (GLsizei) first.height(), 1,
+                        TextureFormatForBitmapFormat(first.format(), false), GL_UNSIGNED_BYTE, layers[i]->pixelBuffer());
+    }
+    ResetUnpackState();
+    
+    _applyFiltering(maxAnisotropy);
+    
+    glBindTexture(_target, 0);
+}
+
+Texture::Texture(const std::vector<const KtxFile *>& layers, Filtering filtering, GLint wrapMode, GLfloat maxAnisotropy) :
+    _target(GL_TEXTURE_2D_ARRAY), _layerCount((GLint) layers.size()), _filtering(filtering), _levelCount(0), _baseLevel(0), _compressed(true),
+    _bytesPerPixel(0), _compressedLevelSizes() {
+    if (layers.empty())
+        throw std::runtime_error("No layers provided for the texture array");
+    
+    const KtxFile& first = *layers[0];
+    if (first.levelCount() == 0)
+        throw std::runtime_error("KTX container has no image data");
+    
+    for (unsigned i = 1; i < layers.size(); ++i) {
+        if (layers[i]->width() != first.width() || layers[i]->height() != first.height() ||
+            layers[i]->internalFormat() != first.internalFormat() || layers[i]->levelCount() != first.levelCount())
+            throw std::runtime_error("Texture array layers must have the same dimensions, format and mip levels");
+    }
+    
+    _originalWidth = (GLfloat) first.width();
+    _originalHeight = (GLfloat) first.height();
+    _levelCount = (GLint) first.levelCount();
+    
+    _create(wrapMode);
+    
+    for (unsigned level = 0; level < first.levelCount(); ++level) {
+        GLsizei width = (GLsizei) first.levelWidth(level), height = (GLsizei) first.levelHeight(level);
+        GLsizei layerSize = (GLsizei) first.level(level).size();
+        _compressedLevelSizes.push_back((GLsizeiptr) layerSize * _layerCount);
+        
+        glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, first.internalFormat(), width, height, _layerCount, 0, layerSize * _layerCount, NULL);
+        
+        for (unsigned i = 0; i < layers.size(); ++i)
+            glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, i, width, height, 1, first.internalFormat(),
+                                      layerSize, &layers[i]->level(level)[0]);
+    }
+    
+    _applyFiltering(maxAnisotropy);
+    
+    glBindTexture(_target, 0);
+}
+
+Texture::Texture(unsigned width, unsigned height, GLint layerCount, Bitmap::Format format, Filtering filtering, GLint wrapMode, GLfloat maxAnisotropy) :
+    _target(layerCount == 0 ? GL_TEXTURE_2D : GL_TEXTURE_2D_ARRAY), _layerCount(layerCount == 0 ? 1 : layerCount),
+    _originalWidth((GLfloat) width), _originalHeight((GLfloat) height), _filtering(filtering), _levelCount(1), _baseLevel(0), _compressed(false),
+    _bytesPerPixel(format), _compressedLevelSizes() {
+    _create(wrapMode);
+    
+    // Every layer starts out as the placeholder color, one layer-sized image at a time, so nothing samples undefined
+    // storage before the layers are filled in
+    std::vector<unsigned char> placeholder(PlaceholderImage(width, height, format));
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (_target == GL_TEXTURE_2D) {
+        glTexImage2D(GL_TEXTURE_2D, 0, TextureFormatForBitmapFormat(format, true), (GLsizei) width, (GLsizei) height, 0,
+                     TextureFormatForBitmapFormat(format, false), GL_UNSIGNED_BYTE, placeholder.data());
+    } else {
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, TextureFormatForBitmapFormat(format, true), (GLsizei) width, (GLsizei) height, _layerCount, 0,
+                     TextureFormatForBitmapFormat(format, false), GL_UNSIGNED_BYTE, NULL);
+        for (GLint layer = 0; layer < _layerCount; ++layer)
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, (GLsizei) width, (GLsizei) height, 1,
+                            TextureFormatForBitmapFormat(format, false), GL_UNSIGNED_BYTE, placeholder.data());
+    }
+    ResetUnpackState();
+    
+    _applyFiltering(maxAnisotropy);
     
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(_target, 0);
 }
 
 Texture::~Texture() {
@@ -41,10 +221,171 @@ GLuint Texture::handle() const {
     return _handle;
 }
 
+GLenum Texture::target() const {
+    return _target;
+}
+
+GLint Texture::layerCount() const {
+    return _layerCount;
+}
+
 GLfloat Texture::originalWidth() const {
     return _originalWidth;
 }
 
 GLfloat Texture::originalHeight() const {
     return _originalHeight;
-}
\ No newline at end of file
+}
+
+Texture::Filtering Texture::filtering() const {
+    return _filtering;
+}
+
+void Texture::setFiltering(Filtering filtering, GLfloat maxAnisotropy) {
+    _filtering = filtering;
+    
+    glBindTexture(_target, _handle);
+    _applyFiltering(maxAnisotropy);
+    glBindTexture(_target, 0);
+}
+
+GLint Texture::levelCount() const {
+    return _levelCount;
+}
+
+void Texture::uploadRows(const Bitmap& bitmap, GLint layer, unsigned firstRow, unsigned rowCount, const void *pixels) {
+    if (_compressed)
+        throw std::runtime_error("Can't upload bitmap rows to a compressed texture");
+    
+    if (bitmap.width() != (unsigned) _originalWidth || bitmap.height() != (unsigned) _originalHeight)
+        throw std::runtime_error("Bitmap dimensions don't match the texture");
+    
+    if (firstRow + rowCount > bitmap.height() || layer < 0 || layer >= _layerCount)
+        throw std::runtime_error("Rows or layer out of the texture's bounds");
+    
+    glBindTexture(_target, _handle);
+    SetUnpackStateForBitmap(bitmap);
+    
+    if (_target == GL_TEXTURE_2D)
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, (GLint) firstRow, (GLsizei) bitmap.width(), (GLsizei) rowCount,
+                        TextureFormatForBitmapFormat(bitmap.format(), false), GL_UNSIGNED_BYTE, pixels);
+    else
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, (GLint) firstRow, layer, (GLsizei) bitmap.width(), (GLsizei) rowCount, 1,
+                        TextureFormatForBitmapFormat(bitmap.format(), false), GL_UNSIGNED_BYTE, pixels);
+    
+    ResetUnpackState();
+    glBindTexture(_target, 0);
+}
+
+void Texture::updateMipmaps() {
+    if (_levelCount == 1)
+        return;
+    
+    // glGenerateMipmap builds the chain down from the base level, so level 0 has to be the base while it runs
+    glBindTexture(_target, _handle);
+    if (_baseLevel != 0)
+        glTexParameteri(_target, GL_TEXTURE_BASE_LEVEL, 0);
+    glGenerateMipmap(_target);
+    if (_baseLevel != 0)
+        glTexParameteri(_target, GL_TEXTURE_BASE_LEVEL, _baseLevel);
+    glBindTexture(_target, 0);
+}
+
+GLint Texture::baseLevel() const {
+    return _baseLevel;
+}
+
+void Texture::setBaseLevel(GLint level) {
+    level = std::max(0, std::min(level, _levelCount - 1));
+    if (level == _baseLevel)
+        return;
+    
+    _baseLevel = level;
+    glBindTexture(_target, _handle);
+    glTexParameteri(_target, GL_TEXTURE_BASE_LEVEL, _baseLevel);
+    glBindTexture(_target, 0);
+}
+
+GLsizeiptr Texture::levelSize(GLint level) const {
+    if (level < 0 || level >= _levelCount)
+        throw std::runtime_error("Mip level out of range");
+    
+    if (_compressed)
+        return _compressedLevelSizes[level];
+    
+    // The driver may pad the pixels, so this is a lower bound
+    GLsizeiptr width = std::max((GLsizeiptr) _originalWidth >> level, (GLsizeiptr) 1);
+    GLsizeiptr height = std::max((GLsizeiptr) _originalHeight >> level, (GLsizeiptr) 1);
+    return width * height * _bytesPerPixel * _layerCount;
+}
+
+GLsizeiptr Texture::residentSize() const {
+    GLsizeiptr size = 0;
+    for (GLint level = _baseLevel; level < _levelCount; ++level)
+        size += levelSize(level);
+    
+    return size;
+}
+
+GLsizeiptr Texture::fullSize() const {
+    GLsizeiptr size = 0;
+    for (GLint level = 0; level < _levelCount; ++level)
+        size += levelSize(level);
+    
+    return size;
+}
+
+GLint Texture::fullMipChainLength(GLsizei width, GLsizei height) {
+    GLint levels = 1;
+    GLsizei size = width > height ? width : height;
+    while (size > 1) {
+        size >>= 1;
+        ++levels;
+    }
+    
+    return levels;
+}
+
+const char *Texture::filteringName(Filtering filtering) {
+    switch (filtering) {
+        case Filtering_Nearest: return "nearest";
+        case Filtering_Linear: return "linear";
+        case Filtering_Bilinear: return "bilinear";
+        case Filtering_Trilinear: return "trilinear";
+        case Filtering_Anisotropic: return "anisotropic";
+        default: return "unknown";
+    }
+}
+
+// Generates the texture object and leaves it bound
+void Texture::_create(GLint wrapMode) {
+    glGenTextures(1, &_handle);
+    glBindTexture(_target, _handle);
+    glTexParameteri(_target, GL_TEXTURE_WRAP_S, wrapMode);
+    glTexParameteri(_target, GL_TEXTURE_WRAP_T, wrapMode);
+}
+
+// Expects the texture to be bound to its target
+void Texture::_applyFiltering(GLfloat maxAnisotropy) {
+    // Build the mip chain the first time a mipmapped mode is requested. The internal format is sRGB, which lets
+    // the driver average the levels in linear space.
+    if (FilteringIsMipmapped(_filtering) && _levelCount == 1 && !_compressed) {
+        glGenerateMipmap(_target);
+        _levelCount = fullMipChainLength((GLsizei) _originalWidth, (GLsizei) _originalHeight);
+    }
+    
+    glTexParameteri(_target, GL_TEXTURE_MIN_FILTER, MinFilterForFiltering(_filtering));
+    glTexParameteri(_target, GL_TEXTURE_MAG_FILTER, _filtering == Filtering_Nearest ? GL_NEAREST : GL_LINEAR);
+    glTexParameteri(_target, GL_TEXTURE_MAX_LEVEL, _levelCount - 1);
+    
+    if (GLEW_EXT_texture_filter_anisotropic) {
+        GLfloat anisotropy = 1.0f;
+        if (_filtering == Filtering_Anisotropic) {
+            GLfloat supportedAnisotropy = 1.0f;
+            glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &supportedAnisotropy);
+            anisotropy = maxAnisotropy < supportedAnisotropy ? maxAnisotropy : supportedAnisotropy;
+        }
+        
+        glTexParameterf(_target, GL_TEXTURE_MAX_ANISOTROPY_EXT, anisotropy);
+    }
+}
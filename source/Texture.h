@@ -9,27 +9,114 @@
 #ifndef __Robot__Texture__
 #define __Robot__Texture__
 
+#include <vector>
+
 #include <GL/glew.h>
 #include "Bitmap.h"
+#include "KtxFile.h"
 
 class Texture {
 public:
+    // Sampling modes. The mipmapped modes (Bilinear and up) build the full mip chain on upload.
+    enum Filtering {
+        Filtering_Nearest, /* GL_NEAREST, level 0 only */
+        Filtering_Linear, /* GL_LINEAR, level 0 only */
+        Filtering_Bilinear, /* GL_LINEAR_MIPMAP_NEAREST */
+        Filtering_Trilinear, /* GL_LINEAR_MIPMAP_LINEAR */
+        Filtering_Anisotropic /* Trilinear, plus anisotropic filtering if EXT_texture_filter_anisotropic is available */
+    };
+    
     /* Creates a Texture from a Bitmap. The texture will be loaded upside down since Bitmap pixel data is ordered
      * column-major, from the top-row downwards, but OpenGL expects the data to be ordered bottom-row upwards.
-     * minMagFiler should be either GL_LINEAR/GL_NEAREST, wrapMode should be GL_REPEAT/GL_MIRRORED_REPEAT/GL_CLAMP_TO_EDGE/GL_CLAMP_TO_BORDER. */
-    Texture(const Bitmap& bitmap, GLint minMagFiler = GL_LINEAR, GLint wrapMode = GL_CLAMP_TO_EDGE);
+     * wrapMode should be GL_REPEAT/GL_MIRRORED_REPEAT/GL_CLAMP_TO_EDGE/GL_CLAMP_TO_BORDER.
+     * maxAnisotropy is only used with Filtering_Anisotropic, and is clamped to what the driver supports. */
+    Texture(const Bitmap& bitmap, Filtering filtering = Filtering_Linear, GLint wrapMode = GL_CLAMP_TO_EDGE, GLfloat maxAnisotropy = 8.0f);
+    
+    /* Creates a Texture from pre-compressed data, uploading every mip level in the container as is. The data is
+     * expected to be stored bottom-row first already. A container without mip levels can't use the mipmapped
+     * filtering modes, since the chain can't be generated from compressed data - those modes then sample level 0. */
+    Texture(const KtxFile& ktx, Filtering filtering = Filtering_Linear, GLint wrapMode = GL_CLAMP_TO_EDGE, GLfloat maxAnisotropy = 8.0f);
+    
+    /* Creates a GL_TEXTURE_2D_ARRAY with one layer per Bitmap. All the layers must have the same dimensions and
+     * format. Like the single Bitmap constructor, rows are uploaded in the order they're stored. */
+    Texture(const std::vector<const Bitmap *>& layers, Filtering filtering = Filtering_Linear, GLint wrapMode = GL_CLAMP_TO_EDGE, GLfloat maxAnisotropy = 8.0f);
+    
+    // Creates a GL_TEXTURE_2D_ARRAY from pre-compressed layers, which must share format, dimensions and mip count.
+    Texture(const std::vector<const KtxFile *>& layers, Filtering filtering = Filtering_Linear, GLint wrapMode = GL_CLAMP_TO_EDGE, GLfloat maxAnisotropy = 8.0f);
+    
+    /* Creates a texture for bitmaps of the given dimensions and format, to be filled in later with uploadRows (e.g. by
+     * a TextureStreamer). Until then every layer is an opaque mid-gray placeholder. A layerCount of 0 creates a GL_TEXTURE_2D, anything else a
+     * GL_TEXTURE_2D_ARRAY with that many layers. */
+    Texture(unsigned width, unsigned height, GLint layerCount, Bitmap::Format format, Filtering filtering = Filtering_Linear,
+            GLint wrapMode = GL_CLAMP_TO_EDGE, GLfloat maxAnisotropy = 8.0f);
     ~Texture();
     
     // Returns the OpenGL handle
     GLuint handle() const;
     
+    // GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY
+    GLenum target() const;
+    
+    // Number of array layers (1 for GL_TEXTURE_2D)
+    GLint layerCount() const;
+    
     GLfloat originalWidth() const;
     GLfloat originalHeight() const;
     
+    // Changes the sampling mode. Switching to a mipmapped mode generates the mip chain if it wasn't built yet.
+    Filtering filtering() const;
+    void setFiltering(Filtering filtering, GLfloat maxAnisotropy = 8.0f);
+    
+    // Number of mip levels currently allocated (1 if the texture isn't mipmapped)
+    GLint levelCount() const;
+    
+    /* Replaces rows [firstRow, firstRow + rowCount) of level 0 of a layer (ignored for GL_TEXTURE_2D). pixels holds
+     * those rows laid out like they are in bitmap, which must match the texture's dimensions and format. When a
+     * GL_PIXEL_UNPACK_BUFFER is bound, pixels is an offset into it. */
+    void uploadRows(const Bitmap& bitmap, GLint layer, unsigned firstRow, unsigned rowCount, const void *pixels);
+    
+    // Rebuilds the mip chain after level 0 was changed with uploadRows. Does nothing if the texture isn't mipmapped.
+    void updateMipmaps();
+    
+    /* The finest mip level that can be sampled (GL_TEXTURE_BASE_LEVEL). Levels below it aren't referenced, so the
+     * driver is free to page them out of VRAM. Clamped to the allocated levels. */
+    GLint baseLevel() const;
+    void setBaseLevel(GLint level);
+    
+    // Estimated VRAM size of one mip level across all the layers, in bytes
+    GLsizeiptr levelSize(GLint level) const;
+    
+    // Estimated size of the levels from baseLevel() down, and of the whole mip chain
+    GLsizeiptr residentSize() const;
+    GLsizeiptr fullSize() const;
+    
+    // Returns the number of mip levels in a full chain for the given dimensions
+    static GLint fullMipChainLength(GLsizei width, GLsizei height);
+    
+    // Returns a human readable name of the filtering mode, for diagnostics
+    static const char *filteringName(Filtering filtering);
+    
 private:
     GLuint _handle;
+    GLenum _target;
+    GLint _layerCount;
     GLfloat _originalWidth;
     GLfloat _originalHeight;
+    Filtering _filtering;
+    GLint _levelCount;
+    GLint _baseLevel;
+    bool _compressed;
+    
+    // Level sizes are computed from this for uncompressed textures, and taken from the containers for compressed ones
+    GLsizeiptr _bytesPerPixel;
+    std::vector<GLsizeiptr> _compressedLevelSizes;
+    
+    void _create(GLint wrapMode);
+    void _applyFiltering(GLfloat maxAnisotropy);
+    
+    // Textures own a GL object, so they can't be copied
+    Texture(const Texture& other);
+    Texture& operator = (const Texture& other);
 };
 
 #endif /* defined(__Robot__Texture__) */
@@ -0,0 +1,206 @@
+//
+//  TextureLibrary.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 4/9/14.
+//
+//
+
+#include "TextureLibrary.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+
+#include "BitmapTransforms.h"
+#include "Loaders.h"
+#include "ThreadPool.h"
+
+// Identifies the pre-compressed textures that can share an array
+struct CompressedArrayKey {
+    GLenum internalFormat;
+    unsigned width;
+    unsigned height;
+    unsigned levelCount;
+    
+    CompressedArrayKey(const KtxFile& ktx) : internalFormat(ktx.internalFormat()), width(ktx.width()), height(ktx.height()), levelCount(ktx.levelCount()) {}
+    
+    bool operator < (const CompressedArrayKey& other) const {
+        if (internalFormat != other.internalFormat)
+            return internalFormat < other.internalFormat;
+        if (width != other.width)
+            return width < other.width;
+        if (height != other.height)
+            return height < other.height;
+        return levelCount < other.levelCount;
+    }
+};
+
+// The narrowest format that can hold the channels of every given format
+static Bitmap::Format CommonFormat(const std::vector<std::unique_ptr<Bitmap> >& bitmaps) {
+    bool hasColor = false, hasAlpha = false;
+    for (unsigned i = 0; i < bitmaps.size(); ++i) {
+        Bitmap::Format format = bitmaps[i]->format();
+        hasColor = hasColor || format == Bitmap::Format_RGB || format == Bitmap::Format_RGBA;
+        hasAlpha = hasAlpha || format == Bitmap::Format_GrayscaleAlpha || format == Bitmap::Format_RGBA;
+    }
+    
+    if (hasColor)
+        return hasAlpha ? Bitmap::Format_RGBA : Bitmap::Format_RGB;
+    
+    return hasAlpha ? Bitmap::Format_GrayscaleAlpha : Bitmap::Format_Grayscale;
+}
+
+TextureLibrary::TextureLibrary() : _filenames(), _layers(), _textures(), _built(false), _streamer(nullptr), _uploads() {
+}
+
+TextureLibrary::~TextureLibrary() {
+    for (std::vector<Texture *>::const_iterator it = _textures.begin(); it != _textures.end(); ++it)
+        delete *it;
+}
+
+void TextureLibrary::addTexture(const std::string& filename) {
+    if (_built)
+        throw std::runtime_error("Can't add textures to a TextureLibrary after it was built");
+    
+    if (std::find(_filenames.begin(), _filenames.end(), filename) == _filenames.end())
+        _filenames.push_back(filename);
+}
+
+void TextureLibrary::build(Texture::Filtering filtering, TextureStreamer *streamer) {
+    if (_built)
+        throw std::runtime_error("TextureLibrary was already built");
+    
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    
+    // Which files have a usable compressed version depends on GL extensions, so decide on this thread
+    std::vector<std::string> bitmapFilenames, ktxFilenames;
+    for (std::vector<std::string>::const_iterator it = _filenames.begin(); it != _filenames.end(); ++it) {
+        if (compressedTextureAvailable(*it))
+            ktxFilenames.push_back(*it);
+        else
+            bitmapFilenames.push_back(*it);
+    }
+    
+    /* Decode everything on the thread pool. stb_image keeps its state per call, so decodes can run concurrently.
+     * Indices below bitmapFilenames.size() are images, the rest are KTX files. The decoded files are owned here until
+     * they're uploaded, so whatever throws along the way doesn't leak them.
+     *
+     * The flip after decoding is a pool loop of its own. Nested in this one, it runs serially on whichever thread is
+     * decoding the file, so the files themselves are what's spread over the threads. */
+    std::vector<std::unique_ptr<Bitmap> > bitmaps(bitmapFilenames.size());
+    std::vector<std::unique_ptr<KtxFile> > ktxFiles(ktxFilenames.size());
+    ThreadPool& pool = ThreadPool::shared();
+    
+    pool.parallelFor((unsigned) _filenames.size(), 1, [&](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i < end; ++i) {
+            if (i < bitmaps.size())
+                bitmaps[i].reset(new Bitmap(bitmapFromTextureFile(bitmapFilenames[i])));
+            else
+                ktxFiles[i - bitmaps.size()].reset(new KtxFile(compressedTextureFromFile(ktxFilenames[i - bitmaps.size()])));
+        }
+    });
+    
+    double decodeSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    
+    // Uncompressed textures all go into one array, conformed to the largest dimensions and a common format
+    if (!bitmaps.empty()) {
+        unsigned width = 0, height = 0;
+        for (unsigned i = 0; i < bitmaps.size(); ++i) {
+            width = std::max(width, bitmaps[i]->width());
+            height = std::max(height, bitmaps[i]->height());
+        }
+        
+        Bitmap::Format format = CommonFormat(bitmaps);
+        
+        // Like the flips, each resize runs serially within its layer's task
+        pool.parallelFor((unsigned) bitmaps.size(), 1, [&](unsigned begin, unsigned end) {
+            for (unsigned i = begin; i < end; ++i) {
+                if (bitmaps[i]->width() != width || bitmaps[i]->height() != height)
+                    *bitmaps[i] = BitmapTransforms::resize(*bitmaps[i], width, height, BitmapTransforms::Filter_Bilinear);
+                
+                if (bitmaps[i]->format() != format) {
+                    Bitmap converted(width, height, format);
+                    converted.copyRectFromBitmap(*bitmaps[i], 0, 0, 0, 0, 0, 0);
+                    *bitmaps[i] = std::move(converted);
+                }
+            }
+        });
+        
+        // Only the upload needs the GL context. The library owns the texture before anything is queued into it, so a
+        // failed upload leaves it to the destructor rather than deleting it under the uploads queued before.
+        Texture *texture;
+        if (streamer) {
+            _adoptTexture(new Texture(width, height, (GLint) bitmaps.size(), format, filtering));
+            texture = _textures.back();
+            for (unsigned i = 0; i < bitmaps.size(); ++i)
+                _uploads.push_back(std::make_pair(texture, streamer->upload(texture, (GLint) i, std::move(*bitmaps[i]))));
+            _streamer = streamer;
+        } else {
+            std::vector<const Bitmap *> layers;
+            for (unsigned i = 0; i < bitmaps.size(); ++i)
+                layers.push_back(bitmaps[i].get());
+            _adoptTexture(new Texture(layers, filtering));
+            texture = _textures.back();
+        }
+        
+        for (unsigned i = 0; i < bitmapFilenames.size(); ++i)
+            _layers[bitmapFilenames[i]] = TextureLayer(texture, (GLint) i);
+        
+        bitmaps.clear();
+    }
+    
+    // Pre-compressed textures are grouped by everything that has to match within an array
+    std::map<CompressedArrayKey, std::vector<unsigned> > groups;
+    for (unsigned i = 0; i < ktxFiles.size(); ++i)
+        groups[CompressedArrayKey(*ktxFiles[i])].push_back(i);
+    
+    for (std::map<CompressedArrayKey, std::vector<unsigned> >::const_iterator it = groups.begin(); it != groups.end(); ++it) {
+        std::vector<const KtxFile *> layers;
+        for (unsigned i = 0; i < it->second.size(); ++i)
+            layers.push_back(ktxFiles[it->second[i]].get());
+        
+        _adoptTexture(new Texture(layers, filtering));
+        Texture *texture = _textures.back();
+        
+        for (unsigned i = 0; i < it->second.size(); ++i)
+            _layers[ktxFilenames[it->second[i]]] = TextureLayer(texture, (GLint) i);
+    }
+    
+    ktxFiles.clear();
+    
+    std::cout << "Loaded " << _filenames.size() << " textures in "
+              << std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() * 1000.0
+              << " ms (decoding took " << decodeSeconds * 1000.0 << " ms on " << pool.threadCount() << " threads)" << std::endl;
+    
+    _built = true;
+}
+
+TextureLayer TextureLibrary::layer(const std::string& filename) const {
+    std::map<std::string, TextureLayer>::const_iterator it = _layers.find(filename);
+    if (it == _layers.end())
+        throw std::runtime_error("Texture wasn't added to the library before it was built: " + filename);
+    
+    return it->second;
+}
+
+// Takes ownership of a new texture, deleting it if it can't be added
+void TextureLibrary::_adoptTexture(Texture *texture) {
+    std::unique_ptr<Texture> owned(texture);
+    _textures.push_back(texture);
+    owned.release();
+}
+
+const std::vector<Texture *>& TextureLibrary::textures() const {
+    return _textures;
+}
+
+bool TextureLibrary::isLoaded(const Texture *texture) const {
+    for (unsigned i = 0; i < _uploads.size(); ++i) {
+        if (_uploads[i].first == texture && !_streamer->isComplete(_uploads[i].second))
+            return false;
+    }
+    
+    return true;
+}
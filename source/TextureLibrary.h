@@ -0,0 +1,74 @@
+//
+//  TextureLibrary.h
+//  Robot
+//
+//  Created by Itamar Ravid on 4/9/14.
+//
+//
+
+#ifndef __Robot__TextureLibrary__
+#define __Robot__TextureLibrary__
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Texture.h"
+#include "TextureStreamer.h"
+
+// A material's texture: an array texture, and the layer in it that holds the material's image
+struct TextureLayer {
+    Texture *texture;
+    GLint layer;
+    
+    TextureLayer() : texture(nullptr), layer(0) {}
+    TextureLayer(Texture *texture, GLint layer) : texture(texture), layer(layer) {}
+};
+
+/* Packs the material textures into GL_TEXTURE_2D_ARRAYs, so that different materials can be drawn with the same
+ * texture binding and only differ by a layer index.
+ *
+ * All the textures are registered first, then packed by build(). Uncompressed images are converted to a common
+ * format and resized to the largest dimensions among them, so they always end up in a single array. Pre-compressed
+ * (KTX) images can't be resampled, so they're grouped into one array per format, size and mip count. */
+class TextureLibrary {
+public:
+    TextureLibrary();
+    ~TextureLibrary();
+    
+    // Registers a texture resource. Must be called before build().
+    void addTexture(const std::string& filename);
+    
+    /* Loads every registered texture and packs them into texture arrays. Decoding and conversion run on
+     * ThreadPool::shared(); only the uploads happen on the calling thread, which must own the GL context.
+     * With a streamer, uncompressed images are queued on it instead of uploaded here, and fill in over the next
+     * frames. */
+    void build(Texture::Filtering filtering, TextureStreamer *streamer = nullptr);
+    
+    // The array and layer of a registered texture. Only valid after build().
+    TextureLayer layer(const std::string& filename) const;
+    
+    // All the texture arrays that were built
+    const std::vector<Texture *>& textures() const;
+    
+    // Whether every layer of a built texture is in. Until the streamer completes a texture's uploads, its layers are
+    // placeholders.
+    bool isLoaded(const Texture *texture) const;
+    
+private:
+    std::vector<std::string> _filenames;
+    std::map<std::string, TextureLayer> _layers;
+    std::vector<Texture *> _textures;
+    bool _built;
+    
+    // The streamer the uploads were queued on, and the upload of each streamed layer with the texture it fills
+    TextureStreamer *_streamer;
+    std::vector<std::pair<const Texture *, TextureStreamer::UploadId> > _uploads;
+    
+    void _adoptTexture(Texture *texture);
+    
+    TextureLibrary(const TextureLibrary& other);
+    TextureLibrary& operator = (const TextureLibrary& other);
+};
+
+#endif /* defined(__Robot__TextureLibrary__) */
@@ -0,0 +1,161 @@
+//
+//  TextureResidency.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 8/9/14.
+//
+//
+
+#include "TextureResidency.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+// Entry::requestedLevel when no model needed the texture this frame
+static const GLint NoRequest = INT_MAX;
+
+// Size of the levels from the given one down to the coarsest
+static GLsizeiptr SizeFromLevel(const Texture& texture, GLint level) {
+    GLsizeiptr size = 0;
+    for (; level < texture.levelCount(); ++level)
+        size += texture.levelSize(level);
+    
+    return size;
+}
+
+TextureResidency::TextureResidency(GLsizeiptr budget, unsigned evictionDelay) :
+    _entries(), _targets(), _budget(budget), _evictionDelay(evictionDelay), _frame(1) {
+}
+
+void TextureResidency::addTexture(Texture *texture) {
+    if (_entry(texture))
+        return;
+    
+    Entry entry;
+    entry.texture = texture;
+    entry.requestedLevel = NoRequest;
+    _entries.push_back(entry);
+    
+    texture->setBaseLevel(texture->levelCount() - 1);
+}
+
+void TextureResidency::requestForModel(const Model& model, const glm::mat4& transform, const Camera& camera, float viewportHeight) {
+    if (!model.texture || model.textureDensity <= 0.0f)
+        return;
+    
+    // The transforms only rotate, translate and scale, so the longest basis vector is the largest scale
+    float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+    
+    // The closest point of the bounds sees the most detail
+    glm::vec3 center = glm::vec3(transform * glm::vec4(model.boundsCenter, 1.0f));
+    float distance = std::max(glm::length(center - camera.position()) - model.boundsRadius * scale, camera.nearPlane());
+    
+    // Texels per world unit against pixels per world unit. Each level halves the texels, so the ratio's log2 is the level.
+    float texelsPerUnit = model.textureDensity / scale * sqrtf(model.texture->originalWidth() * model.texture->originalHeight());
+    float pixelsPerUnit = camera.pixelsPerUnit(distance, viewportHeight);
+    
+    requestLevel(model.texture, log2f(texelsPerUnit / pixelsPerUnit));
+}
+
+void TextureResidency::requestLevel(Texture *texture, float level) {
+    Entry *entry = _entry(texture);
+    if (!entry)
+        return;
+    
+    GLint finestLevel = (GLint) floorf(std::max(level, 0.0f));
+    finestLevel = std::min(finestLevel, texture->levelCount() - 1);
+    entry->requestedLevel = std::min(entry->requestedLevel, finestLevel);
+}
+
+void TextureResidency::update() {
+    // Keep everything down from the finest level that was needed within the eviction delay. The targets vector is
+    // kept between frames, so it only allocates when textures are added.
+    std::vector<GLint>& targets = _targets;
+    targets.resize(_entries.size());
+    GLsizeiptr total = 0;
+    
+    for (unsigned i = 0; i < _entries.size(); ++i) {
+        Entry& entry = _entries[i];
+        GLint levelCount = entry.texture->levelCount();
+        
+        // Switching to a mipmapped filtering mode can add levels
+        if (entry.lastRequested.size() != (size_t) levelCount)
+            entry.lastRequested.resize(levelCount, 0);
+        
+        if (entry.requestedLevel != NoRequest)
+            entry.lastRequested[std::min(entry.requestedLevel, levelCount - 1)] = _frame;
+        entry.requestedLevel = NoRequest;
+        
+        targets[i] = levelCount - 1;
+        for (GLint level = 0; level < levelCount; ++level) {
+            if (entry.lastRequested[level] != 0 && _frame - entry.lastRequested[level] <= _evictionDelay) {
+                targets[i] = level;
+                break;
+            }
+        }
+        
+        total += SizeFromLevel(*entry.texture, targets[i]);
+    }
+    
+    // Over the budget, give up the largest resident levels first. They cost the most and are only seen up close.
+    while (total > _budget) {
+        int largest = -1;
+        GLsizeiptr largestSize = 0;
+        for (unsigned i = 0; i < _entries.size(); ++i) {
+            if (targets[i] >= _entries[i].texture->levelCount() - 1)
+                continue;
+            
+            GLsizeiptr size = _entries[i].texture->levelSize(targets[i]);
+            if (size > largestSize) {
+                largest = (int) i;
+                largestSize = size;
+            }
+        }
+        
+        // Only the coarsest levels are left
+        if (largest < 0)
+            break;
+        
+        total -= largestSize;
+        ++targets[largest];
+    }
+    
+    for (unsigned i = 0; i < _entries.size(); ++i)
+        _entries[i].texture->setBaseLevel(targets[i]);
+    
+    ++_frame;
+}
+
+GLsizeiptr TextureResidency::budget() const {
+    return _budget;
+}
+
+void TextureResidency::setBudget(GLsizeiptr budget) {
+    _budget = budget;
+}
+
+GLsizeiptr TextureResidency::residentBytes() const {
+    GLsizeiptr size = 0;
+    for (std::vector<Entry>::const_iterator it = _entries.begin(); it != _entries.end(); ++it)
+        size += it->texture->residentSize();
+    
+    return size;
+}
+
+GLsizeiptr TextureResidency::fullResidencyBytes() const {
+    GLsizeiptr size = 0;
+    for (std::vector<Entry>::const_iterator it = _entries.begin(); it != _entries.end(); ++it)
+        size += it->texture->fullSize();
+    
+    return size;
+}
+
+TextureResidency::Entry *TextureResidency::_entry(Texture *texture) {
+    for (std::vector<Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+        if (it->texture == texture)
+            return &*it;
+    }
+    
+    return nullptr;
+}
@@ -0,0 +1,77 @@
+//
+//  TextureResidency.h
+//  Robot
+//
+//  Created by Itamar Ravid on 8/9/14.
+//
+//
+
+#ifndef __Robot__TextureResidency__
+#define __Robot__TextureResidency__
+
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Camera.h"
+#include "Model.h"
+#include "Texture.h"
+
+/* Keeps only the mip levels that are actually seen resident, using GL_TEXTURE_BASE_LEVEL.
+ *
+ * Every frame, the visible models report the finest mip level they need, estimated on the CPU from their texture
+ * coordinate density and their distance to the camera. update() then moves each texture's base level to the finest
+ * level that was needed recently. Finer levels that stay unused for evictionDelay frames are dropped, and if the
+ * resident levels still don't fit in the budget, the largest resident levels are dropped until they do.
+ *
+ * "Resident" means referenced from the base level down. GL can't say what's actually in VRAM; levels above the base
+ * level are only free to be paged out, so the byte counts here are estimates from the levels' sizes. */
+class TextureResidency {
+public:
+    TextureResidency(GLsizeiptr budget = 128 * 1024 * 1024, unsigned evictionDelay = 120);
+    
+    // Starts managing a texture. Its base level starts at the coarsest level, until a model asks for more.
+    void addTexture(Texture *texture);
+    
+    // Notes that an instance of a model is drawn this frame with the given model transform
+    void requestForModel(const Model& model, const glm::mat4& transform, const Camera& camera, float viewportHeight);
+    
+    // Notes that the given level (or a finer one) of a texture is needed this frame
+    void requestLevel(Texture *texture, float level);
+    
+    // Applies this frame's requests and the budget to the base levels, and starts a new frame
+    void update();
+    
+    GLsizeiptr budget() const;
+    void setBudget(GLsizeiptr budget);
+    
+    // Estimated size of the resident levels of every managed texture, and what it would be if all levels were resident.
+    // Both are computed from the level sizes, not measured, so they're what the driver may keep, not what it does.
+    GLsizeiptr residentBytes() const;
+    GLsizeiptr fullResidencyBytes() const;
+    
+private:
+    struct Entry {
+        Texture *texture;
+        
+        // Finest level requested this frame, if any was
+        GLint requestedLevel;
+        
+        // The frame each level was last the finest one requested
+        std::vector<unsigned long> lastRequested;
+    };
+    
+    std::vector<Entry> _entries;
+    std::vector<GLint> _targets; /* Scratch space for update() */
+    GLsizeiptr _budget;
+    unsigned _evictionDelay;
+    unsigned long _frame;
+    
+    Entry *_entry(Texture *texture);
+    
+    TextureResidency(const TextureResidency& other);
+    TextureResidency& operator = (const TextureResidency& other);
+};
+
+#endif /* defined(__Robot__TextureResidency__) */
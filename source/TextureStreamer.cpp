@@ -0,0 +1,254 @@
+//
+//  TextureStreamer.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 7/9/14.
+//
+//
+
+#include "TextureStreamer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// Checks a fence without waiting. Flushes, so a fence that was never flushed still gets to signal.
+static bool FenceSignaled(GLsync fence) {
+    GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    return result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED;
+}
+
+TextureStreamer::TextureStreamer(GLsizeiptr bufferSize, unsigned bufferCount, GLsizeiptr bytesPerFrame) :
+    _bufferSize(bufferSize), _bytesPerFrame(bytesPerFrame), _bytesUploadedLastFrame(0), _nextUploadId(0),
+    _buffers(bufferCount), _uploads(), _filledBuffers(), _worker(), _mutex(), _fillQueued(), _fillQueue(), _workerFilled(), _quit(false) {
+    if (bufferCount == 0 || bufferSize <= 0)
+        throw std::runtime_error("TextureStreamer needs at least one non-empty buffer");
+    
+    // The storage is allocated once. Buffers are only mapped again after their fence shows the GPU is done with them.
+    for (std::vector<Buffer>::iterator it = _buffers.begin(); it != _buffers.end(); ++it) {
+        glGenBuffers(1, &it->handle);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, it->handle);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bufferSize, NULL, GL_STREAM_DRAW);
+        
+        it->state = BufferState_Free;
+        it->fence = 0;
+        it->mapped = nullptr;
+        it->upload = nullptr;
+        it->firstRow = it->rowCount = 0;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    
+    _worker = std::thread(&TextureStreamer::_workerMain, this);
+}
+
+TextureStreamer::~TextureStreamer() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _fillQueued.notify_one();
+    _worker.join();
+    
+    for (std::vector<Buffer>::iterator it = _buffers.begin(); it != _buffers.end(); ++it) {
+        if (it->mapped) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, it->handle);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        if (it->fence)
+            glDeleteSync(it->fence);
+        glDeleteBuffers(1, &it->handle);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    
+    for (std::vector<Upload *>::iterator it = _uploads.begin(); it != _uploads.end(); ++it) {
+        if ((*it)->fence)
+            glDeleteSync((*it)->fence);
+        delete *it;
+    }
+}
+
+TextureStreamer::UploadId TextureStreamer::upload(Texture *texture, GLint layer, Bitmap bitmap) {
+    if (bitmap.stride() > (unsigned) _bufferSize)
+        throw std::runtime_error("Bitmap rows don't fit in the streaming buffers");
+    
+    if (bitmap.width() != (unsigned) texture->originalWidth() || bitmap.height() != (unsigned) texture->originalHeight())
+        throw std::runtime_error("Bitmap dimensions don't match the texture");
+    
+    if (layer < 0 || layer >= texture->layerCount())
+        throw std::runtime_error("Texture layer out of range");
+    
+    _uploads.push_back(new Upload(_nextUploadId, texture, layer, std::move(bitmap)));
+    return _nextUploadId++;
+}
+
+void TextureStreamer::update() {
+    _bytesUploadedLastFrame = 0;
+    
+    _retireFinished();
+    _submitFilled();
+    _startFills();
+}
+
+bool TextureStreamer::isComplete(UploadId upload) const {
+    if (upload >= _nextUploadId)
+        return false;
+    
+    for (std::vector<Upload *>::const_iterator it = _uploads.begin(); it != _uploads.end(); ++it) {
+        if ((*it)->id == upload)
+            return false;
+    }
+    
+    return true;
+}
+
+unsigned TextureStreamer::pendingUploads() const {
+    return (unsigned) _uploads.size();
+}
+
+GLsizeiptr TextureStreamer::bytesUploadedLastFrame() const {
+    return _bytesUploadedLastFrame;
+}
+
+void TextureStreamer::_workerMain() {
+    for (;;) {
+        unsigned index;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _fillQueued.wait(lock, [this] { return _quit || !_fillQueue.empty(); });
+            if (_fillQueue.empty())
+                return;
+            
+            index = _fillQueue.front();
+            _fillQueue.pop_front();
+        }
+        
+        // The GL thread doesn't touch a buffer while it's being filled
+        const Buffer& buffer = _buffers[index];
+        const Bitmap& bitmap = buffer.upload->bitmap;
+        memcpy(buffer.mapped, bitmap.rowBuffer(buffer.firstRow), (size_t) buffer.rowCount * bitmap.stride());
+        
+        std::lock_guard<std::mutex> lock(_mutex);
+        _workerFilled.push_back(index);
+    }
+}
+
+// Frees the buffers and completes the uploads the GPU is done with
+void TextureStreamer::_retireFinished() {
+    for (std::vector<Buffer>::iterator it = _buffers.begin(); it != _buffers.end(); ++it) {
+        if (it->state == BufferState_InFlight && FenceSignaled(it->fence)) {
+            glDeleteSync(it->fence);
+            it->fence = 0;
+            it->state = BufferState_Free;
+        }
+    }
+    
+    for (std::vector<Upload *>::iterator it = _uploads.begin(); it != _uploads.end(); ) {
+        if ((*it)->fence && FenceSignaled((*it)->fence)) {
+            glDeleteSync((*it)->fence);
+            delete *it;
+            it = _uploads.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Turns filled buffers into texture uploads, within the frame's budget
+void TextureStreamer::_submitFilled() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (std::deque<unsigned>::const_iterator it = _workerFilled.begin(); it != _workerFilled.end(); ++it) {
+            _buffers[*it].state = BufferState_Filled;
+            _filledBuffers.push_back(*it);
+        }
+        _workerFilled.clear();
+    }
+    
+    while (!_filledBuffers.empty()) {
+        Buffer& buffer = _buffers[_filledBuffers.front()];
+        Upload *upload = buffer.upload;
+        GLsizeiptr bytes = (GLsizeiptr) buffer.rowCount * upload->bitmap.stride();
+        
+        if (_bytesUploadedLastFrame > 0 && _bytesUploadedLastFrame + bytes > _bytesPerFrame)
+            break;
+        
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.handle);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        buffer.mapped = nullptr;
+        
+        upload->texture->uploadRows(upload->bitmap, upload->layer, buffer.firstRow, buffer.rowCount, NULL);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        
+        buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        buffer.state = BufferState_InFlight;
+        buffer.upload = nullptr;
+        _filledBuffers.pop_front();
+        _bytesUploadedLastFrame += bytes;
+        
+        upload->submittedRows += buffer.rowCount;
+        if (upload->submittedRows == upload->bitmap.height()) {
+            // Rebuilding the chain covers every layer, so it waits for the texture's last upload rather than running
+            // once per layer
+            if (!_hasUnsubmittedRows(upload->texture, upload))
+                upload->texture->updateMipmaps();
+            upload->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            
+            // Every row is in a buffer, so the pixels can go
+            Bitmap released(std::move(upload->bitmap));
+        }
+    }
+}
+
+// Checks whether an upload into the texture other than the given one still has rows to submit
+bool TextureStreamer::_hasUnsubmittedRows(const Texture *texture, const Upload *except) const {
+    for (std::vector<Upload *>::const_iterator it = _uploads.begin(); it != _uploads.end(); ++it) {
+        if (*it != except && (*it)->texture == texture && !(*it)->fence)
+            return true;
+    }
+    
+    return false;
+}
+
+// Maps the free buffers and hands them to the worker with the next rows to upload
+void TextureStreamer::_startFills() {
+    std::vector<Upload *>::iterator nextUpload = _uploads.begin();
+    
+    for (unsigned index = 0; index < _buffers.size(); ++index) {
+        Buffer& buffer = _buffers[index];
+        if (buffer.state != BufferState_Free)
+            continue;
+        
+        // Uploads with a fence have released their bitmap, so their row counts are gone
+        while (nextUpload != _uploads.end() && ((*nextUpload)->fence || (*nextUpload)->nextRow == (*nextUpload)->bitmap.height()))
+            ++nextUpload;
+        if (nextUpload == _uploads.end())
+            break;
+        
+        Upload *upload = *nextUpload;
+        unsigned stride = upload->bitmap.stride();
+        unsigned rowCount = std::min((unsigned) (_bufferSize / stride), upload->bitmap.height() - upload->nextRow);
+        
+        // Unsynchronized, since the fence already showed the GPU is done with the buffer
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.handle);
+        buffer.mapped = (unsigned char *) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr) rowCount * stride,
+                                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (!buffer.mapped) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            throw std::runtime_error("Couldn't map a texture streaming buffer");
+        }
+        
+        buffer.state = BufferState_Filling;
+        buffer.upload = upload;
+        buffer.firstRow = upload->nextRow;
+        buffer.rowCount = rowCount;
+        upload->nextRow += rowCount;
+        
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _fillQueue.push_back(index);
+        }
+        _fillQueued.notify_one();
+    }
+    
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
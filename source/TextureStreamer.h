@@ -0,0 +1,116 @@
+//
+//  TextureStreamer.h
+//  Robot
+//
+//  Created by Itamar Ravid on 7/9/14.
+//
+//
+
+#ifndef __Robot__TextureStreamer__
+#define __Robot__TextureStreamer__
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "Bitmap.h"
+#include "Texture.h"
+
+/* Uploads bitmaps into textures over several frames, through a ring of pixel buffer objects, so the render thread
+ * never waits for the driver to copy client memory.
+ *
+ * Each update() maps the free buffers, and a worker thread copies the next rows of the queued bitmaps into them.
+ * Filled buffers are unmapped and turned into glTexSubImage calls on later updates, up to a budget of bytes per
+ * frame. The copy out of a buffer happens asynchronously on the GPU; a fence tells when the buffer can be reused, and
+ * another one when a whole upload has landed in its texture.
+ *
+ * Everything except the worker's copying runs on the thread that owns the GL context. */
+class TextureStreamer {
+public:
+    typedef unsigned UploadId;
+    
+    /* bufferSize is the size of each pixel buffer; a bitmap row must fit in one. At least one buffer is submitted
+     * every frame, even if it's bigger than bytesPerFrame. */
+    TextureStreamer(GLsizeiptr bufferSize = 4 * 1024 * 1024, unsigned bufferCount = 4, GLsizeiptr bytesPerFrame = 8 * 1024 * 1024);
+    ~TextureStreamer();
+    
+    /* Queues a bitmap to be uploaded into level 0 of a texture layer (0 for GL_TEXTURE_2D). The texture must have
+     * been created with matching dimensions and format, and must outlive the upload. Mipmapped textures have their
+     * chain rebuilt once, when all the rows of every upload queued into them are in. */
+    UploadId upload(Texture *texture, GLint layer, Bitmap bitmap);
+    
+    // Advances the uploads. Call once per frame.
+    void update();
+    
+    // True once all of an upload's rows were copied into its texture by the GPU
+    bool isComplete(UploadId upload) const;
+    
+    // Uploads that aren't complete yet
+    unsigned pendingUploads() const;
+    
+    // Bytes submitted to glTexSubImage by the last update()
+    GLsizeiptr bytesUploadedLastFrame() const;
+    
+private:
+    struct Upload {
+        UploadId id;
+        Texture *texture;
+        GLint layer;
+        Bitmap bitmap;
+        unsigned nextRow; /* First row that wasn't handed to a buffer yet */
+        unsigned submittedRows;
+        GLsync fence; /* Set when every row was submitted */
+        
+        Upload(UploadId id, Texture *texture, GLint layer, Bitmap&& bitmap) :
+            id(id), texture(texture), layer(layer), bitmap(std::move(bitmap)), nextRow(0), submittedRows(0), fence(0) {}
+    };
+    
+    enum BufferState {
+        BufferState_Free,
+        BufferState_Filling, /* Mapped, and queued for or being filled by the worker */
+        BufferState_Filled, /* Mapped and filled, waiting for its turn under the budget */
+        BufferState_InFlight /* Submitted; the GPU may still be reading it */
+    };
+    
+    struct Buffer {
+        GLuint handle;
+        BufferState state;
+        GLsync fence;
+        unsigned char *mapped;
+        Upload *upload;
+        unsigned firstRow;
+        unsigned rowCount;
+    };
+    
+    GLsizeiptr _bufferSize;
+    GLsizeiptr _bytesPerFrame;
+    GLsizeiptr _bytesUploadedLastFrame;
+    UploadId _nextUploadId;
+    
+    std::vector<Buffer> _buffers;
+    std::vector<Upload *> _uploads; /* Uploads that aren't complete, in the order they were queued */
+    std::deque<unsigned> _filledBuffers; /* Filled buffers waiting to be submitted, in the order they were filled */
+    
+    // Shared with the worker
+    std::thread _worker;
+    std::mutex _mutex;
+    std::condition_variable _fillQueued;
+    std::deque<unsigned> _fillQueue; /* Buffers for the worker to fill */
+    std::deque<unsigned> _workerFilled; /* Buffers the worker filled since the last update() */
+    bool _quit;
+    
+    void _workerMain();
+    void _retireFinished();
+    void _submitFilled();
+    void _startFills();
+    bool _hasUnsubmittedRows(const Texture *texture, const Upload *except) const;
+    
+    TextureStreamer(const TextureStreamer&);
+    TextureStreamer& operator=(const TextureStreamer&);
+};
+
+#endif /* defined(__Robot__TextureStreamer__) */
@@ -0,0 +1,130 @@
+//
+//  ThreadPool.cpp
+//  Robot
+//
+//  Created by Itamar Ravid on 6/9/14.
+//
+//
+
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned threadCount) : _workers(), _loopMutex(), _mutex(), _loopStarted(), _loopFinished(),
+    _quit(false), _func(NULL), _count(0), _grainSize(1), _generation(0), _busyWorkers(0), _nextIndex(0), _exception(), _loopOwner() {
+    for (unsigned i = 1; i < threadCount; ++i)
+        _workers.push_back(std::thread(&ThreadPool::_workerMain, this));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _loopStarted.notify_all();
+    
+    for (std::vector<std::thread>::iterator it = _workers.begin(); it != _workers.end(); ++it)
+        it->join();
+}
+
+void ThreadPool::parallelFor(unsigned count, unsigned grainSize, const RangeFunc& func) {
+    if (count == 0)
+        return;
+    
+    grainSize = std::max(grainSize, 1u);
+    
+    // A loop nested in a body that runs on the thread that issued the outer loop can't even try to take the loop
+    // mutex, since that thread already holds it. Bodies on the workers can, and fail.
+    bool nested;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        nested = _loopOwner == std::this_thread::get_id();
+    }
+    
+    std::unique_lock<std::mutex> loopLock;
+    if (!nested)
+        loopLock = std::unique_lock<std::mutex>(_loopMutex, std::try_to_lock);
+    if (!loopLock.owns_lock() || _workers.empty() || count <= grainSize) {
+        for (unsigned begin = 0; begin < count; begin += grainSize)
+            func(begin, std::min(begin + grainSize, count));
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _loopOwner = std::this_thread::get_id();
+        _func = &func;
+        _count = count;
+        _grainSize = grainSize;
+        _nextIndex = 0;
+        _exception = std::exception_ptr();
+        _busyWorkers = (unsigned) _workers.size();
+        ++_generation;
+    }
+    _loopStarted.notify_all();
+    
+    _runRanges();
+    
+    std::unique_lock<std::mutex> lock(_mutex);
+    _loopFinished.wait(lock, [this] { return _busyWorkers == 0; });
+    _func = NULL;
+    _loopOwner = std::thread::id();
+    
+    if (_exception)
+        std::rethrow_exception(_exception);
+}
+
+unsigned ThreadPool::threadCount() const {
+    return (unsigned) _workers.size() + 1;
+}
+
+unsigned ThreadPool::defaultThreadCount() {
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::_workerMain() {
+    unsigned seenGeneration = 0;
+    
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _loopStarted.wait(lock, [&] { return _quit || _generation != seenGeneration; });
+            if (_quit)
+                return;
+            seenGeneration = _generation;
+        }
+        
+        _runRanges();
+        
+        bool lastWorker;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            lastWorker = --_busyWorkers == 0;
+        }
+        if (lastWorker)
+            _loopFinished.notify_one();
+    }
+}
+
+void ThreadPool::_runRanges() {
+    for (;;) {
+        unsigned begin = _nextIndex.fetch_add(_grainSize);
+        if (begin >= _count)
+            return;
+        
+        try {
+            (*_func)(begin, std::min(begin + _grainSize, _count));
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_exception)
+                _exception = std::current_exception();
+            
+            // Skip the rest of the loop
+            _nextIndex = _count;
+        }
+    }
+}
@@ -0,0 +1,70 @@
+//
+//  ThreadPool.h
+//  Robot
+//
+//  Created by Itamar Ravid on 6/9/14.
+//
+//
+
+#ifndef __Robot__ThreadPool__
+#define __Robot__ThreadPool__
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* A fixed set of worker threads that run parallel loops. The calling thread works on the loop too, and parallelFor
+ * returns once every index is done. Only one loop runs on the pool at a time: a parallelFor issued while another one
+ * is running runs serially on its caller instead of waiting. That covers loops from a different thread, and loops
+ * nested inside a loop body, whether the body runs on a worker or on the thread that issued the outer loop. */
+class ThreadPool {
+public:
+    // Calls func(begin, end) on ranges of [0, count), at most grainSize indices at a time
+    typedef std::function<void (unsigned begin, unsigned end)> RangeFunc;
+    
+    // threadCount includes the calling thread, so a pool of 1 has no workers and runs everything inline
+    explicit ThreadPool(unsigned threadCount = defaultThreadCount());
+    ~ThreadPool();
+    
+    // Runs func over [0, count) and waits for it. Rethrows the first exception thrown by func.
+    void parallelFor(unsigned count, unsigned grainSize, const RangeFunc& func);
+    
+    unsigned threadCount() const;
+    
+    // The number of hardware threads
+    static unsigned defaultThreadCount();
+    
+    // The pool used by the engine's CPU-heavy loops (image transforms, asset loading), created on first use
+    static ThreadPool& shared();
+    
+private:
+    std::vector<std::thread> _workers;
+    
+    std::mutex _loopMutex; /* Held by whoever is running a loop on the pool */
+    std::mutex _mutex; /* Guards the fields below */
+    std::condition_variable _loopStarted;
+    std::condition_variable _loopFinished;
+    bool _quit;
+    
+    // The current loop
+    const RangeFunc *_func;
+    unsigned _count;
+    unsigned _grainSize;
+    unsigned _generation; /* Bumped for every loop, so workers know when there's a new one */
+    unsigned _busyWorkers;
+    std::atomic<unsigned> _nextIndex;
+    std::exception_ptr _exception;
+    std::thread::id _loopOwner; /* The thread that issued the current loop, which holds _loopMutex */
+    
+    void _workerMain();
+    void _runRanges();
+    
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+};
+
+#endif /* defined(__Robot__ThreadPool__) */
@@ -6,12 +6,49 @@
 //
 //
 
+#include <cstdlib>
 #include <iostream>
+#include <string>
 
 #include "Application.h"
+#include "CommandLineTools.h"
 
 int main(int argc, char *argv[]) {
     try {
+        // Asset pipeline commands run instead of the application
+        int exitCode;
+        if (runCommandLineTool(argc, argv, exitCode))
+            return exitCode;
+        
+        // Robot --check-frame-allocations [frames]: runs the application for a number of frames (600 by default) and
+        // fails if the frame loop allocated from the heap
+        if (argc >= 2 && std::string(argv[1]) == "--check-frame-allocations") {
+            unsigned frameCount = argc >= 3 ? (unsigned) atoi(argv[2]) : 600;
+            return Application::getInstance().checkFrameAllocations(frameCount) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        
+        // Robot --benchmark-sensor [captures]: loads the scene and reports the head sensor's ray throughput with each
+        // instruction set, over a number of captures (100 by default)
+        if (argc >= 2 && std::string(argv[1]) == "--benchmark-sensor") {
+            Application::getInstance().benchmarkHeadSensor(argc >= 3 ? (unsigned) atoi(argv[2]) : 100);
+            return EXIT_SUCCESS;
+        }
+        
+        // Robot --benchmark-lights [frames]: reports the GPU frame time of forward shading, and of clustered and deferred
+        // shading with 1 to 1000 point lights, each averaged over a number of frames (200 by default)
+        if (argc >= 2 && std::string(argv[1]) == "--benchmark-lights") {
+            Application::getInstance().benchmarkLights(argc >= 3 ? (unsigned) atoi(argv[2]) : 200);
+            return EXIT_SUCCESS;
+        }
+        
+        // Robot --benchmark-overdraw [frames]: reports the GPU frame time and the fragments shaded per pixel of each
+        // render path, in scene order and front to back, with and without the depth pre-pass, each averaged over a
+        // number of frames (200 by default)
+        if (argc >= 2 && std::string(argv[1]) == "--benchmark-overdraw") {
+            Application::getInstance().benchmarkOverdraw(argc >= 3 ? (unsigned) atoi(argv[2]) : 200);
+            return EXIT_SUCCESS;
+        }
+        
         Application::getInstance().startAppLoop();
     } catch (const std::exception& e) {
         std::cerr << "ERROR: " << e.what() << std::endl;